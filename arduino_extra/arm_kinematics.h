@@ -0,0 +1,210 @@
+#pragma once
+
+// Forward kinematics of the RASM from its Denavit-Hartenberg table
+// (motion-planning/linearTransformationDHParameters.m), for the firmware and the computer
+// alike. Link it into your Arduino libraries folder next to common.h.
+//
+// Instead of the expanded MATLAB expressions, which take the sine and cosine of the same joint
+// sums dozens of times, each joint's sine and cosine is taken once and the chain is composed one
+// 3x4 transform at a time (T_i = RotX(alpha_i-1) TransX(a_i-1) RotZ(th_i) TransZ(d_i), Craig's
+// convention as in the .m file). Joints with alpha = 0 skip the half of the product that would
+// only multiply by 0 and 1.
+//
+// ArmKinematics<float> is the single-precision build (on the AVR double is float anyway).
+// ArmKinematics<Real, true> takes sin and cos from a 257-entry quarter-wave table in flash
+// instead of the math library, which on the AVR is most of the time of an evaluation; its
+// error is below 2e-5. ARM_KINEMATICS_TABLE_TRIG sets the default, on for the AVR.
+
+#include <math.h>
+#include <stdint.h>
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#endif
+
+#define ARM_JOINT_COUNT 5   // shoulder, elbow, wrist yaw, wrist pitch, wrist roll (th1 .. th5)
+
+#ifndef ARM_KINEMATICS_TABLE_TRIG
+#ifdef __AVR__
+#define ARM_KINEMATICS_TABLE_TRIG 1
+#else
+#define ARM_KINEMATICS_TABLE_TRIG 0
+#endif
+#endif
+
+#ifndef PROGMEM
+#define PROGMEM
+#define pgm_read_word(address) (*(const uint16_t*)(address))
+#endif
+
+// sin(i / 256 * pi / 2) * 65535 for i = 0 .. 256.
+const uint16_t arm_sine_table[257] PROGMEM = {
+  0, 402, 804, 1206, 1608, 2010, 2412, 2814, 3216, 3617, 4019, 4420,
+  4821, 5222, 5623, 6023, 6424, 6824, 7223, 7623, 8022, 8421, 8820, 9218,
+  9616, 10014, 10411, 10808, 11204, 11600, 11996, 12391, 12785, 13179, 13573, 13966,
+  14359, 14751, 15142, 15533, 15924, 16313, 16703, 17091, 17479, 17866, 18253, 18639,
+  19024, 19408, 19792, 20175, 20557, 20939, 21319, 21699, 22078, 22456, 22834, 23210,
+  23586, 23960, 24334, 24707, 25079, 25450, 25820, 26189, 26557, 26925, 27291, 27656,
+  28020, 28383, 28745, 29106, 29465, 29824, 30181, 30538, 30893, 31247, 31600, 31952,
+  32302, 32651, 32999, 33346, 33692, 34036, 34379, 34721, 35061, 35400, 35738, 36074,
+  36409, 36743, 37075, 37406, 37736, 38064, 38390, 38715, 39039, 39361, 39682, 40001,
+  40319, 40635, 40950, 41263, 41575, 41885, 42194, 42500, 42806, 43109, 43411, 43712,
+  44011, 44308, 44603, 44897, 45189, 45479, 45768, 46055, 46340, 46624, 46905, 47185,
+  47464, 47740, 48014, 48287, 48558, 48827, 49095, 49360, 49624, 49885, 50145, 50403,
+  50659, 50913, 51166, 51416, 51664, 51911, 52155, 52398, 52638, 52877, 53113, 53348,
+  53580, 53811, 54039, 54266, 54490, 54713, 54933, 55151, 55367, 55582, 55794, 56003,
+  56211, 56417, 56620, 56822, 57021, 57218, 57413, 57606, 57797, 57985, 58171, 58356,
+  58537, 58717, 58895, 59070, 59243, 59414, 59582, 59749, 59913, 60075, 60234, 60391,
+  60546, 60699, 60850, 60998, 61144, 61287, 61429, 61567, 61704, 61838, 61970, 62100,
+  62227, 62352, 62475, 62595, 62713, 62829, 62942, 63053, 63161, 63267, 63371, 63472,
+  63571, 63668, 63762, 63853, 63943, 64030, 64114, 64196, 64276, 64353, 64428, 64500,
+  64570, 64638, 64703, 64765, 64826, 64883, 64939, 64992, 65042, 65090, 65136, 65179,
+  65219, 65258, 65293, 65327, 65357, 65386, 65412, 65435, 65456, 65475, 65491, 65504,
+  65515, 65524, 65530, 65534, 65535
+};
+
+inline float armTableSine(int32_t quarter_steps, float fraction)
+{
+  // quarter_steps counts 1/256 of a quarter turn; fold it into the first quarter.
+  const uint8_t quadrant = (quarter_steps >> 8) & 3;
+  const uint16_t i = quarter_steps & 255;
+  uint16_t from, to;
+  if (quadrant & 1)
+  {
+    from = pgm_read_word(&arm_sine_table[256 - i]);
+    to = pgm_read_word(&arm_sine_table[255 - i]);
+  }
+  else
+  {
+    from = pgm_read_word(&arm_sine_table[i]);
+    to = pgm_read_word(&arm_sine_table[i + 1]);
+  }
+  const float value = (from + ((float)to - from) * fraction) * (1.0f / 65535);
+  return quadrant & 2 ? -value : value;
+}
+
+// Sine and cosine of one angle in radians, from the table or the math library.
+template <typename Real>
+inline void armSinCos(Real angle, Real& sine, Real& cosine, bool table)
+{
+  if (table)
+  {
+    const float steps = (float)angle * (float)(1024 / (2 * M_PI));
+    const float whole = floorf(steps);
+    const int32_t quarter_steps = (int32_t)whole;
+    sine = armTableSine(quarter_steps, steps - whole);
+    cosine = armTableSine(quarter_steps + 256, steps - whole);
+  }
+  else
+  {
+    sine = sin(angle);
+    cosine = cos(angle);
+  }
+}
+
+template <typename Real, bool table_trig = ARM_KINEMATICS_TABLE_TRIG>
+class ArmKinematics
+{
+public:
+  // The arm as linearTransformationDHParameters.m has it, lengths in inches.
+  ArmKinematics()
+  {
+    const Real lengths[ARM_JOINT_COUNT] = {0, 16, 19.75, 1.5, 1};
+    const Real twists[ARM_JOINT_COUNT] = {0, 0, 0, -M_PI / 2, -M_PI / 2};
+    for (int i = 0; i < ARM_JOINT_COUNT; ++i)
+    {
+      a[i] = lengths[i];
+      d[i] = 0;
+      setTwist(i, twists[i]);
+    }
+  }
+
+  void setTwist(int joint, Real alpha)
+  {
+    // Exact 0 and 1 for the right angles, so the alpha = 0 shortcut and the zeros hold.
+    const Real quarter = alpha / (Real)(M_PI / 2);
+    if (quarter == floor(quarter))
+    {
+      const int turns = ((int)quarter % 4 + 4) % 4;
+      sin_alpha[joint] = turns == 1 ? 1 : turns == 3 ? -1 : 0;
+      cos_alpha[joint] = turns == 0 ? 1 : turns == 2 ? -1 : 0;
+    }
+    else
+    {
+      sin_alpha[joint] = sin(alpha);
+      cos_alpha[joint] = cos(alpha);
+    }
+  }
+
+  // Multiplies every length (a and d) by factor, e.g. 0.0254 for metres.
+  void scale(Real factor)
+  {
+    for (int i = 0; i < ARM_JOINT_COUNT; ++i)
+    {
+      a[i] *= factor;
+      d[i] *= factor;
+    }
+  }
+
+  // Pose of frame `joints` (5 for the end of the arm) in frame 0 for joint angles theta
+  // (radians): rotation[row][column] and position. Only the first `joints` angles are used.
+  void forward(const Real* theta, Real rotation[3][3], Real position[3], int joints = ARM_JOINT_COUNT) const
+  {
+    for (int row = 0; row < 3; ++row)
+    {
+      for (int column = 0; column < 3; ++column)
+      {
+        rotation[row][column] = row == column;
+      }
+      position[row] = 0;
+    }
+    for (int i = 0; i < joints; ++i)
+    {
+      Real s, c;
+      armSinCos(theta[i], s, c, table_trig);
+      // The new frame's y and z axes before turning by theta: RotX(alpha) of the old ones.
+      Real y_axis[3], z_axis[3];
+      const bool twisted = sin_alpha[i] != 0 || cos_alpha[i] != 1;
+      for (int row = 0; row < 3; ++row)
+      {
+        y_axis[row] = twisted ? rotation[row][1] * cos_alpha[i] + rotation[row][2] * sin_alpha[i] : rotation[row][1];
+        z_axis[row] = twisted ? rotation[row][2] * cos_alpha[i] - rotation[row][1] * sin_alpha[i] : rotation[row][2];
+        position[row] += rotation[row][0] * a[i] + z_axis[row] * d[i];
+        const Real x_axis = rotation[row][0];
+        rotation[row][0] = x_axis * c + y_axis[row] * s;
+        rotation[row][1] = y_axis[row] * c - x_axis * s;
+        rotation[row][2] = z_axis[row];
+      }
+    }
+  }
+
+  // Where a point fixed in frame 5 (tool, e.g. the Tobii screen) is in frame 0.
+  void point(const Real theta[ARM_JOINT_COUNT], const Real tool[3], Real out[3]) const
+  {
+    Real rotation[3][3], position[3];
+    forward(theta, rotation, position);
+    for (int row = 0; row < 3; ++row)
+    {
+      out[row] = position[row] + rotation[row][0] * tool[0] + rotation[row][1] * tool[1] + rotation[row][2] * tool[2];
+    }
+  }
+
+  // point() for count configurations at once, e.g. to check a planned path on the computer.
+  void points(const Real (*theta)[ARM_JOINT_COUNT], int count, const Real tool[3], Real (*out)[3]) const
+  {
+    for (int i = 0; i < count; ++i)
+    {
+      point(theta[i], tool, out[i]);
+    }
+  }
+
+  // The DH table: a_i-1, d_i and alpha_i-1 of joint i (0-based).
+  Real a[ARM_JOINT_COUNT];
+  Real d[ARM_JOINT_COUNT];
+  Real cos_alpha[ARM_JOINT_COUNT];
+  Real sin_alpha[ARM_JOINT_COUNT];
+};
+
+// The Tobii screen's position in frame 5, inches (linearTransformationDHParameters.m).
+#define ARM_TOBII_SCREEN_X -6.5
+#define ARM_TOBII_SCREEN_Y 0.5
+#define ARM_TOBII_SCREEN_Z -4.5
@@ -2,6 +2,7 @@
 
 
 #include "DualMC33926MotorShield.h"
+#include <joint_angles.h>
 
 #define setRollSpeed(speed) md.setM1Speed(speed)
 #define setBaseSpeed(speed) md.setM2Speed(speed)
@@ -33,52 +34,15 @@ int elbow_encoder_pin = A8;
 int pitch_encoder_pin = A6;
 int yaw_encoder_pin = A7;
 int shoulder_encoder_pin = A4;
-double degrees_per_step = 360.0 / 1024.0; //see page 6 of RM22 rotary magnetic modular encoder data sheet
-
-double degreesInCircle = 360;
-double shoulderEncoderOffset = 273.16; //degrees
-double elbowEncoderOffset = 171.7; //degrees
-double yawEncoderOffset = 15.2; //degrees
-double pitchEncoderOffset = 44; //degrees
-double rollEncoderOffset = 245.4; //degrees
 #define sinDeg(degrees) sin((degrees)*PI/180.0)
 #define cosDeg(degrees) cos((degrees)*PI/180.0)
 double a1 = 16.0; //inches
 double a2 = 19.75; //inches
 
-double shoulderAngle()
-{
-  // This encoder is backwards, so I subtract the reading from 360 degrees so
-  // that the right hand rule will still be followed. Also adjust by an offset of 273.16 degrees
-  // (this offset is so that the shoulder will conveniently be at a reading of zero when the
-  // arm is stretched out oppposite from the spline/battery, and not necessary for the DH parameters).
-  return degreesInCircle - analogRead(shoulder_encoder_pin) * degrees_per_step - shoulderEncoderOffset;
-}
-
-double elbowAngle()
-{
-  // Following the Denavit–Hartenberg parameter system, this angle (theta2) is off by about 172
-  // degrees, so I subtract roughly 172 degrees from the reading.
-  return analogRead(elbow_encoder_pin) * degrees_per_step - elbowEncoderOffset;
-}
-
-double yawAngle()
-{
-  // Following the denavit-Hartenberg parameter system, this angle (theta3) is off by about 15
-  // degrees, so I add roughly 15 degrees to the reading.
-  return analogRead(yaw_encoder_pin) * degrees_per_step + yawEncoderOffset;
-}
-
-double pitchAngle()
-{
-  // Following the denavit-Hartenberg parameter system, this angle (theta4) is off by about 44
-  // degrees, so I add roughly 44 degrees to the reading.
-  return analogRead(pitch_encoder_pin) * degrees_per_step + pitchEncoderOffset;
-}
-
-double rollAngle()
-{
-  // Following the denavit-Hartenberg parameter system, this angle (theta5) is off by about 245
-  // degrees, so I subtract roughly 245 degrees from the reading.
-  return analogRead(roll_encoder_pin) * degrees_per_step - rollEncoderOffset;
-}
+// Each of these waits for one conversion. Sketches that read the encoders every loop should
+// use encoder_sampler.h instead.
+double shoulderAngle() { return shoulderAngleFromSteps(analogRead(shoulder_encoder_pin)); }
+double elbowAngle() { return elbowAngleFromSteps(analogRead(elbow_encoder_pin)); }
+double yawAngle() { return yawAngleFromSteps(analogRead(yaw_encoder_pin)); }
+double pitchAngle() { return pitchAngleFromSteps(analogRead(pitch_encoder_pin)); }
+double rollAngle() { return rollAngleFromSteps(analogRead(roll_encoder_pin)); }
@@ -0,0 +1,296 @@
+#pragma once
+
+// Interrupt-driven encoder sampling. Link it into your Arduino libraries folder next to
+// common.h.
+//
+// analogRead() starts a conversion and then spins for the ~110 us it takes, once per encoder
+// per loop, and a single noisy conversion goes straight into the motor logic. Instead, the ADC
+// interrupt here works through the encoder channels on its own: it takes
+// ENCODER_OVERSAMPLE conversions of one channel (after one thrown away to let the input
+// settle on the new channel), averages them, and moves on to the next channel. Each average
+// goes into a three-entry ring per channel; the median of the ring throws out a single bad
+// reading and a first-order low-pass smooths what is left. snapshot() copies the newest
+// filtered readings out without turning interrupts off and without ever waiting for the ADC.
+//
+// Readings are in 1/16 of an encoder step (0 - 16383). The encoders are absolute and wrap
+// from 1023 back to 0, so every average, median and filter step works on the short way
+// round between readings; a joint sitting on the wrap point does not read as 512.
+//
+// While the sampler runs it owns the ADC: do not call analogRead() (or anything that does,
+// such as the motor shield's current sensing) until stop().
+//
+// On a computer (the firmware simulator in sim/) there is no ADC interrupt, so there poll()
+// takes the conversions the ADC would have finished since the last call; call it from loop().
+// On the Arduino poll() does nothing.
+
+#include <Arduino.h>
+#include <stdint.h>
+#ifdef __AVR__
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#endif
+
+#define ENCODER_MAX_CHANNELS 8
+#define ENCODER_STEPS 1024
+// Readings carry this many bits below one encoder step.
+#define ENCODER_FRACTION_BITS 4
+#define ENCODER_FULL_TURN ((int32_t)ENCODER_STEPS << ENCODER_FRACTION_BITS)
+// Conversions averaged into one reading. At most 16, so the sum fits in 16 bits.
+#ifndef ENCODER_OVERSAMPLE
+#define ENCODER_OVERSAMPLE 16
+#endif
+// Each filtered reading moves 1 / 2^ENCODER_FILTER_SHIFT of the way to the median; 0 turns the
+// low-pass off.
+#ifndef ENCODER_FILTER_SHIFT
+#define ENCODER_FILTER_SHIFT 2
+#endif
+// ADC clock is 16 MHz / 64 = 250 kHz, 52 us a conversion, which keeps the full 10 bits. With 5
+// channels and 16 conversions each that is a new reading of every channel every 4.4 ms.
+#ifndef ENCODER_ADC_PRESCALER_BITS
+#define ENCODER_ADC_PRESCALER_BITS (_BV(ADPS2) | _BV(ADPS1))
+#endif
+#define ENCODER_CONVERSION_US 52
+// How poll() samples a pin on a computer.
+#ifndef ENCODER_HOST_SAMPLE
+#define ENCODER_HOST_SAMPLE(pin) analogRead(pin)
+#endif
+
+// Filtered readings of every channel at one moment.
+struct EncoderSnapshot
+{
+  uint16_t readings[ENCODER_MAX_CHANNELS];   // 1/16 steps, channel order of begin()
+  uint32_t time_us;                          // micros() when the newest of them was taken
+  uint16_t cycles;                           // full passes over all channels so far (wraps)
+
+  // A reading in encoder steps (0 - 1023.94), what analogRead() gives but with a fraction.
+  double steps(uint8_t channel) const
+  {
+    return (double)readings[channel] / (1 << ENCODER_FRACTION_BITS);
+  }
+};
+
+// A difference between two readings taken the short way round the encoder.
+inline int16_t encoderWrap(int32_t difference, int32_t full_turn)
+{
+  while (difference > full_turn / 2)
+  {
+    difference -= full_turn;
+  }
+  while (difference <= -full_turn / 2)
+  {
+    difference += full_turn;
+  }
+  return (int16_t)difference;
+}
+
+// a + offset, back in 0 .. full_turn - 1.
+inline uint16_t encoderAdd(int32_t a, int32_t offset, int32_t full_turn)
+{
+  int32_t sum = (a + offset) % full_turn;
+  return (uint16_t)(sum < 0 ? sum + full_turn : sum);
+}
+
+class EncoderSampler
+{
+public:
+  EncoderSampler() : channel_count(0), channel(0), conversion(0), batch_reference(0), batch_sum(0),
+                     sequence(0), running(false), polled_us(0)
+  {
+    published.time_us = 0;
+    published.cycles = 0;
+    for (uint8_t c = 0; c < ENCODER_MAX_CHANNELS; ++c)
+    {
+      published.readings[c] = 0;
+      history_count[c] = 0;
+    }
+  }
+
+  // Starts sampling the given analog pins (A4, A8, ...), up to ENCODER_MAX_CHANNELS of them.
+  // Readings are in this order. The first snapshot with every channel filled in is ready after
+  // one pass over all of them.
+  void begin(const uint8_t* analog_pins, uint8_t count)
+  {
+    channel_count = count < ENCODER_MAX_CHANNELS ? count : ENCODER_MAX_CHANNELS;
+    for (uint8_t c = 0; c < channel_count; ++c)
+    {
+      pins[c] = analog_pins[c];
+      history_count[c] = 0;
+    }
+    channel = 0;
+    conversion = 0;
+    batch_sum = 0;
+    running = true;
+    polled_us = micros();
+#ifdef __AVR__
+    ADCSRA = _BV(ADEN) | _BV(ADIE) | ENCODER_ADC_PRESCALER_BITS;
+    startConversion();
+#endif
+  }
+
+  // Stops sampling and gives the ADC back to analogRead().
+  void stop()
+  {
+    running = false;
+#ifdef __AVR__
+    ADCSRA &= ~_BV(ADIE);
+    while (ADCSRA & _BV(ADSC))
+    {
+    }
+    ADCSRA = _BV(ADEN) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);   // what the Arduino core sets up
+#endif
+  }
+
+  // The newest filtered readings. Never blocks: if the interrupt updated them halfway through
+  // the copy, the copy is simply taken again.
+  void snapshot(EncoderSnapshot& out) const
+  {
+    uint8_t before;
+    do
+    {
+      before = sequence;
+      for (uint8_t c = 0; c < channel_count; ++c)
+      {
+        out.readings[c] = published.readings[c];
+      }
+      out.time_us = published.time_us;
+      out.cycles = published.cycles;
+    } while ((before & 1) || before != sequence);
+  }
+
+  // On a computer, takes the conversions the ADC would have finished since the last call (at
+  // most one pass over all channels). Does nothing on the Arduino, where the ADC interrupt does
+  // the sampling.
+  void poll()
+  {
+#ifndef __AVR__
+    if (!running)
+    {
+      return;
+    }
+    const uint32_t now = micros();
+    const uint32_t pass = (uint32_t)channel_count * (ENCODER_OVERSAMPLE + 1);
+    uint32_t due = (now - polled_us) / ENCODER_CONVERSION_US;
+    if (due >= pass)
+    {
+      due = pass;
+      polled_us = now;
+    }
+    else
+    {
+      polled_us += due * ENCODER_CONVERSION_US;
+    }
+    for (uint32_t i = 0; i < due; ++i)
+    {
+      conversionDone((uint16_t)ENCODER_HOST_SAMPLE(pins[channel]));
+    }
+#endif
+  }
+
+  uint8_t channels() const { return channel_count; }
+
+  // One finished conversion of the current channel. Called from the ADC interrupt.
+  void conversionDone(uint16_t value)
+  {
+    if (conversion > 0)
+    {
+      // Sum the offsets from the batch's first sample, so a batch that straddles the wrap
+      // point averages to the right place.
+      const int16_t sample = (int16_t)value;
+      if (conversion == 1)
+      {
+        batch_reference = sample;
+      }
+      batch_sum += encoderWrap(sample - batch_reference, ENCODER_STEPS);
+    }
+    // Conversion 0 was the one after switching channels; it is thrown away.
+    if (conversion++ < ENCODER_OVERSAMPLE)
+    {
+      startConversion();
+      return;
+    }
+    const int32_t offset = ((int32_t)batch_sum << ENCODER_FRACTION_BITS) / ENCODER_OVERSAMPLE;
+    filtered(channel, encoderAdd((int32_t)batch_reference << ENCODER_FRACTION_BITS, offset, ENCODER_FULL_TURN));
+    batch_sum = 0;
+    conversion = 0;
+    if (++channel == channel_count)
+    {
+      channel = 0;
+    }
+    startConversion();
+  }
+
+private:
+  // A new oversampled reading of channel c: into the ring, median of three, low-pass, out.
+  void filtered(uint8_t c, uint16_t reading)
+  {
+    uint16_t* ring = history[c];
+    ring[2] = ring[1];
+    ring[1] = ring[0];
+    ring[0] = reading;
+    uint16_t result = reading;
+    if (history_count[c] < 3)
+    {
+      ++history_count[c];
+    }
+    else
+    {
+      // Median of the three, measured from the newest.
+      const int16_t d1 = encoderWrap((int32_t)ring[1] - ring[0], ENCODER_FULL_TURN);
+      const int16_t d2 = encoderWrap((int32_t)ring[2] - ring[0], ENCODER_FULL_TURN);
+      const int16_t lo = d1 < d2 ? d1 : d2;
+      const int16_t hi = d1 < d2 ? d2 : d1;
+      const int16_t median = 0 < lo ? lo : (0 > hi ? hi : 0);
+      result = encoderAdd(ring[0], median, ENCODER_FULL_TURN);
+      // Low-pass. The shift rounds towards minus infinity, which is well below one step.
+      const int16_t step = encoderWrap((int32_t)result - published.readings[c], ENCODER_FULL_TURN);
+      result = encoderAdd(published.readings[c], step >> ENCODER_FILTER_SHIFT, ENCODER_FULL_TURN);
+    }
+    ++sequence;
+    published.readings[c] = result;
+    published.time_us = micros();
+    if (c + 1 == channel_count)
+    {
+      ++published.cycles;
+    }
+    ++sequence;
+  }
+
+  void startConversion()
+  {
+#ifdef __AVR__
+    if (!running)
+    {
+      return;
+    }
+    const uint8_t adc = pins[channel] >= A0 ? pins[channel] - A0 : pins[channel];
+#ifdef MUX5
+    ADCSRB = (ADCSRB & ~_BV(MUX5)) | ((adc & 0x08) ? _BV(MUX5) : 0);
+#endif
+    ADMUX = _BV(REFS0) | (adc & 0x07);   // AVcc reference, like analogRead()'s DEFAULT
+    ADCSRA |= _BV(ADSC);
+#endif
+  }
+
+  uint8_t pins[ENCODER_MAX_CHANNELS];
+  uint8_t channel_count;
+  uint8_t channel;
+  uint8_t conversion;
+  int16_t batch_reference;
+  int16_t batch_sum;
+  uint16_t history[ENCODER_MAX_CHANNELS][3];
+  uint8_t history_count[ENCODER_MAX_CHANNELS];
+  // Odd while the interrupt is changing published.
+  volatile uint8_t sequence;
+  volatile EncoderSnapshot published;
+  bool running;
+  uint32_t polled_us;   // poll() on a computer: conversions are done up to here
+};
+
+EncoderSampler encoder_sampler;
+
+#ifdef __AVR__
+ISR(ADC_vect)
+{
+  encoder_sampler.conversionDone(ADC);
+}
+#endif
@@ -0,0 +1,52 @@
+#pragma once
+
+// The encoder readings as joint angles, following the Denavit-Hartenberg parameters. Shared
+// by common.h and arduino_main; link it into your Arduino libraries folder next to common.h.
+
+double degrees_per_step = 360.0 / 1024.0; //see page 6 of RM22 rotary magnetic modular encoder data sheet
+
+double degreesInCircle = 360;
+double shoulderEncoderOffset = 273.16; //degrees
+double elbowEncoderOffset = 171.7; //degrees
+double yawEncoderOffset = 15.2; //degrees
+double pitchEncoderOffset = 44; //degrees
+double rollEncoderOffset = 245.4; //degrees
+
+// The joint angles from encoder readings in steps (what analogRead() gives, or a filtered
+// reading with a fraction from encoder_sampler.h).
+double shoulderAngleFromSteps(double steps)
+{
+  // This encoder is backwards, so I subtract the reading from 360 degrees so
+  // that the right hand rule will still be followed. Also adjust by an offset of 273.16 degrees
+  // (this offset is so that the shoulder will conveniently be at a reading of zero when the
+  // arm is stretched out oppposite from the spline/battery, and not necessary for the DH parameters).
+  return degreesInCircle - steps * degrees_per_step - shoulderEncoderOffset;
+}
+
+double elbowAngleFromSteps(double steps)
+{
+  // Following the Denavit–Hartenberg parameter system, this angle (theta2) is off by about 172
+  // degrees, so I subtract roughly 172 degrees from the reading.
+  return steps * degrees_per_step - elbowEncoderOffset;
+}
+
+double yawAngleFromSteps(double steps)
+{
+  // Following the denavit-Hartenberg parameter system, this angle (theta3) is off by about 15
+  // degrees, so I add roughly 15 degrees to the reading.
+  return steps * degrees_per_step + yawEncoderOffset;
+}
+
+double pitchAngleFromSteps(double steps)
+{
+  // Following the denavit-Hartenberg parameter system, this angle (theta4) is off by about 44
+  // degrees, so I add roughly 44 degrees to the reading.
+  return steps * degrees_per_step + pitchEncoderOffset;
+}
+
+double rollAngleFromSteps(double steps)
+{
+  // Following the denavit-Hartenberg parameter system, this angle (theta5) is off by about 245
+  // degrees, so I subtract roughly 245 degrees from the reading.
+  return steps * degrees_per_step - rollEncoderOffset;
+}
@@ -0,0 +1,265 @@
+#pragma once
+
+// Closed-loop control of one joint. Link it into your Arduino libraries folder next to
+// common.h.
+//
+// A joint is given either a target angle, a target velocity, or (following a trajectory) the
+// reference itself. For the first two, each control period the
+// controller first moves a reference angle towards the target, never faster than the joint's
+// velocity limit, never accelerating faster than its acceleration limit, and never leaving
+// its angle limits. A PID loop on the encoder angle then makes the joint follow the reference
+// (the reference velocity is fed forward, so the PID only has to correct what is left). The
+// output is a motor speed for DualMC33926MotorShield (-400 .. 400).
+//
+// Once the reference has stopped and the joint is within its tolerance of it, the motor is
+// switched off rather than nudged back and forth around the last encoder step.
+//
+// A joint without an encoder runs open loop: its velocities are motor speeds, still limited
+// in acceleration.
+
+#include <Arduino.h>
+
+// One row of the joint table.
+struct JointConfig
+{
+  const char* name;
+  int8_t encoder;                 // encoder_sampler channel, -1 for a joint without an encoder
+  double (*angle)(double steps);  // encoder reading to degrees (joint_angles.h)
+  double min_angle;               // degrees
+  double max_angle;
+  double max_velocity;            // degrees per second
+  double max_acceleration;        // degrees per second per second
+  double kp;                      // motor speed per degree of error
+  double ki;                      // motor speed per degree second of error
+  double kd;                      // motor speed per degree per second of velocity error
+  double kv;                      // motor speed per degree per second of reference velocity
+  int min_speed;                  // the joint does not move below this motor speed
+  int max_speed;                  // up to 400
+  int direction;                  // motor speed sign that turns the angle up
+  double tolerance;               // degrees
+};
+
+class JointController
+{
+public:
+  enum Mode { HOLD, POSITION, VELOCITY, FOLLOW };
+
+  JointController() : config(0), mode(HOLD), target(0), target_velocity(0), reference(0), reference_velocity(0),
+                      measured(0), measured_velocity(0), integral(0), history_next(0), started(false) {}
+
+  // Starts holding the joint where it is.
+  void begin(const JointConfig& joint_config, double angle)
+  {
+    config = &joint_config;
+    measured = unwrap(angle);
+    reference = constrainAngle(measured);
+    reference_velocity = 0;
+    measured_velocity = 0;
+    integral = 0;
+    for (uint8_t i = 0; i < history_size; ++i)
+    {
+      history[i] = measured;
+      history_dt[i] = 0;
+    }
+    mode = HOLD;
+    started = true;
+  }
+
+  bool running() const { return started; }
+
+  // Moves to angle (degrees, kept inside the limits) and stops there.
+  void moveTo(double angle)
+  {
+    target = constrainAngle(unwrap(angle));
+    mode = POSITION;
+  }
+
+  // Moves by offset degrees from where the joint was age seconds ago (as far back as the last
+  // 16 updates go), for offsets measured on a camera image that took that long to arrive. Using
+  // the angle now instead would count any movement since the image twice.
+  void moveBy(double offset, double age)
+  {
+    // Updates are not evenly spaced (a motion frame brings one forward), so walk back through
+    // their periods to the measurement closest to age ago.
+    uint8_t back = 0;
+    double elapsed = 0;
+    while (back + 1 < history_size)
+    {
+      const double older = elapsed + history_dt[historyIndex(back)];
+      if (fabs(older - age) >= fabs(elapsed - age))
+      {
+        break;
+      }
+      elapsed = older;
+      ++back;
+    }
+    moveTo(history[historyIndex(back)] + offset);
+  }
+
+  // Moves at velocity (degrees per second, or a motor speed without an encoder) until told
+  // otherwise or a limit is reached.
+  void moveAt(double velocity)
+  {
+    target_velocity = constrain(velocity, -config->max_velocity, config->max_velocity);
+    mode = VELOCITY;
+  }
+
+  // Slows down as fast as allowed and holds where that ends.
+  void hold() { mode = HOLD; }
+
+  // Makes the reference angle (degrees, kept inside the limits) and velocity exactly these, for
+  // a trajectory that is already within the joint's limits (trajectory_player.h). Call it
+  // every period before update(); the reference stays where it was left if it is not called.
+  void follow(double angle, double velocity)
+  {
+    reference = constrainAngle(unwrap(angle));
+    reference_velocity = constrain(velocity, -config->max_velocity, config->max_velocity);
+    target = reference;
+    mode = FOLLOW;
+  }
+
+  // One control period of dt seconds with the joint's current encoder angle. Returns the
+  // motor speed.
+  int update(double angle, double dt)
+  {
+    if (mode == FOLLOW)
+    {
+      return feedback(angle, dt);
+    }
+
+    // Reference: the velocity the mode asks for, reached within the acceleration limit.
+    double wanted = 0;
+    if (mode == POSITION)
+    {
+      const double distance = target - reference;
+      // The fastest speed from which the joint can still stop at the target.
+      wanted = sqrt(2 * config->max_acceleration * fabs(distance));
+      wanted = distance < 0 ? -wanted : wanted;
+    }
+    else if (mode == VELOCITY)
+    {
+      wanted = target_velocity;
+    }
+    wanted = constrain(wanted, -config->max_velocity, config->max_velocity);
+    const double step = config->max_acceleration * dt;
+    reference_velocity += constrain(wanted - reference_velocity, -step, step);
+    const double distance = target - reference;
+    if (mode == POSITION && distance * reference_velocity >= 0 && fabs(distance) <= fabs(reference_velocity * dt))
+    {
+      // Arrives this period.
+      reference = target;
+      reference_velocity = 0;
+    }
+    else
+    {
+      reference += reference_velocity * dt;
+    }
+    if (reference <= config->min_angle || reference >= config->max_angle)
+    {
+      reference = constrainAngle(reference);
+      reference_velocity = 0;
+    }
+
+    return feedback(angle, dt);
+  }
+
+  double angle() const { return measured; }
+  // Whether angle (degrees) is inside the limits, give or take the tolerance.
+  bool withinLimits(double angle) const
+  {
+    angle = unwrap(angle);
+    return angle >= config->min_angle - config->tolerance && angle <= config->max_angle + config->tolerance;
+  }
+  double referenceAngle() const { return reference; }
+  double targetAngle() const { return target; }
+  Mode currentMode() const { return mode; }
+
+private:
+  // Time constant of the measured velocity's low-pass filter, in seconds; the encoder's steps
+  // make single differences noisy. Weighting each difference by its period keeps a short
+  // period's difference from counting for more than a long one's.
+  static constexpr double velocity_time_constant = 0.025;
+  static const uint8_t history_size = 16;
+
+  // Where in history the measurement back updates before the newest one is.
+  uint8_t historyIndex(uint8_t back) const { return (history_next + 2 * history_size - 1 - back) % history_size; }
+
+  // The PID on the encoder angle that makes the joint follow the reference.
+  int feedback(double angle, double dt)
+  {
+    if (config->encoder < 0)
+    {
+      return config->direction * (int)constrain(reference_velocity, (double)-config->max_speed,
+                                                (double)config->max_speed);
+    }
+
+    const double previous = measured;
+    measured = unwrap(angle);
+    history[history_next] = measured;
+    history_dt[history_next] = dt;
+    history_next = (history_next + 1) % history_size;
+    if (dt > 0)
+    {
+      measured_velocity += (((measured - previous) / dt) - measured_velocity) * dt / (dt + velocity_time_constant);
+    }
+    const double error = reference - measured;
+    if (reference_velocity == 0 && mode != VELOCITY && fabs(error) < config->tolerance)
+    {
+      integral = 0;
+      return 0;
+    }
+    double output = config->kv * reference_velocity + config->kp * error + config->ki * integral +
+                    config->kd * (reference_velocity - measured_velocity);
+    // Below min_speed the motor only hums, so ask for at least that. (Adding it on top instead
+    // drives the joint min_speed harder than the gains ask for all the way in, which shows as
+    // overshoot.)
+    if (fabs(output) < config->min_speed)
+    {
+      output = output > 0 ? config->min_speed : output < 0 ? -config->min_speed : 0;
+    }
+    const double limited = constrain(output, (double)-config->max_speed, (double)config->max_speed);
+    // Only build up the integral while the output has room to act on it.
+    if (limited == output || (output > 0) != (error > 0))
+    {
+      integral += error * dt;
+    }
+    // Never drive further past a limit.
+    if ((measured >= config->max_angle && limited > 0) || (measured <= config->min_angle && limited < 0))
+    {
+      return 0;
+    }
+    return config->direction * (int)limited;
+  }
+
+  // The angle within half a turn of the middle of the joint's range, so a range across the
+  // encoder's wrap point (the yaw) is one piece.
+  double unwrap(double angle) const
+  {
+    const double middle = (config->min_angle + config->max_angle) / 2;
+    while (angle - middle > 180)
+    {
+      angle -= 360;
+    }
+    while (angle - middle <= -180)
+    {
+      angle += 360;
+    }
+    return angle;
+  }
+
+  double constrainAngle(double angle) const { return constrain(angle, config->min_angle, config->max_angle); }
+
+  const JointConfig* config;
+  Mode mode;
+  double target;
+  double target_velocity;
+  double reference;
+  double reference_velocity;
+  double measured;
+  double measured_velocity;
+  double integral;
+  double history[history_size];     // measured angles of the last updates, for moveBy()
+  double history_dt[history_size];  // seconds from the update before each of them
+  uint8_t history_next;
+  bool started;
+};
@@ -0,0 +1,447 @@
+#pragma once
+
+// Binary protocol between the computer and the Arduino. This header is shared by the firmware
+// (link it into your Arduino libraries folder next to common.h) and by the programs on the
+// computer, so it only uses what both avr-gcc and a desktop compiler have: no STL, no heap,
+// fixed-size integers.
+//
+// Every frame looks like
+//
+//   sync (0xA5) | type | sequence | payload (fixed size per type) | CRC-16 (low byte first)
+//
+// The CRC (CRC-16/CCITT-FALSE) covers type, sequence and payload. Multi-byte values are sent
+// little-endian. A receiver that sees a bad CRC or an unknown type just goes back to hunting
+// for the next sync byte. A corrupted, lost or extra byte costs the frame it was in, and a
+// lost one usually the next frame too (the damaged frame takes its sync byte as a CRC byte);
+// at worst, when the damage makes a header read as the longest frame type, the receiver is
+// back in step a trajectory frame's length later. tests/protocol_test.cpp checks this.
+
+#include <stdint.h>
+
+#define RASM_SERIAL_BAUD 115200
+#define RASM_SYNC_BYTE 0xA5
+
+// Frame types.
+#define RASM_FRAME_MOTION 0x01        // five axis setpoints from the vision code (main.cpp)
+#define RASM_FRAME_JOINT_STATE 0x02   // encoder angles and firmware time from the arm (sendJointPositions.ino)
+#define RASM_FRAME_TRAJECTORY 0x03    // a batch of trajectory waypoints from rasm_motion (trajectory_streamer.h)
+#define RASM_FRAME_TRAJECTORY_STATUS 0x04   // how far arduino_main has got through a trajectory
+
+#define RASM_AXIS_COUNT 5
+// Order of the setpoints in a motion frame. The values mean the same thing as the numbers
+// that used to follow the '#', '&', '*', '$' and '^' prefix characters.
+#define RASM_AXIS_ROLL 0
+#define RASM_AXIS_PITCH 1
+#define RASM_AXIS_YAW 2
+#define RASM_AXIS_Y 3
+#define RASM_AXIS_X 4
+
+#define RASM_JOINT_COUNT 5
+// Order of the angles in a joint-state frame (the encoders in common.h).
+#define RASM_JOINT_SHOULDER 0
+#define RASM_JOINT_ELBOW 1
+#define RASM_JOINT_YAW 2
+#define RASM_JOINT_PITCH 3
+#define RASM_JOINT_ROLL 4
+// Joint angles travel as int16 in 1/50 degree steps, which covers +-655 degrees, well past
+// what any encoder angle in common.h can be, at a resolution far below the encoders' 0.35.
+#define RASM_JOINT_ANGLE_SCALE 50
+
+// Trajectories. rasm_motion sends a planned trajectory as waypoints (time, and an angle and a
+// velocity per joint), RASM_TRAJECTORY_BATCH to a frame, and arduino_main interpolates between
+// them at its control rate (trajectory_player.h). The firmware keeps RASM_TRAJECTORY_BUFFER
+// waypoints; every status frame it sends back says how many more it can take, and the
+// computer never sends past that.
+#define RASM_TRAJECTORY_BATCH 4
+#define RASM_TRAJECTORY_BUFFER 16
+// Trajectory frame flags.
+#define RASM_TRAJECTORY_END 0x01    // the frame's last waypoint is the last of the trajectory
+#define RASM_TRAJECTORY_STOP 0x02   // drop the trajectory and hold where it got to (no waypoints)
+// Where the firmware is with a trajectory, in a status frame.
+#define RASM_TRAJECTORY_IDLE 0
+#define RASM_TRAJECTORY_RUNNING 1
+#define RASM_TRAJECTORY_STARVED 2   // at the last waypoint it has, waiting for more; the clock stops
+#define RASM_TRAJECTORY_DONE 3
+#define RASM_TRAJECTORY_STOPPED 4
+
+#define RASM_HEADER_SIZE 3   // sync, type, sequence
+#define RASM_CRC_SIZE 2
+#define RASM_MOTION_PAYLOAD_SIZE (2 * RASM_AXIS_COUNT)
+#define RASM_MOTION_FRAME_SIZE (RASM_HEADER_SIZE + RASM_MOTION_PAYLOAD_SIZE + RASM_CRC_SIZE)
+#define RASM_JOINT_STATE_PAYLOAD_SIZE (4 + 2 * RASM_JOINT_COUNT)   // time, angles
+#define RASM_JOINT_STATE_FRAME_SIZE (RASM_HEADER_SIZE + RASM_JOINT_STATE_PAYLOAD_SIZE + RASM_CRC_SIZE)
+#define RASM_TRAJECTORY_POINT_SIZE (2 + 4 * RASM_JOINT_COUNT)   // duration, angles, velocities
+#define RASM_TRAJECTORY_PAYLOAD_SIZE (6 + RASM_TRAJECTORY_BATCH * RASM_TRAJECTORY_POINT_SIZE)
+#define RASM_TRAJECTORY_FRAME_SIZE (RASM_HEADER_SIZE + RASM_TRAJECTORY_PAYLOAD_SIZE + RASM_CRC_SIZE)
+#define RASM_TRAJECTORY_STATUS_PAYLOAD_SIZE 12
+#define RASM_TRAJECTORY_STATUS_FRAME_SIZE (RASM_HEADER_SIZE + RASM_TRAJECTORY_STATUS_PAYLOAD_SIZE + RASM_CRC_SIZE)
+// Largest payload of any frame type; sizes the parser's buffer.
+#define RASM_MAX_PAYLOAD_SIZE RASM_TRAJECTORY_PAYLOAD_SIZE
+
+struct RasmMotionFrame
+{
+  uint8_t sequence;
+  int16_t setpoints[RASM_AXIS_COUNT];
+};
+
+struct RasmJointStateFrame
+{
+  uint8_t sequence;
+  uint32_t time_us;                    // micros() on the Arduino when the encoders were read
+  int16_t angles[RASM_JOINT_COUNT];    // degrees * RASM_JOINT_ANGLE_SCALE
+};
+
+// One trajectory waypoint.
+struct RasmTrajectoryPoint
+{
+  uint16_t duration_ms;                  // since the waypoint before (0 for the first)
+  int16_t angles[RASM_JOINT_COUNT];      // degrees * RASM_JOINT_ANGLE_SCALE
+  int16_t velocities[RASM_JOINT_COUNT];  // degrees per second * RASM_JOINT_ANGLE_SCALE
+};
+
+struct RasmTrajectoryFrame
+{
+  uint8_t sequence;
+  uint8_t trajectory;    // changes for every new trajectory
+  uint8_t joints;        // bit (1 << RASM_JOINT_*) for each joint the trajectory moves
+  uint8_t flags;         // RASM_TRAJECTORY_END, RASM_TRAJECTORY_STOP
+  uint8_t count;         // waypoints in use, 0 - RASM_TRAJECTORY_BATCH
+  uint16_t first;        // index of points[0] in the trajectory
+  RasmTrajectoryPoint points[RASM_TRAJECTORY_BATCH];
+};
+
+struct RasmTrajectoryStatusFrame
+{
+  uint8_t sequence;
+  uint8_t trajectory;    // the trajectory this is about
+  uint8_t state;         // RASM_TRAJECTORY_*
+  uint8_t free;          // waypoints the firmware can take after the ones it has
+  uint8_t rejected;      // trajectory frames thrown away so far because one before them was lost (wraps)
+  uint16_t received;     // waypoints received, i.e. the index of the next one it expects
+  uint16_t segment;      // index of the waypoint it is moving towards
+  uint32_t time_ms;      // how far into the trajectory it is
+};
+
+inline uint16_t rasmCrc16Update(uint16_t crc, uint8_t byte)
+{
+  crc ^= (uint16_t)byte << 8;
+  for (uint8_t bit = 0; bit < 8; ++bit)
+  {
+    crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+  }
+  return crc;
+}
+
+inline uint16_t rasmCrc16(const uint8_t* data, uint8_t length)
+{
+  uint16_t crc = 0xFFFF;
+  for (uint8_t i = 0; i < length; ++i)
+  {
+    crc = rasmCrc16Update(crc, data[i]);
+  }
+  return crc;
+}
+
+// Payload size for a frame type, or -1 if the type is unknown.
+inline int rasmPayloadSize(uint8_t type)
+{
+  switch (type)
+  {
+    case RASM_FRAME_MOTION:
+      return RASM_MOTION_PAYLOAD_SIZE;
+    case RASM_FRAME_JOINT_STATE:
+      return RASM_JOINT_STATE_PAYLOAD_SIZE;
+    case RASM_FRAME_TRAJECTORY:
+      return RASM_TRAJECTORY_PAYLOAD_SIZE;
+    case RASM_FRAME_TRAJECTORY_STATUS:
+      return RASM_TRAJECTORY_STATUS_PAYLOAD_SIZE;
+    default:
+      return -1;
+  }
+}
+
+inline void rasmPutInt16(uint8_t* out, int16_t value)
+{
+  out[0] = (uint8_t)((uint16_t)value & 0xFF);
+  out[1] = (uint8_t)((uint16_t)value >> 8);
+}
+
+inline void rasmPutUint16(uint8_t* out, uint16_t value)
+{
+  out[0] = (uint8_t)(value & 0xFF);
+  out[1] = (uint8_t)(value >> 8);
+}
+
+inline uint16_t rasmGetUint16(const uint8_t* in)
+{
+  return (uint16_t)((uint16_t)in[0] | ((uint16_t)in[1] << 8));
+}
+
+inline int16_t rasmGetInt16(const uint8_t* in)
+{
+  return (int16_t)((uint16_t)in[0] | ((uint16_t)in[1] << 8));
+}
+
+inline void rasmPutUint32(uint8_t* out, uint32_t value)
+{
+  for (uint8_t i = 0; i < 4; ++i)
+  {
+    out[i] = (uint8_t)(value >> (8 * i));
+  }
+}
+
+inline uint32_t rasmGetUint32(const uint8_t* in)
+{
+  return (uint32_t)in[0] | ((uint32_t)in[1] << 8) | ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+// A joint angle in degrees as it goes on the wire, rounded and clamped to int16.
+inline int16_t rasmJointAngle(double degrees)
+{
+  const double scaled = degrees * RASM_JOINT_ANGLE_SCALE;
+  if (scaled >= 32767)
+  {
+    return 32767;
+  }
+  if (scaled <= -32768)
+  {
+    return -32768;
+  }
+  return (int16_t)(scaled < 0 ? scaled - 0.5 : scaled + 0.5);
+}
+
+inline double rasmJointDegrees(int16_t angle)
+{
+  return (double)angle / RASM_JOINT_ANGLE_SCALE;
+}
+
+// Fills in sync, type, sequence and CRC around a payload that is already in place at
+// frame + RASM_HEADER_SIZE. Returns the total frame size.
+inline uint8_t rasmFinishFrame(uint8_t* frame, uint8_t type, uint8_t sequence, uint8_t payload_size)
+{
+  frame[0] = RASM_SYNC_BYTE;
+  frame[1] = type;
+  frame[2] = sequence;
+  const uint16_t crc = rasmCrc16(frame + 1, payload_size + 2);
+  frame[RASM_HEADER_SIZE + payload_size] = (uint8_t)(crc & 0xFF);
+  frame[RASM_HEADER_SIZE + payload_size + 1] = (uint8_t)(crc >> 8);
+  return RASM_HEADER_SIZE + payload_size + RASM_CRC_SIZE;
+}
+
+// Writes a motion frame into frame, which must hold RASM_MOTION_FRAME_SIZE bytes.
+inline uint8_t rasmEncodeMotion(const RasmMotionFrame& motion, uint8_t* frame)
+{
+  for (uint8_t axis = 0; axis < RASM_AXIS_COUNT; ++axis)
+  {
+    rasmPutInt16(frame + RASM_HEADER_SIZE + 2 * axis, motion.setpoints[axis]);
+  }
+  return rasmFinishFrame(frame, RASM_FRAME_MOTION, motion.sequence, RASM_MOTION_PAYLOAD_SIZE);
+}
+
+// Writes a joint-state frame into frame, which must hold RASM_JOINT_STATE_FRAME_SIZE bytes.
+inline uint8_t rasmEncodeJointState(const RasmJointStateFrame& state, uint8_t* frame)
+{
+  rasmPutUint32(frame + RASM_HEADER_SIZE, state.time_us);
+  for (uint8_t joint = 0; joint < RASM_JOINT_COUNT; ++joint)
+  {
+    rasmPutInt16(frame + RASM_HEADER_SIZE + 4 + 2 * joint, state.angles[joint]);
+  }
+  return rasmFinishFrame(frame, RASM_FRAME_JOINT_STATE, state.sequence, RASM_JOINT_STATE_PAYLOAD_SIZE);
+}
+
+// Writes a trajectory frame into frame, which must hold RASM_TRAJECTORY_FRAME_SIZE bytes. Unused
+// waypoints go out as zeros.
+inline uint8_t rasmEncodeTrajectory(const RasmTrajectoryFrame& trajectory, uint8_t* frame)
+{
+  uint8_t* out = frame + RASM_HEADER_SIZE;
+  out[0] = trajectory.trajectory;
+  out[1] = trajectory.joints;
+  out[2] = trajectory.flags;
+  out[3] = trajectory.count;
+  rasmPutUint16(out + 4, trajectory.first);
+  out += 6;
+  for (uint8_t i = 0; i < RASM_TRAJECTORY_BATCH; ++i, out += RASM_TRAJECTORY_POINT_SIZE)
+  {
+    const bool used = i < trajectory.count;
+    const RasmTrajectoryPoint& point = trajectory.points[i];
+    rasmPutUint16(out, used ? point.duration_ms : 0);
+    for (uint8_t joint = 0; joint < RASM_JOINT_COUNT; ++joint)
+    {
+      rasmPutInt16(out + 2 + 2 * joint, used ? point.angles[joint] : 0);
+      rasmPutInt16(out + 2 + 2 * RASM_JOINT_COUNT + 2 * joint, used ? point.velocities[joint] : 0);
+    }
+  }
+  return rasmFinishFrame(frame, RASM_FRAME_TRAJECTORY, trajectory.sequence, RASM_TRAJECTORY_PAYLOAD_SIZE);
+}
+
+// Writes a trajectory status frame into frame, which must hold RASM_TRAJECTORY_STATUS_FRAME_SIZE
+// bytes.
+inline uint8_t rasmEncodeTrajectoryStatus(const RasmTrajectoryStatusFrame& status, uint8_t* frame)
+{
+  uint8_t* out = frame + RASM_HEADER_SIZE;
+  out[0] = status.trajectory;
+  out[1] = status.state;
+  out[2] = status.free;
+  out[3] = status.rejected;
+  rasmPutUint16(out + 4, status.received);
+  rasmPutUint16(out + 6, status.segment);
+  rasmPutUint32(out + 8, status.time_ms);
+  return rasmFinishFrame(frame, RASM_FRAME_TRAJECTORY_STATUS, status.sequence, RASM_TRAJECTORY_STATUS_PAYLOAD_SIZE);
+}
+
+// Incremental, non-blocking frame parser. Feed it one received byte at a time (for example
+// everything Serial.available() says is waiting); it never waits for more input. When
+// feed() returns true a complete frame with a good CRC is available through type(),
+// sequence() and the decode functions until the next byte is fed.
+class RasmParser
+{
+public:
+  RasmParser() : state(WAIT_SYNC), frame_type(0), frame_sequence(0), payload_size(0), received(0),
+                 crc(0), crc_low(0), good_frames(0), bad_frames(0), lost_frames(0), expected_sequence(0),
+                 synced_once(false) {}
+
+  bool feed(uint8_t byte)
+  {
+    switch (state)
+    {
+      case WAIT_SYNC:
+        if (byte == RASM_SYNC_BYTE)
+        {
+          crc = 0xFFFF;
+          state = TYPE;
+        }
+        return false;
+      case TYPE:
+      {
+        const int size = rasmPayloadSize(byte);
+        if (size < 0)
+        {
+          ++bad_frames;
+          // The byte after a false sync might itself be a real sync byte.
+          state = byte == RASM_SYNC_BYTE ? TYPE : WAIT_SYNC;
+          return false;
+        }
+        frame_type = byte;
+        payload_size = (uint8_t)size;
+        crc = rasmCrc16Update(crc, byte);
+        state = SEQUENCE;
+        return false;
+      }
+      case SEQUENCE:
+        frame_sequence = byte;
+        crc = rasmCrc16Update(crc, byte);
+        received = 0;
+        state = payload_size > 0 ? PAYLOAD : CRC_LOW;
+        return false;
+      case PAYLOAD:
+        payload[received++] = byte;
+        crc = rasmCrc16Update(crc, byte);
+        if (received == payload_size)
+        {
+          state = CRC_LOW;
+        }
+        return false;
+      case CRC_LOW:
+        crc_low = byte;
+        state = CRC_HIGH;
+        return false;
+      case CRC_HIGH:
+        state = WAIT_SYNC;
+        if (((uint16_t)byte << 8 | crc_low) != crc)
+        {
+          ++bad_frames;
+          return false;
+        }
+        ++good_frames;
+        if (synced_once && frame_sequence != expected_sequence)
+        {
+          lost_frames += (uint8_t)(frame_sequence - expected_sequence);
+        }
+        expected_sequence = frame_sequence + 1;
+        synced_once = true;
+        return true;
+    }
+    return false;
+  }
+
+  uint8_t type() const { return frame_type; }
+  uint8_t sequence() const { return frame_sequence; }
+
+  // Only valid right after feed() returned true for a RASM_FRAME_MOTION frame.
+  void decodeMotion(RasmMotionFrame& motion) const
+  {
+    motion.sequence = frame_sequence;
+    for (uint8_t axis = 0; axis < RASM_AXIS_COUNT; ++axis)
+    {
+      motion.setpoints[axis] = rasmGetInt16(payload + 2 * axis);
+    }
+  }
+
+  // Only valid right after feed() returned true for a RASM_FRAME_JOINT_STATE frame.
+  void decodeJointState(RasmJointStateFrame& state) const
+  {
+    state.sequence = frame_sequence;
+    state.time_us = rasmGetUint32(payload);
+    for (uint8_t joint = 0; joint < RASM_JOINT_COUNT; ++joint)
+    {
+      state.angles[joint] = rasmGetInt16(payload + 4 + 2 * joint);
+    }
+  }
+
+  // Only valid right after feed() returned true for a RASM_FRAME_TRAJECTORY frame.
+  void decodeTrajectory(RasmTrajectoryFrame& trajectory) const
+  {
+    trajectory.sequence = frame_sequence;
+    trajectory.trajectory = payload[0];
+    trajectory.joints = payload[1];
+    trajectory.flags = payload[2];
+    trajectory.count = payload[3] < RASM_TRAJECTORY_BATCH ? payload[3] : RASM_TRAJECTORY_BATCH;
+    trajectory.first = rasmGetUint16(payload + 4);
+    const uint8_t* in = payload + 6;
+    for (uint8_t i = 0; i < trajectory.count; ++i, in += RASM_TRAJECTORY_POINT_SIZE)
+    {
+      RasmTrajectoryPoint& point = trajectory.points[i];
+      point.duration_ms = rasmGetUint16(in);
+      for (uint8_t joint = 0; joint < RASM_JOINT_COUNT; ++joint)
+      {
+        point.angles[joint] = rasmGetInt16(in + 2 + 2 * joint);
+        point.velocities[joint] = rasmGetInt16(in + 2 + 2 * RASM_JOINT_COUNT + 2 * joint);
+      }
+    }
+  }
+
+  // Only valid right after feed() returned true for a RASM_FRAME_TRAJECTORY_STATUS frame.
+  void decodeTrajectoryStatus(RasmTrajectoryStatusFrame& status) const
+  {
+    status.sequence = frame_sequence;
+    status.trajectory = payload[0];
+    status.state = payload[1];
+    status.free = payload[2];
+    status.rejected = payload[3];
+    status.received = rasmGetUint16(payload + 4);
+    status.segment = rasmGetUint16(payload + 6);
+    status.time_ms = rasmGetUint32(payload + 8);
+  }
+
+  // Counters for link diagnostics. lost_frames is worked out from gaps in the sequence numbers.
+  uint32_t goodFrames() const { return good_frames; }
+  uint32_t badFrames() const { return bad_frames; }
+  uint32_t lostFrames() const { return lost_frames; }
+
+private:
+  enum State { WAIT_SYNC, TYPE, SEQUENCE, PAYLOAD, CRC_LOW, CRC_HIGH };
+
+  State state;
+  uint8_t frame_type;
+  uint8_t frame_sequence;
+  uint8_t payload_size;
+  uint8_t received;
+  uint16_t crc;
+  uint8_t crc_low;
+  uint8_t payload[RASM_MAX_PAYLOAD_SIZE];
+  uint32_t good_frames;
+  uint32_t bad_frames;
+  uint32_t lost_frames;
+  uint8_t expected_sequence;
+  bool synced_once;
+};
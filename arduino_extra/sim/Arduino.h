@@ -0,0 +1,286 @@
+#pragma once
+
+// Just enough of the Arduino core for the RASM sketches to compile and run on a computer
+// against the simulated board in firmware_sim.h. Every call charges the board time it would
+// take on the Arduino Mega; see the SIM_*_US costs there.
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "firmware_sim.h"
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define PI 3.1415926535897932384626433832795
+#define HALF_PI 1.5707963267948966192313216916398
+#define TWO_PI 6.283185307179586476925286766559
+#define DEG_TO_RAD 0.017453292519943295769236907684886
+#define RAD_TO_DEG 57.295779513082320876798154814105
+#define DEC 10
+#define HEX 16
+
+// Analog pins of the Mega.
+static const uint8_t A0 = 54;
+static const uint8_t A1 = 55;
+static const uint8_t A2 = 56;
+static const uint8_t A3 = 57;
+static const uint8_t A4 = 58;
+static const uint8_t A5 = 59;
+static const uint8_t A6 = 60;
+static const uint8_t A7 = 61;
+static const uint8_t A8 = 62;
+static const uint8_t A9 = 63;
+static const uint8_t A10 = 64;
+static const uint8_t A11 = 65;
+static const uint8_t A12 = 66;
+static const uint8_t A13 = 67;
+static const uint8_t A14 = 68;
+static const uint8_t A15 = 69;
+
+// encoder_sampler.h's ADC runs in the background on the board, so its samples take no time here.
+#define ENCODER_HOST_SAMPLE(pin) firmware_sim.analogSample(pin)
+
+inline unsigned long micros()
+{
+  firmware_sim.charge(SIM_COST_CALLS, SIM_CALL_US);
+  return (unsigned long)firmware_sim.now();
+}
+
+inline unsigned long millis()
+{
+  firmware_sim.charge(SIM_COST_CALLS, SIM_CALL_US);
+  return (unsigned long)(firmware_sim.now() / 1000);
+}
+
+inline void delay(unsigned long ms) { firmware_sim.charge(SIM_COST_DELAY, ms * 1000.0); }
+inline void delayMicroseconds(unsigned int us) { firmware_sim.charge(SIM_COST_DELAY, us); }
+
+inline int analogRead(uint8_t pin)
+{
+  firmware_sim.charge(SIM_COST_ANALOG_READ, SIM_ANALOG_READ_US);
+  return firmware_sim.analogSample(pin >= A0 ? pin : pin + A0);
+}
+
+inline void analogWrite(uint8_t, int) { firmware_sim.charge(SIM_COST_CALLS, SIM_ANALOG_WRITE_US); }
+inline void pinMode(uint8_t, uint8_t) { firmware_sim.charge(SIM_COST_CALLS, SIM_DIGITAL_WRITE_US); }
+inline void digitalWrite(uint8_t, uint8_t) { firmware_sim.charge(SIM_COST_CALLS, SIM_DIGITAL_WRITE_US); }
+
+inline int digitalRead(uint8_t)
+{
+  firmware_sim.charge(SIM_COST_CALLS, SIM_DIGITAL_WRITE_US);
+  return LOW;
+}
+
+template <typename T>
+T constrain(T value, T low, T high)
+{
+  return value < low ? low : value > high ? high : value;
+}
+
+inline long map(long value, long in_min, long in_max, long out_min, long out_max)
+{
+  return (value - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
+}
+
+// The parts of Arduino's String the sketches use.
+class String
+{
+public:
+  String() {}
+  String(const char* text) : text(text) {}
+  String(const std::string& text) : text(text) {}
+  String(char c) : text(1, c) {}
+  String(int value) : text(std::to_string(value)) {}
+  String(long value) : text(std::to_string(value)) {}
+  String(unsigned long value) : text(std::to_string(value)) {}
+  String(double value, int digits = 2)
+  {
+    char buffer[64];
+    std::snprintf(buffer, sizeof(buffer), "%.*f", digits, value);
+    text = buffer;
+  }
+
+  unsigned int length() const { return (unsigned int)text.size(); }
+  const char* c_str() const { return text.c_str(); }
+  char charAt(unsigned int i) const { return i < text.size() ? text[i] : 0; }
+  char operator[](unsigned int i) const { return charAt(i); }
+  int indexOf(char c, unsigned int from = 0) const
+  {
+    const std::string::size_type i = text.find(c, from);
+    return i == std::string::npos ? -1 : (int)i;
+  }
+  String substring(unsigned int from) const { return from < text.size() ? String(text.substr(from)) : String(); }
+  String substring(unsigned int from, unsigned int to) const
+  {
+    return from < to && from < text.size() ? String(text.substr(from, to - from)) : String();
+  }
+  long toInt() const { return std::atol(text.c_str()); }
+  float toFloat() const { return (float)std::atof(text.c_str()); }
+  void trim()
+  {
+    const std::string::size_type first = text.find_first_not_of(" \t\r\n");
+    const std::string::size_type last = text.find_last_not_of(" \t\r\n");
+    text = first == std::string::npos ? std::string() : text.substr(first, last - first + 1);
+  }
+  bool equals(const String& other) const { return text == other.text; }
+  bool operator==(const String& other) const { return text == other.text; }
+  bool operator!=(const String& other) const { return text != other.text; }
+  String& operator+=(const String& other)
+  {
+    text += other.text;
+    return *this;
+  }
+  friend String operator+(String a, const String& b) { return a += b; }
+
+private:
+  std::string text;
+};
+
+// Serial: input comes from the command stream firmware_sim.cpp plays, output goes out through
+// the simulated UART at the speed given to begin().
+class HardwareSerial
+{
+public:
+  HardwareSerial() : timeout_ms(1000) {}
+
+  void begin(unsigned long baud) { firmware_sim.serialBegin(baud); }
+  void end() {}
+  operator bool() const { return true; }
+
+  int available()
+  {
+    firmware_sim.charge(SIM_COST_CALLS, SIM_CALL_US);
+    return firmware_sim.serialAvailable();
+  }
+
+  int peek()
+  {
+    firmware_sim.charge(SIM_COST_CALLS, SIM_CALL_US);
+    return firmware_sim.serialPeek();
+  }
+
+  int read()
+  {
+    firmware_sim.charge(SIM_COST_CALLS, SIM_CALL_US);
+    return firmware_sim.serialRead();
+  }
+
+  int availableForWrite()
+  {
+    firmware_sim.charge(SIM_COST_CALLS, SIM_CALL_US);
+    return firmware_sim.serialAvailableForWrite();
+  }
+
+  void setTimeout(unsigned long ms) { timeout_ms = ms; }
+
+  size_t readBytes(char* buffer, size_t length)
+  {
+    size_t count = 0;
+    while (count < length)
+    {
+      const int c = timedRead();
+      if (c < 0)
+      {
+        break;
+      }
+      buffer[count++] = (char)c;
+    }
+    return count;
+  }
+
+  // Like the real one, waits up to the timeout for each character.
+  String readStringUntil(char terminator)
+  {
+    std::string text;
+    int c = timedRead();
+    while (c >= 0 && c != terminator)
+    {
+      text += (char)c;
+      c = timedRead();
+    }
+    return String(text);
+  }
+
+  String readString()
+  {
+    std::string text;
+    for (int c = timedRead(); c >= 0; c = timedRead())
+    {
+      text += (char)c;
+    }
+    return String(text);
+  }
+
+  size_t write(uint8_t value)
+  {
+    firmware_sim.charge(SIM_COST_CALLS, SIM_SERIAL_WRITE_US);
+    firmware_sim.serialWrite(value);
+    return 1;
+  }
+
+  size_t write(const uint8_t* buffer, size_t size)
+  {
+    for (size_t i = 0; i < size; ++i)
+    {
+      write(buffer[i]);
+    }
+    return size;
+  }
+
+  size_t write(const char* text) { return write((const uint8_t*)text, std::strlen(text)); }
+
+  void flush() { firmware_sim.serialFlush(); }
+
+  size_t print(const char* text) { return write(text); }
+  size_t print(const String& text) { return write(text.c_str()); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(int value, int base = DEC) { return print((long)value, base); }
+  size_t print(unsigned int value, int base = DEC) { return print((unsigned long)value, base); }
+  size_t print(long value, int base = DEC)
+  {
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), base == HEX ? "%lX" : "%ld", value);
+    return write(buffer);
+  }
+  size_t print(unsigned long value, int base = DEC)
+  {
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), base == HEX ? "%lX" : "%lu", value);
+    return write(buffer);
+  }
+  size_t print(double value, int digits = 2) { return print(String(value, digits)); }
+
+  size_t println() { return write("\r\n"); }
+  template <typename T>
+  size_t println(const T& value)
+  {
+    const size_t size = print(value);
+    return size + println();
+  }
+  template <typename T>
+  size_t println(const T& value, int format)
+  {
+    const size_t size = print(value, format);
+    return size + println();
+  }
+
+private:
+  int timedRead()
+  {
+    firmware_sim.charge(SIM_COST_CALLS, SIM_CALL_US);
+    return firmware_sim.serialTimedRead(timeout_ms);
+  }
+
+  unsigned long timeout_ms;
+};
+
+HardwareSerial Serial;
@@ -0,0 +1,62 @@
+#pragma once
+
+// Stands in for Pololu's DualMC33926MotorShield library on the simulated board: speeds go to
+// the motor on the shield's PWM pin in firmware_sim.h. Same constructors and defaults as the
+// real library.
+
+#include <Arduino.h>
+
+class DualMC33926MotorShield
+{
+public:
+  DualMC33926MotorShield() : m1_pwm(9), m1_fb(A0), m2_pwm(10), m2_fb(A1) {}
+  DualMC33926MotorShield(unsigned char, unsigned char M1PWM, unsigned char M1FB, unsigned char, unsigned char M2PWM,
+                         unsigned char M2FB, unsigned char, unsigned char)
+    : m1_pwm(M1PWM), m1_fb(M1FB), m2_pwm(M2PWM), m2_fb(M2FB) {}
+
+  // The real init() sets up six pins and the PWM timer.
+  void init()
+  {
+    for (int i = 0; i < 6; ++i)
+    {
+      pinMode(0, OUTPUT);
+    }
+  }
+
+  void setM1Speed(int speed) { setSpeed(m1_pwm, speed); }
+  void setM2Speed(int speed) { setSpeed(m2_pwm, speed); }
+
+  void setSpeeds(int m1_speed, int m2_speed)
+  {
+    setM1Speed(m1_speed);
+    setM2Speed(m2_speed);
+  }
+
+  // Takes an analogRead() of the feedback pin like the real one, but the simulated motors
+  // draw no current.
+  unsigned int getM1CurrentMilliamps() { return analogRead(m1_fb) * 9; }
+  unsigned int getM2CurrentMilliamps() { return analogRead(m2_fb) * 9; }
+  unsigned char getFault() { return 0; }
+
+private:
+  // Like the library: clamp to +-400, then a direction pin and a PWM duty cycle.
+  void setSpeed(unsigned char pwm_pin, int speed)
+  {
+    if (speed > SIM_MOTOR_MAX_SPEED)
+    {
+      speed = SIM_MOTOR_MAX_SPEED;
+    }
+    else if (speed < -SIM_MOTOR_MAX_SPEED)
+    {
+      speed = -SIM_MOTOR_MAX_SPEED;
+    }
+    digitalWrite(0, speed < 0 ? HIGH : LOW);
+    analogWrite(pwm_pin, std::abs(speed) * 51 / 80);
+    firmware_sim.setMotorSpeed(pwm_pin, speed);
+  }
+
+  unsigned char m1_pwm;
+  unsigned char m1_fb;
+  unsigned char m2_pwm;
+  unsigned char m2_fb;
+};
@@ -0,0 +1,954 @@
+// Runs one of the sketches on the simulated board in firmware_sim.h and reports how long its
+// loop() takes and how long a command from the computer takes to reach the motors, all in
+// board time. The sketch is compiled into this file: the build passes its path in RASM_SKETCH
+// (see build/CMakeLists.txt, one *-sim target per sketch).
+//
+// The computer's side is a command stream played into Serial:
+//   --commands=FILE    motion commands recorded with './vision-benchmark VIDEO --record=FILE',
+//                      sent as motion frames (rasm_protocol.h), one per video frame at
+//                      --command-hz. Plays once; --seconds defaults to its length.
+//   --keys=KEYS        single-character commands (manually_move_the_motors), one every
+//                      1 / --command-hz seconds, over and over.
+//   neither            main-code following a face that moves back and forth in front of the
+//                      arm: every 1 / --command-hz seconds the face's offset from where each
+//                      joint points becomes a motion frame, which arrives --latency-ms later.
+//                      Reports how far each joint trails the face.
+//   --step=DEG         the same, but the face stays still and jumps DEG degrees on every joint
+//                      half a second in; reports each joint's step response.
+//   --trajectory[=FILE]  rasm_motion executing a planned trajectory (trajectory_streamer.h):
+//                      its waypoints go out in trajectory frames as the firmware makes room for
+//                      them, and the firmware interpolates. FILE has lines of
+//                      time,shoulder,elbow,yaw,pitch,roll (seconds, degrees); without it, a
+//                      search pattern through three poses from wherever the arm is. Reports how
+//                      far each joint strays from the trajectory and what went over the link,
+//                      and exits with 1 if the trajectory did not finish or a joint strayed
+//                      more than --max-error degrees.
+// Usage: <sketch>-sim [--commands=FILE | --keys=KEYS | --step=DEG | --trajectory[=FILE]]
+//                     [--command-hz=HZ] [--latency-ms=MS] [--seconds=S] [--max-error=DEG]
+//                     [--noise=STEPS] [--cpu-scale=N] [--seed=N] [--format=text|csv] [--output=FILE]
+// --noise is the encoder noise in steps (standard deviation). --cpu-scale=N also charges the
+// sketch's own computation as N times the time it takes on this computer (very roughly 100
+// for an ATmega2560 against a desktop core); it is off by default so that runs are repeatable.
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <Arduino.h>
+
+#include RASM_SKETCH
+
+// Only sketches that play trajectories (arduino_main) are built with RASM_SIM_TRAJECTORY; the
+// others have their own copies of the joint angle functions.
+#ifdef RASM_SIM_TRAJECTORY
+#include <joint_angles.h>
+#include "trajectory_streamer.h"
+#endif
+
+#ifndef RASM_SIM_DEFAULT_KEYS
+#define RASM_SIM_DEFAULT_KEYS ""
+#endif
+
+typedef std::chrono::steady_clock host_clock;
+
+// Motion commands recorded by vision-benchmark --record: frame,roll,pitch,yaw,y,x.
+struct RecordedCommand
+{
+  unsigned long frame;
+  int setpoints[RASM_AXIS_COUNT];
+};
+
+bool readCommands(const char* path, std::vector<RecordedCommand>& commands)
+{
+  std::ifstream in(path);
+  if (!in)
+  {
+    std::cout << "Unable to read " << path << std::endl;
+    return false;
+  }
+  std::string line;
+  while (std::getline(in, line))
+  {
+    RecordedCommand c;
+    int roll, pitch, yaw, y, x;
+    if (std::sscanf(line.c_str(), "%lu,%d,%d,%d,%d,%d", &c.frame, &roll, &pitch, &yaw, &y, &x) != 6)
+    {
+      continue;   // the header
+    }
+    c.setpoints[RASM_AXIS_ROLL] = roll;
+    c.setpoints[RASM_AXIS_PITCH] = pitch;
+    c.setpoints[RASM_AXIS_YAW] = yaw;
+    c.setpoints[RASM_AXIS_Y] = y;
+    c.setpoints[RASM_AXIS_X] = x;
+    commands.push_back(c);
+  }
+  return true;
+}
+
+void sendMotion(double at_us, uint8_t sequence, const int* setpoints)
+{
+  RasmMotionFrame motion;
+  motion.sequence = sequence;
+  for (int axis = 0; axis < RASM_AXIS_COUNT; ++axis)
+  {
+    const int value = setpoints[axis];
+    motion.setpoints[axis] = value > INT16_MAX ? INT16_MAX : value < INT16_MIN ? INT16_MIN : value;
+  }
+  uint8_t frame[RASM_MOTION_FRAME_SIZE];
+  const uint8_t size = rasmEncodeMotion(motion, frame);
+  firmware_sim.sendCommand(at_us, frame, size);
+}
+
+// How the face moves each joint. main-code's setpoint for an axis is scale times the face's
+// offset from where the joint points, in encoder steps: roll, pitch and yaw are twice the
+// angle in degrees (command_generator.h), x is tenths of an inch, taken as a third of an inch
+// per degree of elbow. The signs follow the motor directions in arduino_main.
+struct FaceAxis
+{
+  int axis;              // RASM_AXIS_*
+  const char* joint;     // the simulated joint that axis moves
+  double scale;          // setpoint per encoder step of offset
+  double amplitude;      // following: encoder steps either side of where the joint started
+  double hz;
+};
+
+const FaceAxis face_axes[] =
+{
+  {RASM_AXIS_ROLL,  "roll",  2 * 360.0 / 1024,  60,  0.15},
+  {RASM_AXIS_PITCH, "pitch", -2 * 360.0 / 1024, 20,  0.2},
+  {RASM_AXIS_YAW,   "yaw",   2 * 360.0 / 1024,  60,  0.12},
+  {RASM_AXIS_X,     "elbow", 10 * 360.0 / 1024 / 3, 100, 0.1},
+};
+const int face_axis_count = sizeof(face_axes) / sizeof(face_axes[0]);
+const double degrees_per_encoder_step = 360.0 / 1024;
+
+// Difference a - b of two encoder positions the short way round.
+double stepsBetween(double a, double b)
+{
+  const double d = a - b;
+  return d - 1024 * std::floor(d / 1024 + 0.5);
+}
+
+// Plays main-code following a face (--step, or no other input), closed loop: the setpoints
+// come from where the simulated joints really are, and arrive latency_us after the moment
+// they describe. Call update() after every loop().
+class FaceFollower
+{
+public:
+  // step_degrees 0 for a face moving back and forth.
+  FaceFollower(double step_degrees, double period_us, double latency_us, double start_us)
+    : step(step_degrees / degrees_per_encoder_step), period_us(period_us), latency_us(latency_us),
+      start_us(start_us), next_capture_us(start_us), next_sample_us(start_us), sequence(0)
+  {
+    for (int i = 0; i < face_axis_count; ++i)
+    {
+      Axis& axis = axes[i];
+      axis.joint = NULL;
+      for (SimJoint& joint : firmware_sim.joints())
+      {
+        if (std::strcmp(joint.name, face_axes[i].joint) == 0)
+        {
+          axis.joint = &joint;
+        }
+      }
+      axis.start = axis.joint->position;
+      axis.error_squares = 0;
+      axis.max_error = 0;
+      axis.samples = 0;
+      axis.rise_start_us = axis.rise_end_us = axis.settled_us = -1;
+      axis.peak = 0;
+    }
+  }
+
+  bool stepping() const { return step != 0; }
+
+  // When the face jumps, for --step.
+  double stepTime() const { return start_us + 500000; }
+
+  void update()
+  {
+    firmware_sim.moveArm();
+    const double now = firmware_sim.now();
+    while (next_capture_us <= now)
+    {
+      RasmMotionFrame motion;
+      motion.sequence = sequence++;
+      for (int axis = 0; axis < RASM_AXIS_COUNT; ++axis)
+      {
+        motion.setpoints[axis] = 0;
+      }
+      for (int i = 0; i < face_axis_count; ++i)
+      {
+        const double offset = stepsBetween(face(i, next_capture_us), axes[i].joint->position);
+        // main-code truncates, like (int) does.
+        motion.setpoints[face_axes[i].axis] = (int16_t)(face_axes[i].scale * offset);
+      }
+      uint8_t frame[RASM_MOTION_FRAME_SIZE];
+      const uint8_t size = rasmEncodeMotion(motion, frame);
+      firmware_sim.sendCommand(next_capture_us + latency_us, frame, size);
+      next_capture_us += period_us;
+    }
+    if (now < next_sample_us)
+    {
+      return;
+    }
+    next_sample_us = now + 1000;
+    for (int i = 0; i < face_axis_count; ++i)
+    {
+      sample(i, now);
+    }
+  }
+
+  void writeText() const
+  {
+    if (stepping())
+    {
+      std::printf("\nstep response to a %.1f degree step (band +-%.2f degrees):\n", step * degrees_per_encoder_step,
+                  band() * degrees_per_encoder_step);
+    }
+    else
+    {
+      std::printf("\nfollowing the face (after the first second):\n");
+    }
+    for (int i = 0; i < face_axis_count; ++i)
+    {
+      const Axis& axis = axes[i];
+      if (stepping())
+      {
+        std::printf("  %-10s rise %8.1f ms  overshoot %6.1f%%  settled after %8.1f ms  final error %6.2f deg\n",
+                    face_axes[i].joint, riseMs(axis), overshoot(axis), settledMs(axis), finalError(i));
+      }
+      else
+      {
+        std::printf("  %-10s rms error %6.2f deg  max error %6.2f deg\n", face_axes[i].joint, rmsError(axis),
+                    axis.max_error * degrees_per_encoder_step);
+      }
+    }
+  }
+
+  void writeCsv(std::ostream& out) const
+  {
+    for (int i = 0; i < face_axis_count; ++i)
+    {
+      const Axis& axis = axes[i];
+      const std::string name = face_axes[i].joint;
+      if (stepping())
+      {
+        out << name << ",step_rise_ms," << riseMs(axis) << "\n";
+        out << name << ",step_overshoot_percent," << overshoot(axis) << "\n";
+        out << name << ",step_settling_ms," << settledMs(axis) << "\n";
+        out << name << ",step_final_error_deg," << finalError(i) << "\n";
+      }
+      else
+      {
+        out << name << ",tracking_rms_error_deg," << rmsError(axis) << "\n";
+        out << name << ",tracking_max_error_deg," << axis.max_error * degrees_per_encoder_step << "\n";
+      }
+    }
+  }
+
+private:
+  struct Axis
+  {
+    SimJoint* joint;
+    double start;            // encoder position when the run started
+    double error_squares;    // following
+    double max_error;
+    unsigned long samples;
+    double rise_start_us;    // step: first at 10% of the step
+    double rise_end_us;      // first at 90%
+    double settled_us;       // last outside the band
+    double peak;             // furthest along, as a fraction of the step
+  };
+
+  // Where the face is for axis i at board time t, as an encoder position of its joint.
+  double face(int i, double t) const
+  {
+    if (stepping())
+    {
+      return axes[i].start + (t >= stepTime() ? step : 0);
+    }
+    return axes[i].start + face_axes[i].amplitude * std::sin(2 * M_PI * face_axes[i].hz * (t - start_us) / 1e6);
+  }
+
+  void sample(int i, double now)
+  {
+    Axis& axis = axes[i];
+    const double error = stepsBetween(face(i, now), axis.joint->position);
+    if (!stepping())
+    {
+      if (now - start_us >= 1e6)
+      {
+        axis.error_squares += error * error;
+        axis.max_error = std::max(axis.max_error, std::fabs(error));
+        ++axis.samples;
+      }
+      return;
+    }
+    if (now < stepTime())
+    {
+      return;
+    }
+    const double progress = stepsBetween(axis.joint->position, axis.start) / step;
+    axis.peak = std::max(axis.peak, progress);
+    if (axis.rise_start_us < 0 && progress >= 0.1)
+    {
+      axis.rise_start_us = now;
+    }
+    if (axis.rise_end_us < 0 && progress >= 0.9)
+    {
+      axis.rise_end_us = now;
+    }
+    if (std::fabs(error) > band())
+    {
+      axis.settled_us = now;
+    }
+  }
+
+  // Settled means within 5% of the step or one degree, whichever is more.
+  double band() const { return std::max(0.05 * std::fabs(step), 1 / degrees_per_encoder_step); }
+
+  double rmsError(const Axis& axis) const
+  {
+    return axis.samples ? std::sqrt(axis.error_squares / axis.samples) * degrees_per_encoder_step : 0;
+  }
+  // -1 if the joint never got to 90%.
+  double riseMs(const Axis& axis) const
+  {
+    return axis.rise_end_us < 0 ? -1 : (axis.rise_end_us - axis.rise_start_us) / 1000;
+  }
+  double overshoot(const Axis& axis) const { return axis.peak > 1 ? 100 * (axis.peak - 1) : 0; }
+  double settledMs(const Axis& axis) const
+  {
+    return axis.settled_us < 0 ? 0 : (axis.settled_us - stepTime()) / 1000;
+  }
+  double finalError(int i) const
+  {
+    return std::fabs(stepsBetween(face(i, firmware_sim.now()), axes[i].joint->position)) * degrees_per_encoder_step;
+  }
+
+  double step;
+  double period_us;
+  double latency_us;
+  double start_us;
+  double next_capture_us;
+  double next_sample_us;
+  uint8_t sequence;
+  Axis axes[face_axis_count];
+};
+
+#ifdef RASM_SIM_TRAJECTORY
+// The joints a trajectory moves, as the simulated arm has them.
+struct TrajectoryJoint
+{
+  int joint;                       // RASM_JOINT_*
+  const char* name;                // the simulated joint
+  double (*angle)(double steps);   // joint_angles.h
+};
+
+const TrajectoryJoint trajectory_joints[RASM_JOINT_COUNT] =
+{
+  {RASM_JOINT_SHOULDER, "shoulder", shoulderAngleFromSteps},
+  {RASM_JOINT_ELBOW,    "elbow",    elbowAngleFromSteps},
+  {RASM_JOINT_YAW,      "yaw",      yawAngleFromSteps},
+  {RASM_JOINT_PITCH,    "pitch",    pitchAngleFromSteps},
+  {RASM_JOINT_ROLL,     "roll",     rollAngleFromSteps},
+};
+
+// Angle a - b in degrees, the short way round.
+double degreesBetween(double a, double b)
+{
+  const double d = a - b;
+  return d - 360 * std::floor(d / 360 + 0.5);
+}
+
+// Reads --trajectory=FILE: time,shoulder,elbow,yaw,pitch,roll per line. The velocities are
+// worked out from the positions.
+bool readTrajectory(const char* path, std::vector<TrajectoryWaypoint>& points)
+{
+  std::ifstream in(path);
+  if (!in)
+  {
+    std::cout << "Unable to read " << path << std::endl;
+    return false;
+  }
+  std::string line;
+  while (std::getline(in, line))
+  {
+    TrajectoryWaypoint point;
+    double* p = point.position;
+    if (std::sscanf(line.c_str(), "%lf,%lf,%lf,%lf,%lf,%lf", &point.time, &p[RASM_JOINT_SHOULDER],
+                    &p[RASM_JOINT_ELBOW], &p[RASM_JOINT_YAW], &p[RASM_JOINT_PITCH], &p[RASM_JOINT_ROLL]) != 6)
+    {
+      continue;   // the header
+    }
+    points.push_back(point);
+  }
+  fillTrajectoryVelocities(points);
+  return true;
+}
+
+// Plays rasm_motion executing a trajectory (--trajectory), closed loop: a TrajectoryBatcher
+// sends the waypoints in trajectory frames when the status frames coming back say there is
+// room, just as TrajectoryStreamer does over the port. Call update() after every loop().
+class TrajectoryRun
+{
+public:
+  // The trajectory goes out 0.2 s after sim_start_us, once the encoders are up and the
+  // controllers have started.
+  explicit TrajectoryRun(double sim_start_us)
+    : begin_us(sim_start_us + 200000), started(false), start_us(0), done_us(-1), next_sample_us(0), frames_at_done(0),
+                    bytes_at_done(0), starved_statuses(0), have_status(false), status_us(0)
+  {
+    for (int i = 0; i < RASM_JOINT_COUNT; ++i)
+    {
+      axes[i].joint = NULL;
+      for (SimJoint& joint : firmware_sim.joints())
+      {
+        if (std::strcmp(joint.name, trajectory_joints[i].name) == 0)
+        {
+          axes[i].joint = &joint;
+        }
+      }
+      axes[i].error_squares = 0;
+      axes[i].max_error = 0;
+      axes[i].samples = 0;
+    }
+  }
+
+  // The joint angles the arm is at now.
+  void currentAngles(double* angles) const
+  {
+    for (int i = 0; i < RASM_JOINT_COUNT; ++i)
+    {
+      angles[trajectory_joints[i].joint] =
+          axes[i].joint ? trajectory_joints[i].angle(axes[i].joint->position) : 0;
+    }
+  }
+
+  // A search pattern from where the arm is: over to one side, across to the other, and back to
+  // the middle, each move a quintic (at rest at both ends) sampled the way a planner's time
+  // parameterization would give it, at 10 degrees per second on average for the joint that
+  // moves furthest.
+  void makeSearchPattern()
+  {
+    //                                    shoulder elbow  yaw   pitch roll
+    static const double poses[][RASM_JOINT_COUNT] = {{10,     80,    30,   80,   25},
+                                                     {-15,    40,    -15,  92,   0},
+                                                     {0,      60,    10,   86,   13}};
+    const int moves = sizeof(poses) / sizeof(poses[0]);
+    const int samples_per_move = 12;
+    TrajectoryWaypoint from;
+    currentAngles(from.position);
+    trajectory.push_back(from);
+    double time = 0;
+    for (int move = 0; move < moves; ++move)
+    {
+      double furthest = 0;
+      double delta[RASM_JOINT_COUNT];
+      for (int joint = 0; joint < RASM_JOINT_COUNT; ++joint)
+      {
+        delta[joint] = degreesBetween(poses[move][joint], from.position[joint]);
+        furthest = std::max(furthest, std::fabs(delta[joint]));
+      }
+      const double duration = std::max(1.0, furthest / 10);
+      for (int k = 1; k <= samples_per_move; ++k)
+      {
+        const double tau = (double)k / samples_per_move;
+        const double s = tau * tau * tau * (10 - 15 * tau + 6 * tau * tau);
+        const double ds = 30 * tau * tau * (1 - tau) * (1 - tau) / duration;
+        TrajectoryWaypoint point;
+        point.time = time + tau * duration;
+        for (int joint = 0; joint < RASM_JOINT_COUNT; ++joint)
+        {
+          point.position[joint] = from.position[joint] + s * delta[joint];
+          point.velocity[joint] = ds * delta[joint];
+        }
+        trajectory.push_back(point);
+      }
+      time += duration;
+      from = trajectory.back();
+    }
+  }
+
+  std::vector<TrajectoryWaypoint>& waypoints() { return trajectory; }
+
+  double plannedSeconds() const { return trajectory.empty() ? 0 : trajectory.back().time; }
+  bool finished() const { return done_us >= 0; }
+
+  void update()
+  {
+    firmware_sim.moveArm();
+    const double now = firmware_sim.now();
+    if (!started)
+    {
+      if (now < begin_us)
+      {
+        return;
+      }
+      started = true;
+      start_us = now;
+      batcher.start(trajectory, (1 << RASM_JOINT_COUNT) - 1, now);
+    }
+    RasmTrajectoryStatusFrame status;
+    while (firmware_sim.takeTrajectoryStatus(status))
+    {
+      batcher.received(status, now);
+      if (status.trajectory != batcher.trajectoryId())
+      {
+        continue;
+      }
+      latest = status;
+      status_us = now;
+      have_status = true;
+      starved_statuses += status.state == RASM_TRAJECTORY_STARVED ? 1 : 0;
+      if (status.state == RASM_TRAJECTORY_DONE && done_us < 0)
+      {
+        done_us = now;
+        frames_at_done = batcher.framesSent();
+        bytes_at_done = firmware_sim.bytesToBoard();
+      }
+    }
+    RasmTrajectoryFrame frame;
+    while (batcher.next(now, frame))
+    {
+      uint8_t bytes[RASM_TRAJECTORY_FRAME_SIZE];
+      const uint8_t size = rasmEncodeTrajectory(frame, bytes);
+      firmware_sim.sendCommand(now, bytes, size);
+    }
+    if (now < next_sample_us || !have_status || finished())
+    {
+      return;
+    }
+    next_sample_us = now + 1000;
+    // Where the firmware is along the trajectory: its last word on it, moved on by the time
+    // since, unless it is waiting.
+    double t = latest.time_ms / 1000.0;
+    if (latest.state == RASM_TRAJECTORY_RUNNING)
+    {
+      t += (now - status_us) / 1e6;
+    }
+    double angles[RASM_JOINT_COUNT];
+    currentAngles(angles);
+    for (int i = 0; i < RASM_JOINT_COUNT; ++i)
+    {
+      double position, velocity;
+      sampleTrajectory(trajectory, t, trajectory_joints[i].joint, position, velocity);
+      const double error = degreesBetween(position, angles[trajectory_joints[i].joint]);
+      Axis& axis = axes[i];
+      axis.error_squares += error * error;
+      axis.max_error = std::max(axis.max_error, std::fabs(error));
+      ++axis.samples;
+    }
+  }
+
+  // The largest error of any joint while the trajectory ran.
+  double maxError() const
+  {
+    double error = 0;
+    for (int i = 0; i < RASM_JOINT_COUNT; ++i)
+    {
+      error = std::max(error, axes[i].max_error);
+    }
+    return error;
+  }
+
+  void writeText() const
+  {
+    std::printf("\ntrajectory: %zu waypoints over %.2f s planned, ", trajectory.size(), plannedSeconds());
+    if (finished())
+    {
+      std::printf("finished in %.2f s\n", actualSeconds());
+    }
+    else
+    {
+      std::printf("NOT finished\n");
+    }
+    for (int i = 0; i < RASM_JOINT_COUNT; ++i)
+    {
+      std::printf("  %-10s rms error %6.2f deg  max error %6.2f deg  final error %6.2f deg\n",
+                  trajectory_joints[i].name, rmsError(axes[i]), axes[i].max_error, finalError(i));
+    }
+    std::printf("link to the board: %lu trajectory frames (%.2f per waypoint), %lu bytes, %.0f bytes/s; "
+                "%lu resends\n", framesSent(), (double)framesSent() / std::max<std::size_t>(1, trajectory.size()),
+                bytesSent(), bytesPerSecond(), batcher.resendCount());
+    std::printf("  a motion frame every 10 ms control period instead: %.0f frames, %.0f bytes\n",
+                streamedFrames(), streamedFrames() * RASM_MOTION_FRAME_SIZE);
+    std::printf("link back: %lu status frames (%lu starved)\n", firmware_sim.trajectoryStatusFrames(),
+                starved_statuses);
+  }
+
+  void writeCsv(std::ostream& out) const
+  {
+    out << "trajectory,waypoints," << trajectory.size() << "\n";
+    out << "trajectory,planned_seconds," << plannedSeconds() << "\n";
+    out << "trajectory,finished," << (finished() ? 1 : 0) << "\n";
+    out << "trajectory,actual_seconds," << actualSeconds() << "\n";
+    out << "trajectory,frames_sent," << framesSent() << "\n";
+    out << "trajectory,bytes_sent," << bytesSent() << "\n";
+    out << "trajectory,bytes_per_second," << bytesPerSecond() << "\n";
+    out << "trajectory,resends," << batcher.resendCount() << "\n";
+    out << "trajectory,streamed_equivalent_bytes," << streamedFrames() * RASM_MOTION_FRAME_SIZE << "\n";
+    out << "trajectory,status_frames," << firmware_sim.trajectoryStatusFrames() << "\n";
+    out << "trajectory,starved_statuses," << starved_statuses << "\n";
+    for (int i = 0; i < RASM_JOINT_COUNT; ++i)
+    {
+      const std::string name = trajectory_joints[i].name;
+      out << name << ",trajectory_rms_error_deg," << rmsError(axes[i]) << "\n";
+      out << name << ",trajectory_max_error_deg," << axes[i].max_error << "\n";
+      out << name << ",trajectory_final_error_deg," << finalError(i) << "\n";
+    }
+  }
+
+private:
+  struct Axis
+  {
+    SimJoint* joint;
+    double error_squares;
+    double max_error;
+    unsigned long samples;
+  };
+
+  double actualSeconds() const { return finished() ? (done_us - start_us) / 1e6 : 0; }
+  unsigned long framesSent() const { return finished() ? frames_at_done : batcher.framesSent(); }
+  unsigned long bytesSent() const { return finished() ? bytes_at_done : firmware_sim.bytesToBoard(); }
+  double bytesPerSecond() const { return actualSeconds() > 0 ? bytesSent() / actualSeconds() : 0; }
+  double streamedFrames() const { return std::ceil(plannedSeconds() * 100); }
+  double rmsError(const Axis& axis) const { return axis.samples ? std::sqrt(axis.error_squares / axis.samples) : 0; }
+  double finalError(int i) const
+  {
+    double angles[RASM_JOINT_COUNT];
+    currentAngles(angles);
+    const int joint = trajectory_joints[i].joint;
+    return trajectory.empty() ? 0 : std::fabs(degreesBetween(trajectory.back().position[joint], angles[joint]));
+  }
+
+  std::vector<TrajectoryWaypoint> trajectory;
+  TrajectoryBatcher batcher;
+  double begin_us;
+  bool started;
+  double start_us;
+  double done_us;
+  double next_sample_us;
+  unsigned long frames_at_done;
+  unsigned long bytes_at_done;
+  unsigned long starved_statuses;
+  bool have_status;
+  RasmTrajectoryStatusFrame latest;
+  double status_us;
+  Axis axes[RASM_JOINT_COUNT];
+};
+#endif
+
+const char* sketchName()
+{
+  const char* path = RASM_SKETCH;
+  const char* slash = std::strrchr(path, '/');
+  return slash ? slash + 1 : path;
+}
+
+void writeText(double seconds, unsigned long loops, const LatencyHistogram& loop_us)
+{
+  std::printf("%s: %.2f s of board time, %lu loops\n", sketchName(), seconds, loops);
+  std::printf("%-22s mean %10.1f us  p50 %10.1f us  p99 %10.1f us  max %10.1f us\n", "loop()", loop_us.mean(),
+              loop_us.percentile(50), loop_us.percentile(99), loop_us.max());
+  const LatencyHistogram& command = firmware_sim.commandLatency();
+  std::printf("%-22s mean %10.1f us  p50 %10.1f us  p99 %10.1f us  max %10.1f us\n", "command -> motors",
+              command.mean(), command.percentile(50), command.percentile(99), command.max());
+  std::printf("commands sent %lu, applied %lu, bytes lost to a full receive buffer %lu\n",
+              firmware_sim.commandsSent(), firmware_sim.commandsApplied(), firmware_sim.bytesDropped());
+  std::printf("bytes sent to the computer %lu", firmware_sim.bytesSent());
+  if (firmware_sim.outputFrames() > 0)
+  {
+    const LatencyHistogram& interval = firmware_sim.outputInterval();
+    std::printf(", %lu joint-state frames, every p50 %.1f us p99 %.1f us max %.1f us", firmware_sim.outputFrames(),
+                interval.percentile(50), interval.percentile(99), interval.max());
+  }
+  std::printf("\n\nboard time by what it went on:\n");
+  for (int cost = 0; cost < SIM_COST_COUNT; ++cost)
+  {
+    const SimCostStats& stats = firmware_sim.costStats(cost);
+    std::printf("  %-18s %10.1f ms %5.1f%%  %9lu calls  longest %10.1f us\n", simCostName(cost), stats.total_us / 1000,
+                100 * stats.total_us / (seconds * 1e6), stats.calls, stats.max_us);
+  }
+  std::printf("\nmotors:\n");
+  for (const SimJoint& joint : firmware_sim.joints())
+  {
+    std::printf("  %-10s %9lu updates  %7lu speed changes  driven %5.1f%%  encoder %6.1f\n", joint.name, joint.updates,
+                joint.changes, 100 * joint.driven_us / (seconds * 1e6), joint.position);
+  }
+}
+
+void writeHistogram(std::ostream& out, const char* name, const LatencyHistogram& h)
+{
+  out << name << ",count," << h.count() << "\n";
+  out << name << ",mean_us," << h.mean() << "\n";
+  out << name << ",p50_us," << h.percentile(50) << "\n";
+  out << name << ",p99_us," << h.percentile(99) << "\n";
+  out << name << ",max_us," << h.max() << "\n";
+}
+
+void writeCsv(std::ostream& out, double seconds, unsigned long loops, const LatencyHistogram& loop_us)
+{
+  out << "section,statistic,value\n";
+  out << "all,sketch," << sketchName() << "\n";
+  out << "all,board_seconds," << seconds << "\n";
+  out << "all,loops," << loops << "\n";
+  out << "all,commands_sent," << firmware_sim.commandsSent() << "\n";
+  out << "all,commands_applied," << firmware_sim.commandsApplied() << "\n";
+  out << "all,bytes_dropped," << firmware_sim.bytesDropped() << "\n";
+  out << "all,bytes_sent," << firmware_sim.bytesSent() << "\n";
+  out << "all,joint_state_frames," << firmware_sim.outputFrames() << "\n";
+  writeHistogram(out, "loop", loop_us);
+  writeHistogram(out, "command_to_motor", firmware_sim.commandLatency());
+  writeHistogram(out, "joint_state_interval", firmware_sim.outputInterval());
+  for (int cost = 0; cost < SIM_COST_COUNT; ++cost)
+  {
+    const SimCostStats& stats = firmware_sim.costStats(cost);
+    out << simCostName(cost) << ",total_us," << stats.total_us << "\n";
+    out << simCostName(cost) << ",calls," << stats.calls << "\n";
+    out << simCostName(cost) << ",max_us," << stats.max_us << "\n";
+  }
+  for (const SimJoint& joint : firmware_sim.joints())
+  {
+    out << joint.name << ",updates," << joint.updates << "\n";
+    out << joint.name << ",speed_changes," << joint.changes << "\n";
+    out << joint.name << ",driven_fraction," << joint.driven_us / (seconds * 1e6) << "\n";
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  const char* commands_path = NULL;
+  std::string keys = RASM_SIM_DEFAULT_KEYS;
+  double command_hz = 30;
+  double step_degrees = 0;
+  bool trajectory_mode = false;
+  const char* trajectory_path = NULL;
+  double max_error = 0;
+  double latency_ms = 80;
+  double seconds = 0;
+  std::string format = "text";
+  const char* output_path = NULL;
+  for (int i = 1; i < argc; ++i)
+  {
+    if (std::strncmp(argv[i], "--commands=", 11) == 0)
+    {
+      commands_path = argv[i] + 11;
+    }
+    else if (std::strncmp(argv[i], "--keys=", 7) == 0)
+    {
+      keys = argv[i] + 7;
+    }
+    else if (std::strncmp(argv[i], "--step=", 7) == 0)
+    {
+      step_degrees = std::atof(argv[i] + 7);
+      keys.clear();
+    }
+    else if (std::strcmp(argv[i], "--trajectory") == 0 || std::strncmp(argv[i], "--trajectory=", 13) == 0)
+    {
+      trajectory_mode = true;
+      trajectory_path = argv[i][12] == '=' ? argv[i] + 13 : NULL;
+      keys.clear();
+    }
+    else if (std::strncmp(argv[i], "--max-error=", 12) == 0)
+    {
+      max_error = std::atof(argv[i] + 12);
+    }
+    else if (std::strncmp(argv[i], "--latency-ms=", 13) == 0)
+    {
+      latency_ms = std::atof(argv[i] + 13);
+    }
+    else if (std::strncmp(argv[i], "--command-hz=", 13) == 0)
+    {
+      command_hz = std::atof(argv[i] + 13);
+    }
+    else if (std::strncmp(argv[i], "--seconds=", 10) == 0)
+    {
+      seconds = std::atof(argv[i] + 10);
+    }
+    else if (std::strncmp(argv[i], "--noise=", 8) == 0)
+    {
+      firmware_sim.noise_steps = std::atof(argv[i] + 8);
+    }
+    else if (std::strncmp(argv[i], "--cpu-scale=", 12) == 0)
+    {
+      firmware_sim.cpu_scale = std::atof(argv[i] + 12);
+    }
+    else if (std::strncmp(argv[i], "--seed=", 7) == 0)
+    {
+      firmware_sim.seed((uint32_t)std::strtoul(argv[i] + 7, NULL, 10));
+    }
+    else if (std::strncmp(argv[i], "--format=", 9) == 0)
+    {
+      format = argv[i] + 9;
+    }
+    else if (std::strncmp(argv[i], "--output=", 9) == 0)
+    {
+      output_path = argv[i] + 9;
+    }
+    else
+    {
+      std::cout << "usage: " << argv[0] << " [--commands=FILE | --keys=KEYS | --step=DEG | --trajectory[=FILE]]"
+                << " [--command-hz=HZ] [--latency-ms=MS] [--seconds=S] [--max-error=DEG] [--noise=STEPS]"
+                << " [--cpu-scale=N] [--seed=N] [--format=text|csv] [--output=FILE]" << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  if (command_hz <= 0)
+  {
+    std::cout << "--command-hz must be above 0" << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::vector<RecordedCommand> recorded;
+  if (commands_path && !readCommands(commands_path, recorded))
+  {
+    return EXIT_FAILURE;
+  }
+
+  setup();
+
+  // Queue the whole command stream up front; Serial hands the bytes to the sketch as they
+  // arrive. setup() has set the baud rate they arrive at.
+  const double start_us = firmware_sim.now();
+  const double period_us = 1e6 / command_hz;
+  if (!recorded.empty())
+  {
+    const unsigned long first = recorded.front().frame;
+    for (std::size_t i = 0; i < recorded.size(); ++i)
+    {
+      sendMotion(start_us + (recorded[i].frame - first) * period_us, (uint8_t)i, recorded[i].setpoints);
+    }
+    if (seconds <= 0)
+    {
+      seconds = (recorded.back().frame - first + 1) * period_us / 1e6;
+    }
+  }
+#ifdef RASM_SIM_TRAJECTORY
+  TrajectoryRun trajectory_run(start_us);
+  if (trajectory_mode)
+  {
+    if (trajectory_path)
+    {
+      if (!readTrajectory(trajectory_path, trajectory_run.waypoints()))
+      {
+        return EXIT_FAILURE;
+      }
+    }
+    else
+    {
+      trajectory_run.makeSearchPattern();
+    }
+    if (trajectory_run.waypoints().empty())
+    {
+      std::cout << "No waypoints in " << trajectory_path << std::endl;
+      return EXIT_FAILURE;
+    }
+    if (seconds <= 0)
+    {
+      // Time to settle after the end.
+      seconds = trajectory_run.plannedSeconds() + 1.5;
+    }
+  }
+#else
+  if (trajectory_mode)
+  {
+    std::cout << sketchName() << " does not play trajectories" << std::endl;
+    return EXIT_FAILURE;
+  }
+  (void)trajectory_path;
+  (void)max_error;
+#endif
+  if (seconds <= 0)
+  {
+    seconds = step_degrees != 0 ? 3 : 10;
+  }
+  if (recorded.empty() && !keys.empty())
+  {
+    const unsigned long count = (unsigned long)(seconds * command_hz);
+    for (unsigned long i = 0; i < count; ++i)
+    {
+      const uint8_t key = (uint8_t)keys[i % keys.size()];
+      firmware_sim.sendCommand(start_us + i * period_us, &key, 1);
+    }
+  }
+  const bool following = recorded.empty() && keys.empty() && !trajectory_mode;
+  FaceFollower follower(step_degrees, period_us, latency_ms * 1000, start_us);
+
+  LatencyHistogram loop_us;
+  unsigned long loops = 0;
+  const double end_us = start_us + seconds * 1e6;
+  while (firmware_sim.now() < end_us)
+  {
+    const double loop_start = firmware_sim.now();
+    const host_clock::time_point host_start = host_clock::now();
+    loop();
+    if (firmware_sim.cpu_scale > 0)
+    {
+      const double host_us = std::chrono::duration<double, std::micro>(host_clock::now() - host_start).count();
+      firmware_sim.charge(SIM_COST_SKETCH, host_us * firmware_sim.cpu_scale);
+    }
+    firmware_sim.charge(SIM_COST_CALLS, SIM_LOOP_US);
+    loop_us.record(firmware_sim.now() - loop_start);
+    ++loops;
+    if (following)
+    {
+      follower.update();
+    }
+#ifdef RASM_SIM_TRAJECTORY
+    else if (trajectory_mode)
+    {
+      trajectory_run.update();
+    }
+#endif
+  }
+  firmware_sim.moveArm();
+
+  const double board_seconds = (firmware_sim.now() - start_us) / 1e6;
+  if (format == "csv")
+  {
+    std::ofstream file;
+    if (output_path)
+    {
+      file.open(output_path);
+      if (!file)
+      {
+        std::cout << "Unable to write " << output_path << std::endl;
+        return EXIT_FAILURE;
+      }
+    }
+    writeCsv(output_path ? file : std::cout, board_seconds, loops, loop_us);
+    if (following)
+    {
+      follower.writeCsv(output_path ? file : std::cout);
+    }
+#ifdef RASM_SIM_TRAJECTORY
+    if (trajectory_mode)
+    {
+      trajectory_run.writeCsv(output_path ? file : std::cout);
+    }
+#endif
+  }
+  else
+  {
+    writeText(board_seconds, loops, loop_us);
+    if (following)
+    {
+      follower.writeText();
+    }
+#ifdef RASM_SIM_TRAJECTORY
+    if (trajectory_mode)
+    {
+      trajectory_run.writeText();
+    }
+  }
+  if (trajectory_mode && (!trajectory_run.finished() || (max_error > 0 && trajectory_run.maxError() > max_error)))
+  {
+    return 1;
+  }
+#else
+  }
+#endif
+  return 0;
+}
@@ -0,0 +1,430 @@
+#pragma once
+
+// The simulated board behind the mock Arduino core in this directory (Arduino.h and
+// DualMC33926MotorShield.h): its clock, the serial link to the computer, and the arm that the
+// motor shields drive and the encoders read. firmware_sim.cpp runs a sketch on it.
+//
+// Time on the board only moves when the sketch does something that takes time on the real
+// one. Every Arduino call is charged roughly what it costs on the ATmega2560 at 16 MHz:
+// analogRead() waits 112 us for its conversion, delay() what it asks for, a Serial.write()
+// into a full transmit buffer until the UART has made room, and so on. The sketch's own
+// computation is left out unless cpu_scale is set, so two runs with the same input take
+// exactly the same board time on any computer.
+//
+// The arm is deliberately simple: each motor turns its joint at a speed proportional to the
+// command, above a stall speed, with a first-order lag. It is there to give the encoders
+// something plausible to read, not to match the real arm.
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <random>
+#include <vector>
+#include "rasm_protocol.h"
+#include "stage_timing.h"
+
+// Rough costs on the board, in microseconds.
+#define SIM_CALL_US 1             // millis(), micros(), Serial.available(), Serial.read(), ...
+#define SIM_SERIAL_WRITE_US 2     // Serial.write() of one byte into the transmit buffer
+#define SIM_DIGITAL_WRITE_US 5    // digitalWrite(), pinMode()
+#define SIM_ANALOG_WRITE_US 8     // analogWrite()
+#define SIM_ANALOG_READ_US 112    // analogRead(): 13 ADC clocks at 125 kHz and the call around it
+#define SIM_LOOP_US 1             // main()'s own loop around loop()
+// HardwareSerial's 64-byte rings hold one byte less than their size.
+#define SIM_SERIAL_BUFFER 63
+#define SIM_MOTOR_MAX_SPEED 400
+
+// What board time went on.
+enum SimCost
+{
+  SIM_COST_CALLS,          // short Arduino calls
+  SIM_COST_ANALOG_READ,    // analogRead() waiting for its conversion
+  SIM_COST_DELAY,          // delay() and delayMicroseconds()
+  SIM_COST_SERIAL_WRITE,   // Serial.write()/print() waiting for room in the transmit buffer
+  SIM_COST_SERIAL_FLUSH,   // Serial.flush() waiting for the transmit buffer to empty
+  SIM_COST_SERIAL_READ,    // readStringUntil() and friends waiting for input or their timeout
+  SIM_COST_SKETCH,         // the sketch's own computation (only with cpu_scale)
+  SIM_COST_COUNT
+};
+
+inline const char* simCostName(int cost)
+{
+  switch (cost)
+  {
+    case SIM_COST_CALLS: return "calls";
+    case SIM_COST_ANALOG_READ: return "analog_read";
+    case SIM_COST_DELAY: return "delay";
+    case SIM_COST_SERIAL_WRITE: return "serial_write_wait";
+    case SIM_COST_SERIAL_FLUSH: return "serial_flush";
+    case SIM_COST_SERIAL_READ: return "serial_read_wait";
+    case SIM_COST_SKETCH: return "sketch";
+  }
+  return "unknown";
+}
+
+struct SimCostStats
+{
+  double total_us = 0;
+  unsigned long calls = 0;
+  double max_us = 0;     // longest single charge
+};
+
+// One motor and the joint it turns.
+struct SimJoint
+{
+  const char* name;
+  uint8_t pwm_pin;         // the shield's M1PWM or M2PWM pin, which tells the motors apart
+  int encoder_pin;         // analog pin of its encoder, -1 for none
+  double direction;        // +1 if a positive speed turns the encoder reading up
+  double full_speed;       // encoder steps per second at speed 400
+  double stall_speed;      // speeds below this do not move the joint
+  double time_constant;    // seconds
+  double position;         // encoder steps, 0 - 1024
+  double velocity;         // steps per second
+  int speed;               // last speed command, -400 .. 400
+
+  unsigned long updates;   // speed commands, changed or not
+  unsigned long changes;   // speed commands that changed the speed
+  double driven_us;        // board time spent at a non-zero speed
+  double changed_us;       // board time of the last change
+};
+
+class FirmwareSim
+{
+public:
+  double cpu_scale = 0;       // board time per microsecond the sketch takes on this computer
+  double noise_steps = 1.5;   // standard deviation of the encoder readings
+
+  FirmwareSim() : now_us(0), arm_us(0), byte_us(10e6 / 9600), next_input(0), bytes_dropped(0),
+                  tx_idle_us(0), bytes_sent(0), last_output_frame_us(-1), noise(0, 1)
+  {
+    //        name        pwm encoder dir  steps/s stall  tau   position
+    addJoint("roll",       9,  59,  1,   220,  25,   0.05, 735);
+    addJoint("base",       10, -1,  1,   300,  60,   0.10, 0);
+    addJoint("elbow",      44, 62,  1,   160,  60,   0.12, 650);
+    addJoint("shoulder",   45, 58,  1,   120,  60,   0.15, 300);
+    addJoint("pitch",      13, 60, -1,   180,  25,   0.05, 120);
+    addJoint("yaw",        46, 61,  1,   220,  25,   0.05, 1000);
+  }
+
+  void seed(uint32_t value) { random.seed(value); }
+
+  // Board time in microseconds since the sketch started.
+  double now() const { return now_us; }
+
+  // Moves board time on by us, spent on cost.
+  void charge(int cost, double us)
+  {
+    if (us <= 0)
+    {
+      return;
+    }
+    SimCostStats& stats = costs[cost];
+    stats.total_us += us;
+    ++stats.calls;
+    stats.max_us = us > stats.max_us ? us : stats.max_us;
+    now_us += us;
+  }
+
+  // Waits until board time until_us.
+  void waitUntil(int cost, double until_us) { charge(cost, until_us - now_us); }
+
+  const SimCostStats& costStats(int cost) const { return costs[cost]; }
+
+  // ---- The arm ----
+
+  std::vector<SimJoint>& joints() { return arm; }
+
+  // What the ADC reads on pin right now, without any board time passing: an encoder's reading
+  // with noise, or 0 for a pin with no encoder on it.
+  int analogSample(uint8_t pin)
+  {
+    moveArm();
+    for (std::size_t i = 0; i < arm.size(); ++i)
+    {
+      if (arm[i].encoder_pin == pin)
+      {
+        const double reading = std::floor(arm[i].position + noise_steps * noise(random));
+        return (int)(reading - 1024 * std::floor(reading / 1024));
+      }
+    }
+    return 0;
+  }
+
+  // A new speed command for the motor on pwm_pin. Also where commands count as applied.
+  void setMotorSpeed(uint8_t pwm_pin, int speed)
+  {
+    moveArm();
+    for (std::size_t i = 0; i < arm.size(); ++i)
+    {
+      SimJoint& joint = arm[i];
+      if (joint.pwm_pin != pwm_pin)
+      {
+        continue;
+      }
+      ++joint.updates;
+      if (speed != joint.speed)
+      {
+        ++joint.changes;
+        joint.changed_us = now_us;
+        joint.speed = speed;
+      }
+    }
+    for (std::size_t i = 0; i < consumed.size(); ++i)
+    {
+      command_latency.record(now_us - consumed[i]);
+    }
+    commands_applied += consumed.size();
+    consumed.clear();
+  }
+
+  // Speed of the motor on pwm_pin.
+  int motorSpeed(uint8_t pwm_pin) const
+  {
+    for (std::size_t i = 0; i < arm.size(); ++i)
+    {
+      if (arm[i].pwm_pin == pwm_pin)
+      {
+        return arm[i].speed;
+      }
+    }
+    return 0;
+  }
+
+  // Brings the arm up to the current board time.
+  void moveArm()
+  {
+    while (arm_us < now_us)
+    {
+      const double dt_us = now_us - arm_us < 1000 ? now_us - arm_us : 1000;
+      const double dt = dt_us / 1e6;
+      for (std::size_t i = 0; i < arm.size(); ++i)
+      {
+        SimJoint& joint = arm[i];
+        const double target = std::abs(joint.speed) < joint.stall_speed
+                                ? 0 : joint.direction * joint.full_speed * joint.speed / SIM_MOTOR_MAX_SPEED;
+        joint.velocity += (target - joint.velocity) * (1 - std::exp(-dt / joint.time_constant));
+        joint.position += joint.velocity * dt;
+        joint.position -= 1024 * std::floor(joint.position / 1024);
+        if (joint.speed != 0)
+        {
+          joint.driven_us += dt_us;
+        }
+      }
+      arm_us += dt_us;
+    }
+  }
+
+  // ---- The serial link ----
+
+  void serialBegin(unsigned long baud) { byte_us = 10e6 / baud; }
+
+  // Queues a command from the computer: its bytes go out back to back starting at board time
+  // at_us (or when the line is free), and arrive at the UART's speed. Its latency runs from its
+  // last byte arriving to the first motor update after the sketch has read that byte.
+  void sendCommand(double at_us, const uint8_t* bytes, std::size_t size)
+  {
+    double arrival = input.empty() || input.back().arrival_us < at_us ? at_us : input.back().arrival_us;
+    for (std::size_t i = 0; i < size; ++i)
+    {
+      arrival += byte_us;
+      InputByte byte;
+      byte.value = bytes[i];
+      byte.arrival_us = arrival;
+      byte.last = i + 1 == size;
+      input.push_back(byte);
+    }
+    ++commands_sent;
+    bytes_to_board += size;
+  }
+
+  int serialAvailable()
+  {
+    receive();
+    return (int)rx.size();
+  }
+
+  int serialPeek()
+  {
+    receive();
+    return rx.empty() ? -1 : input[rx.front()].value;
+  }
+
+  int serialRead()
+  {
+    receive();
+    if (rx.empty())
+    {
+      return -1;
+    }
+    const InputByte& byte = input[rx.front()];
+    rx.pop_front();
+    if (byte.last)
+    {
+      consumed.push_back(byte.arrival_us);
+    }
+    return byte.value;
+  }
+
+  // Serial.timedRead(): waits up to timeout_ms for a byte.
+  int serialTimedRead(unsigned long timeout_ms)
+  {
+    receive();
+    if (rx.empty())
+    {
+      const double deadline = now_us + timeout_ms * 1000.0;
+      const double next = next_input < input.size() ? input[next_input].arrival_us : deadline;
+      waitUntil(SIM_COST_SERIAL_READ, next < deadline ? next : deadline);
+    }
+    return serialRead();
+  }
+
+  int serialAvailableForWrite() const
+  {
+    return SIM_SERIAL_BUFFER - transmitQueued();
+  }
+
+  void serialWrite(uint8_t value)
+  {
+    if (transmitQueued() >= SIM_SERIAL_BUFFER)
+    {
+      // Wait for the UART to take one byte out of the full buffer.
+      waitUntil(SIM_COST_SERIAL_WRITE, tx_idle_us - (SIM_SERIAL_BUFFER - 1) * byte_us);
+    }
+    tx_idle_us = (tx_idle_us > now_us ? tx_idle_us : now_us) + byte_us;
+    ++bytes_sent;
+    if (!output.feed(value))
+    {
+      return;
+    }
+    if (output.type() == RASM_FRAME_JOINT_STATE)
+    {
+      ++joint_state_frames;
+      if (last_output_frame_us >= 0)
+      {
+        output_interval.record(tx_idle_us - last_output_frame_us);
+      }
+      last_output_frame_us = tx_idle_us;
+    }
+    else if (output.type() == RASM_FRAME_TRAJECTORY_STATUS)
+    {
+      TrajectoryStatus status;
+      output.decodeTrajectoryStatus(status.frame);
+      status.arrival_us = tx_idle_us;
+      trajectory_statuses.push_back(status);
+      ++trajectory_status_count;
+    }
+  }
+
+  // The next trajectory status frame the sketch sent that has reached the computer by now.
+  bool takeTrajectoryStatus(RasmTrajectoryStatusFrame& status)
+  {
+    if (trajectory_statuses.empty() || trajectory_statuses.front().arrival_us > now_us)
+    {
+      return false;
+    }
+    status = trajectory_statuses.front().frame;
+    trajectory_statuses.pop_front();
+    return true;
+  }
+
+  void serialFlush() { waitUntil(SIM_COST_SERIAL_FLUSH, tx_idle_us); }
+
+  unsigned long commandsSent() const { return commands_sent; }
+  unsigned long commandsApplied() const { return commands_applied; }
+  unsigned long bytesDropped() const { return bytes_dropped; }
+  unsigned long bytesSent() const { return bytes_sent; }
+  // Bytes the computer sent to the board.
+  unsigned long bytesToBoard() const { return bytes_to_board; }
+  unsigned long trajectoryStatusFrames() const { return trajectory_status_count; }
+  // Joint-state frames the sketch sent (decoded from its output).
+  unsigned long outputFrames() const { return joint_state_frames; }
+  const LatencyHistogram& commandLatency() const { return command_latency; }
+  const LatencyHistogram& outputInterval() const { return output_interval; }
+
+private:
+  struct TrajectoryStatus
+  {
+    RasmTrajectoryStatusFrame frame;
+    double arrival_us;   // when its last byte has gone out of the UART
+  };
+
+  struct InputByte
+  {
+    uint8_t value;
+    double arrival_us;
+    bool last;        // last byte of a command
+  };
+
+  void addJoint(const char* name, uint8_t pwm_pin, int encoder_pin, double direction, double full_speed,
+                double stall_speed, double time_constant, double position)
+  {
+    SimJoint joint;
+    std::memset(&joint, 0, sizeof(joint));
+    joint.name = name;
+    joint.pwm_pin = pwm_pin;
+    joint.encoder_pin = encoder_pin;
+    joint.direction = direction;
+    joint.full_speed = full_speed;
+    joint.stall_speed = stall_speed;
+    joint.time_constant = time_constant;
+    joint.position = position;
+    arm.push_back(joint);
+  }
+
+  // Moves whatever has arrived by now into the receive buffer. Bytes that arrive while it is
+  // full are lost, as on the board. Doing this only when the sketch looks is the same as doing
+  // it as bytes arrive, since nothing leaves the buffer in between.
+  void receive()
+  {
+    while (next_input < input.size() && input[next_input].arrival_us <= now_us)
+    {
+      if (rx.size() < SIM_SERIAL_BUFFER)
+      {
+        rx.push_back(next_input);
+      }
+      else
+      {
+        ++bytes_dropped;
+      }
+      ++next_input;
+    }
+  }
+
+  // Bytes still waiting in the transmit buffer.
+  int transmitQueued() const
+  {
+    return tx_idle_us > now_us ? (int)std::ceil((tx_idle_us - now_us) / byte_us - 1e-9) : 0;
+  }
+
+  double now_us;
+  double arm_us;
+  double byte_us;
+  SimCostStats costs[SIM_COST_COUNT];
+  std::vector<SimJoint> arm;
+
+  std::vector<InputByte> input;
+  std::size_t next_input;
+  std::deque<std::size_t> rx;
+  std::vector<double> consumed;   // arrival times of commands read but not yet applied
+  unsigned long bytes_dropped;
+  unsigned long commands_sent = 0;
+  unsigned long commands_applied = 0;
+  unsigned long bytes_to_board = 0;
+  LatencyHistogram command_latency;
+
+  double tx_idle_us;              // when the UART will have sent everything queued
+  unsigned long bytes_sent;
+  RasmParser output;
+  double last_output_frame_us;
+  LatencyHistogram output_interval;
+  unsigned long joint_state_frames = 0;
+  std::deque<TrajectoryStatus> trajectory_statuses;
+  unsigned long trajectory_status_count = 0;
+
+  std::mt19937 random;
+  std::normal_distribution<double> noise;
+};
+
+FirmwareSim firmware_sim;
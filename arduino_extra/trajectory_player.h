@@ -0,0 +1,231 @@
+#pragma once
+
+// Plays a trajectory from rasm_motion on the firmware. Link it into your Arduino libraries
+// folder next to common.h.
+//
+// The computer sends the trajectory's waypoints in trajectory frames (rasm_protocol.h), a few
+// at a time, and keeps up to RASM_TRAJECTORY_BUFFER of them ahead of where the arm is. Every
+// control period advance() moves the trajectory clock on and sample() gives each joint's angle
+// and velocity between the two waypoints around it, from the cubic that passes through both
+// with their velocities. The joint controllers follow that (JointController::follow()).
+//
+// If the arm gets to the last waypoint received before the rest of the trajectory has come in,
+// the trajectory clock stops there (STARVED) and starts again once more waypoints arrive, so a
+// slow link delays the trajectory instead of cutting its corners.
+//
+// Every change worth telling the computer about (a frame taken or thrown away, a waypoint
+// passed, the end) sets statusPending(); the sketch sends status() when its serial port has
+// room and calls statusSent().
+
+#include <Arduino.h>
+#include <rasm_protocol.h>
+
+class TrajectoryPlayer
+{
+public:
+  TrajectoryPlayer() : trajectory(0), joints(0), state(RASM_TRAJECTORY_IDLE), rejected(0), received(0), segment(0),
+                       end(0), ended(false), segment_start_ms(0), elapsed_us(0), status_pending(false),
+                       status_sequence(0) {}
+
+  // Takes the waypoints of a trajectory frame. A frame of a new trajectory replaces whatever
+  // was playing if it starts at the first waypoint; one that does not follow on from the
+  // waypoints already here is thrown away (the computer sends again from received()).
+  void accept(const RasmTrajectoryFrame& frame)
+  {
+    status_pending = true;
+    if (frame.flags & RASM_TRAJECTORY_STOP)
+    {
+      if (frame.trajectory == trajectory && active())
+      {
+        state = RASM_TRAJECTORY_STOPPED;
+      }
+      return;
+    }
+    if (frame.trajectory != trajectory || state == RASM_TRAJECTORY_IDLE)
+    {
+      if (frame.first != 0 || frame.count == 0)
+      {
+        ++rejected;
+        return;
+      }
+      trajectory = frame.trajectory;
+      joints = frame.joints;
+      state = RASM_TRAJECTORY_RUNNING;
+      received = 0;
+      segment = 1;
+      ended = false;
+      segment_start_ms = 0;
+      elapsed_us = 0;
+    }
+    if (!active() || ended)
+    {
+      return;   // a copy sent again of a frame already here
+    }
+    if (frame.first > received)
+    {
+      ++rejected;
+      return;
+    }
+    for (uint8_t i = 0; i < frame.count; ++i)
+    {
+      const uint16_t index = frame.first + i;
+      if (index < received)
+      {
+        continue;
+      }
+      if (free() == 0)
+      {
+        ++rejected;   // the computer never sends more than free() allows, so something is off
+        return;
+      }
+      buffer[index % RASM_TRAJECTORY_BUFFER] = frame.points[i];
+      ++received;
+    }
+    if (frame.flags & RASM_TRAJECTORY_END)
+    {
+      ended = true;
+      end = received - 1;
+    }
+  }
+
+  // Moves the trajectory clock on by dt_us.
+  void advance(unsigned long dt_us)
+  {
+    if (!active())
+    {
+      return;
+    }
+    if (ended && segment > end)
+    {
+      finish();
+      return;
+    }
+    if (segment >= received)
+    {
+      if (state != RASM_TRAJECTORY_STARVED)
+      {
+        state = RASM_TRAJECTORY_STARVED;
+        status_pending = true;
+      }
+      return;
+    }
+    state = RASM_TRAJECTORY_RUNNING;
+    elapsed_us += dt_us;
+    while (segment < received && elapsed_us >= duration_us(segment))
+    {
+      elapsed_us -= duration_us(segment);
+      segment_start_ms += buffer[segment % RASM_TRAJECTORY_BUFFER].duration_ms;
+      ++segment;
+      status_pending = true;
+    }
+    if (ended && segment > end)
+    {
+      finish();
+    }
+    else if (segment >= received)
+    {
+      // Hold at the last waypoint there is; the rest of this period is lost.
+      elapsed_us = 0;
+      state = RASM_TRAJECTORY_STARVED;
+      status_pending = true;
+    }
+  }
+
+  // Stops trajectory id where it is, if it is the one playing, as a stop frame from the
+  // computer would.
+  void stop(uint8_t id)
+  {
+    if (id == trajectory && active())
+    {
+      state = RASM_TRAJECTORY_STOPPED;
+      status_pending = true;
+    }
+  }
+
+  // A trajectory is running or waiting for its next waypoints.
+  bool active() const { return state == RASM_TRAJECTORY_RUNNING || state == RASM_TRAJECTORY_STARVED; }
+  uint8_t currentState() const { return state; }
+  bool moves(uint8_t joint) const { return (joints >> joint) & 1; }
+
+  // Where joint (RASM_JOINT_*) should be now, in degrees and degrees per second. Only once a
+  // trajectory has started; after it has ended or stopped, the last waypoint it passed.
+  void sample(uint8_t joint, double& angle, double& velocity) const
+  {
+    const RasmTrajectoryPoint& from = buffer[(segment - 1) % RASM_TRAJECTORY_BUFFER];
+    if (state != RASM_TRAJECTORY_RUNNING || segment >= received)
+    {
+      // Holding at the waypoint it got to.
+      angle = rasmJointDegrees(from.angles[joint]);
+      velocity = 0;
+      return;
+    }
+    const RasmTrajectoryPoint& to = buffer[segment % RASM_TRAJECTORY_BUFFER];
+    const double t = duration_us(segment) / 1e6;
+    const double s = elapsed_us / (double)duration_us(segment);
+    const double p0 = rasmJointDegrees(from.angles[joint]);
+    const double v0 = rasmJointDegrees(from.velocities[joint]);
+    const double p1 = rasmJointDegrees(to.angles[joint]);
+    const double v1 = rasmJointDegrees(to.velocities[joint]);
+    // Cubic Hermite between the two waypoints.
+    const double s2 = s * s;
+    const double s3 = s2 * s;
+    angle = (2 * s3 - 3 * s2 + 1) * p0 + (s3 - 2 * s2 + s) * t * v0 + (3 * s2 - 2 * s3) * p1 + (s3 - s2) * t * v1;
+    velocity = (6 * s2 - 6 * s) / t * p0 + (3 * s2 - 4 * s + 1) * v0 + (6 * s - 6 * s2) / t * p1 + (3 * s2 - 2 * s) * v1;
+  }
+
+  // Waypoints the buffer can still take: it keeps the one the arm is leaving and everything
+  // after it.
+  uint8_t free() const
+  {
+    const uint16_t kept = received - (segment > 0 ? segment - 1 : 0);
+    return kept >= RASM_TRAJECTORY_BUFFER ? 0 : (uint8_t)(RASM_TRAJECTORY_BUFFER - kept);
+  }
+
+  bool statusPending() const { return status_pending; }
+
+  void status(RasmTrajectoryStatusFrame& frame) const
+  {
+    frame.sequence = status_sequence;
+    frame.trajectory = trajectory;
+    frame.state = state;
+    frame.free = active() ? free() : 0;
+    frame.rejected = rejected;
+    frame.received = received;
+    frame.segment = segment;
+    frame.time_ms = segment_start_ms + elapsed_us / 1000;
+  }
+
+  void statusSent()
+  {
+    status_pending = false;
+    ++status_sequence;
+  }
+
+private:
+  unsigned long duration_us(uint16_t index) const
+  {
+    return buffer[index % RASM_TRAJECTORY_BUFFER].duration_ms * 1000UL;
+  }
+
+  void finish()
+  {
+    segment = end + 1;
+    elapsed_us = 0;
+    state = RASM_TRAJECTORY_DONE;
+    status_pending = true;
+  }
+
+  RasmTrajectoryPoint buffer[RASM_TRAJECTORY_BUFFER];   // waypoint i at i % RASM_TRAJECTORY_BUFFER
+  uint8_t trajectory;
+  uint8_t joints;
+  uint8_t state;
+  uint8_t rejected;
+  uint16_t received;
+  uint16_t segment;           // waypoint the arm is moving towards; it left segment - 1
+  uint16_t end;               // index of the last waypoint, once ended
+  bool ended;
+  uint32_t segment_start_ms;  // trajectory time at waypoint segment - 1
+  unsigned long elapsed_us;   // since waypoint segment - 1
+  bool status_pending;
+  uint8_t status_sequence;
+};
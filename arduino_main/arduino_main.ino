@@ -1,226 +1,295 @@
 #include "DualMC33926MotorShield.h"
+#include <encoder_sampler.h>
+#include <joint_angles.h>
+#include <joint_controller.h>
+#include <rasm_protocol.h>
+#include <trajectory_player.h>
 
-#define setRollSpeed(speed) md.setM1Speed(speed)
-#define setBaseSpeed(speed) md.setM2Speed(speed)
-#define setElbowSpeed(speed) md2.setM1Speed(speed)
-#define setShoulderSpeed(speed) md2.setM2Speed(speed)
-#define setPitchSpeed(speed) md3.setM1Speed(speed)
-#define setYawSpeed(speed) md3.setM2Speed(speed)
 #define SerialSend(message) do{Serial.println(message);Serial.flush();}while(0)  //swallow the semi-colon
 
+// Control periods per second. Every period each joint's controller takes the newest encoder
+// angles and sets its motor; the encoders are refreshed about every 3.5 ms. A motion frame
+// starts a period as soon as it is read instead of waiting up to 10 ms for the next one.
+#define CONTROL_RATE_HZ 100
+// From main-code grabbing a camera frame to its motion frame arriving here. Angle setpoints
+// are offsets on that frame, so they are taken from where the joints were back then.
+#define VISION_LATENCY_MS 80
+
 DualMC33926MotorShield md;
 DualMC33926MotorShield md2(41, 44, A2, 42, 45, A3, 40, 43); //M1DIR, M1PWM, M1FB, M2DIR, M2PWM, M2FB, nD2, nSF
 DualMC33926MotorShield md3(53, 13, A14, 52, 46, A15, 51, 50);
-String serial_input;
-const int width_angle = 4;
-int roll_speed = 0;
-int pitch_speed = 0;
-int yaw_speed = 0;
-int base_speed = 0;
-int y_speed = 0;
-int elbow_speed = 0;
-bool elbow_speed_not_necessarily_zero = true;
-unsigned long time_at_change_in_elbow_speed = millis();
-unsigned long time_since_change_elbow_speed = 0;
-unsigned long elbow_delay_millis = 75;
+RasmParser parser;
+RasmMotionFrame motion;
+RasmTrajectoryFrame trajectory_frame;
+TrajectoryPlayer trajectory;
+bool following_trajectory = false;   // the joints followed the trajectory last period
+bool motion_pending = false;         // a motion frame came in since the last period
+uint8_t status_frame[RASM_TRAJECTORY_STATUS_FRAME_SIZE];
 int roll_encoder_pin = A5;
 int elbow_encoder_pin = A8;
 int pitch_encoder_pin = A6;
 int yaw_encoder_pin = A7;
 int shoulder_encoder_pin = A4;
-double degrees_per_step = 360.0/1024.0; //see page 6 of RM22 rotary magnetic modular encoder data sheet
+// Order of the encoders in encoder_sampler's readings.
+enum { ROLL_ENCODER, ELBOW_ENCODER, PITCH_ENCODER, YAW_ENCODER, SHOULDER_ENCODER, ENCODER_COUNT };
+EncoderSnapshot encoders;
+
+// For a joint no motion frame axis drives.
+#define NO_AXIS 0xFF
 
+// A joint: where its motor is, which motion frame axis and which trajectory joint drive it,
+// and its controller settings.
+struct Joint
+{
+  DualMC33926MotorShield* shield;
+  uint8_t motor;            // 1 or 2
+  uint8_t axis;             // RASM_AXIS_*, or NO_AXIS
+  int8_t trajectory_joint;  // RASM_JOINT_*, or -1 for none
+  bool velocity_command;    // the axis gives a velocity instead of an angle to move by
+  double command_scale;     // degrees (or degrees per second) per unit of the axis setpoint
+  JointConfig config;
+};
+
+// The joint table. The limits are the encoder readings the old bang-bang code stopped at;
+// the yaw's range runs through the encoder's wrap point (readings 900 - 1023 - 100). Roll,
+// pitch and yaw setpoints are the face's angle times 2 (command_generator.h), so they move
+// their joint by half the setpoint; x is the face's offset in tenths of an inch and moves the
+// elbow 0.3 degrees for each (3 degrees to the inch, as the simulator has it), and y (no
+// encoder on the base) runs the base at full speed either way, as before. No motion frame
+// axis goes to the shoulder, so while following a face it holds where it is; trajectories
+// from rasm_motion move it. Its travel has not been measured yet (readings 150 - 350 are a
+// guess), so it is kept to the middle half of that, readings 200 - 300, at half the speed of
+// the other joints, and trajectories that leave those limits are refused (withinLimits()).
+// Widen them once the real stops have been read off the encoder.
+// The gains were tuned on the firmware simulator (arduino_extra/sim) for no more overshoot
+// than the bang-bang code had; check them on the arm.
+Joint joints[] =
+{
+  //                                                                       min angle                 max angle                 max vel  max acc  kp   ki   kd   kv   min  max  dir tolerance
+  {&md,  1, RASM_AXIS_ROLL,  RASM_JOINT_ROLL,     false, 0.5,  {"roll",     ROLL_ENCODER,     rollAngleFromSteps,     rollAngleFromSteps(650),  rollAngleFromSteps(820),  30,  150, 10, 5,  1.0, 5.0, 30, 200, 1,  0.8}},
+  {&md2, 1, RASM_AXIS_X,     RASM_JOINT_ELBOW,    false, 0.3,  {"elbow",    ELBOW_ENCODER,    elbowAngleFromSteps,    elbowAngleFromSteps(400), elbowAngleFromSteps(910), 30,  300, 10, 0,  6.0, 6.0, 64, 250, 1,  0.8}},
+  {&md3, 1, RASM_AXIS_PITCH, RASM_JOINT_PITCH,    false, -0.5, {"pitch",    PITCH_ENCODER,    pitchAngleFromSteps,    pitchAngleFromSteps(90),  pitchAngleFromSteps(150), 30,  100, 35, 0,  2.5, 6.0, 50, 250, -1, 0.8}},
+  {&md3, 2, RASM_AXIS_YAW,   RASM_JOINT_YAW,      false, 0.5,  {"yaw",      YAW_ENCODER,      yawAngleFromSteps,      yawAngleFromSteps(900) - 360, yawAngleFromSteps(100), 30, 200, 20, 0,  2.5, 5.0, 50, 200, 1, 0.8}},
+  {&md2, 2, NO_AXIS,         RASM_JOINT_SHOULDER, false, 0,    {"shoulder", SHOULDER_ENCODER, shoulderAngleFromSteps, shoulderAngleFromSteps(300), shoulderAngleFromSteps(200), 15, 100, 35, 0,  2.5, 8.0, 70, 300, -1, 0.8}},
+  {&md,  2, RASM_AXIS_Y,     -1,                  true,  -400, {"base",     -1,               0,                      -1e9,                     1e9,                      400, 4000, 0, 0,  0,   1,   0,  400, 1,  0}},
+};
+const uint8_t joint_count = sizeof(joints) / sizeof(joints[0]);
+const uint8_t base_joint = joint_count - 1;
+JointController controllers[joint_count];
+
+const unsigned long control_period_us = 1000000UL / CONTROL_RATE_HZ;
+unsigned long next_control_us;
+unsigned long last_control_us;
 
 
 void setup()
 {
-  Serial.begin(9600);
+  Serial.begin(RASM_SERIAL_BAUD);
   md.init();
   md2.init();
   md3.init();
+  // The ADC interrupt samples the encoders from here on; loop() never waits for it.
+  const uint8_t encoder_pins[ENCODER_COUNT] = {(uint8_t)roll_encoder_pin, (uint8_t)elbow_encoder_pin,
+                                               (uint8_t)pitch_encoder_pin, (uint8_t)yaw_encoder_pin,
+                                               (uint8_t)shoulder_encoder_pin};
+  encoder_sampler.begin(encoder_pins, ENCODER_COUNT);
+  next_control_us = last_control_us = micros();
 }
 
-void loop()
+// A joint a running trajectory moves, which motion frames leave alone meanwhile.
+bool onTrajectory(const Joint& joint)
 {
-  char leading_char = Serial.read();
-//  while (leading_char != '^' && leading_char != '#' && leading_char != '$' && leading_char != '&' && leading_char != '*')
-//  {
-//    leading_char = Serial.read();
-//  }
-  ///////////// Roll ////////////////////////////
-  if (leading_char == '#')
-  {
-    //Note that this will require a null terminated string!!!!!
-    serial_input = Serial.readStringUntil('\0');
-    roll_speed = serial_input.toInt();
-  }
-  int roll_encoder_reading = analogRead(roll_encoder_pin);
-  if (abs(roll_speed) > 60)
+  return trajectory.active() && joint.trajectory_joint >= 0 && trajectory.moves(joint.trajectory_joint);
+}
+
+// A motion frame gives each joint a new target.
+void applyMotion(const RasmMotionFrame& frame)
+{
+  for (uint8_t i = 0; i < joint_count; ++i)
   {
-    if (roll_speed > 0) {
-      roll_speed = 50;
-    }
-    else if (roll_speed < 0)
+    Joint& joint = joints[i];
+    JointController& controller = controllers[i];
+    if (joint.axis == NO_AXIS || onTrajectory(joint))
     {
-      roll_speed = -50;
+      continue;
     }
-  }
-  else if (abs(roll_speed) < 30)
-  {
-    if (roll_speed > 0) {
-      roll_speed = 30;
-    }
-    else if (roll_speed < 0)
+    int setpoint = frame.setpoints[joint.axis];
+    if (i == base_joint && frame.setpoints[RASM_AXIS_PITCH] != 0)
     {
-      roll_speed = -30;
+      // Pitching runs the base along with it, as the bang-bang code did.
+      setpoint = frame.setpoints[RASM_AXIS_PITCH];
     }
-  }
-  if (roll_encoder_reading > 820 && roll_speed > 0)
-  {
-    roll_speed = 0;
-  }
-  else if (roll_encoder_reading < 650 && roll_speed < 0)
-  {
-    roll_speed = 0;
-  }
-
-  //////////// Base //////////////////////////////////
-  if (leading_char == '$')
-  {
-    //Note that this will require a null terminated string!!!!!
-    serial_input = Serial.readStringUntil('\0');
-    y_speed = serial_input.toInt();
-  }
-  if (y_speed > 0)
-  {
-    base_speed = -400;
-  }
-  else if (y_speed < 0) {
-    base_speed = 400;
-  }
-  else if (y_speed == 0)
-  {
-    base_speed = 0;
-  }
-
-  ////////// Elbow //////////////////////////////////////
-  if (leading_char == '^')
-  {
-    //Note that this will require a null terminated string!!!!!
-    serial_input = Serial.readStringUntil('\0');
-    elbow_speed = serial_input.toInt();
-  }
-    int elbow_encoder_reading = analogRead(elbow_encoder_pin);
-    if (elbow_speed > 5)
-    {
-      elbow_speed = 120;
-    }
-    else if (elbow_speed < -5)
+    if (!controller.running())
     {
-      elbow_speed = -90;
+      continue;
     }
-    else if (elbow_speed > 0)
+    if (setpoint == 0)
     {
-      elbow_speed = 90;
+      controller.hold();
     }
-    else if (elbow_speed < 0)
+    else if (joint.velocity_command)
     {
-      elbow_speed = -70;
+      controller.moveAt(setpoint * joint.command_scale);
     }
-    if (elbow_speed_not_necessarily_zero && time_since_change_elbow_speed < elbow_delay_millis)
+    else
     {
-      time_since_change_elbow_speed = millis() - time_at_change_in_elbow_speed;
+      controller.moveBy(setpoint * joint.command_scale, VISION_LATENCY_MS / 1000.0);
     }
-    else if (elbow_speed_not_necessarily_zero && time_since_change_elbow_speed >= elbow_delay_millis)
+  }
+}
+
+// Whether every waypoint of a trajectory frame keeps the joints it moves inside their limits.
+// The controllers would only clamp the rest, and a trajectory planned through a clamped stretch
+// is not the one the arm would follow, so it is not played at all.
+bool withinLimits(const RasmTrajectoryFrame& frame)
+{
+  for (uint8_t p = 0; p < frame.count; ++p)
+  {
+    for (uint8_t i = 0; i < joint_count; ++i)
     {
-      elbow_speed_not_necessarily_zero = false;
-      time_at_change_in_elbow_speed = millis();
-      time_since_change_elbow_speed = 0;
+      const Joint& joint = joints[i];
+      if (joint.trajectory_joint < 0 || !((frame.joints >> joint.trajectory_joint) & 1))
+      {
+        continue;
+      }
+      if (!controllers[i].withinLimits(rasmJointDegrees(frame.points[p].angles[joint.trajectory_joint])))
+      {
+        return false;
+      }
     }
-    else if (!elbow_speed_not_necessarily_zero && time_since_change_elbow_speed < elbow_delay_millis)
+  }
+  return true;
+}
+
+// One control period of the trajectory: the joints it moves follow it, and when it ends or is
+// stopped they stay where it left them.
+void playTrajectory(unsigned long dt_us)
+{
+  trajectory.advance(dt_us);
+  const bool was_following = following_trajectory;
+  following_trajectory = trajectory.active();
+  if (!was_following && !following_trajectory)
+  {
+    return;
+  }
+  for (uint8_t i = 0; i < joint_count; ++i)
+  {
+    Joint& joint = joints[i];
+    JointController& controller = controllers[i];
+    if (joint.trajectory_joint < 0 || !trajectory.moves(joint.trajectory_joint))
     {
-      elbow_speed = 0;
-      time_since_change_elbow_speed = millis() - time_at_change_in_elbow_speed;
+      continue;
     }
-    else if (!elbow_speed_not_necessarily_zero && time_since_change_elbow_speed >= elbow_delay_millis)
+    double angle, velocity;
+    trajectory.sample(joint.trajectory_joint, angle, velocity);
+    if (trajectory.active())
     {
-      elbow_speed_not_necessarily_zero = true;
-      time_at_change_in_elbow_speed = millis();
-      time_since_change_elbow_speed = 0;
+      controller.follow(angle, velocity);
     }
-    if (elbow_encoder_reading > 910 && elbow_speed > 0)
+    else if (trajectory.currentState() == RASM_TRAJECTORY_DONE)
     {
-      elbow_speed = 0;
+      controller.moveTo(angle);
     }
-    else if (elbow_encoder_reading < 400 && elbow_speed < 0)
+    else
     {
-      elbow_speed = 0;
+      controller.hold();
     }
-  
+  }
+}
 
-  /////// Pitch ////////////////////////////////////////
-  if (leading_char == '&')
+// Tells rasm_motion how far the trajectory has got, if there is news and the transmit buffer
+// has room for it; otherwise it goes next time.
+void sendTrajectoryStatus()
+{
+  if (!trajectory.statusPending() || Serial.availableForWrite() < RASM_TRAJECTORY_STATUS_FRAME_SIZE)
   {
-    //Note that this will require a null terminated string!!!!!
-    serial_input = Serial.readStringUntil('\0');
-    pitch_speed = serial_input.toInt();
-  }
-  int pitch_encoder_reading = analogRead(pitch_encoder_pin);
-  //  if (pitch_speed > 7)
-  //  {
-  //    setYawSpeed(70);
-  //  }
-  //  else if (pitch_speed < -7)
-  //  {
-  //    setYawSpeed(-70);
-  //  }
-  if (pitch_speed > 0) {
-    pitch_speed = 150;
-    base_speed = -400;
+    return;
   }
-  else if (pitch_speed < 0)
+  RasmTrajectoryStatusFrame status;
+  trajectory.status(status);
+  Serial.write(status_frame, rasmEncodeTrajectoryStatus(status, status_frame));
+  trajectory.statusSent();
+}
+
+void setMotorSpeed(const Joint& joint, int speed)
+{
+  if (joint.motor == 1)
   {
-    pitch_speed = -50;
-    base_speed = 400;
+    joint.shield->setM1Speed(speed);
   }
-  if (pitch_encoder_reading < 90 && pitch_speed > 0)
+  else
   {
-    pitch_speed = 0;
+    joint.shield->setM2Speed(speed);
   }
-  else if (pitch_encoder_reading > 150 && pitch_speed < 0)
+}
+
+void loop()
+{
+  // Take whatever bytes have already arrived (the Serial receive buffer is the ring buffer)
+  // and never wait for more, so a lost or corrupted byte can't hold up the motor updates
+  // below. Each good motion frame carries all five axes at once; trajectory frames carry the
+  // next few waypoints of a trajectory from rasm_motion.
+  while (Serial.available() > 0)
   {
-    pitch_speed = 0;
+    if (!parser.feed(Serial.read()))
+    {
+      continue;
+    }
+    if (parser.type() == RASM_FRAME_MOTION)
+    {
+      parser.decodeMotion(motion);
+      applyMotion(motion);
+      motion_pending = true;
+    }
+    else if (parser.type() == RASM_FRAME_TRAJECTORY)
+    {
+      parser.decodeTrajectory(trajectory_frame);
+      trajectory.accept(trajectory_frame);
+      if (!withinLimits(trajectory_frame))
+      {
+        trajectory.stop(trajectory_frame.trajectory);   // rasm_motion aborts the goal when it sees it stopped
+      }
+    }
   }
+  encoder_sampler.poll();
+  sendTrajectoryStatus();
 
-  /////// Yaw ////////////////////////////////////////
-  if (leading_char == '*')
+  const unsigned long now = micros();
+  const bool due = (long)(now - next_control_us) >= 0;
+  if (!due && !motion_pending)
   {
-    //Note that this will require a null terminated string!!!!!
-    serial_input = Serial.readStringUntil('\0');
-    yaw_speed = serial_input.toInt();
+    return;
   }
-  int yaw_encoder_reading = analogRead(yaw_encoder_pin);
-
-  if (yaw_speed > 0) {
-    yaw_speed = 50;
+  motion_pending = false;
+  next_control_us += control_period_us;
+  if (!due || (long)(now - next_control_us) >= 0)
+  {
+    // Brought forward by a motion frame, or fell a whole period behind: start the schedule
+    // over from now instead of catching up.
+    next_control_us = now + control_period_us;
   }
-  else if (yaw_speed < 0)
+  const unsigned long dt_us = now - last_control_us;
+  const double dt = dt_us / 1e6;
+  last_control_us = now;
+
+  encoder_sampler.snapshot(encoders);
+  if (encoders.cycles == 0)
   {
-    yaw_speed = -50;
+    return;   // no reading of every encoder yet
   }
-  if (yaw_encoder_reading > 100 && yaw_encoder_reading < 700 && yaw_speed > 0)
+  double angles[joint_count];
+  for (uint8_t i = 0; i < joint_count; ++i)
   {
-    yaw_speed = 0;
+    Joint& joint = joints[i];
+    angles[i] = joint.config.encoder < 0 ? 0 : joint.config.angle(encoders.steps(joint.config.encoder));
+    if (!controllers[i].running())
+    {
+      controllers[i].begin(joint.config, angles[i]);
+    }
   }
-  else if (yaw_encoder_reading < 900 && yaw_encoder_reading > 200 && yaw_speed < 0)
+  playTrajectory(dt_us);
+  for (uint8_t i = 0; i < joint_count; ++i)
   {
-    yaw_speed = 0;
+    setMotorSpeed(joints[i], controllers[i].update(angles[i], dt));
   }
-
-  ////// Set Motor Speeds ///////////////////////////////////////
-    setBaseSpeed(base_speed);
-    setRollSpeed(roll_speed);
-    setPitchSpeed(pitch_speed);
-    setYawSpeed(yaw_speed);
-    setElbowSpeed(elbow_speed);
 }
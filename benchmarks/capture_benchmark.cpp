@@ -0,0 +1,130 @@
+//Measures what getting a frame costs with each capture backend: time per read, frames per
+//second, CPU time, and how many frames came without a copy. Each run reads the frames twice,
+//once asking for BGR on every frame (what a full display or a DNN detector needs) and once
+//grayscale only (what main-code asks for with the HOG detector and the display off).
+//
+//Usage: capture-benchmark [--frames=N] [--hold=N] [main-code capture options]
+//For example
+//  capture-benchmark --capture=opencv --capture-device=1
+//  capture-benchmark --capture=v4l2 --capture-device=/dev/video1 --capture-size=640x480
+//  capture-benchmark --capture=file --capture-device=face.yuyv
+//--hold keeps the last N frames alive, the way frames in the stage queues are (default 3),
+//so buffers go back to the driver as late as they would in main-code.
+#include <chrono>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include "capture.h"
+#include "options.h"
+#include "stage_timing.h"
+
+struct CaptureRun
+{
+  LatencyHistogram read_us;
+  unsigned long frames = 0;
+  double seconds = 0;
+  double cpu_seconds = 0;
+  unsigned long zero_copy = 0;
+  unsigned long copied = 0;
+};
+
+double cpuSeconds()
+{
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+bool runCapture(const CaptureOptions& options, bool want_bgr, unsigned long max_frames, std::size_t hold, CaptureRun& run)
+{
+  std::unique_ptr<CaptureBackend> capture = createCaptureBackend(options);
+  if (!capture)
+  {
+    return false;
+  }
+  std::deque<CapturedImage> held;
+  CapturedImage image;
+  const pipeline_clock::time_point run_start = pipeline_clock::now();
+  const double cpu_start = cpuSeconds();
+  //A camera that times out once in a while is not the end of the run; one that keeps
+  //timing out is.
+  int misses = 0;
+  while (run.frames < max_frames && misses < 3)
+  {
+    const pipeline_clock::time_point start = pipeline_clock::now();
+    if (!capture->read(image, want_bgr))
+    {
+      if (capture->ended())
+      {
+        break;
+      }
+      ++misses;
+      continue;
+    }
+    run.read_us.record(elapsedMicroseconds(start));
+    ++run.frames;
+    held.push_back(image);
+    if (held.size() > hold)
+    {
+      held.pop_front();
+    }
+  }
+  run.seconds = std::chrono::duration<double>(pipeline_clock::now() - run_start).count();
+  run.cpu_seconds = cpuSeconds() - cpu_start;
+  run.zero_copy = capture->zeroCopyFrames();
+  run.copied = capture->copiedFrames();
+  return run.frames > 0;
+}
+
+void printRun(const char* label, const CaptureRun& run)
+{
+  std::cout << label << ": " << run.frames << " frames, " << run.frames / run.seconds << " fps, read mean "
+            << run.read_us.mean() << " us p50 " << run.read_us.percentile(50) << " p99 "
+            << run.read_us.percentile(99) << " max " << run.read_us.max() << " | cpu "
+            << 1e6 * run.cpu_seconds / run.frames << " us/frame (" << 100 * run.cpu_seconds / run.seconds
+            << "% of a core) | zero-copy " << run.zero_copy << " copied " << run.copied << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+  unsigned long max_frames = 300;
+  std::size_t hold = 3;
+  std::vector<char*> rest(1, argv[0]);
+  for (int i = 1; i < argc; ++i)
+  {
+    const char* value;
+    if ((value = optionValue(argv[i], "--frames")))
+    {
+      max_frames = std::strtoul(value, NULL, 10);
+    }
+    else if ((value = optionValue(argv[i], "--hold")))
+    {
+      hold = std::strtoul(value, NULL, 10);
+    }
+    else
+    {
+      rest.push_back(argv[i]);
+    }
+  }
+  RasmOptions options;
+  if (!parseOptions((int)rest.size(), rest.data(), options))
+  {
+    return EXIT_FAILURE;
+  }
+  std::cout << "capture: " << captureBackendName(options.capture.backend) << " " << options.capture.device << std::endl;
+
+  CaptureRun bgr;
+  CaptureRun gray;
+  if (!runCapture(options.capture, true, max_frames, hold, bgr) ||
+      !runCapture(options.capture, false, max_frames, hold, gray))
+  {
+    return EXIT_FAILURE;
+  }
+  printRun("bgr every frame", bgr);
+  printRun("gray only      ", gray);
+  return 0;
+}
@@ -0,0 +1,303 @@
+//Checks the face pose channel (face_pose_channel.h) between two processes, the way main-code
+//and rasm_motion use it. A writer process publishes poses whose every field follows from the
+//pose's number, so a reader can tell a torn copy (half one pose, half the next) from a whole
+//one.
+// 1. Latency: the writer publishes at --rate and the reader takes every pose in order with
+//    next(), spinning (or, with --poll-us, polling every N us the way a control loop would).
+//    Reports the time from the writer's timestamp to the reader having the copy.
+// 2. Stress: the writer publishes as fast as it can while --readers threads read (half with
+//    latest(), half with next()) as fast as they can, so most copies race the writer.
+//Exits with 1 if any reader saw a torn pose or poses out of order.
+//Usage: face-pose-channel-benchmark [--rate=HZ] [--seconds=S] [--poll-us=US] [--readers=N]
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "face_pose_channel.h"
+
+typedef std::chrono::steady_clock bench_clock;
+
+//Pose number k as the writer fills it in.
+void makePose(uint64_t k, SharedFacePose& pose)
+{
+  pose.frame_id = k;
+  pose.captured_ns = (int64_t)k * 7;
+  pose.x = (double)k;
+  pose.y = -(double)k;
+  pose.z = k * 0.5;
+  pose.roll = k + 0.25;
+  pose.pitch = k + 0.5;
+  pose.yaw = k + 0.75;
+  pose.confidence = (k % 100) / 100.0;
+}
+
+//A whole pose: every field from the same k, and k the pose's index.
+bool wholePose(const SharedFacePose& pose)
+{
+  SharedFacePose expected;
+  makePose(pose.frame_id, expected);
+  return pose.index == pose.frame_id && pose.captured_ns == expected.captured_ns && pose.x == expected.x &&
+         pose.y == expected.y && pose.z == expected.z && pose.roll == expected.roll &&
+         pose.pitch == expected.pitch && pose.yaw == expected.yaw && pose.confidence == expected.confidence;
+}
+
+//The writer process: waits for go, then writes poses at rate_hz (flat out for 0) for seconds.
+void runWriter(const char* name, int ready_pipe, int go_pipe, double rate_hz, double seconds)
+{
+  FacePoseWriter writer;
+  char byte = writer.open(name) ? 1 : 0;
+  if (write(ready_pipe, &byte, 1) != 1 || !byte || read(go_pipe, &byte, 1) != 1)
+  {
+    _exit(1);
+  }
+  const bench_clock::duration period =
+      std::chrono::duration_cast<bench_clock::duration>(std::chrono::duration<double>(rate_hz > 0 ? 1 / rate_hz : 0));
+  const bench_clock::time_point end =
+      bench_clock::now() + std::chrono::duration_cast<bench_clock::duration>(std::chrono::duration<double>(seconds));
+  bench_clock::time_point next = bench_clock::now();
+  SharedFacePose pose;
+  for (uint64_t k = 0; bench_clock::now() < end; ++k)
+  {
+    if (rate_hz > 0)
+    {
+      next += period;
+      std::this_thread::sleep_until(next);
+    }
+    makePose(k, pose);
+    writer.write(pose);
+  }
+  writer.close();
+  _exit(0);
+}
+
+struct Writer
+{
+  pid_t pid = -1;
+  int go = -1;
+};
+
+//Starts a writer process on name and waits until the channel is there.
+bool startWriter(const char* name, double rate_hz, double seconds, Writer& writer)
+{
+  int ready[2], go[2];
+  if (pipe(ready) != 0 || pipe(go) != 0)
+  {
+    std::perror("pipe");
+    return false;
+  }
+  writer.pid = fork();
+  if (writer.pid == 0)
+  {
+    close(ready[0]);
+    close(go[1]);
+    runWriter(name, ready[1], go[0], rate_hz, seconds);
+  }
+  close(ready[1]);
+  close(go[0]);
+  char byte = 0;
+  const bool ok = writer.pid > 0 && read(ready[0], &byte, 1) == 1 && byte == 1;
+  close(ready[0]);
+  writer.go = go[1];
+  return ok;
+}
+
+bool finishWriter(Writer& writer)
+{
+  int status = 0;
+  close(writer.go);
+  return waitpid(writer.pid, &status, 0) == writer.pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+void report(const char* name, std::vector<double>& values, const char* unit)
+{
+  if (values.empty())
+  {
+    std::printf("%-30s no samples\n", name);
+    return;
+  }
+  double total = 0;
+  for (double v : values)
+  {
+    total += v;
+  }
+  std::sort(values.begin(), values.end());
+  const std::size_t n = values.size();
+  std::printf("%-30s mean %9.2f %s  p50 %9.2f %s  p99 %9.2f %s  p99.9 %9.2f %s  max %9.2f %s\n", name, total / n,
+              unit, values[n / 2], unit, values[std::min(n - 1, n * 99 / 100)], unit,
+              values[std::min(n - 1, n * 999 / 1000)], unit, values.back(), unit);
+}
+
+struct ReaderResult
+{
+  unsigned long reads = 0;
+  unsigned long torn = 0;
+  unsigned long out_of_order = 0;
+  unsigned long retries = 0;
+  unsigned long lost = 0;
+};
+
+int main(int argc, char* argv[])
+{
+  double rate_hz = 1000;
+  double seconds = 2;
+  double poll_us = 0;
+  int readers = 2;
+  for (int i = 1; i < argc; ++i)
+  {
+    if (std::strncmp(argv[i], "--rate=", 7) == 0)
+    {
+      rate_hz = std::atof(argv[i] + 7);
+    }
+    else if (std::strncmp(argv[i], "--seconds=", 10) == 0)
+    {
+      seconds = std::atof(argv[i] + 10);
+    }
+    else if (std::strncmp(argv[i], "--poll-us=", 10) == 0)
+    {
+      poll_us = std::atof(argv[i] + 10);
+    }
+    else if (std::strncmp(argv[i], "--readers=", 10) == 0)
+    {
+      readers = std::max(1, std::atoi(argv[i] + 10));
+    }
+    else
+    {
+      std::printf("usage: %s [--rate=HZ] [--seconds=S] [--poll-us=US] [--readers=N]\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  const std::string name = "/rasm_face_pose_benchmark_" + std::to_string(getpid());
+  bool ok = true;
+
+  //1. Latency.
+  Writer writer;
+  FacePoseReader reader;
+  if (!startWriter(name.c_str(), rate_hz, seconds, writer) || !reader.open(name.c_str()))
+  {
+    std::printf("Unable to open the channel %s\n", name.c_str());
+    shm_unlink(name.c_str());
+    return EXIT_FAILURE;
+  }
+  std::vector<double> latency_us;
+  ReaderResult paced;
+  uint64_t expected = 0;
+  if (write(writer.go, "", 1) != 1)
+  {
+    return EXIT_FAILURE;
+  }
+  const bench_clock::time_point end = bench_clock::now() +
+      std::chrono::duration_cast<bench_clock::duration>(std::chrono::duration<double>(seconds + 0.1));
+  SharedFacePose pose;
+  while (bench_clock::now() < end)
+  {
+    if (!reader.next(pose))
+    {
+      if (poll_us > 0)
+      {
+        std::this_thread::sleep_for(std::chrono::duration<double, std::micro>(poll_us));
+      }
+      continue;
+    }
+    latency_us.push_back((facePoseClockNs() - pose.published_ns) / 1000.0);
+    ++paced.reads;
+    paced.torn += !wholePose(pose);
+    paced.out_of_order += pose.index < expected;
+    expected = pose.index + 1;
+  }
+  ok = finishWriter(writer) && ok;
+  paced.lost = reader.lost();
+  reader.close();
+  std::printf("latency: %lu poses of %zu bytes at %.0f Hz, reader %s\n", paced.reads, sizeof(SharedFacePose),
+              rate_hz, poll_us > 0 ? ("polling every " + std::to_string((int)poll_us) + " us").c_str() : "spinning");
+  report("  writer to reader", latency_us, "us");
+  std::printf("  lost %lu  retries %lu  torn %lu  out of order %lu\n", paced.lost, reader.retries(), paced.torn,
+              paced.out_of_order);
+
+  //2. Stress.
+  if (!startWriter(name.c_str(), 0, seconds, writer))
+  {
+    shm_unlink(name.c_str());
+    return EXIT_FAILURE;
+  }
+  std::vector<ReaderResult> results(readers);
+  std::atomic<bool> stop(false);
+  std::atomic<int> opened(0);
+  std::vector<std::thread> threads;
+  for (int r = 0; r < readers; ++r)
+  {
+    threads.emplace_back([&, r]()
+    {
+      FacePoseReader stress_reader;
+      const bool use_latest = r % 2 == 0;
+      ReaderResult& result = results[r];
+      if (!stress_reader.open(name.c_str()))
+      {
+        opened = -readers;
+        return;
+      }
+      ++opened;
+      SharedFacePose copy;
+      uint64_t last = 0;
+      bool any = false;
+      while (!stop.load(std::memory_order_relaxed))
+      {
+        if (!(use_latest ? stress_reader.latest(copy) : stress_reader.next(copy)))
+        {
+          continue;
+        }
+        ++result.reads;
+        result.torn += !wholePose(copy);
+        result.out_of_order += any && (use_latest ? copy.index < last : copy.index <= last);
+        last = copy.index;
+        any = true;
+      }
+      result.retries = stress_reader.retries();
+      result.lost = stress_reader.lost();
+    });
+  }
+  while (opened.load() >= 0 && opened.load() < readers)
+  {
+    std::this_thread::yield();
+  }
+  const bench_clock::time_point stress_start = bench_clock::now();
+  if (write(writer.go, "", 1) != 1)
+  {
+    return EXIT_FAILURE;
+  }
+  ok = finishWriter(writer) && ok;
+  const double stress_seconds = std::chrono::duration<double>(bench_clock::now() - stress_start).count();
+  stop = true;
+  for (std::thread& thread : threads)
+  {
+    thread.join();
+  }
+  FacePoseReader counter;
+  const unsigned long written = counter.open(name.c_str()) && counter.latest(pose) ? pose.index + 1 : 0;
+  counter.close();
+  shm_unlink(name.c_str());
+  std::printf("stress: writer flat out, %lu poses in %.2f s (%.1f M/s), %d readers\n", written, stress_seconds,
+              written / stress_seconds / 1e6, readers);
+  ReaderResult total;
+  for (int r = 0; r < readers; ++r)
+  {
+    const ReaderResult& result = results[r];
+    std::printf("  reader %d (%-6s) reads %10lu  retries %10lu  lost %10lu  torn %lu  out of order %lu\n", r,
+                r % 2 == 0 ? "latest" : "next", result.reads, result.retries, result.lost, result.torn,
+                result.out_of_order);
+    total.torn += result.torn;
+    total.out_of_order += result.out_of_order;
+  }
+
+  ok = ok && opened.load() == readers && paced.torn == 0 && paced.out_of_order == 0 && total.torn == 0 &&
+       total.out_of_order == 0;
+  std::printf("%s\n", ok ? "no torn or out-of-order poses" : "FAILED");
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,201 @@
+//How the HOG face detector scales over threads (parallel_hog_detector.h). Scans every
+//recorded frame with dlib's frontal_face_detector on one thread, then with
+//ParallelHogDetector on each of the thread counts asked for, and reports the time per frame,
+//the speedup over the sequential detector and the efficiency (speedup over threads).
+//
+//Every frame's faces from the parallel detector have to be the sequential detector's: the
+//same boxes from the same filters with the same confidences, in the same order. The
+//benchmark exits with 1 if any frame differs.
+//
+//Usage: hog-scaling-benchmark INPUT [--threads=N,N,...] [--max-frames=N] [--color]
+//                                   [--capture-size=WxH]
+//INPUT is a video file, a directory of images or a raw .yuyv recording, as for
+//vision-benchmark. Frames are scanned in grayscale, as main-code's HOG detector scans them,
+//or in BGR with --color. The thread counts default to 1, 2, 4, ... up to the cores there are.
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dlib/opencv.h>
+#include <opencv2/imgproc/imgproc.hpp>
+#include "capture.h"
+#include "detector_engine.h"
+#include "options.h"
+#include "parallel_hog_detector.h"
+#include "stage_timing.h"
+
+typedef std::vector<dlib::rect_detection> Detections;
+
+bool sameDetections(const Detections& a, const Detections& b)
+{
+  if (a.size() != b.size())
+  {
+    return false;
+  }
+  for (std::size_t i = 0; i < a.size(); ++i)
+  {
+    if (a[i].rect != b[i].rect || a[i].weight_index != b[i].weight_index ||
+        a[i].detection_confidence != b[i].detection_confidence)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+template <typename Detector>
+void scan(Detector& detector, const cv::Mat& image, Detections& dets)
+{
+  if (image.channels() == 1)
+  {
+    detector(dlib::cv_image<unsigned char>(image), dets);
+  }
+  else
+  {
+    detector(dlib::cv_image<dlib::bgr_pixel>(image), dets);
+  }
+}
+
+void report(const char* name, int threads, const LatencyHistogram& h, double sequential_mean, unsigned long differ)
+{
+  const double speedup = h.mean() > 0 ? sequential_mean / h.mean() : 0;
+  std::printf("%-10s %3d threads  mean %8.2f ms  p50 %8.2f ms  p99 %8.2f ms  speedup %5.2fx  efficiency %5.1f%%",
+              name, threads, h.mean() / 1000, h.percentile(50) / 1000, h.percentile(99) / 1000, speedup,
+              100 * speedup / threads);
+  if (differ != (unsigned long)-1)
+  {
+    std::printf("  frames differing %lu", differ);
+  }
+  std::printf("\n");
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc < 2)
+  {
+    std::cout << "usage: " << argv[0] << " INPUT [--threads=N,N,...] [--max-frames=N] [--color] [--capture-size=WxH]"
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+  CaptureOptions capture;
+  capture.backend = CAPTURE_FILE;
+  capture.device = argv[1];
+  unsigned long max_frames = 300;
+  bool color = false;
+  std::vector<int> thread_counts;
+  for (int i = 2; i < argc; ++i)
+  {
+    const char* value;
+    if ((value = optionValue(argv[i], "--threads")))
+    {
+      for (const char* p = value; *p; p = std::strchr(p, ',') ? std::strchr(p, ',') + 1 : p + std::strlen(p))
+      {
+        thread_counts.push_back(std::max(1, std::atoi(p)));
+      }
+    }
+    else if ((value = optionValue(argv[i], "--max-frames")))
+    {
+      max_frames = std::strtoul(value, NULL, 10);
+    }
+    else if (std::strcmp(argv[i], "--color") == 0)
+    {
+      color = true;
+    }
+    else if ((value = optionValue(argv[i], "--capture-size")))
+    {
+      if (!parseInputSize(value, capture.width, capture.height))
+      {
+        std::cout << "--capture-size must be WIDTHxHEIGHT, e.g. 640x480" << std::endl;
+        return EXIT_FAILURE;
+      }
+    }
+    else
+    {
+      std::cout << "Unknown option " << argv[i] << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  if (thread_counts.empty())
+  {
+    const int cores = std::max(1u, std::thread::hardware_concurrency());
+    for (int t = 1; t < cores; t *= 2)
+    {
+      thread_counts.push_back(t);
+    }
+    thread_counts.push_back(cores);
+  }
+
+  std::unique_ptr<CaptureBackend> source = createCaptureBackend(capture);
+  if (!source)
+  {
+    return EXIT_FAILURE;
+  }
+  std::vector<cv::Mat> frames;
+  CapturedImage image;
+  while (frames.size() < max_frames && source->read(image, color))
+  {
+    if (color)
+    {
+      frames.push_back(image.bgr.clone());
+    }
+    else if (!image.gray.empty())
+    {
+      frames.push_back(image.gray.clone());
+    }
+    else
+    {
+      cv::Mat gray;
+      cv::cvtColor(image.bgr, gray, cv::COLOR_BGR2GRAY);
+      frames.push_back(gray);
+    }
+  }
+  if (frames.empty())
+  {
+    std::cout << "No frames in " << argv[1] << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::printf("%zu %s frames of %dx%d, %u cores\n", frames.size(), color ? "BGR" : "grayscale", frames[0].cols,
+              frames[0].rows, std::thread::hardware_concurrency());
+
+  dlib::frontal_face_detector detector = dlib::get_frontal_face_detector();
+  std::vector<Detections> expected(frames.size());
+  LatencyHistogram sequential;
+  unsigned long faces = 0;
+  for (std::size_t f = 0; f < frames.size(); ++f)
+  {
+    const pipeline_clock::time_point start = pipeline_clock::now();
+    scan(detector, frames[f], expected[f]);
+    sequential.record(elapsedMicroseconds(start));
+    faces += expected[f].size();
+  }
+  std::printf("%lu faces\n", faces);
+  report("sequential", 1, sequential, sequential.mean(), (unsigned long)-1);
+
+  unsigned long total_differ = 0;
+  Detections dets;
+  for (int threads : thread_counts)
+  {
+    ParallelHogDetector parallel(detector, threads);
+    //The first frame sizes the pyramid and band buffers; it is not timed.
+    scan(parallel, frames[0], dets);
+    LatencyHistogram timing;
+    unsigned long differ = 0;
+    for (std::size_t f = 0; f < frames.size(); ++f)
+    {
+      const pipeline_clock::time_point start = pipeline_clock::now();
+      scan(parallel, frames[f], dets);
+      timing.record(elapsedMicroseconds(start));
+      differ += !sameDetections(dets, expected[f]);
+    }
+    report("parallel", threads, timing, sequential.mean(), differ);
+    total_differ += differ;
+  }
+
+  std::printf("%s\n", total_differ == 0 ? "every frame matches the sequential detector" : "FAILED");
+  return total_differ == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
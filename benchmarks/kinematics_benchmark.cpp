@@ -0,0 +1,119 @@
+//Checks arduino_extra/arm_kinematics.h against the expressions MATLAB expanded from
+//motion-planning/linearTransformationDHParameters.m (the ones cameraPosition.ino used to paste)
+//and measures how many camera positions per second each version computes on this computer.
+//Exits with 1 if a version is further from MATLAB than its precision allows.
+//Usage: kinematics-benchmark [CONFIGURATIONS]
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include "arduino_extra/arm_kinematics.h"
+
+typedef std::chrono::steady_clock bench_clock;
+
+//Camera (Tobii screen) position for joint angles th1 .. th5, as printed by the .m file.
+template <typename Real>
+void matlabCameraPosition(const Real* th, Real out[3])
+{
+  const Real th1 = th[0], th2 = th[1], th3 = th[2], th4 = th[3], th5 = th[4];
+  out[0] = (79 * cos(th1 + th2)) / 4 + 16 * cos(th1) - (3 * sin(th1 + th2) * sin(th3)) / 2 + (cos(th4 + th5) * ((13 * sin(th1 + th2) * sin(th3)) / 2 - (13 * cos(th1 + th2) * cos(th3)) / 2)) / 2 + (sin(th4 + th5) * ((sin(th1 + th2) * sin(th3)) / 2 - (cos(th1 + th2) * cos(th3)) / 2)) / 2 - cos(th4) * (sin(th1 + th2) * sin(th3) - cos(th1 + th2) * cos(th3)) + cos(th5) * ((cos(th1 + th2) * sin(th3)) / 2 + (sin(th1 + th2) * cos(th3)) / 2) - sin(th4) * ((9 * sin(th1 + th2) * sin(th3)) / 2 - (9 * cos(th1 + th2) * cos(th3)) / 2) - sin(th5) * ((13 * cos(th1 + th2) * sin(th3)) / 2 + (13 * sin(th1 + th2) * cos(th3)) / 2) + (cos(th4 - th5) * ((13 * sin(th1 + th2) * sin(th3)) / 2 - (13 * cos(th1 + th2) * cos(th3)) / 2)) / 2 - (sin(th4 - th5) * ((sin(th1 + th2) * sin(th3)) / 2 - (cos(th1 + th2) * cos(th3)) / 2)) / 2 + (3 * cos(th1 + th2) * cos(th3)) / 2;
+  out[1] = (79 * sin(th1 + th2)) / 4 + 16 * sin(th1) - (13 * sin(th1 + th2 + th3) * cos(th4 + th5)) / 4 - (sin(th1 + th2 + th3) * sin(th4 + th5)) / 4 - (cos(th1 + th2 + th3) * cos(th5)) / 2 + sin(th1 + th2 + th3) * cos(th4) + (13 * cos(th1 + th2 + th3) * sin(th5)) / 2 + (9 * sin(th1 + th2 + th3) * sin(th4)) / 2 - (13 * cos(th4 - th5) * sin(th1 + th2 + th3)) / 4 + (sin(th4 - th5) * sin(th1 + th2 + th3)) / 4 + (3 * cos(th1 + th2) * sin(th3)) / 2 + (3 * sin(th1 + th2) * cos(th3)) / 2;
+  out[2] = (9 * cos(th4)) / 2 - sin(th4) + (13 * cos(th5) * sin(th4)) / 2 + (sin(th4) * sin(th5)) / 2;
+}
+
+struct Version
+{
+  const char* name;
+  double tolerance;    //inches from MATLAB (in double) allowed
+  double error = 0;    //largest found
+  double per_second = 0;
+};
+
+//Times compute over every configuration and keeps the largest distance from the reference.
+template <typename Real, typename Compute>
+void run(Version& version, const std::vector<double>& angles, const std::vector<double>& reference, Compute compute)
+{
+  const size_t count = reference.size() / 3;
+  std::vector<Real> theta(angles.begin(), angles.end());
+  std::vector<Real> out(count * 3);
+  const bench_clock::time_point start = bench_clock::now();
+  compute(theta.data(), out.data(), count);
+  version.per_second = count / std::chrono::duration<double>(bench_clock::now() - start).count();
+  for (size_t i = 0; i < out.size(); ++i)
+  {
+    version.error = std::max(version.error, std::fabs(out[i] - reference[i]));
+  }
+}
+
+template <typename Real, bool table>
+void runLibrary(Version& version, const std::vector<double>& angles, const std::vector<double>& reference, bool batch)
+{
+  const ArmKinematics<Real, table> arm;
+  const Real tool[3] = {ARM_TOBII_SCREEN_X, ARM_TOBII_SCREEN_Y, ARM_TOBII_SCREEN_Z};
+  run<Real>(version, angles, reference, [&](const Real* theta, Real* out, size_t count)
+  {
+    if (batch)
+    {
+      arm.points((const Real(*)[ARM_JOINT_COUNT])theta, (int)count, tool, (Real(*)[3])out);
+      return;
+    }
+    for (size_t i = 0; i < count; ++i)
+    {
+      arm.point(theta + i * ARM_JOINT_COUNT, tool, out + i * 3);
+    }
+  });
+}
+
+int main(int argc, char* argv[])
+{
+  const unsigned long count = argc > 1 ? std::strtoul(argv[1], NULL, 10) : 1000000;
+  //Angles anywhere in a turn, beyond what the joints can reach, so every term gets exercised.
+  std::mt19937 random(1);
+  std::uniform_real_distribution<double> turn(-M_PI, M_PI);
+  std::vector<double> angles(count * ARM_JOINT_COUNT);
+  for (double& angle : angles)
+  {
+    angle = turn(random);
+  }
+  std::vector<double> reference(count * 3);
+  for (unsigned long i = 0; i < count; ++i)
+  {
+    matlabCameraPosition(&angles[i * ARM_JOINT_COUNT], &reference[i * 3]);
+  }
+
+  Version versions[] = {{"MATLAB expressions, double", 0}, {"MATLAB expressions, float", 1e-3},
+                        {"ArmKinematics<double>", 1e-9}, {"ArmKinematics<double> batch", 1e-9},
+                        {"ArmKinematics<float>", 1e-3}, {"ArmKinematics<float, table>", 5e-3}};
+  run<double>(versions[0], angles, reference, [](const double* theta, double* out, size_t n)
+  {
+    for (size_t i = 0; i < n; ++i)
+    {
+      matlabCameraPosition(theta + i * ARM_JOINT_COUNT, out + i * 3);
+    }
+  });
+  run<float>(versions[1], angles, reference, [](const float* theta, float* out, size_t n)
+  {
+    for (size_t i = 0; i < n; ++i)
+    {
+      matlabCameraPosition(theta + i * ARM_JOINT_COUNT, out + i * 3);
+    }
+  });
+  runLibrary<double, false>(versions[2], angles, reference, false);
+  runLibrary<double, false>(versions[3], angles, reference, true);
+  runLibrary<float, false>(versions[4], angles, reference, false);
+  runLibrary<float, true>(versions[5], angles, reference, false);
+
+  std::printf("%lu configurations, camera position in inches\n", count);
+  bool failed = false;
+  for (const Version& version : versions)
+  {
+    const bool ok = version.error <= version.tolerance;
+    failed = failed || !ok;
+    std::printf("%-30s %12.0f per second  %5.2fx  max error %9.2g in %s\n", version.name, version.per_second,
+                version.per_second / versions[0].per_second, version.error, ok ? "" : "FAILED");
+  }
+  return failed ? 1 : 0;
+}
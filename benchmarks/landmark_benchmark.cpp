@@ -0,0 +1,161 @@
+//Compares landmark models: how long each takes to load, how long it takes per face, and how
+//far the head pose it leads to is from the pose the reference model gives.
+//
+//Usage: landmark-benchmark VIDEO_FILE MODEL... [--max-frames=N]
+//Each MODEL is a dlib .dat shape predictor or a .rsp model (landmark_model.h); the first one
+//is the reference, normally ../data/face_model_68_points.dat. For example
+//  landmark-benchmark face.avi ../data/face_model_68_points.dat face_model_68_points.rsp pose14.rsp
+//Faces are found once per frame with the full-frame detector and every model gets the same
+//face box.
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <dlib/opencv.h>
+#include <opencv2/highgui/highgui.hpp>
+#include "face_pose.h"
+#include "landmark_model.h"
+#include "options.h"
+#include "stage_timing.h"
+
+struct FaceSample
+{
+  cv::Mat image;
+  dlib::rectangle face;
+};
+
+struct ModelPose
+{
+  FacePose pose;
+  cv::Point2d points[head_pose_point_count];
+};
+
+//Difference between two angles in degrees, going the short way round.
+double angleDifference(double a, double b)
+{
+  double d = std::fmod(std::fabs(a - b), 360.0);
+  return d > 180 ? 360 - d : d;
+}
+
+int main(int argc, char* argv[])
+{
+  std::vector<std::string> models;
+  unsigned long max_frames = 300;
+  for (int i = 2; i < argc; ++i)
+  {
+    const char* value;
+    if ((value = optionValue(argv[i], "--max-frames")))
+    {
+      max_frames = std::strtoul(value, NULL, 10);
+    }
+    else
+    {
+      models.push_back(argv[i]);
+    }
+  }
+  if (argc < 3 || models.empty())
+  {
+    std::cout << "usage: " << argv[0] << " VIDEO_FILE MODEL... [--max-frames=N]" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  cv::VideoCapture cap(argv[1]);
+  if (!cap.isOpened())
+  {
+    std::cout << "Unable to open " << argv[1] << std::endl;
+    return EXIT_FAILURE;
+  }
+  dlib::frontal_face_detector detector = dlib::get_frontal_face_detector();
+  std::vector<FaceSample> samples;
+  cv::Mat image;
+  for (unsigned long frame = 0; frame < max_frames && cap.read(image); ++frame)
+  {
+    std::vector<dlib::rectangle> faces = detector(dlib::cv_image<dlib::bgr_pixel>(image));
+    if (!faces.empty())
+    {
+      FaceSample sample;
+      sample.image = image.clone();
+      sample.face = faces[0];
+      samples.push_back(sample);
+    }
+  }
+  std::cout << samples.size() << " frames with a face" << std::endl;
+  if (samples.empty())
+  {
+    return EXIT_FAILURE;
+  }
+
+  std::vector<ModelPose> reference;
+  for (std::size_t m = 0; m < models.size(); ++m)
+  {
+    LandmarkPredictor predictor;
+    pipeline_clock::time_point start = pipeline_clock::now();
+    if (!predictor.load(models[m]))
+    {
+      return EXIT_FAILURE;
+    }
+    const double load_ms = elapsedMicroseconds(start) / 1000;
+
+    //Cold solves only, so the pose differences come from the landmarks and nothing else.
+    HeadPoseSolverOptions solver_options;
+    solver_options.warm_start = false;
+    PoseEstimator estimator(solver_options);
+    LatencyHistogram landmark_timing;
+    std::vector<ModelPose> poses(samples.size());
+    for (std::size_t i = 0; i < samples.size(); ++i)
+    {
+      dlib::cv_image<dlib::bgr_pixel> cimg(samples[i].image);
+      start = pipeline_clock::now();
+      const dlib::full_object_detection shape = predictor(cimg, samples[i].face);
+      landmark_timing.record(elapsedMicroseconds(start));
+      StageTimes times;
+      estimator.estimate(shape, samples[i].image.cols, samples[i].image.rows, poses[i].pose, times);
+      for (int p = 0; p < head_pose_point_count; ++p)
+      {
+        const dlib::point& part = shape.part(head_pose_landmarks[p]);
+        poses[i].points[p] = cv::Point2d(part.x(), part.y());
+      }
+    }
+
+    std::cout << "\n" << models[m] << (m == 0 ? " (reference)" : "") << "\n  " << predictor.predictedParts()
+              << " landmarks, loaded in " << load_ms << " ms\n  per face: mean " << landmark_timing.mean()
+              << " us, p50 " << landmark_timing.percentile(50) << " us, p99 " << landmark_timing.percentile(99)
+              << " us, max " << landmark_timing.max() << " us" << std::endl;
+    if (m == 0)
+    {
+      reference = poses;
+      continue;
+    }
+    //Landmark error relative to the reference model's eye distance (iBUG 36 to 45, head pose
+    //points 4 and 7), and the pose differences it causes.
+    double landmark_error = 0;
+    double worst_angle = 0;
+    double angle_sum = 0;
+    double worst_depth = 0;
+    for (std::size_t i = 0; i < samples.size(); ++i)
+    {
+      const double interocular = cv::norm(reference[i].points[4] - reference[i].points[7]);
+      for (int p = 0; p < head_pose_point_count; ++p)
+      {
+        landmark_error += interocular > 0 ? cv::norm(poses[i].points[p] - reference[i].points[p]) / interocular : 0;
+      }
+      const FacePose& a = poses[i].pose;
+      const FacePose& b = reference[i].pose;
+      const double angles[3] = {angleDifference(a.pitch, b.pitch), angleDifference(a.yaw, b.yaw),
+                                angleDifference(a.roll, b.roll)};
+      for (double d : angles)
+      {
+        worst_angle = std::max(worst_angle, d);
+        angle_sum += d;
+      }
+      worst_depth = std::max(worst_depth, std::fabs(a.z_pos - b.z_pos));
+    }
+    std::cout << "  vs. reference: pose landmarks off by " << landmark_error / (samples.size() * head_pose_point_count)
+              << " of the eye distance on average\n  pitch/yaw/roll: mean " << angle_sum / (3 * samples.size())
+              << " deg, max " << worst_angle << " deg | distance: max " << worst_depth << " in" << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,293 @@
+//Compares HeadPoseSolver with the head pose sequence main-code used to run on every frame
+//(image points pushed into a vector, a cold solvePnP, Rodrigues, hconcat and a full
+//decomposeProjectionMatrix), for speed and for agreement.
+//
+//Usage: pose-benchmark [LANDMARKS_CSV]
+//LANDMARKS_CSV is a landmark recording from 'vision-benchmark VIDEO --record-landmarks=FILE'.
+//Without one, a synthetic head moving in front of the camera is used, with 1 pixel of noise
+//on the landmarks, and the results are also checked against the true pose.
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <opencv2/calib3d/calib3d.hpp>
+#include <opencv2/core/core.hpp>
+#include "head_pose_solver.h"
+#include "stage_timing.h"
+
+//Same intrinsics as face_pose.h (which needs dlib, so it is not included here).
+const double K[9] = {7.3530833553043510e+02, 0.0, 320.0, 0.0, 7.3530833553043510e+02, 240.0, 0.0, 0.0, 1.0};
+const double D[5] = {-2.3528667558034226e-02, 1.3301431879108856e+00, 0.0, 0.0, -6.0786673300480434e+00};
+
+struct LandmarkSet
+{
+  cv::Point2d points[head_pose_point_count];
+  bool has_truth = false;
+  double true_euler[3];
+};
+
+struct PoseResult
+{
+  double euler[3];
+  double depth;   //translation along the optical axis
+};
+
+//The original per-frame sequence from main.cpp, kept here as the reference.
+class LegacyPose
+{
+public:
+  LegacyPose()
+    : cam_matrix(3, 3, CV_64FC1, const_cast<double*>(K)), dist_coeffs(5, 1, CV_64FC1, const_cast<double*>(D)),
+      pose_mat(3, 4, CV_64FC1), euler_angle(3, 1, CV_64FC1),
+      out_intrinsics(3, 3, CV_64FC1), out_rotation(3, 3, CV_64FC1), out_translation(3, 1, CV_64FC1)
+  {
+    object_pts.assign(head_model_points, head_model_points + head_pose_point_count);
+  }
+
+  void solve(const LandmarkSet& landmarks, PoseResult& result)
+  {
+    image_pts.clear();
+    for (int i = 0; i < head_pose_point_count; ++i)
+    {
+      image_pts.push_back(landmarks.points[i]);
+    }
+    cv::solvePnP(object_pts, image_pts, cam_matrix, dist_coeffs, rotation_vec, translation_vec);
+    cv::Rodrigues(rotation_vec, rotation_mat);
+    cv::hconcat(rotation_mat, translation_vec, pose_mat);
+    cv::decomposeProjectionMatrix(pose_mat, out_intrinsics, out_rotation, out_translation, cv::noArray(),
+                                  cv::noArray(), cv::noArray(), euler_angle);
+    for (int i = 0; i < 3; ++i)
+    {
+      result.euler[i] = euler_angle.at<double>(i);
+    }
+    result.depth = translation_vec.at<double>(1, 1);
+  }
+
+private:
+  cv::Mat cam_matrix;
+  cv::Mat dist_coeffs;
+  std::vector<cv::Point3d> object_pts;
+  std::vector<cv::Point2d> image_pts;
+  cv::Mat rotation_vec;
+  cv::Mat rotation_mat;
+  cv::Mat translation_vec;
+  cv::Mat pose_mat;
+  cv::Mat euler_angle;
+  cv::Mat out_intrinsics;
+  cv::Mat out_rotation;
+  cv::Mat out_translation;
+};
+
+//One line per frame: frame, image columns, image rows, then x,y of all 68 landmarks.
+bool loadLandmarks(const char* path, std::vector<LandmarkSet>& sets)
+{
+  std::ifstream in(path);
+  if (!in)
+  {
+    std::cout << "Unable to open " << path << std::endl;
+    return false;
+  }
+  std::string line;
+  std::getline(in, line);   //header
+  while (std::getline(in, line))
+  {
+    std::vector<double> values;
+    std::istringstream fields(line);
+    std::string field;
+    while (std::getline(fields, field, ','))
+    {
+      values.push_back(std::atof(field.c_str()));
+    }
+    if (values.size() != 3 + 2 * 68)
+    {
+      continue;
+    }
+    LandmarkSet set;
+    for (int i = 0; i < head_pose_point_count; ++i)
+    {
+      set.points[i] = cv::Point2d(values[3 + 2 * head_pose_landmarks[i]], values[4 + 2 * head_pose_landmarks[i]]);
+    }
+    sets.push_back(set);
+  }
+  return !sets.empty();
+}
+
+//A head turning and nodding at about 60 cm from the camera, 30 frames a second.
+void syntheticLandmarks(std::vector<LandmarkSet>& sets)
+{
+  const cv::Matx33d camera_matrix(K);
+  const cv::Vec<double, 5> distortion(D);
+  cv::RNG rng(2019);
+  for (int i = 0; i < 3000; ++i)
+  {
+    const double t = i / 30.0;
+    const cv::Vec3d rotation(CV_PI + 0.25 * std::sin(t), 0.35 * std::sin(0.7 * t), 0.1 * std::cos(1.3 * t));
+    const cv::Vec3d translation(3 * std::sin(0.5 * t), 2 * std::cos(0.3 * t), 60 + 10 * std::sin(0.2 * t));
+    LandmarkSet set;
+    cv::Mat projected(head_pose_point_count, 1, CV_64FC2, set.points);
+    cv::projectPoints(cv::Mat(head_pose_point_count, 1, CV_64FC3, const_cast<cv::Point3d*>(head_model_points)),
+                      rotation, translation, camera_matrix, distortion, projected);
+    for (int p = 0; p < head_pose_point_count; ++p)
+    {
+      set.points[p] += cv::Point2d(rng.gaussian(1.0), rng.gaussian(1.0));
+    }
+    cv::Matx33d rotation_matrix;
+    cv::Rodrigues(rotation, rotation_matrix);
+    rotationToEuler(rotation_matrix, set.true_euler);
+    set.has_truth = true;
+    sets.push_back(set);
+  }
+}
+
+double angleDifference(double a, double b)
+{
+  double d = std::fmod(std::fabs(a - b), 360.0);
+  return d > 180 ? 360 - d : d;
+}
+
+void printTiming(const char* name, const LatencyHistogram& h)
+{
+  std::cout << name << ": mean " << h.mean() << " us, p50 " << h.percentile(50) << " us, p99 "
+            << h.percentile(99) << " us, max " << h.max() << " us" << std::endl;
+}
+
+//Largest and mean disagreement in degrees over all frames and all three angles.
+struct AngleError
+{
+  double max = 0;
+  double sum = 0;
+  unsigned long count = 0;
+
+  void add(const double a[3], const double b[3])
+  {
+    for (int i = 0; i < 3; ++i)
+    {
+      const double d = angleDifference(a[i], b[i]);
+      max = std::max(max, d);
+      sum += d;
+      ++count;
+    }
+  }
+
+  void print(const char* name) const
+  {
+    std::cout << name << ": max " << max << " deg, mean " << (count ? sum / count : 0) << " deg" << std::endl;
+  }
+};
+
+void runSolver(const char* name, const std::vector<LandmarkSet>& sets, const HeadPoseSolverOptions& options,
+               const std::vector<PoseResult>& reference)
+{
+  HeadPoseSolver solver(cv::Matx33d(K), cv::Vec<double, 5>(D), options);
+  HeadPoseSolution solution;
+  LatencyHistogram timing;
+  AngleError against_reference;
+  AngleError against_truth;
+  double worst_depth = 0;
+  for (std::size_t i = 0; i < sets.size(); ++i)
+  {
+    const pipeline_clock::time_point start = pipeline_clock::now();
+    solver.solve(sets[i].points, solution);
+    HeadPoseSolver::eulerAngles(solution);
+    timing.record(elapsedMicroseconds(start));
+
+    against_reference.add(solution.euler, reference[i].euler);
+    worst_depth = std::max(worst_depth, std::fabs(solution.translation[2] - reference[i].depth));
+    if (sets[i].has_truth)
+    {
+      against_truth.add(solution.euler, sets[i].true_euler);
+    }
+  }
+  std::cout << "\n" << name << " (" << solver.warmSolves() << " warm, " << solver.coldSolves() << " cold, "
+            << solver.coldFallbacks() << " warm solves redone cold)" << std::endl;
+  printTiming("  solve + euler", timing);
+  against_reference.print("  angles vs. original sequence");
+  std::cout << "  depth vs. original sequence: max " << worst_depth << " cm" << std::endl;
+  if (against_truth.count)
+  {
+    against_truth.print("  angles vs. true pose");
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  std::vector<LandmarkSet> sets;
+  if (argc > 1)
+  {
+    if (!loadLandmarks(argv[1], sets))
+    {
+      return EXIT_FAILURE;
+    }
+  }
+  else
+  {
+    syntheticLandmarks(sets);
+  }
+  std::cout << sets.size() << " landmark sets" << std::endl;
+
+  //The original sequence, which is also the reference for agreement.
+  LegacyPose legacy;
+  std::vector<PoseResult> reference(sets.size());
+  LatencyHistogram legacy_timing;
+  AngleError legacy_truth;
+  for (std::size_t i = 0; i < sets.size(); ++i)
+  {
+    const pipeline_clock::time_point start = pipeline_clock::now();
+    legacy.solve(sets[i], reference[i]);
+    legacy_timing.record(elapsedMicroseconds(start));
+    if (sets[i].has_truth)
+    {
+      legacy_truth.add(reference[i].euler, sets[i].true_euler);
+    }
+  }
+  std::cout << "\noriginal sequence" << std::endl;
+  printTiming("  solve + euler", legacy_timing);
+  if (legacy_truth.count)
+  {
+    legacy_truth.print("  angles vs. true pose");
+  }
+
+  HeadPoseSolverOptions cold;
+  cold.warm_start = false;
+  runSolver("HeadPoseSolver, cold", sets, cold, reference);
+  runSolver("HeadPoseSolver, warm started", sets, HeadPoseSolverOptions(), reference);
+
+  //The Euler angle step on its own: decomposeProjectionMatrix against rotationToEuler.
+  LatencyHistogram decompose_timing;
+  LatencyHistogram direct_timing;
+  AngleError euler_error;
+  cv::Mat pose_mat(3, 4, CV_64FC1);
+  cv::Mat euler_angle(3, 1, CV_64FC1);
+  cv::Mat out_intrinsics(3, 3, CV_64FC1), out_rotation(3, 3, CV_64FC1), out_translation(3, 1, CV_64FC1);
+  const cv::Mat translation = (cv::Mat_<double>(3, 1) << 0, 0, 60);
+  cv::RNG rng(7);
+  for (int i = 0; i < 100000; ++i)
+  {
+    const cv::Vec3d rotation(rng.uniform(-CV_PI, CV_PI), rng.uniform(-CV_PI, CV_PI), rng.uniform(-CV_PI, CV_PI));
+    cv::Matx33d rotation_matrix;
+    cv::Rodrigues(rotation, rotation_matrix);
+
+    pipeline_clock::time_point start = pipeline_clock::now();
+    cv::hconcat(cv::Mat(rotation_matrix), translation, pose_mat);
+    cv::decomposeProjectionMatrix(pose_mat, out_intrinsics, out_rotation, out_translation, cv::noArray(),
+                                  cv::noArray(), cv::noArray(), euler_angle);
+    decompose_timing.record(elapsedMicroseconds(start));
+
+    double direct[3];
+    start = pipeline_clock::now();
+    rotationToEuler(rotation_matrix, direct);
+    direct_timing.record(elapsedMicroseconds(start));
+
+    const double decomposed[3] = {euler_angle.at<double>(0), euler_angle.at<double>(1), euler_angle.at<double>(2)};
+    euler_error.add(direct, decomposed);
+  }
+  std::cout << "\nEuler angles from a random rotation" << std::endl;
+  printTiming("  hconcat + decomposeProjectionMatrix", decompose_timing);
+  printTiming("  rotationToEuler", direct_timing);
+  euler_error.print("  difference");
+  return 0;
+}
@@ -0,0 +1,408 @@
+//Replays head motion through PoseFilter and CommandGenerator with the filter off, smoothing
+//and predicting, and reports how the arm (or the commands) behave with each.
+//
+//Usage: pose-filter-benchmark [POSES_CSV] [--latency=MS] [--actuation-delay=MS]
+//Without POSES_CSV the loop is closed in simulation: a head steps and sways in front of the
+//camera, each frame measures the head relative to the arm with noise, the command made from
+//it reaches the motors --latency (pipeline, default 70 +-15) plus --actuation-delay (default
+//30) milliseconds after capture, and the arm moves at the speed the command asks for. For
+//every axis it reports the arm's overshoot after each step of the head, the RMS distance
+//between head and arm, and the command jitter (RMS change of the command from one frame to
+//the next). In this loop the jitter comes almost all from commands stepping in and out of
+//the deadbands as the arm closes in, not from the measurement noise, so no mode changes it by
+//more than a few percent.
+//POSES_CSV is a pose recording from 'vision-benchmark INPUT --record-poses=FILE'. Its poses
+//are replayed open loop on their recorded timestamps, and only the command jitter and the
+//jitter of the pose the commands were made from are reported. tests/pose_filter_test.cpp
+//replays a head whose real position is known, and checks predict's jitter and latency.
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "command_generator.h"
+#include "pose_filter.h"
+
+//The commanded axes, in MotionCommand's order, with the factor CommandGenerator scales each
+//one by.
+const int commanded_axes[5] = {AXIS_ROLL, AXIS_PITCH, AXIS_YAW, AXIS_Y, AXIS_X};
+const double command_scale[5] = {-2, 2, -2, -2, -10};
+const char* const axis_names[pose_axis_count] = {"x", "y", "distance", "pitch", "yaw", "roll"};
+
+inline int commandValue(const MotionCommand& command, int i)
+{
+  const int values[5] = {command.roll, command.pitch, command.yaw, command.y, command.x};
+  return values[i];
+}
+
+inline pipeline_clock::time_point atMs(double ms)
+{
+  return pipeline_clock::time_point(std::chrono::duration_cast<pipeline_clock::duration>(
+                                      std::chrono::duration<double, std::milli>(ms)));
+}
+
+//Command jitter: the RMS second difference of each commanded axis from frame to frame.
+//A command that ramps up or down smoothly scores close to zero; one that flickers with the
+//measurement noise does not.
+struct CommandJitter
+{
+  double sum[5] = {};
+  unsigned long count = 0;
+  int history = 0;
+  MotionCommand last[2];
+
+  void add(const MotionCommand& command)
+  {
+    if (history == 2)
+    {
+      for (int i = 0; i < 5; ++i)
+      {
+        const double d = commandValue(command, i) - 2 * commandValue(last[1], i) + commandValue(last[0], i);
+        sum[i] += d * d;
+      }
+      ++count;
+    }
+    last[0] = last[1];
+    last[1] = command;
+    history = std::min(history + 1, 2);
+  }
+
+  double rms(int i) const { return count ? std::sqrt(sum[i] / count) : 0; }
+};
+
+//Where the simulated head is at time t (seconds), relative to where the arm started: held
+//positions with steps between them, then a sway, then still again.
+struct HeadMotion
+{
+  //Step times (s) and the offsets held from then on, per commanded axis (MotionCommand order).
+  static const int step_count = 4;
+  double step_time[step_count] = {1, 4, 7, 16};
+  double step_to[5][step_count] = {
+    {-15, 20, -10, 0},   //roll, degrees
+    {15, -20, 10, 0},    //pitch, degrees
+    {25, -15, 10, 0},    //yaw, degrees
+    {6, -8, 5, 0},       //y, inches
+    {-8, 10, -6, 0}      //x, inches
+  };
+  //Between the third step and the last the head sways, two full periods around the third
+  //step's offset.
+  double sway_start = 10;
+  double sway_end = 16;
+
+  //When the head stops holding step s.
+  double holdEnd(int s) const
+  {
+    if (s + 1 == step_count)
+    {
+      return 1e9;
+    }
+    return std::min(step_time[s + 1], step_time[s] < sway_start ? sway_start : 1e9);
+  }
+
+  double offset(int i, double t) const
+  {
+    if (t < step_time[0])
+    {
+      return 0;
+    }
+    if (t >= sway_start && t < sway_end)
+    {
+      return step_to[i][2] + 0.8 * std::fabs(step_to[i][0]) * std::sin(2 * M_PI * 2 * (t - sway_start) / (sway_end - sway_start));
+    }
+    int s = 0;
+    while (s + 1 < step_count && t >= step_time[s + 1])
+    {
+      ++s;
+    }
+    return step_to[i][s];
+  }
+};
+
+struct ClosedLoopResult
+{
+  double overshoot[5] = {};   //mean over the steps, percent of the step
+  double rms_error[5] = {};
+  double jitter[5] = {};
+};
+
+//Closed loop: camera at 30 frames a second, pipeline latency base_latency_ms +-15 ms,
+//actuation_delay_ms on top, and an arm that moves each axis at arm_gain times the offset
+//the command asks it to close (per second).
+ClosedLoopResult runClosedLoop(PoseFilterMode mode, double base_latency_ms, double actuation_delay_ms, unsigned seed)
+{
+  const double frame_ms = 1000.0 / 30;
+  const double run_ms = 20000;
+  const double arm_gain = 4;
+  const double noise[pose_axis_count] = {0.3, 0.3, 0.5, 1.5, 1.5, 1.5};
+
+  PoseFilterOptions options;
+  options.mode = mode;
+  options.actuation_delay_ms = actuation_delay_ms;
+  PoseFilter filter(options);
+  CommandGenerator generator;
+  HeadMotion head;
+  std::mt19937 rng(seed);
+  std::normal_distribution<double> gaussian(0.0, 1.0);
+  std::uniform_real_distribution<double> latency_jitter(-15.0, 15.0);
+
+  struct Pending
+  {
+    double captured_ms;
+    double due_ms;
+    PoseSample measured;
+    MotionCommand command;
+  };
+  std::deque<Pending> in_pipeline;   //captured, command not made yet
+  std::deque<Pending> in_flight;     //command made, not acted on yet
+  MotionCommand acting;
+  double arm[5] = {};
+  double next_frame_ms = 0;
+  unsigned long frame_id = 0;
+
+  ClosedLoopResult result;
+  CommandJitter jitter;
+  double worst[5][HeadMotion::step_count] = {};
+  double error_sum[5] = {};
+  unsigned long samples = 0;
+  for (double t = 0; t < run_ms; t += 1)
+  {
+    if (t >= next_frame_ms)
+    {
+      Pending frame;
+      frame.captured_ms = t;
+      frame.measured.time = atMs(t);
+      for (int a = 0; a < pose_axis_count; ++a)
+      {
+        frame.measured.axis[a] = noise[a] * gaussian(rng);
+      }
+      frame.measured.axis[AXIS_DISTANCE] += 24;
+      for (int i = 0; i < 5; ++i)
+      {
+        frame.measured.axis[commanded_axes[i]] += head.offset(i, t / 1000) - arm[i];
+      }
+      frame.command.frame_id = frame_id++;
+      frame.due_ms = t + base_latency_ms + latency_jitter(rng);
+      in_pipeline.push_back(frame);
+      next_frame_ms += frame_ms;
+    }
+    while (!in_pipeline.empty() && in_pipeline.front().due_ms <= t)
+    {
+      Pending frame = in_pipeline.front();
+      in_pipeline.pop_front();
+      PoseSample target;
+      filter.update(frame.measured, atMs(t), target);
+      generator.generate(target, frame.command);
+      jitter.add(frame.command);
+      frame.due_ms = t + actuation_delay_ms;
+      in_flight.push_back(frame);
+    }
+    while (!in_flight.empty() && in_flight.front().due_ms <= t)
+    {
+      acting = in_flight.front().command;
+      in_flight.pop_front();
+    }
+
+    //Move the arm 1 ms and score it.
+    for (int i = 0; i < 5; ++i)
+    {
+      arm[i] += arm_gain * (commandValue(acting, i) / command_scale[i]) / 1000;
+      const double target = head.offset(i, t / 1000);
+      error_sum[i] += (target - arm[i]) * (target - arm[i]);
+      for (int s = 0; s < HeadMotion::step_count; ++s)
+      {
+        if (t / 1000 >= head.step_time[s] && t / 1000 < head.holdEnd(s))
+        {
+          const double from = s ? head.step_to[i][s - 1] : 0;
+          const double direction = head.step_to[i][s] >= from ? 1 : -1;
+          worst[i][s] = std::max(worst[i][s], (arm[i] - head.step_to[i][s]) * direction);
+        }
+      }
+    }
+    ++samples;
+  }
+  for (int i = 0; i < 5; ++i)
+  {
+    for (int s = 0; s < HeadMotion::step_count; ++s)
+    {
+      const double from = s ? head.step_to[i][s - 1] : 0;
+      result.overshoot[i] += 100 * worst[i][s] / std::fabs(head.step_to[i][s] - from) / HeadMotion::step_count;
+    }
+    result.rms_error[i] = std::sqrt(error_sum[i] / samples);
+    result.jitter[i] = jitter.rms(i);
+  }
+  return result;
+}
+
+//Enough runs that the differences between the modes are larger than the ones between runs.
+const int closed_loop_runs = 200;
+
+struct RecordedPose
+{
+  double captured_ms;
+  double latency_ms;
+  PoseSample pose;
+};
+
+//frame,captured_us,latency_us then the pose axes, as written by vision-benchmark.
+bool loadPoses(const char* path, std::vector<RecordedPose>& poses)
+{
+  std::ifstream in(path);
+  if (!in)
+  {
+    std::cout << "Unable to open " << path << std::endl;
+    return false;
+  }
+  std::string line;
+  std::getline(in, line);   //header
+  while (std::getline(in, line))
+  {
+    std::vector<double> values;
+    std::istringstream fields(line);
+    std::string field;
+    while (std::getline(fields, field, ','))
+    {
+      values.push_back(std::atof(field.c_str()));
+    }
+    if (values.size() != 3 + pose_axis_count)
+    {
+      continue;
+    }
+    RecordedPose pose;
+    pose.captured_ms = values[1] / 1000;
+    pose.latency_ms = values[2] / 1000;
+    pose.pose.time = atMs(pose.captured_ms);
+    for (int a = 0; a < pose_axis_count; ++a)
+    {
+      pose.pose.axis[a] = values[3 + a];
+    }
+    poses.push_back(pose);
+  }
+  return !poses.empty();
+}
+
+void replayRecording(const std::vector<RecordedPose>& poses, PoseFilterMode mode, double actuation_delay_ms)
+{
+  PoseFilterOptions options;
+  options.mode = mode;
+  options.actuation_delay_ms = actuation_delay_ms;
+  PoseFilter filter(options);
+  CommandGenerator generator;
+  CommandJitter jitter;
+  //RMS second difference of the target pose: how much it wobbles from frame to frame.
+  double wobble[pose_axis_count] = {};
+  unsigned long wobble_count = 0;
+  PoseSample previous[2];
+  for (std::size_t f = 0; f < poses.size(); ++f)
+  {
+    PoseSample target;
+    filter.update(poses[f].pose, atMs(poses[f].captured_ms + poses[f].latency_ms), target);
+    MotionCommand command;
+    generator.generate(target, command);
+    jitter.add(command);
+    if (f >= 2)
+    {
+      for (int a = 0; a < pose_axis_count; ++a)
+      {
+        double d = target.axis[a] - 2 * previous[1].axis[a] + previous[0].axis[a];
+        if (isAngleAxis(a))
+        {
+          d = wrapDegrees(target.axis[a] - previous[1].axis[a]) - wrapDegrees(previous[1].axis[a] - previous[0].axis[a]);
+        }
+        wobble[a] += d * d;
+      }
+      ++wobble_count;
+    }
+    previous[0] = previous[1];
+    previous[1] = target;
+  }
+  std::cout << "\n" << poseFilterModeName(mode) << "\n  command jitter:";
+  for (int i = 0; i < 5; ++i)
+  {
+    std::cout << " " << axis_names[commanded_axes[i]] << " " << jitter.rms(i);
+  }
+  std::cout << "\n  pose wobble:";
+  for (int a = 0; a < pose_axis_count; ++a)
+  {
+    std::cout << " " << axis_names[a] << " " << (wobble_count ? std::sqrt(wobble[a] / wobble_count) : 0);
+  }
+  std::cout << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+  const char* recording = NULL;
+  double latency_ms = 70;
+  double actuation_delay_ms = 30;
+  for (int i = 1; i < argc; ++i)
+  {
+    if (std::strncmp(argv[i], "--latency=", 10) == 0)
+    {
+      latency_ms = std::atof(argv[i] + 10);
+    }
+    else if (std::strncmp(argv[i], "--actuation-delay=", 18) == 0)
+    {
+      actuation_delay_ms = std::atof(argv[i] + 18);
+    }
+    else if (argv[i][0] != '-')
+    {
+      recording = argv[i];
+    }
+    else
+    {
+      std::cout << "usage: " << argv[0] << " [POSES_CSV] [--latency=MS] [--actuation-delay=MS]" << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  const PoseFilterMode modes[] = {FILTER_OFF, FILTER_SMOOTH, FILTER_PREDICT};
+  std::cout << std::fixed << std::setprecision(2);
+
+  if (recording)
+  {
+    std::vector<RecordedPose> poses;
+    if (!loadPoses(recording, poses))
+    {
+      return EXIT_FAILURE;
+    }
+    std::cout << poses.size() << " recorded poses" << std::endl;
+    for (PoseFilterMode mode : modes)
+    {
+      replayRecording(poses, mode, actuation_delay_ms);
+    }
+    return 0;
+  }
+
+  std::cout << "closed loop, pipeline latency " << latency_ms << " +-15 ms, actuation delay " << actuation_delay_ms
+            << " ms" << std::endl;
+  for (PoseFilterMode mode : modes)
+  {
+    //Averaged over several runs with different noise.
+    ClosedLoopResult result;
+    for (int run = 0; run < closed_loop_runs; ++run)
+    {
+      const ClosedLoopResult one = runClosedLoop(mode, latency_ms, actuation_delay_ms, 2019 + run);
+      for (int i = 0; i < 5; ++i)
+      {
+        result.overshoot[i] += one.overshoot[i] / closed_loop_runs;
+        result.rms_error[i] += one.rms_error[i] / closed_loop_runs;
+        result.jitter[i] += one.jitter[i] / closed_loop_runs;
+      }
+    }
+    std::cout << "\n" << poseFilterModeName(mode) << "\n  axis      overshoot %   rms error   command jitter\n";
+    for (int i = 0; i < 5; ++i)
+    {
+      std::cout << "  " << std::left << std::setw(8) << axis_names[commanded_axes[i]] << std::right
+                << std::setw(12) << result.overshoot[i] << std::setw(12) << result.rms_error[i]
+                << std::setw(17) << result.jitter[i] << "\n";
+    }
+  }
+  std::cout << std::flush;
+  return 0;
+}
@@ -0,0 +1,79 @@
+//Throughput of the binary motion protocol in arduino_extra/rasm_protocol.h on this computer:
+//how fast frames can be encoded and parsed, and how the parser copes with corrupted bytes.
+//Also prints how long a frame spends on the wire compared with the old ASCII commands.
+//Usage: protocol-benchmark [FRAMES]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "arduino_extra/rasm_protocol.h"
+
+typedef std::chrono::steady_clock bench_clock;
+
+double seconds(bench_clock::duration d)
+{
+  return std::chrono::duration<double>(d).count();
+}
+
+//Parses a byte stream and returns how many motion frames came out of it intact.
+unsigned long parseAll(const std::vector<uint8_t>& stream, RasmParser& parser)
+{
+  unsigned long frames = 0;
+  RasmMotionFrame motion;
+  for (uint8_t byte : stream)
+  {
+    if (parser.feed(byte) && parser.type() == RASM_FRAME_MOTION)
+    {
+      parser.decodeMotion(motion);
+      ++frames;
+    }
+  }
+  return frames;
+}
+
+int main(int argc, char* argv[])
+{
+  const unsigned long frames = argc > 1 ? std::strtoul(argv[1], NULL, 10) : 1000000;
+  std::vector<uint8_t> stream(frames * RASM_MOTION_FRAME_SIZE);
+
+  bench_clock::time_point start = bench_clock::now();
+  RasmMotionFrame motion;
+  for (unsigned long i = 0; i < frames; ++i)
+  {
+    motion.sequence = (uint8_t)i;
+    for (int axis = 0; axis < RASM_AXIS_COUNT; ++axis)
+    {
+      motion.setpoints[axis] = (int16_t)(i * (axis + 3) % 400 - 200);
+    }
+    rasmEncodeMotion(motion, &stream[i * RASM_MOTION_FRAME_SIZE]);
+  }
+  const double encode_s = seconds(bench_clock::now() - start);
+
+  RasmParser parser;
+  start = bench_clock::now();
+  const unsigned long parsed = parseAll(stream, parser);
+  const double parse_s = seconds(bench_clock::now() - start);
+
+  std::printf("%lu frames of %d bytes\n", frames, RASM_MOTION_FRAME_SIZE);
+  std::printf("encode: %12.0f frames/s %8.1f MB/s\n", frames / encode_s, stream.size() / encode_s / 1e6);
+  std::printf("parse:  %12.0f frames/s %8.1f MB/s (%lu good)\n", parsed / parse_s, stream.size() / parse_s / 1e6, parsed);
+
+  //Flip one byte in every 100th frame and see how many good frames survive around it.
+  std::vector<uint8_t> corrupted = stream;
+  srand(1);
+  for (unsigned long i = 0; i < frames; i += 100)
+  {
+    corrupted[i * RASM_MOTION_FRAME_SIZE + rand() % RASM_MOTION_FRAME_SIZE] ^= (uint8_t)(1 + rand() % 255);
+  }
+  RasmParser noisy_parser;
+  const unsigned long survived = parseAll(corrupted, noisy_parser);
+  std::printf("1%% corrupted: %lu good, %lu rejected, %lu reported lost from sequence gaps\n",
+              survived, (unsigned long)noisy_parser.badFrames(), (unsigned long)noisy_parser.lostFrames());
+
+  //10 bits per byte on the wire (start, 8 data, stop).
+  const int ascii_frame_size = 5 * 5;   //"#+05\0" per axis
+  std::printf("time on the wire per frame: binary @%d baud %.2f ms, old ASCII @9600 baud %.2f ms\n",
+              RASM_SERIAL_BAUD, RASM_MOTION_FRAME_SIZE * 10 * 1000.0 / RASM_SERIAL_BAUD,
+              ascii_frame_size * 10 * 1000.0 / 9600);
+  return 0;
+}
@@ -0,0 +1,143 @@
+//Measures what sending one frame's worth of motion commands costs, using a pseudo-terminal
+//as a stand-in for the Arduino. Reports the time the pose stage spends handing a command to
+//SerialWriter and the time until all of the frame's bytes have arrived on the other end.
+//When built with RASM_BENCHMARK_PYTHON (see build/CMakeLists.txt) it also times the old path
+//main-code used: five sprintf'd ser.write() calls plus five ser.flush() calls through the
+//embedded Python interpreter, sending the old ASCII commands at the old 9600 baud.
+//Usage: serial-benchmark [FRAMES]
+#ifdef RASM_BENCHMARK_PYTHON
+#include <Python.h>
+#endif
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <pty.h>
+#include <vector>
+#include "serial_writer.h"
+
+typedef std::chrono::steady_clock bench_clock;
+
+double microseconds(bench_clock::duration d)
+{
+  return std::chrono::duration<double, std::micro>(d).count();
+}
+
+void report(const char* name, std::vector<double>& us)
+{
+  double total = 0;
+  for (double u : us)
+  {
+    total += u;
+  }
+  std::sort(us.begin(), us.end());
+  std::printf("%-28s mean %9.2f us  p50 %9.2f us  p99 %9.2f us  max %9.2f us\n", name,
+              total / us.size(), us[us.size() / 2], us[std::min(us.size() - 1, us.size() * 99 / 100)], us.back());
+}
+
+//Reads from the master side of the pty until count bytes have arrived.
+void drain(int master, std::size_t count)
+{
+  char buffer[256];
+  while (count > 0)
+  {
+    ssize_t got = read(master, buffer, std::min(count, sizeof(buffer)));
+    if (got > 0)
+    {
+      count -= got;
+    }
+  }
+}
+
+MotionCommand commandFor(int frame)
+{
+  MotionCommand command;
+  command.frame_id = frame;
+  command.roll = frame % 41 - 20;
+  command.pitch = frame % 17 - 8;
+  command.yaw = -(frame % 23);
+  command.y = frame % 2 ? 6 : 0;
+  command.x = frame % 9;
+  return command;
+}
+
+int main(int argc, char* argv[])
+{
+  const int frames = argc > 1 ? std::atoi(argv[1]) : 2000;
+  int master, slave;
+  char slave_name[64];
+  if (openpty(&master, &slave, slave_name, NULL, NULL) != 0)
+  {
+    std::perror("openpty");
+    return EXIT_FAILURE;
+  }
+  struct termios tty;
+  tcgetattr(master, &tty);
+  cfmakeraw(&tty);
+  tcsetattr(master, TCSANOW, &tty);
+
+  std::vector<double> submit_us;
+  std::vector<double> delivered_us;
+  {
+    SerialWriter writer;
+    if (!writer.open(slave_name))
+    {
+      return EXIT_FAILURE;
+    }
+    uint8_t frame[SerialWriter::max_frame_size];
+    for (int i = 0; i < frames; ++i)
+    {
+      const MotionCommand command = commandFor(i);
+      const std::size_t size = SerialWriter::encode(command, i, frame);
+      bench_clock::time_point start = bench_clock::now();
+      writer.submit(command);
+      bench_clock::time_point submitted = bench_clock::now();
+      drain(master, size);
+      submit_us.push_back(microseconds(submitted - start));
+      delivered_us.push_back(microseconds(bench_clock::now() - start));
+    }
+  }
+  std::printf("%d frames through %s\n", frames, slave_name);
+  report("native submit()", submit_us);
+  report("native until delivered", delivered_us);
+
+#ifdef RASM_BENCHMARK_PYTHON
+  Py_Initialize();
+  char buffer[100];
+  std::snprintf(buffer, sizeof(buffer), "ser = serial.Serial('%s', 9600, timeout=5)", slave_name);
+  if (PyRun_SimpleString("import serial\n") != 0 || PyRun_SimpleString(buffer) != 0)
+  {
+    std::cout << "Skipping the Python comparison (is python3-serial installed?)" << std::endl;
+    Py_Finalize();
+    return 0;
+  }
+  std::vector<double> python_us;
+  const char prefixes[5] = {'#', '&', '*', '$', '^'};
+  for (int i = 0; i < frames; ++i)
+  {
+    const MotionCommand command = commandFor(i);
+    const int values[5] = {command.roll, command.pitch, command.yaw, command.y, command.x};
+    //The old ASCII format: prefix, "%+03d" and a '\0' per axis.
+    std::size_t size = 0;
+    for (int axis = 0; axis < 5; ++axis)
+    {
+      size += std::snprintf(buffer, sizeof(buffer), "%+03d", values[axis]) + 2;
+    }
+    bench_clock::time_point start = bench_clock::now();
+    for (int axis = 0; axis < 5; ++axis)
+    {
+      std::snprintf(buffer, sizeof(buffer), "ser.write('%c%+03d\\x00'.encode())", prefixes[axis], values[axis]);
+      PyRun_SimpleString(buffer);
+      PyRun_SimpleString("ser.flush()");
+    }
+    python_us.push_back(microseconds(bench_clock::now() - start));
+    drain(master, size);
+  }
+  report("python per frame (blocking)", python_us);
+  Py_Finalize();
+#endif
+  close(master);
+  close(slave);
+  return 0;
+}
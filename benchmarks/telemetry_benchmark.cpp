@@ -0,0 +1,217 @@
+//Measures the joint-state telemetry link (RASM_FRAME_JOINT_STATE frames read by
+//JointStateReceiver) with a pseudo-terminal standing in for the Arduino. A board thread sends
+//frames at the firmware's rate, with the joints moving along sine waves and quantized to the
+//encoders' 1024 steps per turn, and a consumer thread polls the receiver the way the control
+//loop in rasm_motion does. Reports frames sent, received and lost, the latency from the
+//board's timestamp to the receiver and to the consumer, and how far the receiver's velocity is
+//from the true one. Then it sends as fast as the pty takes frames, to show the receiver's
+//throughput.
+//Usage: telemetry-benchmark [--rate=HZ] [--seconds=S] [--consumer-hz=HZ] [--baud=BAUD]
+//--baud paces the board at what the UART could carry (default 115200, 0 for no limit).
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <pty.h>
+#include <thread>
+#include <vector>
+#include "joint_state_receiver.h"
+
+typedef std::chrono::steady_clock bench_clock;
+
+//The board's micros(): microseconds since the run started, wrapping like the Arduino's.
+uint32_t boardMicros(bench_clock::time_point start, bench_clock::time_point now)
+{
+  return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(now - start).count();
+}
+
+//Where joint j is at t seconds, in degrees and degrees per second.
+double jointAngle(int j, double t)
+{
+  return 40 * std::sin(2 * M_PI * (0.3 + 0.2 * j) * t + j);
+}
+
+double jointVelocity(int j, double t)
+{
+  return 40 * 2 * M_PI * (0.3 + 0.2 * j) * std::cos(2 * M_PI * (0.3 + 0.2 * j) * t + j);
+}
+
+//What an encoder with 1024 steps per turn reads for angle.
+double encoderReading(double angle)
+{
+  const double step = 360.0 / 1024.0;
+  return std::floor(angle / step) * step;
+}
+
+void report(const char* name, std::vector<double>& values, const char* unit)
+{
+  if (values.empty())
+  {
+    std::printf("%-34s no samples\n", name);
+    return;
+  }
+  double total = 0;
+  for (double v : values)
+  {
+    total += v;
+  }
+  std::sort(values.begin(), values.end());
+  std::printf("%-34s mean %9.2f %s  p50 %9.2f %s  p99 %9.2f %s  max %9.2f %s\n", name, total / values.size(), unit,
+              values[values.size() / 2], unit, values[std::min(values.size() - 1, values.size() * 99 / 100)], unit,
+              values.back(), unit);
+}
+
+//Sends joint-state frames on master at rate_hz (as fast as possible for 0) for seconds,
+//never faster than baud would allow. Returns the number of frames sent.
+unsigned long runBoard(int master, double rate_hz, double seconds, double baud, bench_clock::time_point start)
+{
+  const double frame_seconds = baud > 0 ? RASM_JOINT_STATE_FRAME_SIZE * 10 / baud : 0;
+  const double period = std::max(rate_hz > 0 ? 1 / rate_hz : 0, frame_seconds);
+  uint8_t frame[RASM_JOINT_STATE_FRAME_SIZE];
+  RasmJointStateFrame state;
+  unsigned long sent = 0;
+  bench_clock::time_point next = bench_clock::now();
+  const bench_clock::time_point end = next + std::chrono::duration_cast<bench_clock::duration>(std::chrono::duration<double>(seconds));
+  while (next < end)
+  {
+    if (period > 0)
+    {
+      std::this_thread::sleep_until(next);
+      next += std::chrono::duration_cast<bench_clock::duration>(std::chrono::duration<double>(period));
+    }
+    else
+    {
+      next = bench_clock::now();
+    }
+    const bench_clock::time_point now = bench_clock::now();
+    const double t = std::chrono::duration<double>(now - start).count();
+    state.sequence = (uint8_t)sent;
+    state.time_us = boardMicros(start, now);
+    for (int j = 0; j < RASM_JOINT_COUNT; ++j)
+    {
+      state.angles[j] = rasmJointAngle(encoderReading(jointAngle(j, t)));
+    }
+    const uint8_t size = rasmEncodeJointState(state, frame);
+    std::size_t written = 0;
+    while (written < size)
+    {
+      const ssize_t result = write(master, frame + written, size - written);
+      if (result > 0)
+      {
+        written += result;
+      }
+    }
+    ++sent;
+  }
+  return sent;
+}
+
+int main(int argc, char* argv[])
+{
+  double rate_hz = 200;
+  double seconds = 5;
+  double consumer_hz = 300;
+  double baud = RASM_SERIAL_BAUD;
+  for (int i = 1; i < argc; ++i)
+  {
+    if (std::strncmp(argv[i], "--rate=", 7) == 0)
+    {
+      rate_hz = std::atof(argv[i] + 7);
+    }
+    else if (std::strncmp(argv[i], "--seconds=", 10) == 0)
+    {
+      seconds = std::atof(argv[i] + 10);
+    }
+    else if (std::strncmp(argv[i], "--consumer-hz=", 14) == 0)
+    {
+      consumer_hz = std::atof(argv[i] + 14);
+    }
+    else if (std::strncmp(argv[i], "--baud=", 7) == 0)
+    {
+      baud = std::atof(argv[i] + 7);
+    }
+    else
+    {
+      std::printf("usage: %s [--rate=HZ] [--seconds=S] [--consumer-hz=HZ] [--baud=BAUD]\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  int master, slave;
+  char slave_name[64];
+  if (openpty(&master, &slave, slave_name, NULL, NULL) != 0)
+  {
+    std::perror("openpty");
+    return EXIT_FAILURE;
+  }
+  struct termios tty;
+  tcgetattr(master, &tty);
+  cfmakeraw(&tty);
+  tcsetattr(master, TCSANOW, &tty);
+
+  JointStateReceiver receiver;
+  if (!receiver.open(slave_name))
+  {
+    return EXIT_FAILURE;
+  }
+  const bench_clock::time_point start = bench_clock::now();
+  std::atomic<bool> board_done(false);
+  std::vector<double> receive_us;
+  std::vector<double> consume_us;
+  std::vector<double> velocity_error;
+  unsigned long taken = 0;
+  //The consumer: polls at consumer_hz like the control loop.
+  std::thread consumer([&]()
+  {
+    const auto period = std::chrono::duration_cast<bench_clock::duration>(std::chrono::duration<double>(1 / consumer_hz));
+    bench_clock::time_point next = bench_clock::now();
+    JointState state;
+    while (!board_done)
+    {
+      next += period;
+      std::this_thread::sleep_until(next);
+      if (!receiver.latest(state))
+      {
+        continue;
+      }
+      const bench_clock::time_point now = bench_clock::now();
+      const bench_clock::time_point sent = start + std::chrono::microseconds(state.firmware_us);
+      receive_us.push_back(std::chrono::duration<double, std::micro>(state.received - sent).count());
+      consume_us.push_back(std::chrono::duration<double, std::micro>(now - sent).count());
+      //The velocity is an average over the receiver's window, so compare with the true
+      //velocity half a window back, once there has been a full window.
+      const double t = state.firmware_us / 1e6 - 0.01;
+      for (int j = 0; j < RASM_JOINT_COUNT && t > 0.02; ++j)
+      {
+        velocity_error.push_back(std::fabs(state.velocity[j] - jointVelocity(j, t)));
+      }
+      ++taken;
+    }
+  });
+  const unsigned long sent = runBoard(master, rate_hz, seconds, baud, start);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  board_done = true;
+  consumer.join();
+
+  std::printf("%lu frames of %d bytes at %.0f Hz through %s, consumer at %.0f Hz\n", sent,
+              RASM_JOINT_STATE_FRAME_SIZE, rate_hz, slave_name, consumer_hz);
+  std::printf("received %lu, lost %lu, bad %lu, taken by the consumer %lu, replaced before it got them %lu\n",
+              receiver.framesReceived(), receiver.lostFrames(), receiver.badFrames(), taken, receiver.framesReplaced());
+  report("board -> receiver", receive_us, "us");
+  report("board -> consumer", consume_us, "us");
+  report("velocity error", velocity_error, "deg/s");
+
+  //Throughput: no pacing at all.
+  const unsigned long before = receiver.framesReceived();
+  const bench_clock::time_point flood_start = bench_clock::now();
+  const unsigned long flooded = runBoard(master, 0, 1, 0, start);
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  const double flood_seconds = std::chrono::duration<double>(bench_clock::now() - flood_start).count() - 0.1;
+  std::printf("unpaced: sent %lu frames in %.2f s, received %lu (%.0f frames/s)\n", flooded, flood_seconds,
+              receiver.framesReceived() - before, (receiver.framesReceived() - before) / flood_seconds);
+  receiver.close();
+  return 0;
+}
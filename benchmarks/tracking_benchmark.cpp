@@ -0,0 +1,116 @@
+//Measures what the detect stage of main-code costs per frame with face tracking off and on.
+//Usage: tracking-benchmark VIDEO_FILE [main-code tracking options, e.g. --detect-every=5]
+//The video is played through twice, once with every frame getting the full-frame detector
+//and once with FaceTracker following the face between detections.
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <dlib/opencv.h>
+#include <opencv2/highgui/highgui.hpp>
+#include "detector_engine.h"
+#include "face_tracker.h"
+#include "options.h"
+
+struct RunResult
+{
+  std::vector<double> frame_ms;
+  unsigned long faces = 0;
+  unsigned long full_frame_detections = 0;
+  unsigned long region_detections = 0;
+  unsigned long tracked_frames = 0;
+};
+
+bool runVideo(const char* path, DetectorEngine& detector, dlib::shape_predictor& predictor,
+              const FaceTrackerOptions& tracker_options, const FaceDetectorOptions& detection,
+              RunResult& result)
+{
+  cv::VideoCapture cap(path);
+  if (!cap.isOpened())
+  {
+    std::cout << "Unable to open " << path << std::endl;
+    return false;
+  }
+  FaceTracker tracker(detector, tracker_options, detection);
+  cv::Mat temp;
+  while (cap.read(temp))
+  {
+    dlib::cv_image<dlib::bgr_pixel> cimg(temp);
+    dlib::rectangle face;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (tracker.update(cimg, face))
+    {
+      dlib::full_object_detection shape = predictor(cimg, face);
+      ++result.faces;
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    result.frame_ms.push_back(elapsed.count());
+  }
+  result.full_frame_detections = tracker.fullFrameDetections();
+  result.region_detections = tracker.regionDetections();
+  result.tracked_frames = tracker.trackedFrames();
+  return true;
+}
+
+void report(const char* name, RunResult& result)
+{
+  std::vector<double>& ms = result.frame_ms;
+  if (ms.empty())
+  {
+    std::cout << name << ": no frames" << std::endl;
+    return;
+  }
+  double total = 0;
+  for (double m : ms)
+  {
+    total += m;
+  }
+  std::sort(ms.begin(), ms.end());
+  std::cout << name << ": " << ms.size() << " frames, face in " << result.faces
+            << " | per frame ms mean " << total / ms.size()
+            << " p50 " << ms[ms.size() / 2]
+            << " p99 " << ms[std::min(ms.size() - 1, ms.size() * 99 / 100)]
+            << " max " << ms.back()
+            << " | full-frame detections " << result.full_frame_detections
+            << " region detections " << result.region_detections
+            << " tracked " << result.tracked_frames << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc < 2)
+  {
+    std::cout << "usage: " << argv[0] << " VIDEO_FILE [tracking options]" << std::endl;
+    return EXIT_FAILURE;
+  }
+  //Everything after the video file is parsed exactly like main-code's command line.
+  RasmOptions options;
+  if (!parseOptions(argc - 1, argv + 1, options))
+  {
+    return EXIT_FAILURE;
+  }
+  std::unique_ptr<DetectorEngine> detector = createDetectorEngine(options.detector);
+  if (!detector)
+  {
+    return EXIT_FAILURE;
+  }
+  dlib::shape_predictor predictor;
+  dlib::deserialize("../data/face_model_68_points.dat") >> predictor;
+
+  FaceTrackerOptions off = options.tracker;
+  off.enabled = false;
+  FaceTrackerOptions on = options.tracker;
+  on.enabled = true;
+
+  RunResult without_tracking;
+  RunResult with_tracking;
+  if (!runVideo(argv[1], *detector, predictor, off, options.detection, without_tracking) ||
+      !runVideo(argv[1], *detector, predictor, on, options.detection, with_tracking))
+  {
+    return EXIT_FAILURE;
+  }
+  report("tracking off", without_tracking);
+  report("tracking on ", with_tracking);
+  return 0;
+}
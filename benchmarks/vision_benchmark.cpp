@@ -0,0 +1,553 @@
+//Offline, headless benchmark of the tracking loop. Plays a video file or a directory of images
+//through the same detect and pose code main-code runs, with the serial port replaced by a
+//recording sink and no window, and reports per-stage latency histograms, end-to-end latency
+//percentiles and frames per second. This is the baseline every performance change to the
+//tracking loop should be measured against.
+//
+//The display mode defaults to off here. With --display=preview or full, the frames main-code
+//would show are rendered (but not shown) after each frame and timed as the "render" stage,
+//which is kept out of end-to-end since main-code does it on a separate thread.
+//
+//The detection settings (--detector, --detect-scale, --detect-roi, ...), the detection rate
+//they got and the CPU time the run took are part of the report, so running the same input
+//once per setting shows what each one trades in latency and CPU against faces found.
+//
+//Usage: vision-benchmark INPUT [--format=json|csv] [--output=FILE] [--record=FILE]
+//                              [--record-landmarks=FILE] [--record-poses=FILE]
+//                              [--record-faces=FILE] [--faces=FILE] [--max-frames=N]
+//                              [main-code options such as --track]
+//--record-landmarks saves the 68 landmarks of every frame with a face, for pose-benchmark.
+//--record-poses saves every frame's measured head pose with its capture time and how long
+//the frame took to get through the pose stage, for pose-filter-benchmark.
+//--record-faces saves the face found in every frame; --faces reads a file in the same format
+//(frame,left,top,right,bottom, one line per face) as the true faces and adds the recall and
+//the number of false detections to the report. The true faces can be labelled by hand, or
+//recorded with the most thorough setting (e.g. --detector=ssd without --track), in which
+//case recall is relative to that setting.
+//INPUT is a video file, a directory of images (played in file name order) or a raw .yuyv
+//recording of --capture-size frames. A .yuyv input goes through the same grayscale path as
+//main-code's --capture=v4l2, so the detector and landmarks see what they would live.
+//
+//Every frame is also counted into the same runtime metrics main-code keeps (pipeline_metrics.h),
+//with the metrics exported once per metrics_export_frames frames, and the time that takes is
+//reported against end-to-end as metrics_overhead. The benchmark fails if it reaches 1%.
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <sys/resource.h>
+#include <vector>
+#include <opencv2/highgui/highgui.hpp>
+#include "capture.h"
+#include "detector_engine.h"
+#include "display.h"
+#include "face_pose.h"
+#include "face_tracker.h"
+#include "options.h"
+#include "pipeline.h"
+#include "pipeline_metrics.h"
+#include "stage_timing.h"
+
+//Stands in for SerialWriter: keeps every command that would have been sent.
+class RecordingSink
+{
+public:
+  void submit(const MotionCommand& command) { commands.push_back(command); }
+
+  std::size_t size() const { return commands.size(); }
+
+  bool write(const std::string& path) const
+  {
+    std::ofstream out(path.c_str());
+    if (!out)
+    {
+      return false;
+    }
+    out << "frame,roll,pitch,yaw,y,x\n";
+    for (const MotionCommand& c : commands)
+    {
+      out << c.frame_id << ',' << c.roll << ',' << c.pitch << ',' << c.yaw << ',' << c.y << ',' << c.x << '\n';
+    }
+    return true;
+  }
+
+private:
+  std::vector<MotionCommand> commands;
+};
+
+//Faces by frame number, as written by --record-faces and read by --faces.
+typedef std::map<unsigned long, std::vector<dlib::rectangle> > FaceList;
+
+bool loadFaces(const std::string& path, FaceList& faces)
+{
+  std::ifstream in(path.c_str());
+  if (!in)
+  {
+    return false;
+  }
+  std::string line;
+  std::getline(in, line);   //header
+  while (std::getline(in, line))
+  {
+    std::istringstream fields(line);
+    unsigned long frame;
+    long left, top, right, bottom;
+    char comma;
+    if (fields >> frame >> comma >> left >> comma >> top >> comma >> right >> comma >> bottom)
+    {
+      faces[frame].push_back(dlib::rectangle(left, top, right, bottom));
+    }
+  }
+  return true;
+}
+
+//Intersection over union of two boxes.
+double overlap(const dlib::rectangle& a, const dlib::rectangle& b)
+{
+  const double shared = a.intersect(b).area();
+  return shared / (a.area() + b.area() - shared);
+}
+
+//A found face counts as a true face if they overlap at least this much.
+const double face_match_overlap = 0.5;
+
+//main-code exports its metrics once a second; at 30 frames per second that is once per this
+//many frames.
+const unsigned long metrics_export_frames = 30;
+
+//Most of the frame time the metrics may take.
+const double max_metrics_overhead = 0.01;
+
+//User plus system CPU time this process has used, in seconds.
+double cpuSeconds()
+{
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+struct NamedHistogram
+{
+  const char* name;
+  LatencyHistogram histogram;
+};
+
+//What the run was configured with and the totals that do not fit in a histogram.
+struct RunSummary
+{
+  std::string input;
+  RasmOptions options;
+  unsigned long frames = 0;
+  unsigned long faces = 0;
+  double fps = 0;
+  unsigned long full_frame_scans = 0;
+  unsigned long region_scans = 0;
+  unsigned long long pixels_scanned = 0;
+  //CPU time over wall time: 1 is one core kept busy.
+  double cpu_seconds = 0;
+  double cpu_utilization = 0;
+  //Only with --faces.
+  bool has_truth = false;
+  unsigned long true_faces = 0;
+  unsigned long faces_matched = 0;
+  unsigned long false_detections = 0;
+  //Time spent counting and exporting the runtime metrics, and that over end-to-end.
+  double metrics_us = 0;
+  double metrics_overhead = 0;
+
+  double detectionRate() const { return frames ? static_cast<double>(faces) / frames : 0; }
+  double recall() const { return true_faces ? static_cast<double>(faces_matched) / true_faces : 0; }
+};
+
+void writeJson(std::ostream& out, const RunSummary& run, const std::vector<NamedHistogram>& stages)
+{
+  const FaceDetectorOptions& detection = run.options.detection;
+  out << "{\n  \"input\": \"" << run.input << "\",\n  \"display\": \"" << displayModeName(run.options.display.mode)
+      << "\",\n  \"landmark_model\": \"" << run.options.landmark_model
+      << "\",\n  \"detector\": \"" << detectorEngineName(run.options.detector.engine)
+      << "\",\n  \"detector_threads\": " << run.options.detector.threads
+      << ",\n  \"detector_input\": \"" << run.options.detector.input_width << "x" << run.options.detector.input_height
+      << "\",\n  \"pose_filter\": \"" << poseFilterModeName(run.options.filter.mode)
+      << "\",\n  \"tracking\": " << (run.options.tracker.enabled ? "true" : "false")
+      << ",\n  \"detect_scale\": " << detection.scale
+      << ",\n  \"detect_roi\": \"" << roiPolicyName(detection.roi) << "\""
+      << ",\n  \"frames\": " << run.frames << ",\n  \"frames_with_face\": " << run.faces
+      << ",\n  \"detection_rate\": " << run.detectionRate()
+      << ",\n  \"full_frame_scans\": " << run.full_frame_scans << ",\n  \"region_scans\": " << run.region_scans
+      << ",\n  \"pixels_scanned\": " << run.pixels_scanned
+      << ",\n  \"cpu_seconds\": " << run.cpu_seconds << ",\n  \"cpu_utilization\": " << run.cpu_utilization
+      << ",\n  \"metrics_us\": " << run.metrics_us << ",\n  \"metrics_overhead\": " << run.metrics_overhead;
+  if (run.has_truth)
+  {
+    out << ",\n  \"true_faces\": " << run.true_faces << ",\n  \"recall\": " << run.recall()
+        << ",\n  \"false_detections\": " << run.false_detections;
+  }
+  out << ",\n  \"frames_per_second\": " << run.fps << ",\n  \"stages\": {\n";
+  for (std::size_t s = 0; s < stages.size(); ++s)
+  {
+    const LatencyHistogram& h = stages[s].histogram;
+    out << "    \"" << stages[s].name << "\": {\"count\": " << h.count() << ", \"mean_us\": " << h.mean()
+        << ", \"p50_us\": " << h.percentile(50) << ", \"p99_us\": " << h.percentile(99)
+        << ", \"max_us\": " << h.max() << ", \"buckets\": [";
+    bool first = true;
+    for (int i = 0; i < LatencyHistogram::bucket_count; ++i)
+    {
+      if (h.bucketCount(i) == 0)
+      {
+        continue;
+      }
+      out << (first ? "" : ", ") << "{\"le_us\": " << LatencyHistogram::bucketLimit(i) << ", \"count\": " << h.bucketCount(i) << "}";
+      first = false;
+    }
+    out << "]}" << (s + 1 < stages.size() ? "," : "") << "\n";
+  }
+  out << "  }\n}\n";
+}
+
+//Long format, one statistic per row, so it pivots easily in a spreadsheet.
+void writeCsv(std::ostream& out, const RunSummary& run, const std::vector<NamedHistogram>& stages)
+{
+  const FaceDetectorOptions& detection = run.options.detection;
+  out << "stage,statistic,value\n";
+  out << "all,input," << run.input << "\n";
+  out << "all,display," << displayModeName(run.options.display.mode) << "\n";
+  out << "all,landmark_model," << run.options.landmark_model << "\n";
+  out << "all,detector," << detectorEngineName(run.options.detector.engine) << "\n";
+  out << "all,detector_threads," << run.options.detector.threads << "\n";
+  out << "all,detector_input," << run.options.detector.input_width << "x" << run.options.detector.input_height << "\n";
+  out << "all,pose_filter," << poseFilterModeName(run.options.filter.mode) << "\n";
+  out << "all,tracking," << (run.options.tracker.enabled ? "true" : "false") << "\n";
+  out << "all,detect_scale," << detection.scale << "\n";
+  out << "all,detect_roi," << roiPolicyName(detection.roi) << "\n";
+  out << "all,frames," << run.frames << "\n";
+  out << "all,frames_with_face," << run.faces << "\n";
+  out << "all,detection_rate," << run.detectionRate() << "\n";
+  out << "all,full_frame_scans," << run.full_frame_scans << "\n";
+  out << "all,region_scans," << run.region_scans << "\n";
+  out << "all,pixels_scanned," << run.pixels_scanned << "\n";
+  out << "all,cpu_seconds," << run.cpu_seconds << "\n";
+  out << "all,cpu_utilization," << run.cpu_utilization << "\n";
+  out << "all,metrics_us," << run.metrics_us << "\n";
+  out << "all,metrics_overhead," << run.metrics_overhead << "\n";
+  if (run.has_truth)
+  {
+    out << "all,true_faces," << run.true_faces << "\n";
+    out << "all,recall," << run.recall() << "\n";
+    out << "all,false_detections," << run.false_detections << "\n";
+  }
+  out << "all,frames_per_second," << run.fps << "\n";
+  for (const NamedHistogram& stage : stages)
+  {
+    const LatencyHistogram& h = stage.histogram;
+    out << stage.name << ",count," << h.count() << "\n";
+    out << stage.name << ",mean_us," << h.mean() << "\n";
+    out << stage.name << ",p50_us," << h.percentile(50) << "\n";
+    out << stage.name << ",p99_us," << h.percentile(99) << "\n";
+    out << stage.name << ",max_us," << h.max() << "\n";
+    for (int i = 0; i < LatencyHistogram::bucket_count; ++i)
+    {
+      if (h.bucketCount(i) != 0)
+      {
+        out << stage.name << ",bucket_le_us_" << LatencyHistogram::bucketLimit(i) << "," << h.bucketCount(i) << "\n";
+      }
+    }
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc < 2)
+  {
+    std::cout << "usage: " << argv[0] << " INPUT [--format=json|csv] [--output=FILE] [--record=FILE]"
+              << " [--record-landmarks=FILE] [--record-poses=FILE] [--record-faces=FILE] [--faces=FILE]"
+              << " [--max-frames=N]"
+              << " [main-code options]" << std::endl;
+    return EXIT_FAILURE;
+  }
+  const std::string input = argv[1];
+  std::string format = "json";
+  std::string output_path;
+  std::string record_path;
+  std::string landmarks_path;
+  std::string poses_path;
+  std::string record_faces_path;
+  std::string faces_path;
+  unsigned long max_frames = 0;
+  //Pick out the benchmark's own options and hand the rest to main-code's parser.
+  std::vector<char*> rest(1, argv[0]);
+  for (int i = 2; i < argc; ++i)
+  {
+    const char* value;
+    if ((value = optionValue(argv[i], "--format")))
+    {
+      format = value;
+    }
+    else if ((value = optionValue(argv[i], "--output")))
+    {
+      output_path = value;
+    }
+    else if ((value = optionValue(argv[i], "--record")))
+    {
+      record_path = value;
+    }
+    else if ((value = optionValue(argv[i], "--record-landmarks")))
+    {
+      landmarks_path = value;
+    }
+    else if ((value = optionValue(argv[i], "--record-poses")))
+    {
+      poses_path = value;
+    }
+    else if ((value = optionValue(argv[i], "--record-faces")))
+    {
+      record_faces_path = value;
+    }
+    else if ((value = optionValue(argv[i], "--faces")))
+    {
+      faces_path = value;
+    }
+    else if ((value = optionValue(argv[i], "--max-frames")))
+    {
+      max_frames = std::strtoul(value, NULL, 10);
+    }
+    else
+    {
+      rest.push_back(argv[i]);
+    }
+  }
+  RasmOptions options;
+  options.display.mode = DISPLAY_OFF;
+  if (!parseOptions((int)rest.size(), rest.data(), options))
+  {
+    return EXIT_FAILURE;
+  }
+  if (format != "json" && format != "csv")
+  {
+    std::cout << "--format must be json or csv" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  options.capture.backend = CAPTURE_FILE;
+  options.capture.device = input;
+  std::unique_ptr<CaptureBackend> source = createCaptureBackend(options.capture);
+  std::unique_ptr<DetectorEngine> detector = createDetectorEngine(options.detector);
+  LandmarkPredictor predictor;
+  if (!source || !detector || !predictor.load(options.landmark_model))
+  {
+    return EXIT_FAILURE;
+  }
+  FaceTracker tracker(*detector, options.tracker, options.detection);
+  FaceList true_faces;
+  if (!faces_path.empty() && !loadFaces(faces_path, true_faces))
+  {
+    std::cout << "Unable to read " << faces_path << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::ofstream found_faces;
+  if (!record_faces_path.empty())
+  {
+    found_faces.open(record_faces_path.c_str());
+    if (!found_faces)
+    {
+      std::cout << "Unable to write " << record_faces_path << std::endl;
+      return EXIT_FAILURE;
+    }
+    found_faces << "frame,left,top,right,bottom\n";
+  }
+  PoseEstimator estimator;
+  PoseFilter filter(options.filter);
+  CommandGenerator generator(options.commands);
+  RecordingSink sink;
+  std::ofstream landmarks;
+  if (!landmarks_path.empty())
+  {
+    landmarks.open(landmarks_path.c_str());
+    if (!landmarks)
+    {
+      std::cout << "Unable to write " << landmarks_path << std::endl;
+      return EXIT_FAILURE;
+    }
+    landmarks << "frame,cols,rows";
+    for (int i = 0; i < 68; ++i)
+    {
+      landmarks << ",x" << i << ",y" << i;
+    }
+    landmarks << "\n";
+  }
+  std::ofstream poses;
+  if (!poses_path.empty())
+  {
+    poses.open(poses_path.c_str());
+    if (!poses)
+    {
+      std::cout << "Unable to write " << poses_path << std::endl;
+      return EXIT_FAILURE;
+    }
+    poses << "frame,captured_us,latency_us,x,y,distance,pitch,yaw,roll\n";
+  }
+
+  enum { CAPTURE, DETECT, LANDMARKS, SOLVE_PNP, EULER, COMMAND, END_TO_END, RENDER };
+  std::vector<NamedHistogram> stages = {
+    {"capture", LatencyHistogram()}, {"detect", LatencyHistogram()}, {"landmarks", LatencyHistogram()},
+    {"solve_pnp", LatencyHistogram()}, {"euler", LatencyHistogram()}, {"command", LatencyHistogram()},
+    {"end_to_end", LatencyHistogram()}, {"render", LatencyHistogram()}};
+
+  MetricsRegistry registry;
+  PipelineMetrics metrics(registry);
+  std::ostringstream exported;
+
+  RunSummary run;
+  run.input = input;
+  run.options = options;
+  run.has_truth = !faces_path.empty();
+  unsigned long& frames = run.frames;
+  unsigned long& faces = run.faces;
+  const pipeline_clock::time_point run_start = pipeline_clock::now();
+  const double cpu_start = cpuSeconds();
+  CapturedImage image;
+  while (max_frames == 0 || frames < max_frames)
+  {
+    Frame frame;
+    frame.id = frames;
+    const pipeline_clock::time_point start = pipeline_clock::now();
+    if (!source->read(image, detector->needsColor() || wantsDisplay(options.display, frame)))
+    {
+      break;
+    }
+    frame.captured = image.captured;
+    frame.image = image.bgr;
+    frame.gray = image.gray;
+    frame.times.capture_us = elapsedMicroseconds(start);
+    ++frames;
+
+    detectFace(tracker, predictor, *detector, frame);
+    if (estimatePose(estimator, filter, generator, frame))
+    {
+      sink.submit(frame.command);
+    }
+    const double end_to_end_us = elapsedMicroseconds(start);
+
+    //What main-code's stage threads add to every frame, and its exporter thread once a second.
+    const pipeline_clock::time_point metrics_start = pipeline_clock::now();
+    metrics.captured(frame.times);
+    metrics.detected(frame.times, frame.has_face);
+    metrics.posed(frame.times, frame.has_face, frame.has_face, end_to_end_us);
+    if (frames % metrics_export_frames == 0)
+    {
+      exported.str("");
+      registry.writePrometheus(exported);
+    }
+    run.metrics_us += elapsedMicroseconds(metrics_start);
+    if (frame.has_face && poses.is_open())
+    {
+      const FacePose& p = frame.pose;
+      poses << frame.id << ',' << std::chrono::duration<double, std::micro>(frame.captured - run_start).count() << ','
+            << elapsedMicroseconds(frame.captured) << ',' << p.x_pos << ',' << p.y_pos << ',' << p.z_pos << ','
+            << p.pitch << ',' << p.yaw << ',' << p.roll << '\n';
+    }
+
+    stages[CAPTURE].histogram.record(frame.times.capture_us);
+    stages[DETECT].histogram.record(frame.times.detect_us);
+    if (frame.has_face)
+    {
+      ++faces;
+      if (landmarks.is_open())
+      {
+        landmarks << frame.id << ',' << frameWidth(frame) << ',' << frameHeight(frame);
+        for (unsigned long i = 0; i < frame.shape.num_parts(); ++i)
+        {
+          landmarks << ',' << frame.shape.part(i).x() << ',' << frame.shape.part(i).y();
+        }
+        landmarks << '\n';
+      }
+      stages[LANDMARKS].histogram.record(frame.times.landmarks_us);
+      stages[SOLVE_PNP].histogram.record(frame.times.solve_pnp_us);
+      stages[EULER].histogram.record(frame.times.euler_us);
+      stages[COMMAND].histogram.record(frame.times.command_us);
+    }
+    stages[END_TO_END].histogram.record(end_to_end_us);
+
+    if (frame.has_face && found_faces.is_open())
+    {
+      found_faces << frame.id << ',' << frame.face.left() << ',' << frame.face.top() << ','
+                  << frame.face.right() << ',' << frame.face.bottom() << '\n';
+    }
+    if (run.has_truth)
+    {
+      //main-code follows one face, so a frame scores a match if its face is any of the true
+      //ones there.
+      const FaceList::const_iterator truth = true_faces.find(frame.id);
+      const std::size_t count = truth == true_faces.end() ? 0 : truth->second.size();
+      run.true_faces += count;
+      if (frame.has_face)
+      {
+        bool matched = false;
+        for (std::size_t i = 0; i < count && !matched; ++i)
+        {
+          matched = overlap(frame.face, truth->second[i]) >= face_match_overlap;
+        }
+        if (matched)
+        {
+          ++run.faces_matched;
+        }
+        else
+        {
+          ++run.false_detections;
+        }
+      }
+    }
+
+    if (wantsDisplay(options.display, frame))
+    {
+      const pipeline_clock::time_point render_start = pipeline_clock::now();
+      renderFrame(options.display, frame);
+      stages[RENDER].histogram.record(elapsedMicroseconds(render_start));
+    }
+  }
+  const double seconds = elapsedMicroseconds(run_start) / 1e6;
+  run.fps = seconds > 0 ? frames / seconds : 0;
+  run.cpu_seconds = cpuSeconds() - cpu_start;
+  run.cpu_utilization = seconds > 0 ? run.cpu_seconds / seconds : 0;
+  run.full_frame_scans = tracker.faceDetector().fullFrameScans();
+  run.region_scans = tracker.faceDetector().regionScans();
+  run.pixels_scanned = tracker.faceDetector().pixelsScanned();
+  const double end_to_end_total_us = stages[END_TO_END].histogram.mean() * stages[END_TO_END].histogram.count();
+  run.metrics_overhead = end_to_end_total_us > 0 ? run.metrics_us / end_to_end_total_us : 0;
+
+  std::ofstream file;
+  if (!output_path.empty())
+  {
+    file.open(output_path.c_str());
+    if (!file)
+    {
+      std::cout << "Unable to write " << output_path << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  std::ostream& out = output_path.empty() ? std::cout : file;
+  if (format == "json")
+  {
+    writeJson(out, run, stages);
+  }
+  else
+  {
+    writeCsv(out, run, stages);
+  }
+  if (!record_path.empty() && !sink.write(record_path))
+  {
+    std::cout << "Unable to write " << record_path << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (run.metrics_overhead >= max_metrics_overhead)
+  {
+    std::cerr << "The runtime metrics took " << run.metrics_overhead * 100 << "% of the frame time" << std::endl;
+    return EXIT_FAILURE;
+  }
+  return 0;
+}
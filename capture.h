@@ -0,0 +1,614 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <linux/videodev2.h>
+#include <memory>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include "motion_command.h"
+
+//Where frames come from.
+enum CaptureBackendType
+{
+  CAPTURE_OPENCV,   //cv::VideoCapture, BGR frames (what main-code always used)
+  CAPTURE_V4L2,     //the camera's V4L2 driver directly, through a ring of mmap'd buffers
+  CAPTURE_FILE      //a video file, a directory of images or a raw YUYV recording
+};
+
+struct CaptureOptions
+{
+  CaptureBackendType backend = CAPTURE_OPENCV;
+  //Camera number or device path (/dev/video1), or for CAPTURE_FILE the file or directory.
+  std::string device = "1";
+  //Frame size asked of a V4L2 camera, and the size of the frames in a raw .yuyv file.
+  int width = 640;
+  int height = 480;
+  //Driver buffers in the V4L2 ring.
+  int buffers = 6;
+};
+
+inline const char* captureBackendName(CaptureBackendType backend)
+{
+  switch (backend)
+  {
+    case CAPTURE_OPENCV:
+      return "opencv";
+    case CAPTURE_V4L2:
+      return "v4l2";
+    case CAPTURE_FILE:
+      return "file";
+  }
+  return "unknown";
+}
+
+//Returns false if name is not one of the names captureBackendName() gives out.
+inline bool parseCaptureBackend(const char* name, CaptureBackendType& backend)
+{
+  const CaptureBackendType backends[] = {CAPTURE_OPENCV, CAPTURE_V4L2, CAPTURE_FILE};
+  for (CaptureBackendType b : backends)
+  {
+    if (std::strcmp(name, captureBackendName(b)) == 0)
+    {
+      backend = b;
+      return true;
+    }
+  }
+  return false;
+}
+
+//One grabbed frame. A backend that has luminance from the camera fills in gray and only
+//converts to BGR when asked to; one that decodes to BGR anyway (OpenCV, video files) fills
+//in bgr and leaves gray empty.
+struct CapturedImage
+{
+  cv::Mat gray;
+  cv::Mat bgr;
+  //When the frame was exposed: the driver's timestamp where there is one, otherwise when
+  //the backend got it.
+  pipeline_clock::time_point captured;
+  //Keeps a driver buffer out of the capture ring while gray points into it.
+  std::shared_ptr<void> buffer;
+};
+
+//Hands out images to fill without allocating a new one per frame: an image is reused once
+//nothing outside the pool refers to it any more (every stage has let go of the frame).
+class MatPool
+{
+public:
+  cv::Mat get(int rows, int cols, int type)
+  {
+    for (cv::Mat& mat : mats)
+    {
+      if (mat.u && CV_XADD(&mat.u->refcount, 0) == 1 && mat.rows == rows && mat.cols == cols && mat.type() == type)
+      {
+        return mat;
+      }
+    }
+    mats.push_back(cv::Mat(rows, cols, type));
+    return mats.back();
+  }
+
+  std::size_t size() const { return mats.size(); }
+
+private:
+  std::vector<cv::Mat> mats;
+};
+
+//Conversions from packed YUYV (Y0 U Y1 V), shared by the V4L2 and file backends.
+inline void yuyvToGray(const cv::Mat& yuyv, cv::Mat& gray)
+{
+  cv::extractChannel(yuyv, gray, 0);
+}
+
+inline void yuyvToBgr(const cv::Mat& yuyv, cv::Mat& bgr)
+{
+  cv::cvtColor(yuyv, bgr, cv::COLOR_YUV2BGR_YUYV);
+}
+
+//A source of frames.
+class CaptureBackend
+{
+public:
+  CaptureBackend() : zero_copy_frames(0), copied_frames(0), at_end(false) {}
+  virtual ~CaptureBackend() {}
+
+  //Returns false (after saying why) if the source cannot be opened.
+  virtual bool open(const CaptureOptions& options) = 0;
+
+  //The next frame. want_bgr asks for image.bgr as well as image.gray (backends that only
+  //make BGR always fill it in). Returns false at the end of a file, or if the camera had
+  //nothing to give.
+  virtual bool read(CapturedImage& image, bool want_bgr) = 0;
+
+  //True once read() has returned false because there are no frames left (the end of a video
+  //file, a raw recording or a directory of images). A camera never ends; a false read() from
+  //one is worth trying again.
+  bool ended() const { return at_end; }
+
+  virtual CaptureBackendType type() const = 0;
+  const char* name() const { return captureBackendName(type()); }
+
+  //Frames whose gray image points straight into a driver (or file) buffer, and frames that
+  //had to be copied or converted.
+  unsigned long zeroCopyFrames() const { return zero_copy_frames; }
+  unsigned long copiedFrames() const { return copied_frames; }
+
+protected:
+  unsigned long zero_copy_frames;
+  unsigned long copied_frames;
+  bool at_end;
+  MatPool gray_pool;
+  MatPool bgr_pool;
+};
+
+//cv::VideoCapture, as main-code always used it, but filling pooled images instead of a new
+//one per frame. Frames come out BGR only.
+class OpenCvCapture : public CaptureBackend
+{
+public:
+  bool open(const CaptureOptions& options) override
+  {
+    char* end;
+    const long index = std::strtol(options.device.c_str(), &end, 10);
+    const bool opened = *end == '\0' ? capture.open(static_cast<int>(index)) : capture.open(options.device);
+    if (!opened)
+    {
+      std::cout << "Unable to connect to camera " << options.device << std::endl;
+    }
+    //VideoCapture plays video files as well; those run out.
+    struct stat info;
+    from_file = *end != '\0' && stat(options.device.c_str(), &info) == 0 && S_ISREG(info.st_mode);
+    return opened;
+  }
+
+  bool read(CapturedImage& image, bool) override
+  {
+    if (!capture.grab())
+    {
+      at_end = from_file;
+      return false;
+    }
+    image.captured = pipeline_clock::now();
+    image.gray.release();
+    image.buffer.reset();
+    image.bgr = bgr_pool.get(rows, cols, CV_8UC3);
+    if (!capture.retrieve(image.bgr) || image.bgr.empty())
+    {
+      return false;
+    }
+    rows = image.bgr.rows;
+    cols = image.bgr.cols;
+    ++copied_frames;
+    return true;
+  }
+
+  CaptureBackendType type() const override { return CAPTURE_OPENCV; }
+
+private:
+  cv::VideoCapture capture;
+  bool from_file = false;
+  int rows = 480;
+  int cols = 640;
+};
+
+//The driver side of a V4L2 capture: the device and its mmap'd buffers. Frames that point
+//into a buffer hold a reference to the ring, so the buffers stay mapped until the last of
+//them is gone, even after the backend itself is closed.
+struct V4l2Ring
+{
+  int fd = -1;
+  std::vector<void*> starts;
+  std::vector<std::size_t> lengths;
+  //Buffers handed out with a frame and not given back to the driver yet.
+  std::atomic<int> held{0};
+
+  ~V4l2Ring()
+  {
+    if (fd >= 0)
+    {
+      v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+      ioctl(fd, VIDIOC_STREAMOFF, &type);
+    }
+    for (std::size_t i = 0; i < starts.size(); ++i)
+    {
+      munmap(starts[i], lengths[i]);
+    }
+    if (fd >= 0)
+    {
+      close(fd);
+    }
+  }
+
+  bool requeue(unsigned int index)
+  {
+    v4l2_buffer buf;
+    std::memset(&buf, 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = index;
+    return xioctl(fd, VIDIOC_QBUF, &buf);
+  }
+
+  static bool xioctl(int fd, unsigned long request, void* arg)
+  {
+    int r;
+    do
+    {
+      r = ioctl(fd, request, arg);
+    } while (r == -1 && errno == EINTR);
+    return r != -1;
+  }
+};
+
+//Reads the camera through V4L2 with a ring of driver buffers mmap'd into the process, so
+//nothing is copied out of the kernel and nothing is allocated per frame. The camera is
+//asked for 8-bit grayscale (GREY) first and packed YUYV otherwise. With GREY the detector
+//gets a cv::Mat straight over the driver buffer, which goes back to the driver once every
+//stage is done with the frame. YUYV interleaves the chroma with the luminance, so there
+//the Y channel is pulled out into a pooled image in one pass and the buffer goes straight
+//back. BGR is only made when asked for.
+class V4l2Capture : public CaptureBackend
+{
+public:
+  bool open(const CaptureOptions& options) override
+  {
+    std::string path = options.device;
+    char* end;
+    std::strtol(path.c_str(), &end, 10);
+    if (!path.empty() && *end == '\0')
+    {
+      path = "/dev/video" + path;
+    }
+    ring = std::make_shared<V4l2Ring>();
+    ring->fd = ::open(path.c_str(), O_RDWR | O_NONBLOCK);
+    if (ring->fd < 0)
+    {
+      return fail(path, "open");
+    }
+    v4l2_capability capability;
+    std::memset(&capability, 0, sizeof(capability));
+    if (!V4l2Ring::xioctl(ring->fd, VIDIOC_QUERYCAP, &capability) ||
+        !(capability.capabilities & V4L2_CAP_VIDEO_CAPTURE) || !(capability.capabilities & V4L2_CAP_STREAMING))
+    {
+      return fail(path, "not a streaming capture device");
+    }
+
+    const uint32_t formats[] = {V4L2_PIX_FMT_GREY, V4L2_PIX_FMT_YUYV};
+    bool have_format = false;
+    for (uint32_t pixel_format : formats)
+    {
+      std::memset(&format, 0, sizeof(format));
+      format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+      format.fmt.pix.width = options.width;
+      format.fmt.pix.height = options.height;
+      format.fmt.pix.pixelformat = pixel_format;
+      format.fmt.pix.field = V4L2_FIELD_NONE;
+      //The driver may pick another format; only take the one asked for.
+      if (V4l2Ring::xioctl(ring->fd, VIDIOC_S_FMT, &format) && format.fmt.pix.pixelformat == pixel_format)
+      {
+        have_format = true;
+        break;
+      }
+    }
+    if (!have_format)
+    {
+      return fail(path, "neither GREY nor YUYV frames");
+    }
+
+    v4l2_requestbuffers request;
+    std::memset(&request, 0, sizeof(request));
+    request.count = options.buffers;
+    request.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    request.memory = V4L2_MEMORY_MMAP;
+    if (!V4l2Ring::xioctl(ring->fd, VIDIOC_REQBUFS, &request) || request.count < 2)
+    {
+      return fail(path, "buffer request");
+    }
+    for (unsigned int i = 0; i < request.count; ++i)
+    {
+      v4l2_buffer buf;
+      std::memset(&buf, 0, sizeof(buf));
+      buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+      buf.memory = V4L2_MEMORY_MMAP;
+      buf.index = i;
+      if (!V4l2Ring::xioctl(ring->fd, VIDIOC_QUERYBUF, &buf))
+      {
+        return fail(path, "buffer query");
+      }
+      void* start = mmap(NULL, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, buf.m.offset);
+      if (start == MAP_FAILED)
+      {
+        return fail(path, "mmap");
+      }
+      ring->starts.push_back(start);
+      ring->lengths.push_back(buf.length);
+      if (!ring->requeue(i))
+      {
+        return fail(path, "queueing a buffer");
+      }
+    }
+    v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (!V4l2Ring::xioctl(ring->fd, VIDIOC_STREAMON, &type))
+    {
+      return fail(path, "stream on");
+    }
+    return true;
+  }
+
+  bool read(CapturedImage& image, bool want_bgr) override
+  {
+    //Wait up to a second for a frame, so a stalled camera cannot hang the capture thread.
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(ring->fd, &fds);
+    timeval timeout = {1, 0};
+    if (select(ring->fd + 1, &fds, NULL, NULL, &timeout) <= 0)
+    {
+      return false;
+    }
+    v4l2_buffer buf;
+    std::memset(&buf, 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    if (!V4l2Ring::xioctl(ring->fd, VIDIOC_DQBUF, &buf))
+    {
+      return false;
+    }
+    image.captured = captureTime(buf);
+    const int rows = format.fmt.pix.height;
+    const int cols = format.fmt.pix.width;
+    const std::size_t step = format.fmt.pix.bytesperline;
+    void* data = ring->starts[buf.index];
+    image.bgr.release();
+    image.buffer.reset();
+
+    if (format.fmt.pix.pixelformat == V4L2_PIX_FMT_GREY)
+    {
+      const cv::Mat frame(rows, cols, CV_8UC1, data, step);
+      if (want_bgr)
+      {
+        image.bgr = bgr_pool.get(rows, cols, CV_8UC3);
+        cv::cvtColor(frame, image.bgr, cv::COLOR_GRAY2BGR);
+      }
+      //Keep the driver from running dry: with the ring nearly all handed out, copy the
+      //frame and give the buffer straight back.
+      if (ring->held.load() + 2 < static_cast<int>(ring->starts.size()))
+      {
+        ++ring->held;
+        image.gray = frame;
+        std::shared_ptr<V4l2Ring> owner = ring;
+        const unsigned int index = buf.index;
+        image.buffer = std::shared_ptr<void>(data, [owner, index](void*)
+                                             {
+                                               --owner->held;
+                                               owner->requeue(index);
+                                             });
+        ++zero_copy_frames;
+        return true;
+      }
+      image.gray = gray_pool.get(rows, cols, CV_8UC1);
+      frame.copyTo(image.gray);
+    }
+    else
+    {
+      const cv::Mat frame(rows, cols, CV_8UC2, data, step);
+      image.gray = gray_pool.get(rows, cols, CV_8UC1);
+      yuyvToGray(frame, image.gray);
+      if (want_bgr)
+      {
+        image.bgr = bgr_pool.get(rows, cols, CV_8UC3);
+        yuyvToBgr(frame, image.bgr);
+      }
+    }
+    ++copied_frames;
+    return ring->requeue(buf.index);
+  }
+
+  CaptureBackendType type() const override { return CAPTURE_V4L2; }
+
+  //FOURCC of the frames the camera sends.
+  uint32_t pixelFormat() const { return format.fmt.pix.pixelformat; }
+
+private:
+  bool fail(const std::string& path, const char* what)
+  {
+    std::cout << "V4L2 capture from " << path << ": " << what << " failed (" << std::strerror(errno) << ")" << std::endl;
+    ring.reset();
+    return false;
+  }
+
+  //The driver stamps each buffer when it fills it. With a monotonic timestamp that is the
+  //same clock as pipeline_clock on Linux, so the frame's age includes the time it spent
+  //in the driver.
+  static pipeline_clock::time_point captureTime(const v4l2_buffer& buf)
+  {
+    if ((buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)
+    {
+      const std::chrono::nanoseconds stamp = std::chrono::seconds(buf.timestamp.tv_sec) +
+                                             std::chrono::microseconds(buf.timestamp.tv_usec);
+      return pipeline_clock::time_point(std::chrono::duration_cast<pipeline_clock::duration>(stamp));
+    }
+    return pipeline_clock::now();
+  }
+
+  std::shared_ptr<V4l2Ring> ring;
+  v4l2_format format;
+};
+
+//Frames from disk, for running and benchmarking without a camera. A raw .yuyv file (frames
+//of CaptureOptions' size back to back, e.g. from 'v4l2-ctl --stream-mmap --stream-to=FILE')
+//is mmap'd and goes through the same YUYV path as the V4L2 backend. Anything else is a video
+//file or a directory of images (read in file name order), decoded to BGR by OpenCV.
+class FileCapture : public CaptureBackend
+{
+public:
+  FileCapture() : raw(NULL), raw_size(0), raw_offset(0), next_file(0) {}
+
+  ~FileCapture() override
+  {
+    if (raw)
+    {
+      munmap(raw, raw_size);
+    }
+  }
+
+  bool open(const CaptureOptions& options) override
+  {
+    const std::string& path = options.device;
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0)
+    {
+      std::cout << "Unable to read frames from " << path << std::endl;
+      return false;
+    }
+    if (S_ISDIR(info.st_mode))
+    {
+      cv::glob(path + "/*", files, false);
+      next_file = 0;
+      if (files.empty())
+      {
+        std::cout << "No images in " << path << std::endl;
+      }
+      return !files.empty();
+    }
+    const std::string extension = ".yuyv";
+    if (path.size() > extension.size() && path.compare(path.size() - extension.size(), extension.size(), extension) == 0)
+    {
+      return openRaw(path, info.st_size, options);
+    }
+    if (!video.open(path))
+    {
+      std::cout << "Unable to read frames from " << path << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  bool read(CapturedImage& image, bool want_bgr) override
+  {
+    image.captured = pipeline_clock::now();
+    image.buffer.reset();
+    if (raw)
+    {
+      if (raw_offset + frame_bytes > raw_size)
+      {
+        at_end = true;
+        return false;
+      }
+      const cv::Mat frame(rows, cols, CV_8UC2, static_cast<char*>(raw) + raw_offset);
+      raw_offset += frame_bytes;
+      image.gray = gray_pool.get(rows, cols, CV_8UC1);
+      yuyvToGray(frame, image.gray);
+      image.bgr.release();
+      if (want_bgr)
+      {
+        image.bgr = bgr_pool.get(rows, cols, CV_8UC3);
+        yuyvToBgr(frame, image.bgr);
+      }
+      ++copied_frames;
+      return true;
+    }
+    image.gray.release();
+    if (video.isOpened())
+    {
+      image.bgr = bgr_pool.get(rows, cols, CV_8UC3);
+      if (!video.read(image.bgr) || image.bgr.empty())
+      {
+        at_end = true;
+        return false;
+      }
+      rows = image.bgr.rows;
+      cols = image.bgr.cols;
+      ++copied_frames;
+      return true;
+    }
+    while (next_file < files.size())
+    {
+      image.bgr = cv::imread(files[next_file++]);
+      if (!image.bgr.empty())
+      {
+        ++copied_frames;
+        return true;
+      }
+    }
+    at_end = true;
+    return false;
+  }
+
+  CaptureBackendType type() const override { return CAPTURE_FILE; }
+
+private:
+  bool openRaw(const std::string& path, std::size_t size, const CaptureOptions& options)
+  {
+    rows = options.height;
+    cols = options.width;
+    frame_bytes = static_cast<std::size_t>(rows) * cols * 2;
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0 || size < frame_bytes)
+    {
+      std::cout << "Unable to read " << options.width << "x" << options.height << " YUYV frames from " << path << std::endl;
+      if (fd >= 0)
+      {
+        close(fd);
+      }
+      return false;
+    }
+    raw = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (raw == MAP_FAILED)
+    {
+      raw = NULL;
+      std::cout << "Unable to map " << path << std::endl;
+      return false;
+    }
+    raw_size = size;
+    raw_offset = 0;
+    return true;
+  }
+
+  void* raw;
+  std::size_t raw_size;
+  std::size_t raw_offset;
+  std::size_t frame_bytes = 0;
+  int rows = 480;
+  int cols = 640;
+  cv::VideoCapture video;
+  std::vector<cv::String> files;
+  std::size_t next_file;
+};
+
+//Makes and opens the backend options asks for. Returns NULL if it cannot be opened.
+inline std::unique_ptr<CaptureBackend> createCaptureBackend(const CaptureOptions& options)
+{
+  std::unique_ptr<CaptureBackend> backend;
+  switch (options.backend)
+  {
+    case CAPTURE_OPENCV:
+      backend.reset(new OpenCvCapture());
+      break;
+    case CAPTURE_V4L2:
+      backend.reset(new V4l2Capture());
+      break;
+    case CAPTURE_FILE:
+      backend.reset(new FileCapture());
+      break;
+  }
+  if (backend && !backend->open(options))
+  {
+    backend.reset();
+  }
+  return backend;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <chrono>
+#include <cmath>
+#include "motion_command.h"
+#include "pose_filter.h"
+
+//Deadbands and debounce for CommandGenerator.
+struct CommandGeneratorOptions
+{
+  //Offsets smaller than these count as zero (and the axis as still).
+  double angle_deadband = 5;      //degrees
+  double position_deadband = 3;   //inches
+  //An axis that was still is held at zero until it has been out of its deadband this long.
+  double debounce_ms = 1000;
+};
+
+//Deadband and debounce for one axis, on the pose timeline.
+class AxisDebounce
+{
+public:
+  AxisDebounce() : still(false), last_still(pipeline_clock::time_point::min()) {}
+
+  //Returns value, or 0 if it is inside the deadband or the axis is still being held.
+  double apply(double value, bool in_deadband, pipeline_clock::time_point now, pipeline_clock::duration debounce)
+  {
+    if (still)
+    {
+      last_still = now;
+    }
+    still = in_deadband;
+    if (in_deadband || now < last_still + debounce)
+    {
+      return 0.0;
+    }
+    return value;
+  }
+
+private:
+  bool still;
+  pipeline_clock::time_point last_still;
+};
+
+//Turns face poses into the offsets arduino_main moves the arm by: roll, pitch and yaw in half
+//degrees (the joint turns by half the setpoint), x in tenths of an inch (the elbow turns 0.3
+//degrees for each) and y in half inches (only its sign counts: the base has no encoder and
+//runs at full speed that way). See the joint table in arduino_main.ino. Small offsets are
+//treated as zero, and an axis that has just been still is held at zero for debounce_ms so
+//the arm doesn't twitch. Time is the pose's own timestamp, so the debounce runs on the
+//capture clock (or the predicted one, after PoseFilter) and a replay behaves like the live
+//run.
+class CommandGenerator
+{
+public:
+  explicit CommandGenerator(const CommandGeneratorOptions& options = CommandGeneratorOptions())
+    : options(options),
+      debounce(std::chrono::duration_cast<pipeline_clock::duration>(std::chrono::duration<double, std::milli>(options.debounce_ms))) {}
+
+  void generate(const PoseSample& pose, MotionCommand& command)
+  {
+    const pipeline_clock::time_point now = pose.time;
+    const double roll = pose.axis[AXIS_ROLL];
+    const double pitch = pose.axis[AXIS_PITCH];
+    const double yaw = pose.axis[AXIS_YAW];
+    const double y_pos = pose.axis[AXIS_Y];
+    const double x_pos = pose.axis[AXIS_X];
+
+    command.roll = (int)(still_roll.apply(roll, std::fabs(roll) < options.angle_deadband, now, debounce)*-2);      // #
+    command.pitch = (int)(still_pitch.apply(pitch, std::fabs(pitch) < options.angle_deadband, now, debounce)*2);   // &
+    command.yaw = (int)(still_yaw.apply(yaw, std::fabs(yaw) < options.angle_deadband, now, debounce)*-2);          // *
+    command.y = (int)(still_y.apply(y_pos, std::fabs(y_pos) <= options.position_deadband, now, debounce)*-2);      // $
+    command.x = (int)(-still_x.apply(x_pos, std::fabs(x_pos) <= options.position_deadband, now, debounce)*10);     // ^
+  }
+
+  const CommandGeneratorOptions& settings() const { return options; }
+
+private:
+  CommandGeneratorOptions options;
+  pipeline_clock::duration debounce;
+  AxisDebounce still_roll;
+  AxisDebounce still_pitch;
+  AxisDebounce still_yaw;
+  AxisDebounce still_y;
+  AxisDebounce still_x;
+};
@@ -0,0 +1,378 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <dlib/image_processing/frontal_face_detector.h>
+#include <dlib/opencv.h>
+#include <opencv2/core/core.hpp>
+#include <opencv2/dnn/dnn.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include "parallel_hog_detector.h"
+//cv::FaceDetectorYN, which runs YuNet, came with OpenCV 4.5.4; its int8 model needs 4.8.
+#if CV_VERSION_MAJOR > 4 || (CV_VERSION_MAJOR == 4 && (CV_VERSION_MINOR > 5 || (CV_VERSION_MINOR == 5 && CV_VERSION_REVISION >= 4)))
+#include <opencv2/objdetect.hpp>
+#define RASM_HAVE_YUNET 1
+#endif
+
+//The face detectors main-code can run.
+enum DetectorEngineType
+{
+  ENGINE_HOG,     //dlib's frontal_face_detector (what main-code always used)
+  ENGINE_SSD,     //OpenCV DNN, the ResNet-10 SSD face model (res10_300x300_ssd)
+  ENGINE_YUNET    //OpenCV DNN, the YuNet face model, int8 quantized by default
+};
+
+//Settings for the detector engine, picked at startup. Anything left at 0 or empty gets the
+//engine's default.
+struct DetectorEngineOptions
+{
+  DetectorEngineType engine = ENGINE_HOG;
+  //Model (and, for the SSD, the network description) to load. Relative to the build
+  //directory like the landmark model.
+  std::string model;
+  std::string config;
+  //Threads OpenCV may use for the DNN engines. This is OpenCV's process-wide setting.
+  //With more than one, the HOG detector scans on a pool of its own of that many threads
+  //(parallel_hog_detector.h); otherwise it runs on the calling thread.
+  int threads = 0;
+  //Network input size for the DNN engines; the image is resized to this before it goes in.
+  int input_width = 0;
+  int input_height = 0;
+  //DNN engines drop faces scoring less than this (0-1).
+  float min_score = 0.5f;
+};
+
+inline const char* detectorEngineName(DetectorEngineType engine)
+{
+  switch (engine)
+  {
+    case ENGINE_HOG:
+      return "hog";
+    case ENGINE_SSD:
+      return "ssd";
+    case ENGINE_YUNET:
+      return "yunet";
+  }
+  return "unknown";
+}
+
+//Returns false if name is not one of the names detectorEngineName() gives out.
+inline bool parseDetectorEngine(const char* name, DetectorEngineType& engine)
+{
+  const DetectorEngineType engines[] = {ENGINE_HOG, ENGINE_SSD, ENGINE_YUNET};
+  for (DetectorEngineType e : engines)
+  {
+    if (std::strcmp(name, detectorEngineName(e)) == 0)
+    {
+      engine = e;
+      return true;
+    }
+  }
+  return false;
+}
+
+//Parses "WIDTHxHEIGHT", e.g. 300x300.
+inline bool parseInputSize(const char* text, int& width, int& height)
+{
+  char* end;
+  const long w = std::strtol(text, &end, 10);
+  if (*end != 'x')
+  {
+    return false;
+  }
+  const long h = std::strtol(end + 1, &end, 10);
+  if (*end != '\0' || w <= 0 || h <= 0)
+  {
+    return false;
+  }
+  width = static_cast<int>(w);
+  height = static_cast<int>(h);
+  return true;
+}
+
+//A face detector. FaceDetector decides which part of the frame to look at and at what
+//scale; the engine only finds faces in the image it is handed.
+class DetectorEngine
+{
+public:
+  virtual ~DetectorEngine() {}
+
+  //Loads the model. Returns false (after saying why) if it cannot be used.
+  virtual bool load(const DetectorEngineOptions& options) = 0;
+
+  //Finds the faces in a BGR or 8-bit grayscale image (which may be a region of a larger
+  //cv::Mat), best first, in that image's pixel coordinates.
+  virtual void detect(const cv::Mat& image, std::vector<dlib::rectangle>& faces) = 0;
+
+  //False if the engine does as well on grayscale as on color, so the capture stage can skip
+  //making BGR frames for it.
+  virtual bool needsColor() const { return true; }
+
+  virtual DetectorEngineType type() const = 0;
+  const char* name() const { return detectorEngineName(type()); }
+
+protected:
+  struct ScoredFace
+  {
+    float score;
+    dlib::rectangle rect;
+    bool operator<(const ScoredFace& other) const { return score > other.score; }
+  };
+
+  //Sorts scored best first and copies the rectangles out.
+  static void bestFirst(std::vector<ScoredFace>& scored, std::vector<dlib::rectangle>& faces)
+  {
+    std::sort(scored.begin(), scored.end());
+    faces.clear();
+    for (const ScoredFace& f : scored)
+    {
+      faces.push_back(f.rect);
+    }
+  }
+
+  static void setThreads(int threads)
+  {
+    if (threads > 0)
+    {
+      cv::setNumThreads(threads);
+    }
+  }
+
+  //The networks take three channel input: grayscale is handed in as gray BGR.
+  static const cv::Mat& colorImage(const cv::Mat& image, cv::Mat& converted)
+  {
+    if (image.channels() == 3)
+    {
+      return image;
+    }
+    cv::cvtColor(image, converted, cv::COLOR_GRAY2BGR);
+    return converted;
+  }
+
+  //A face box from the network, in pixels of an image cols x rows, clipped to the image.
+  static dlib::rectangle clippedRect(double left, double top, double right, double bottom, int cols, int rows)
+  {
+    return dlib::rectangle(static_cast<long>(std::max(0.0, left)), static_cast<long>(std::max(0.0, top)),
+                           static_cast<long>(std::min(cols - 1.0, right)), static_cast<long>(std::min(rows - 1.0, bottom)));
+  }
+};
+
+//dlib's HOG + linear SVM frontal face detector. It needs no model file, but only finds
+//faces turned less than about 30 degrees from the camera.
+class HogDetectorEngine : public DetectorEngine
+{
+public:
+  bool load(const DetectorEngineOptions& options) override
+  {
+    detector = dlib::get_frontal_face_detector();
+    if (options.threads > 1)
+    {
+      parallel.reset(new ParallelHogDetector(detector, options.threads));
+    }
+    return true;
+  }
+
+  void detect(const cv::Mat& image, std::vector<dlib::rectangle>& faces) override
+  {
+    //The detector already returns its faces best first. On a color image its HOG features
+    //take the strongest gradient of the three channels at each pixel, so a grayscale image is
+    //cheaper and usually finds the same faces, but not always, and not always at exactly the
+    //same place.
+    if (parallel && image.channels() == 1)
+    {
+      (*parallel)(dlib::cv_image<unsigned char>(image), faces);
+    }
+    else if (parallel)
+    {
+      (*parallel)(dlib::cv_image<dlib::bgr_pixel>(image), faces);
+    }
+    else if (image.channels() == 1)
+    {
+      faces = detector(dlib::cv_image<unsigned char>(image));
+    }
+    else
+    {
+      faces = detector(dlib::cv_image<dlib::bgr_pixel>(image));
+    }
+  }
+
+  bool needsColor() const override { return false; }
+
+  DetectorEngineType type() const override { return ENGINE_HOG; }
+
+private:
+  dlib::frontal_face_detector detector;
+  std::unique_ptr<ParallelHogDetector> parallel;   //the same faces, found on several threads
+};
+
+//The ResNet-10 SSD face detector from OpenCV's samples
+//(https://github.com/opencv/opencv/tree/master/samples/dnn/face_detector) on the CPU. It
+//handles turned and tilted faces much better than HOG. Its cost depends only on the input
+//size, not on the image.
+class SsdDetectorEngine : public DetectorEngine
+{
+public:
+  bool load(const DetectorEngineOptions& options) override
+  {
+    const std::string model = options.model.empty() ? "../data/res10_300x300_ssd_iter_140000_fp16.caffemodel" : options.model;
+    const std::string config = options.config.empty() ? "../data/deploy.prototxt" : options.config;
+    try
+    {
+      net = cv::dnn::readNet(model, config);
+    }
+    catch (const cv::Exception& e)
+    {
+      std::cout << "Unable to load the SSD face model " << model << " (" << config << "): " << e.what() << std::endl;
+      return false;
+    }
+    if (net.empty())
+    {
+      std::cout << "Unable to load the SSD face model " << model << " (" << config << ")" << std::endl;
+      return false;
+    }
+    net.setPreferableBackend(cv::dnn::DNN_BACKEND_OPENCV);
+    net.setPreferableTarget(cv::dnn::DNN_TARGET_CPU);
+    setThreads(options.threads);
+    input_size = cv::Size(options.input_width > 0 ? options.input_width : 300,
+                          options.input_height > 0 ? options.input_height : 300);
+    min_score = options.min_score;
+    return true;
+  }
+
+  void detect(const cv::Mat& image, std::vector<dlib::rectangle>& faces) override
+  {
+    //The model was trained on BGR images with these channel means subtracted.
+    cv::dnn::blobFromImage(colorImage(image, converted), blob, 1.0, input_size, cv::Scalar(104, 177, 123), false, false);
+    net.setInput(blob);
+    output = net.forward();
+    //1 x 1 x N x 7: image, class, score, left, top, right, bottom (0-1)
+    const cv::Mat detections(output.size[2], output.size[3], CV_32F, output.ptr<float>());
+    scored.clear();
+    for (int i = 0; i < detections.rows; ++i)
+    {
+      const float* d = detections.ptr<float>(i);
+      if (d[2] < min_score)
+      {
+        continue;
+      }
+      ScoredFace face;
+      face.score = d[2];
+      face.rect = clippedRect(d[3] * image.cols, d[4] * image.rows, d[5] * image.cols, d[6] * image.rows,
+                              image.cols, image.rows);
+      if (!face.rect.is_empty())
+      {
+        scored.push_back(face);
+      }
+    }
+    bestFirst(scored, faces);
+  }
+
+  DetectorEngineType type() const override { return ENGINE_SSD; }
+
+private:
+  cv::dnn::Net net;
+  cv::Size input_size;
+  float min_score = 0.5f;
+  cv::Mat converted;
+  cv::Mat blob;
+  cv::Mat output;
+  std::vector<ScoredFace> scored;
+};
+
+//YuNet (https://github.com/opencv/opencv_zoo/tree/main/models/face_detection_yunet) through
+//cv::FaceDetectorYN. The default model is the int8 quantized one, which is the cheapest of
+//the three engines on a CPU. The float model loads the same way with --detector-model.
+class YunetDetectorEngine : public DetectorEngine
+{
+public:
+  bool load(const DetectorEngineOptions& options) override
+  {
+#ifdef RASM_HAVE_YUNET
+    const std::string model = options.model.empty() ? "../data/face_detection_yunet_2023mar_int8.onnx" : options.model;
+    setThreads(options.threads);
+    input_size = cv::Size(options.input_width > 0 ? options.input_width : 320,
+                          options.input_height > 0 ? options.input_height : 240);
+    try
+    {
+      detector = cv::FaceDetectorYN::create(model, "", input_size, options.min_score);
+    }
+    catch (const cv::Exception& e)
+    {
+      std::cout << "Unable to load the YuNet face model " << model << ": " << e.what() << std::endl;
+      return false;
+    }
+    return !detector.empty();
+#else
+    (void)options;
+    std::cout << "The yunet detector needs OpenCV 4.5.4 or later (this is " << CV_VERSION << ")" << std::endl;
+    return false;
+#endif
+  }
+
+  void detect(const cv::Mat& image, std::vector<dlib::rectangle>& faces) override
+  {
+    faces.clear();
+#ifdef RASM_HAVE_YUNET
+    cv::resize(colorImage(image, converted), resized, input_size, 0, 0, cv::INTER_LINEAR);
+    detector->detect(resized, output);
+    //One row per face: left, top, width, height, 5 landmarks, score
+    const double sx = static_cast<double>(image.cols) / input_size.width;
+    const double sy = static_cast<double>(image.rows) / input_size.height;
+    scored.clear();
+    for (int i = 0; i < output.rows; ++i)
+    {
+      const float* d = output.ptr<float>(i);
+      ScoredFace face;
+      face.score = d[14];
+      face.rect = clippedRect(d[0] * sx, d[1] * sy, (d[0] + d[2]) * sx, (d[1] + d[3]) * sy, image.cols, image.rows);
+      if (!face.rect.is_empty())
+      {
+        scored.push_back(face);
+      }
+    }
+    bestFirst(scored, faces);
+#else
+    (void)image;
+#endif
+  }
+
+  DetectorEngineType type() const override { return ENGINE_YUNET; }
+
+private:
+#ifdef RASM_HAVE_YUNET
+  cv::Ptr<cv::FaceDetectorYN> detector;
+#endif
+  cv::Size input_size;
+  cv::Mat converted;
+  cv::Mat resized;
+  cv::Mat output;
+  std::vector<ScoredFace> scored;
+};
+
+//Makes and loads the engine options asks for. Returns NULL if it cannot be loaded.
+inline std::unique_ptr<DetectorEngine> createDetectorEngine(const DetectorEngineOptions& options)
+{
+  std::unique_ptr<DetectorEngine> engine;
+  switch (options.engine)
+  {
+    case ENGINE_HOG:
+      engine.reset(new HogDetectorEngine());
+      break;
+    case ENGINE_SSD:
+      engine.reset(new SsdDetectorEngine());
+      break;
+    case ENGINE_YUNET:
+      engine.reset(new YunetDetectorEngine());
+      break;
+  }
+  if (engine && !engine->load(options))
+  {
+    engine.reset();
+  }
+  return engine;
+}
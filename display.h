@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstring>
+#include <opencv2/imgproc/imgproc.hpp>
+#include "face_pose.h"
+#include "pipeline.h"
+
+//How much of the tracking loop is shown on screen.
+enum DisplayMode
+{
+  DISPLAY_OFF,       //no window and no drawing at all; the pose stage never touches the frame
+  DISPLAY_PREVIEW,   //every Nth frame, shrunk, with the landmarks and head cube
+  DISPLAY_FULL       //every frame at full size with the text overlay (what main-code always did)
+};
+
+struct DisplayOptions
+{
+  DisplayMode mode = DISPLAY_FULL;
+  //With DISPLAY_PREVIEW, show one frame out of this many...
+  unsigned long preview_every = 5;
+  //...scaled by this much in each direction.
+  double preview_scale = 0.5;
+};
+
+inline const char* displayModeName(DisplayMode mode)
+{
+  switch (mode)
+  {
+    case DISPLAY_OFF:
+      return "off";
+    case DISPLAY_PREVIEW:
+      return "preview";
+    case DISPLAY_FULL:
+      return "full";
+  }
+  return "unknown";
+}
+
+//Returns false if name is not one of the names displayModeName() gives out.
+inline bool parseDisplayMode(const char* name, DisplayMode& mode)
+{
+  const DisplayMode modes[] = {DISPLAY_OFF, DISPLAY_PREVIEW, DISPLAY_FULL};
+  for (DisplayMode m : modes)
+  {
+    if (std::strcmp(name, displayModeName(m)) == 0)
+    {
+      mode = m;
+      return true;
+    }
+  }
+  return false;
+}
+
+//Whether a frame should go to the display at all. This is checked by the pose stage before
+//it hands a frame on, so frames that are not going to be shown cost nothing past the check.
+inline bool wantsDisplay(const DisplayOptions& options, const Frame& frame)
+{
+  switch (options.mode)
+  {
+    case DISPLAY_OFF:
+      return false;
+    case DISPLAY_PREVIEW:
+      return options.preview_every <= 1 || frame.id % options.preview_every == 0;
+    case DISPLAY_FULL:
+      return true;
+  }
+  return false;
+}
+
+//Turns a frame that finished the pose stage into the image that goes in the window. Runs on
+//its own thread in main-code, so none of the drawing is on the tracking path.
+inline void renderFrame(const DisplayOptions& options, Frame& frame)
+{
+  if (frame.image.empty())
+  {
+    cv::cvtColor(frame.gray, frame.image, cv::COLOR_GRAY2BGR);
+  }
+  if (options.mode == DISPLAY_PREVIEW && options.preview_scale != 1.0)
+  {
+    cv::Mat preview;
+    cv::resize(frame.image, preview, cv::Size(), options.preview_scale, options.preview_scale, cv::INTER_AREA);
+    frame.image = preview;
+  }
+  if (!frame.has_face)
+  {
+    return;
+  }
+  if (options.mode == DISPLAY_PREVIEW)
+  {
+    drawFaceOverlay(frame.image, frame.shape, frame.pose, options.preview_scale);
+  }
+  else
+  {
+    drawFaceOverlay(frame.image, frame.shape, frame.pose);
+    drawPoseText(frame.image, frame.pose, frame.command);
+  }
+}
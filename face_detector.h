@@ -0,0 +1,260 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <type_traits>
+#include <dlib/image_transforms.h>
+#include <dlib/opencv.h>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <vector>
+#include "detector_engine.h"
+
+//Where FaceDetector looks for a face.
+enum FaceRoiPolicy
+{
+  ROI_FULL_FRAME,   //always scan the whole frame (what main.cpp always did)
+  ROI_LAST_FACE,    //scan a padded region around the last face found
+  ROI_MOTION        //scan the region that changed since the last frame, plus the last face
+};
+
+//Settings for FaceDetector. The defaults reproduce a plain detector(img) call.
+struct FaceDetectorOptions
+{
+  //Run the detector on the image shrunk by this much (0.5 halves both sides). Faces come
+  //out in full-resolution coordinates either way, so the shape predictor still gets every
+  //pixel. The HOG detector only finds faces of about 80x80 pixels and up in the image it is
+  //given, so shrinking also raises the smallest face that can be found. The DNN engines
+  //resize to their own input size anyway.
+  double scale = 1.0;
+  FaceRoiPolicy roi = ROI_FULL_FRAME;
+  //How much of the face width/height to add on every side of a region around a face.
+  double roi_padding = 0.5;
+  //With a region policy, scan the whole frame at least this often (0 or 1: every frame), so a
+  //face that shows up somewhere new is still found.
+  unsigned long full_frame_every = 10;
+  //With ROI_MOTION, how much a pixel's intensity has to change (0-255) to count as motion.
+  int motion_threshold = 25;
+};
+
+inline const char* roiPolicyName(FaceRoiPolicy policy)
+{
+  switch (policy)
+  {
+    case ROI_FULL_FRAME:
+      return "full";
+    case ROI_LAST_FACE:
+      return "last-face";
+    case ROI_MOTION:
+      return "motion";
+  }
+  return "unknown";
+}
+
+//Returns false if name is not one of the names roiPolicyName() gives out.
+inline bool parseRoiPolicy(const char* name, FaceRoiPolicy& policy)
+{
+  const FaceRoiPolicy policies[] = {ROI_FULL_FRAME, ROI_LAST_FACE, ROI_MOTION};
+  for (FaceRoiPolicy p : policies)
+  {
+    if (std::strcmp(name, roiPolicyName(p)) == 0)
+    {
+      policy = p;
+      return true;
+    }
+  }
+  return false;
+}
+
+//Front end to the face detector engine that scans less than the full-resolution frame: a
+//shrunk copy of the frame, a region around the last face or the region that moved, or both.
+//Whatever part of the image was scanned, the face comes back in frame coordinates. Images
+//are BGR (dlib::cv_image<dlib::bgr_pixel>) or grayscale (dlib::cv_image<unsigned char>),
+//which is what the engines take.
+class FaceDetector
+{
+public:
+  FaceDetector(DetectorEngine& engine, const FaceDetectorOptions& options)
+    : engine(engine), options(options), has_last_face(false), frames_since_full_frame(0),
+      full_frame_scans(0), region_scans(0), pixels_scanned(0) {}
+
+  //Finds a face in img following the ROI policy, falling back to the whole frame when the
+  //region comes up empty. Returns false if there is no face.
+  template <typename image_type>
+  bool detect(const image_type& img, dlib::rectangle& face)
+  {
+    dlib::rectangle roi;
+    bool use_roi = false;
+    if (options.roi != ROI_FULL_FRAME && frames_since_full_frame + 1 < options.full_frame_every)
+    {
+      if (options.roi == ROI_MOTION)
+      {
+        use_roi = motionRegion(img, roi);
+      }
+      if (has_last_face)
+      {
+        roi = roi.is_empty() ? paddedRegion(last_face) : roi + paddedRegion(last_face);
+        use_roi = true;
+      }
+    }
+    else if (options.roi == ROI_MOTION)
+    {
+      //Keep the motion reference frame current even on full-frame scans.
+      motionRegion(img, roi);
+    }
+    if (use_roi)
+    {
+      ++frames_since_full_frame;
+      if (detectInRegion(img, roi, face))
+      {
+        return true;
+      }
+    }
+    return detectFullFrame(img, face);
+  }
+
+  //Scans the whole frame (at the configured scale).
+  template <typename image_type>
+  bool detectFullFrame(const image_type& img, dlib::rectangle& face)
+  {
+    ++full_frame_scans;
+    frames_since_full_frame = 0;
+    return remember(scan(img, dlib::get_rect(img), face), face);
+  }
+
+  //Scans a padded region around face_hint (at the configured scale).
+  template <typename image_type>
+  bool detectAround(const image_type& img, const dlib::rectangle& face_hint, dlib::rectangle& face)
+  {
+    return detectInRegion(img, paddedRegion(face_hint), face);
+  }
+
+  //Scans only roi (at the configured scale).
+  template <typename image_type>
+  bool detectInRegion(const image_type& img, dlib::rectangle roi, dlib::rectangle& face)
+  {
+    roi = roi.intersect(dlib::get_rect(img));
+    if (roi.is_empty())
+    {
+      return false;
+    }
+    ++region_scans;
+    return remember(scan(img, roi, face), face);
+  }
+
+  const FaceDetectorOptions& settings() const { return options; }
+  const DetectorEngine& detectorEngine() const { return engine; }
+  unsigned long fullFrameScans() const { return full_frame_scans; }
+  unsigned long regionScans() const { return region_scans; }
+  //Pixels the detector engine was handed, after cropping and scaling.
+  unsigned long long pixelsScanned() const { return pixels_scanned; }
+
+private:
+  //The detector itself: crop to roi, shrink, detect and map the result back.
+  template <typename image_type>
+  bool scan(const image_type& img, const dlib::rectangle& roi, dlib::rectangle& face)
+  {
+    typedef typename dlib::image_traits<image_type>::pixel_type pixel_type;
+    static_assert(std::is_same<pixel_type, dlib::bgr_pixel>::value || std::is_same<pixel_type, unsigned char>::value,
+                  "FaceDetector works on BGR or grayscale images");
+    //A cv::Mat header over img's pixels, no copy.
+    const cv::Mat frame = dlib::toMat(const_cast<image_type&>(img));
+    const cv::Mat region = roi == dlib::get_rect(img) ? frame : frame(cv::Rect(roi.left(), roi.top(), roi.width(), roi.height()));
+    if (options.scale == 1.0)
+    {
+      pixels_scanned += roi.area();
+      engine.detect(region, faces);
+      if (faces.empty())
+      {
+        return false;
+      }
+      face = dlib::translate_rect(faces[0], roi.tl_corner());
+      return true;
+    }
+    //scaled is kept between calls, so the shrunk copy is only reallocated when the region
+    //size changes.
+    const long rows = std::max(1L, static_cast<long>(roi.height() * options.scale));
+    const long cols = std::max(1L, static_cast<long>(roi.width() * options.scale));
+    cv::resize(region, scaled, cv::Size(cols, rows), 0, 0, cv::INTER_LINEAR);
+    pixels_scanned += scaled.total();
+    engine.detect(scaled, faces);
+    if (faces.empty())
+    {
+      return false;
+    }
+    const double sx = static_cast<double>(roi.width()) / cols;
+    const double sy = static_cast<double>(roi.height()) / rows;
+    face = dlib::rectangle(roi.left() + static_cast<long>(faces[0].left() * sx),
+                           roi.top() + static_cast<long>(faces[0].top() * sy),
+                           roi.left() + static_cast<long>((faces[0].right() + 1) * sx) - 1,
+                           roi.top() + static_cast<long>((faces[0].bottom() + 1) * sy) - 1);
+    return true;
+  }
+
+  bool remember(bool found, const dlib::rectangle& face)
+  {
+    has_last_face = found;
+    if (found)
+    {
+      last_face = face;
+    }
+    return found;
+  }
+
+  dlib::rectangle paddedRegion(const dlib::rectangle& face) const
+  {
+    const long pad_x = static_cast<long>(face.width() * options.roi_padding);
+    const long pad_y = static_cast<long>(face.height() * options.roi_padding);
+    return dlib::rectangle(face.left() - pad_x, face.top() - pad_y, face.right() + pad_x, face.bottom() + pad_y);
+  }
+
+  //Compares a small grayscale copy of img with the one from the previous call and returns the
+  //bounding box of the pixels that changed, in frame coordinates. False if nothing moved.
+  template <typename image_type>
+  bool motionRegion(const image_type& img, dlib::rectangle& region)
+  {
+    const long rows = std::max(1L, dlib::num_rows(img) / motion_factor);
+    const long cols = std::max(1L, dlib::num_columns(img) / motion_factor);
+    motion_current.set_size(rows, cols);
+    dlib::resize_image(img, motion_current);
+    const bool comparable = motion_previous.nr() == rows && motion_previous.nc() == cols;
+    dlib::rectangle changed;
+    if (comparable)
+    {
+      for (long r = 0; r < rows; ++r)
+      {
+        for (long c = 0; c < cols; ++c)
+        {
+          if (std::abs(motion_current[r][c] - motion_previous[r][c]) > options.motion_threshold)
+          {
+            changed += dlib::point(c, r);
+          }
+        }
+      }
+    }
+    dlib::swap(motion_current, motion_previous);
+    if (changed.is_empty())
+    {
+      return false;
+    }
+    region = dlib::rectangle(changed.left() * motion_factor, changed.top() * motion_factor,
+                             (changed.right() + 1) * motion_factor - 1, (changed.bottom() + 1) * motion_factor - 1);
+    return true;
+  }
+
+  //Motion is looked for on an image this many times smaller in each direction.
+  static const long motion_factor = 8;
+
+  DetectorEngine& engine;
+  FaceDetectorOptions options;
+  std::vector<dlib::rectangle> faces;
+  cv::Mat scaled;
+  dlib::array2d<unsigned char> motion_current;
+  dlib::array2d<unsigned char> motion_previous;
+  bool has_last_face;
+  dlib::rectangle last_face;
+  unsigned long frames_since_full_frame;
+  unsigned long full_frame_scans;
+  unsigned long region_scans;
+  unsigned long long pixels_scanned;
+};
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <chrono>
+#include <cmath>
+#include <dlib/image_processing.h>
+#include <iomanip>
+#include <opencv2/calib3d/calib3d.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <sstream>
+#include <vector>
+#include "head_pose_solver.h"
+#include "motion_command.h"
+#include "pose_filter.h"
+#include "stage_timing.h"
+
+//Intrisics can be calculated using opencv sample code under opencv/sources/samples/cpp/tutorial_code/calib3d
+//Normally, you can also apprximate fx and fy by image width, cx by half image width, cy by half image height instead
+static double K[9] = {7.3530833553043510e+02, 0.0, 320.0, 0.0, 7.3530833553043510e+02, 240.0, 0.0, 0.0, 1.0};
+static double D[5] = {-2.3528667558034226e-02, 1.3301431879108856e+00, 0.0, 0.0,
+    -6.0786673300480434e+00};
+const double centimeter_to_inch_conversion = 1/2.54;
+
+//Where the face is relative to the camera, worked out from one set of landmarks.
+struct FacePose
+{
+  double x_pos = 0;     //inches, positive to the camera's left
+  double y_pos = 0;     //inches, positive below the middle of the image
+  double z_pos = 0;     //inches, minus the distance along the optical axis (negative in front)
+  double pitch = 0;     //degrees about the camera's x axis (right in the image)
+  double yaw = 0;       //degrees about its y axis (down the image)
+  double roll = 0;      //degrees about its optical axis; R = Rz(roll) Ry(yaw) Rx(pitch)
+  double reprojection_error = 0;   //RMS distance of the landmarks from the fitted model, pixels
+  //corners of a 20x20x20 cube around the head model, projected into the image
+  cv::Point2d reprojectdst[8];
+};
+
+//reproject 3D points world coordinate axis to verify result pose
+const cv::Point3d reprojectsrc[8] = {
+  cv::Point3d(10.0, 10.0, 10.0),
+  cv::Point3d(10.0, 10.0, -10.0),
+  cv::Point3d(10.0, -10.0, -10.0),
+  cv::Point3d(10.0, -10.0, 10.0),
+  cv::Point3d(-10.0, 10.0, 10.0),
+  cv::Point3d(-10.0, 10.0, -10.0),
+  cv::Point3d(-10.0, -10.0, -10.0),
+  cv::Point3d(-10.0, -10.0, 10.0)
+};
+
+//Head pose from the 68 iBUG landmarks: HeadPoseSolver against a generic 3D head model, then
+//the Euler angles and the position of the face in inches.
+class PoseEstimator
+{
+public:
+  explicit PoseEstimator(const HeadPoseSolverOptions& options = HeadPoseSolverOptions())
+    : solver(cv::Matx33d(K), cv::Vec<double, 5>(D), options) {}
+
+  //image_cols/image_rows are the size of the frame the landmarks came from. Fills in the
+  //solve_pnp and euler entries of times.
+  void estimate(const dlib::full_object_detection& shape, int image_cols, int image_rows, FacePose& pose,
+                StageTimes& times)
+  {
+    pipeline_clock::time_point start = pipeline_clock::now();
+    //fill in 2D ref points, annotations follow https://ibug.doc.ic.ac.uk/resources/300-W/
+    for (int i = 0; i < head_pose_point_count; ++i)
+    {
+      const dlib::point& part = shape.part(head_pose_landmarks[i]);
+      image_pts[i] = cv::Point2d(part.x(), part.y());
+    }
+
+    //calc pose
+    solver.solve(image_pts, solution);
+
+    //reproject
+    solver.project(solution, reprojectsrc, 8, pose.reprojectdst);
+    times.solve_pnp_us = elapsedMicroseconds(start);
+
+    start = pipeline_clock::now();
+    const cv::Point2d* reprojectdst = pose.reprojectdst;
+    //This line of code finds the point that is located at the center of the face that
+    //is being detected.
+    cv::Point2d my_point = ((reprojectdst[0] + reprojectdst[1] + reprojectdst[2] + reprojectdst[3] + reprojectdst[4] + reprojectdst[5] + reprojectdst[6] + reprojectdst[7])/8);
+    //Get the x and y coordinates of the point at the center of the face that is being
+    //detected.
+    double x_for_pose = my_point.x/image_cols - 0.5;
+    double y_for_pose = my_point.y/image_rows - 0.5;
+    //Distance along the optical axis. (This used to be read as translation_vec.at<double>(1,1),
+    //which on the 3x1 vector lands on the same element.)
+    const double depth = solution.translation[2];
+    double x_distance = -depth*atan(27.6*3.14159265/180)*x_for_pose/0.5;
+    double y_distance = depth*atan(20*3.14159265/180)*y_for_pose/0.5;
+
+    //calc euler angle
+    HeadPoseSolver::eulerAngles(solution);
+
+    pose.z_pos = -depth*centimeter_to_inch_conversion;
+    pose.x_pos = x_distance*centimeter_to_inch_conversion;
+    pose.y_pos = y_distance*centimeter_to_inch_conversion;
+    pose.pitch = solution.euler[0];
+    pose.yaw = solution.euler[1];
+    pose.roll = solution.euler[2];
+    pose.reprojection_error = solution.reprojection_error;
+    times.euler_us = elapsedMicroseconds(start);
+  }
+
+  //For a frame without a face: the next face may be somewhere else entirely, so its pose is
+  //solved from scratch rather than from the last one.
+  void faceLost() { solver.reset(); }
+
+  const HeadPoseSolver& poseSolver() const { return solver; }
+
+private:
+  HeadPoseSolver solver;
+  HeadPoseSolution solution;
+  //2D ref points(image coordinates), referenced from detected facial feature
+  cv::Point2d image_pts[head_pose_point_count];
+};
+
+
+//The pose axes of a face, stamped with the frame's capture time, for PoseFilter and
+//CommandGenerator.
+inline void poseSample(const FacePose& pose, pipeline_clock::time_point captured, PoseSample& sample)
+{
+  sample.time = captured;
+  sample.axis[AXIS_X] = pose.x_pos;
+  sample.axis[AXIS_Y] = pose.y_pos;
+  sample.axis[AXIS_DISTANCE] = pose.z_pos;
+  sample.axis[AXIS_PITCH] = pose.pitch;
+  sample.axis[AXIS_YAW] = pose.yaw;
+  sample.axis[AXIS_ROLL] = pose.roll;
+}
+
+//The debug overlay: landmarks and the reprojected cube around the head. scale is the size of
+//temp relative to the frame the pose was worked out on (the preview draws on a shrunk copy).
+inline void drawFaceOverlay(cv::Mat& temp, const dlib::full_object_detection& shape, const FacePose& pose,
+                            double scale = 1.0)
+{
+  //draw features (models that only predict some landmarks leave the rest not present)
+  for (unsigned long i = 0; i < shape.num_parts(); ++i)
+      {
+      if (shape.part(i) == dlib::OBJECT_PART_NOT_PRESENT)
+          {
+          continue;
+          }
+      cv::circle(temp, cv::Point(shape.part(i).x() * scale, shape.part(i).y() * scale), 2, cv::Scalar(0, 0, 255), -1);
+      }
+
+  //draw axis
+  cv::Point2d reprojectdst[8];
+  for (int i = 0; i < 8; ++i)
+      {
+      reprojectdst[i] = pose.reprojectdst[i] * scale;
+      }
+  cv::line(temp, reprojectdst[0], reprojectdst[1], cv::Scalar(0, 0, 255));
+  cv::line(temp, reprojectdst[1], reprojectdst[2], cv::Scalar(0, 0, 255));
+  cv::line(temp, reprojectdst[2], reprojectdst[3], cv::Scalar(0, 0, 255));
+  cv::line(temp, reprojectdst[3], reprojectdst[0], cv::Scalar(0, 0, 255));
+  cv::line(temp, reprojectdst[4], reprojectdst[5], cv::Scalar(0, 0, 255));
+  cv::line(temp, reprojectdst[5], reprojectdst[6], cv::Scalar(0, 0, 255));
+  cv::line(temp, reprojectdst[6], reprojectdst[7], cv::Scalar(0, 0, 255));
+  cv::line(temp, reprojectdst[7], reprojectdst[4], cv::Scalar(0, 0, 255));
+  cv::line(temp, reprojectdst[0], reprojectdst[4], cv::Scalar(0, 0, 255));
+  cv::line(temp, reprojectdst[1], reprojectdst[5], cv::Scalar(0, 0, 255));
+  cv::line(temp, reprojectdst[2], reprojectdst[6], cv::Scalar(0, 0, 255));
+  cv::line(temp, reprojectdst[3], reprojectdst[7], cv::Scalar(0, 0, 255));
+}
+
+//The pose and the pitch command as text, for the full debug view.
+inline void drawPoseText(cv::Mat& temp, const FacePose& pose, const MotionCommand& command)
+{
+  //text on screen
+  std::ostringstream outtext;
+  outtext << "Distance from camera [in]: " << std::setprecision(3) << pose.z_pos;
+  cv::putText(temp, outtext.str(), cv::Point(50, 40), cv::FONT_HERSHEY_SIMPLEX, 0.75, cv::Scalar(0, 0, 0));
+  outtext.str("");
+  outtext << "x position [in]: " << std::setprecision(3) << pose.x_pos;
+  cv::putText(temp, outtext.str(), cv::Point(50, 60), cv::FONT_HERSHEY_SIMPLEX, 0.75, cv::Scalar(0, 0, 0));
+  outtext.str("");
+  outtext << "y position [in]: " << std::setprecision(3) << pose.y_pos;
+  cv::putText(temp, outtext.str(), cv::Point(50, 80), cv::FONT_HERSHEY_SIMPLEX, 0.75, cv::Scalar(0, 0, 0));
+  outtext.str("");
+  outtext << "Pitch in degrees: " << std::setprecision(3) << pose.pitch;
+  cv::putText(temp, outtext.str(), cv::Point(50, 100), cv::FONT_HERSHEY_SIMPLEX, 0.75, cv::Scalar(0, 0, 0));
+  outtext.str("");
+  outtext << "Yaw in degrees: " << std::setprecision(3) << pose.yaw;
+  cv::putText(temp, outtext.str(), cv::Point(50, 120), cv::FONT_HERSHEY_SIMPLEX, 0.75, cv::Scalar(0, 0, 0));
+  outtext.str("");
+  outtext << "Roll in degrees: " << std::setprecision(3) << pose.roll;
+  cv::putText(temp, outtext.str(), cv::Point(50, 140), cv::FONT_HERSHEY_SIMPLEX, 0.75, cv::Scalar(0, 0, 0));
+  outtext.str("");
+  outtext << "&" << std::showpos << command.pitch;
+  cv::putText(temp, outtext.str(), cv::Point(100, 200), cv::FONT_HERSHEY_SIMPLEX, 1.5, cv::Scalar(255, 255, 255), 3);
+}
@@ -0,0 +1,323 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//The face poses main-code works out, handed to rasm_motion (or anything else on this computer)
+//through POSIX shared memory instead of being squeezed into the serial motion commands. One
+//process writes (FacePoseWriter), any number read (FacePoseReader), and nobody waits for
+//anybody: the writer never knows the readers are there.
+//
+//The shared memory is a ring of slots, each guarded by a sequence number (a seqlock). The
+//writer makes the number odd, fills the slot in and makes it even again; a reader copies the
+//slot out between two reads of the number and keeps the copy only if the number was even and
+//the same both times, so a pose the writer was halfway through is never seen. The slot
+//contents are atomics written and read relaxed, so the copy that loses the race is not a data
+//race either. A reader that falls more than face_pose_slots behind loses the oldest poses, and
+//counts them.
+
+//One face pose. Times are CLOCK_MONOTONIC (pipeline_clock) nanoseconds, which is the same
+//clock in every process.
+struct SharedFacePose
+{
+  uint64_t index = 0;          //how many poses were written before this one
+  uint64_t frame_id = 0;       //the camera frame it came from
+  int64_t captured_ns = 0;     //when that frame was captured
+  int64_t published_ns = 0;    //when the pose went into the channel
+  double x = 0;                //inches, positive to the camera's left (FacePose)
+  double y = 0;                //inches, positive down
+  double z = 0;                //inches, minus the distance from the camera
+  double roll = 0;             //degrees
+  double pitch = 0;            //degrees
+  double yaw = 0;              //degrees
+  double confidence = 0;       //0 (no face in the frame) to 1
+};
+
+const std::size_t face_pose_slots = 64;
+const char* const face_pose_channel_name = "/rasm_face_pose";
+
+inline int64_t facePoseClockNs(std::chrono::steady_clock::time_point time)
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+}
+
+inline int64_t facePoseClockNs()
+{
+  return facePoseClockNs(std::chrono::steady_clock::now());
+}
+
+//How the shared memory is laid out. Only what is lock-free and address-free may go in here,
+//since the two sides are different processes.
+struct FacePoseRing
+{
+  static const uint32_t magic_value = 0x52465031;   //"RFP1"
+  static const std::size_t pose_words = (sizeof(SharedFacePose) + 7) / 8;
+
+  struct alignas(64) Slot
+  {
+    std::atomic<uint64_t> sequence;   //odd while the writer is in the slot
+    std::atomic<uint64_t> words[pose_words];
+  };
+
+  std::atomic<uint32_t> magic;       //set last, once the ring is ready
+  uint32_t slot_count;
+  uint32_t pose_size;
+  std::atomic<int64_t> started_ns;   //when the writer opened it, to tell its runs apart
+  alignas(64) std::atomic<uint64_t> written;   //poses written so far
+  Slot slots[face_pose_slots];
+};
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+              "the face pose channel needs lock-free atomics to work across processes");
+static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t), "std::atomic<uint64_t> is not a plain word");
+
+class FacePoseWriter
+{
+public:
+  FacePoseWriter() : ring(nullptr) {}
+  ~FacePoseWriter() { close(); }
+
+  FacePoseWriter(const FacePoseWriter&) = delete;
+  FacePoseWriter& operator=(const FacePoseWriter&) = delete;
+
+  //Creates the shared memory (or takes over one a previous run left behind) and empties it.
+  bool open(const char* name = face_pose_channel_name)
+  {
+    close();
+    const int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+    if (fd < 0 || ftruncate(fd, sizeof(FacePoseRing)) != 0)
+    {
+      std::cout << "Unable to create the face pose channel " << name << ": " << std::strerror(errno) << std::endl;
+      if (fd >= 0)
+      {
+        ::close(fd);
+      }
+      return false;
+    }
+    void* memory = mmap(nullptr, sizeof(FacePoseRing), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (memory == MAP_FAILED)
+    {
+      std::cout << "Unable to map the face pose channel " << name << ": " << std::strerror(errno) << std::endl;
+      return false;
+    }
+    ring = static_cast<FacePoseRing*>(memory);
+    //Readers of a previous run's ring see the magic go away and give up on it.
+    ring->magic.store(0, std::memory_order_relaxed);
+    ring->slot_count = face_pose_slots;
+    ring->pose_size = sizeof(SharedFacePose);
+    ring->written.store(0, std::memory_order_relaxed);
+    ring->started_ns.store(facePoseClockNs(), std::memory_order_relaxed);
+    for (FacePoseRing::Slot& slot : ring->slots)
+    {
+      slot.sequence.store(0, std::memory_order_relaxed);
+    }
+    ring->magic.store(FacePoseRing::magic_value, std::memory_order_release);
+    channel_name = name;
+    return true;
+  }
+
+  //Leaves the shared memory there for readers still holding it; unlink() removes the name.
+  void close()
+  {
+    if (ring)
+    {
+      munmap(ring, sizeof(FacePoseRing));
+      ring = nullptr;
+    }
+  }
+
+  void unlink()
+  {
+    if (!channel_name.empty())
+    {
+      shm_unlink(channel_name.c_str());
+    }
+  }
+
+  bool isOpen() const { return ring != nullptr; }
+
+  //Fills in index and published_ns. Only one thread may write.
+  void write(SharedFacePose pose)
+  {
+    const uint64_t index = ring->written.load(std::memory_order_relaxed);
+    FacePoseRing::Slot& slot = ring->slots[index % face_pose_slots];
+    pose.index = index;
+    pose.published_ns = facePoseClockNs();
+    uint64_t words[FacePoseRing::pose_words] = {};
+    std::memcpy(words, &pose, sizeof pose);
+
+    const uint64_t sequence = slot.sequence.load(std::memory_order_relaxed);
+    slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (std::size_t i = 0; i < FacePoseRing::pose_words; ++i)
+    {
+      slot.words[i].store(words[i], std::memory_order_relaxed);
+    }
+    slot.sequence.store(sequence + 2, std::memory_order_release);
+    ring->written.store(index + 1, std::memory_order_release);
+  }
+
+  uint64_t written() const { return ring ? ring->written.load(std::memory_order_relaxed) : 0; }
+
+private:
+  FacePoseRing* ring;
+  std::string channel_name;
+};
+
+class FacePoseReader
+{
+public:
+  FacePoseReader() : ring(nullptr), started_ns(0), next_index(0), lost_count(0), retry_count(0) {}
+  ~FacePoseReader() { close(); }
+
+  FacePoseReader(const FacePoseReader&) = delete;
+  FacePoseReader& operator=(const FacePoseReader&) = delete;
+
+  //Fails quietly if the writer has not made the channel yet; try again later.
+  bool open(const char* name = face_pose_channel_name)
+  {
+    close();
+    const int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+    {
+      return false;
+    }
+    struct stat status;
+    void* memory = MAP_FAILED;
+    if (fstat(fd, &status) == 0 && status.st_size >= (off_t)sizeof(FacePoseRing))
+    {
+      memory = mmap(nullptr, sizeof(FacePoseRing), PROT_READ, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if (memory == MAP_FAILED)
+    {
+      return false;
+    }
+    ring = static_cast<const FacePoseRing*>(memory);
+    if (ring->magic.load(std::memory_order_acquire) != FacePoseRing::magic_value ||
+        ring->slot_count != face_pose_slots || ring->pose_size != sizeof(SharedFacePose))
+    {
+      close();
+      return false;
+    }
+    started_ns = ring->started_ns.load(std::memory_order_relaxed);
+    //Start with the newest pose rather than the whole history.
+    const uint64_t written = ring->written.load(std::memory_order_acquire);
+    next_index = written > 0 ? written - 1 : 0;
+    return true;
+  }
+
+  void close()
+  {
+    if (ring)
+    {
+      munmap(const_cast<FacePoseRing*>(ring), sizeof(FacePoseRing));
+      ring = nullptr;
+    }
+  }
+
+  //False once the writer has started the channel again (main-code restarted); open() again.
+  bool ready() const
+  {
+    return ring && ring->magic.load(std::memory_order_acquire) == FacePoseRing::magic_value &&
+           ring->started_ns.load(std::memory_order_relaxed) == started_ns;
+  }
+
+  //The newest pose. False if there is none yet, or the writer kept getting in the way.
+  bool latest(SharedFacePose& pose)
+  {
+    for (int attempt = 0; attempt < max_attempts; ++attempt)
+    {
+      const uint64_t written = ring->written.load(std::memory_order_acquire);
+      if (written == 0)
+      {
+        return false;
+      }
+      if (copy(written - 1, pose))
+      {
+        next_index = written;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  //The poses in the order they were written, each once. If this reader fell so far behind
+  //that the writer has reused the slot of the next one, it skips ahead to the oldest one still
+  //there and counts the ones it missed in lost().
+  bool next(SharedFacePose& pose)
+  {
+    for (int attempt = 0; attempt < max_attempts; ++attempt)
+    {
+      const uint64_t written = ring->written.load(std::memory_order_acquire);
+      if (next_index >= written)
+      {
+        return false;
+      }
+      if (written - next_index > face_pose_slots)
+      {
+        lost_count += written - face_pose_slots - next_index;
+        next_index = written - face_pose_slots;
+      }
+      if (copy(next_index, pose))
+      {
+        ++next_index;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  unsigned long lost() const { return lost_count; }
+  unsigned long retries() const { return retry_count; }   //copies thrown away because the writer was in the slot
+
+private:
+  static const int max_attempts = 8;
+
+  //Copies out the pose with the given index if its slot still holds it and the copy is whole.
+  bool copy(uint64_t index, SharedFacePose& pose)
+  {
+    const FacePoseRing::Slot& slot = ring->slots[index % face_pose_slots];
+    uint64_t words[FacePoseRing::pose_words];
+    const uint64_t before = slot.sequence.load(std::memory_order_acquire);
+    if (before & 1)
+    {
+      ++retry_count;
+      return false;
+    }
+    for (std::size_t i = 0; i < FacePoseRing::pose_words; ++i)
+    {
+      words[i] = slot.words[i].load(std::memory_order_relaxed);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.sequence.load(std::memory_order_relaxed) != before)
+    {
+      ++retry_count;
+      return false;
+    }
+    std::memcpy(&pose, words, sizeof pose);
+    if (pose.index != index)
+    {
+      //The slot has moved on to a newer pose (or not got to this one yet).
+      ++retry_count;
+      return false;
+    }
+    return true;
+  }
+
+  const FacePoseRing* ring;
+  int64_t started_ns;
+  uint64_t next_index;
+  unsigned long lost_count;
+  unsigned long retry_count;
+};
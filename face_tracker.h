@@ -0,0 +1,121 @@
+#pragma once
+
+#include <algorithm>
+#include <dlib/image_processing.h>
+#include <vector>
+#include "detector_engine.h"
+#include "face_detector.h"
+
+//Settings for FaceTracker. With tracking disabled every frame gets the full-frame
+//detector, which is what main.cpp always used to do.
+struct FaceTrackerOptions
+{
+  bool enabled = false;
+  //Run the detector (on a padded region around the tracked face) at least this often.
+  unsigned long detect_every = 10;
+  //Peak-to-sidelobe ratio reported by dlib::correlation_tracker below which the track is no
+  //longer trusted and the detector is run again. dlib's own examples treat ~7 as solid.
+  double min_confidence = 7.0;
+};
+
+//Finds the face to follow. Runs the detector only every detect_every frames or when
+//the correlation tracker loses confidence, and otherwise follows the last face with a
+//dlib::correlation_tracker, which is much cheaper than a full-frame detection. Scheduled
+//re-detections are tried on a padded region around the last face first and only fall back
+//to the whole frame if that misses. All detection goes through FaceDetector, so its scale
+//and region settings (FaceDetectorOptions) apply with and without tracking.
+class FaceTracker
+{
+public:
+  FaceTracker(DetectorEngine& engine, const FaceTrackerOptions& options,
+              const FaceDetectorOptions& detection = FaceDetectorOptions())
+    : detector(engine, detection), options(options), tracking(false), frames_since_detection(0),
+      last_confidence(0), detections(0), roi_detections(0), tracked_frames(0) {}
+
+  //Returns false if there is no face in img. Otherwise face is set to the face to follow.
+  template <typename image_type>
+  bool update(const image_type& img, dlib::rectangle& face)
+  {
+    if (!options.enabled)
+    {
+      return detectFace(img, face);
+    }
+    if (tracking)
+    {
+      last_confidence = tracker.update(img);
+      ++frames_since_detection;
+      if (frames_since_detection < options.detect_every && last_confidence >= options.min_confidence)
+      {
+        face = last_face = dlib::rectangle(tracker.get_position());
+        ++tracked_frames;
+        return true;
+      }
+      if (detectAroundLastFace(img, face) || detectFullFrame(img, face))
+      {
+        startTrack(img, face);
+        return true;
+      }
+      tracking = false;
+      return false;
+    }
+    if (detectFace(img, face))
+    {
+      startTrack(img, face);
+      return true;
+    }
+    return false;
+  }
+
+  //Forget the current track so the next frame gets a full-frame detection.
+  void reset() { tracking = false; }
+
+  bool isTracking() const { return tracking; }
+  double confidence() const { return last_confidence; }
+  unsigned long fullFrameDetections() const { return detections; }
+  unsigned long regionDetections() const { return roi_detections; }
+  unsigned long trackedFrames() const { return tracked_frames; }
+  const FaceDetector& faceDetector() const { return detector; }
+
+private:
+  //Detection when there is no track to go on, following the detector's region policy.
+  template <typename image_type>
+  bool detectFace(const image_type& img, dlib::rectangle& face)
+  {
+    ++detections;
+    return detector.detect(img, face);
+  }
+
+  template <typename image_type>
+  bool detectFullFrame(const image_type& img, dlib::rectangle& face)
+  {
+    ++detections;
+    return detector.detectFullFrame(img, face);
+  }
+
+  template <typename image_type>
+  bool detectAroundLastFace(const image_type& img, dlib::rectangle& face)
+  {
+    ++roi_detections;
+    return detector.detectAround(img, last_face, face);
+  }
+
+  template <typename image_type>
+  void startTrack(const image_type& img, const dlib::rectangle& face)
+  {
+    tracker.start_track(img, face);
+    last_face = face;
+    tracking = true;
+    frames_since_detection = 0;
+  }
+
+  FaceDetector detector;
+  FaceTrackerOptions options;
+  dlib::correlation_tracker tracker;
+  bool tracking;
+  dlib::rectangle last_face;
+  unsigned long frames_since_detection;
+  double last_confidence;
+  unsigned long detections;
+  unsigned long roi_detections;
+  unsigned long tracked_frames;
+};
@@ -0,0 +1,254 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <opencv2/calib3d/calib3d.hpp>
+#include <opencv2/core/core.hpp>
+
+//Number of landmarks the head pose is solved from.
+const int head_pose_point_count = 14;
+
+//Which of the 68 iBUG landmarks (https://ibug.doc.ic.ac.uk/resources/300-W/) go with each
+//point of the 3D head model below, in the same order.
+const unsigned int head_pose_landmarks[head_pose_point_count] = {
+  17,   //left brow left corner
+  21,   //left brow right corner
+  22,   //right brow left corner
+  26,   //right brow right corner
+  36,   //left eye left corner
+  39,   //left eye right corner
+  42,   //right eye left corner
+  45,   //right eye right corner
+  31,   //nose left corner
+  35,   //nose right corner
+  48,   //mouth left corner
+  54,   //mouth right corner
+  57,   //mouth central bottom corner
+  8     //chin corner
+};
+
+//3D ref points(world coordinates), model referenced from http://aifi.isr.uc.pt/Downloads/OpenGL/glAnthropometric3DModel.cpp
+const cv::Point3d head_model_points[head_pose_point_count] = {
+  cv::Point3d(6.825897, 6.760612, 4.402142),     //#33 left brow left corner
+  cv::Point3d(1.330353, 7.122144, 6.903745),     //#29 left brow right corner
+  cv::Point3d(-1.330353, 7.122144, 6.903745),    //#34 right brow left corner
+  cv::Point3d(-6.825897, 6.760612, 4.402142),    //#38 right brow right corner
+  cv::Point3d(5.311432, 5.485328, 3.987654),     //#13 left eye left corner
+  cv::Point3d(1.789930, 5.393625, 4.413414),     //#17 left eye right corner
+  cv::Point3d(-1.789930, 5.393625, 4.413414),    //#25 right eye left corner
+  cv::Point3d(-5.311432, 5.485328, 3.987654),    //#21 right eye right corner
+  cv::Point3d(2.005628, 1.409845, 6.165652),     //#55 nose left corner
+  cv::Point3d(-2.005628, 1.409845, 6.165652),    //#49 nose right corner
+  cv::Point3d(2.774015, -2.080775, 5.048531),    //#43 mouth left corner
+  cv::Point3d(-2.774015, -2.080775, 5.048531),   //#39 mouth right corner
+  cv::Point3d(0.000000, -3.116408, 6.097667),    //#45 mouth central bottom corner
+  cv::Point3d(0.000000, -7.415691, 4.070434)     //#6 chin corner
+};
+
+//Euler angles in degrees, the same ones cv::decomposeProjectionMatrix (cv::RQDecomp3x3) gives
+//for [R|t], worked out straight from R: the Givens rotations that RQDecomp3x3 would build,
+//without the 3x4 matrix, the decomposition outputs or any allocation. euler is x, y, z
+//(pitch, yaw, roll in main-code's terms).
+inline void rotationToEuler(const cv::Matx33d& rotation, double euler[3])
+{
+  const double eps = 2.220446049250313e-16;   //DBL_EPSILON, as RQDecomp3x3 uses
+  cv::Matx33d m = rotation;
+  cv::Matx33d r;
+
+  //Givens rotation about x that zeroes m(2,1)
+  double s = m(2, 1);
+  double c = m(2, 2);
+  double z = 1.0 / std::sqrt(c * c + s * s + eps);
+  cv::Matx33d qx(1, 0, 0,
+                 0, c * z, s * z,
+                 0, -s * z, c * z);
+  r = m * qx;
+
+  //about y, zeroing r(2,0)
+  s = -r(2, 0);
+  c = r(2, 2);
+  z = 1.0 / std::sqrt(c * c + s * s + eps);
+  cv::Matx33d qy(c * z, 0, -s * z,
+                 0, 1, 0,
+                 s * z, 0, c * z);
+  m = r * qy;
+
+  //about z, zeroing m(1,0)
+  s = m(1, 0);
+  c = m(1, 1);
+  z = 1.0 / std::sqrt(c * c + s * s + eps);
+  cv::Matx33d qz(c * z, s * z, 0,
+                 -s * z, c * z, 0,
+                 0, 0, 1);
+  r = m * qz;
+
+  //RQDecomp3x3 keeps the first two diagonal entries of the upper triangular factor positive
+  //by turning one of the rotations by another 180 degrees.
+  if (r(0, 0) < 0)
+  {
+    if (r(1, 1) < 0)
+    {
+      qz(0, 0) = -qz(0, 0);
+      qz(0, 1) = -qz(0, 1);
+      qz(1, 0) = -qz(1, 0);
+      qz(1, 1) = -qz(1, 1);
+    }
+    else
+    {
+      qz = qz.t();
+      qy(0, 0) = -qy(0, 0);
+      qy(0, 2) = -qy(0, 2);
+      qy(2, 0) = -qy(2, 0);
+      qy(2, 2) = -qy(2, 2);
+    }
+  }
+  else if (r(1, 1) < 0)
+  {
+    qz = qz.t();
+    qy = qy.t();
+    qx(1, 1) = -qx(1, 1);
+    qx(1, 2) = -qx(1, 2);
+    qx(2, 1) = -qx(2, 1);
+    qx(2, 2) = -qx(2, 2);
+  }
+
+  const double to_degrees = 180.0 / CV_PI;
+  euler[0] = std::acos(std::max(-1.0, std::min(1.0, qx(1, 1)))) * (qx(1, 2) >= 0 ? 1 : -1) * to_degrees;
+  euler[1] = std::acos(std::max(-1.0, std::min(1.0, qy(0, 0)))) * (qy(2, 0) >= 0 ? 1 : -1) * to_degrees;
+  euler[2] = std::acos(std::max(-1.0, std::min(1.0, qz(0, 0)))) * (qz(0, 1) >= 0 ? 1 : -1) * to_degrees;
+}
+
+//Settings for HeadPoseSolver.
+struct HeadPoseSolverOptions
+{
+  //Start solvePnP from the previous frame's pose. Off means every frame is solved cold, the
+  //way main-code always did it.
+  bool warm_start = true;
+  //A landmark moving further than this (pixels, on average) since the last frame counts as
+  //a sudden change: the previous pose is no use as a guess and the frame is solved cold.
+  double max_landmark_motion = 40;
+  //A warm solve whose RMS reprojection error is more than this many pixels above the last
+  //frame's is redone cold.
+  double max_error_growth = 2;
+};
+
+//What HeadPoseSolver found for one set of landmarks.
+struct HeadPoseSolution
+{
+  cv::Vec3d rotation;      //Rodrigues vector
+  cv::Vec3d translation;   //model units (cm), camera frame
+  //filled in by HeadPoseSolver::eulerAngles()
+  cv::Matx33d rotation_matrix;
+  double euler[3];         //degrees about x, y, z: pitch, yaw, roll
+  double reprojection_error = 0;   //RMS over the landmarks, pixels
+  bool warm = false;       //solved from the previous frame's pose
+};
+
+//solvePnP of the 14 head model points against their landmarks; eulerAngles() then turns the
+//result into angles. Each solve starts from the previous frame's pose (solvePnP's extrinsic
+//guess), so the Levenberg-Marquardt refinement only needs a few iterations and skips the
+//initialization. If the face jumped, or the warm solve fits the landmarks clearly worse than
+//the last frame did, the frame is solved cold so a bad guess can never stick. The solver's
+//own storage is all fixed size, so nothing on this side of OpenCV is allocated per frame.
+class HeadPoseSolver
+{
+public:
+  explicit HeadPoseSolver(const cv::Matx33d& camera_matrix, const cv::Vec<double, 5>& distortion,
+                          const HeadPoseSolverOptions& options = HeadPoseSolverOptions())
+    : camera_matrix(camera_matrix), distortion(distortion), options(options), has_previous(false),
+      previous_error(0), warm_solves(0), cold_solves(0), fallbacks(0) {}
+
+  //image_points are the landmarks listed in head_pose_landmarks, in that order.
+  void solve(const cv::Point2d (&image_points)[head_pose_point_count], HeadPoseSolution& solution)
+  {
+    const cv::Mat object_mat(head_pose_point_count, 1, CV_64FC3, const_cast<cv::Point3d*>(head_model_points));
+    const cv::Mat image_mat(head_pose_point_count, 1, CV_64FC2, const_cast<cv::Point2d*>(image_points));
+
+    bool warm = options.warm_start && has_previous && landmarkMotion(image_points) <= options.max_landmark_motion;
+    if (warm)
+    {
+      solution.rotation = previous_rotation;
+      solution.translation = previous_translation;
+      cv::solvePnP(object_mat, image_mat, camera_matrix, distortion, solution.rotation, solution.translation, true);
+      solution.reprojection_error = reprojectionError(solution, image_points);
+      ++warm_solves;
+      if (solution.reprojection_error > previous_error + options.max_error_growth)
+      {
+        ++fallbacks;
+        warm = false;
+      }
+    }
+    if (!warm)
+    {
+      cv::solvePnP(object_mat, image_mat, camera_matrix, distortion, solution.rotation, solution.translation, false);
+      solution.reprojection_error = reprojectionError(solution, image_points);
+      ++cold_solves;
+    }
+    solution.warm = warm;
+
+    previous_rotation = solution.rotation;
+    previous_translation = solution.translation;
+    previous_error = solution.reprojection_error;
+    std::copy(image_points, image_points + head_pose_point_count, previous_points);
+    has_previous = true;
+  }
+
+  //Fills in rotation_matrix and euler for a solved pose.
+  static void eulerAngles(HeadPoseSolution& solution)
+  {
+    cv::Rodrigues(solution.rotation, solution.rotation_matrix);
+    rotationToEuler(solution.rotation_matrix, solution.euler);
+  }
+
+  //Forget the previous frame, so the next solve is cold (call it when the face is lost).
+  void reset() { has_previous = false; }
+
+  //Projects points through the camera with a solved pose. out must hold count points.
+  void project(const HeadPoseSolution& solution, const cv::Point3d* points, int count, cv::Point2d* out) const
+  {
+    const cv::Mat object_mat(count, 1, CV_64FC3, const_cast<cv::Point3d*>(points));
+    cv::Mat image_mat(count, 1, CV_64FC2, out);
+    cv::projectPoints(object_mat, solution.rotation, solution.translation, camera_matrix, distortion, image_mat);
+  }
+
+  unsigned long warmSolves() const { return warm_solves; }
+  unsigned long coldSolves() const { return cold_solves; }
+  //Warm solves that had to be redone cold because they did not fit.
+  unsigned long coldFallbacks() const { return fallbacks; }
+
+private:
+  double landmarkMotion(const cv::Point2d (&image_points)[head_pose_point_count]) const
+  {
+    double total = 0;
+    for (int i = 0; i < head_pose_point_count; ++i)
+    {
+      total += cv::norm(image_points[i] - previous_points[i]);
+    }
+    return total / head_pose_point_count;
+  }
+
+  double reprojectionError(const HeadPoseSolution& solution, const cv::Point2d (&image_points)[head_pose_point_count]) const
+  {
+    cv::Point2d projected[head_pose_point_count];
+    project(solution, head_model_points, head_pose_point_count, projected);
+    double sum = 0;
+    for (int i = 0; i < head_pose_point_count; ++i)
+    {
+      const cv::Point2d d = projected[i] - image_points[i];
+      sum += d.dot(d);
+    }
+    return std::sqrt(sum / head_pose_point_count);
+  }
+
+  cv::Matx33d camera_matrix;
+  cv::Vec<double, 5> distortion;
+  HeadPoseSolverOptions options;
+  bool has_previous;
+  cv::Vec3d previous_rotation;
+  cv::Vec3d previous_translation;
+  double previous_error;
+  cv::Point2d previous_points[head_pose_point_count];
+  unsigned long warm_solves;
+  unsigned long cold_solves;
+  unsigned long fallbacks;
+};
@@ -0,0 +1,207 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <termios.h>
+#include <thread>
+#include <unistd.h>
+#include "arduino_extra/rasm_protocol.h"
+#include "motion_command.h"
+#include "serial_port.h"
+#include "spsc_queue.h"
+
+//The arm's joints as of one joint-state frame.
+struct JointState
+{
+  uint8_t sequence = 0;
+  uint32_t firmware_us = 0;              //micros() on the Arduino when the encoders were read
+  pipeline_clock::time_point received;   //when the last byte of the frame was read here
+  double position[RASM_JOINT_COUNT] = {};   //degrees, RASM_JOINT_* order
+  double velocity[RASM_JOINT_COUNT] = {};   //degrees per second
+};
+
+//Reads the joint-state frames the firmware streams (motion-planning/sendJointPositions) on
+//its own thread and keeps the newest one for whoever wants it, without ever blocking them.
+//Velocity comes from the firmware's own timestamps, so serial and scheduling delays on this
+//side do not show up in it. The encoders only resolve 0.35 degrees, so velocity is taken over
+//at least velocity_window_us instead of between neighbouring frames, which at 200 frames a
+//second would turn a single step into 70 degrees per second.
+class JointStateReceiver
+{
+public:
+  JointStateReceiver() : fd(-1), wake_fd(-1), running(false), velocity_window_us(20000), history_count(0),
+                         history_next(0), frames_received(0), bad_frames(0), lost_frames(0) {}
+  ~JointStateReceiver() { close(); }
+
+  JointStateReceiver(const JointStateReceiver&) = delete;
+  JointStateReceiver& operator=(const JointStateReceiver&) = delete;
+
+  //Opens and configures the port and starts the reader thread. Returns false if the port
+  //cannot be used.
+  bool open(const char* device, speed_t baud = B115200, uint32_t velocity_window = 20000)
+  {
+    velocity_window_us = velocity_window;
+    fd = openSerialPort(device, baud);
+    if (fd < 0)
+    {
+      return false;
+    }
+    wake_fd = eventfd(0, EFD_NONBLOCK);
+    if (wake_fd < 0)
+    {
+      std::cout << "Unable to create eventfd: " << std::strerror(errno) << std::endl;
+      close();
+      return false;
+    }
+    running = true;
+    reader = std::thread(&JointStateReceiver::readerLoop, this);
+    return true;
+  }
+
+  //Stops the reader thread and closes the port.
+  void close()
+  {
+    if (running)
+    {
+      running = false;
+      const uint64_t one = 1;
+      if (::write(wake_fd, &one, sizeof(one)) < 0)
+      {
+        //The reader wakes up within its poll timeout anyway.
+      }
+      reader.join();
+    }
+    if (wake_fd >= 0)
+    {
+      ::close(wake_fd);
+      wake_fd = -1;
+    }
+    if (fd >= 0)
+    {
+      ::close(fd);
+      fd = -1;
+    }
+  }
+
+  //The newest joint state since the last call. Returns false if no new frame has come in.
+  //Safe to call from one consumer thread only.
+  bool latest(JointState& state) { return states.take(state); }
+
+  unsigned long framesReceived() const { return frames_received; }
+  //Frames the consumer never picked up because a newer one came in first.
+  unsigned long framesReplaced() const { return states.overwritten(); }
+  unsigned long badFrames() const { return bad_frames; }
+  //Frames the firmware numbered but that never arrived (including ones it skipped because
+  //its serial buffer was full).
+  unsigned long lostFrames() const { return lost_frames; }
+
+private:
+  struct Stamp
+  {
+    uint32_t time_us;
+    double position[RASM_JOINT_COUNT];
+  };
+  static const int history_size = 32;
+
+  void readerLoop()
+  {
+    uint8_t buffer[256];
+    struct pollfd fds[2];
+    fds[0].fd = wake_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = fd;
+    fds[1].events = POLLIN;
+    while (running)
+    {
+      if (poll(fds, 2, 100) <= 0)
+      {
+        continue;
+      }
+      if (fds[0].revents & POLLIN)
+      {
+        continue;
+      }
+      const ssize_t count = ::read(fd, buffer, sizeof(buffer));
+      if (count <= 0)
+      {
+        continue;
+      }
+      for (ssize_t i = 0; i < count; ++i)
+      {
+        if (parser.feed(buffer[i]) && parser.type() == RASM_FRAME_JOINT_STATE)
+        {
+          RasmJointStateFrame frame;
+          parser.decodeJointState(frame);
+          received(frame);
+        }
+      }
+      bad_frames = parser.badFrames();
+      lost_frames = parser.lostFrames();
+    }
+  }
+
+  void received(const RasmJointStateFrame& frame)
+  {
+    JointState state;
+    state.sequence = frame.sequence;
+    state.firmware_us = frame.time_us;
+    state.received = pipeline_clock::now();
+    Stamp& stamp = history[history_next];
+    stamp.time_us = frame.time_us;
+    for (int joint = 0; joint < RASM_JOINT_COUNT; ++joint)
+    {
+      state.position[joint] = stamp.position[joint] = rasmJointDegrees(frame.angles[joint]);
+    }
+    //The newest earlier frame at least velocity_window_us older (unsigned subtraction copes
+    //with micros() wrapping). If the window reaches past the history, use the oldest.
+    const Stamp* reference = NULL;
+    for (int back = 1; back < history_count + 1 && back < history_size; ++back)
+    {
+      const Stamp& older = history[(history_next + history_size - back) % history_size];
+      reference = &older;
+      if (frame.time_us - older.time_us >= velocity_window_us)
+      {
+        break;
+      }
+    }
+    const uint32_t dt_us = reference ? frame.time_us - reference->time_us : 0;
+    //A gap of more than a second (a restart of the firmware, or of the link) starts over.
+    if (dt_us > 0 && dt_us < 1000000)
+    {
+      for (int joint = 0; joint < RASM_JOINT_COUNT; ++joint)
+      {
+        state.velocity[joint] = (state.position[joint] - reference->position[joint]) * 1e6 / dt_us;
+      }
+    }
+    else
+    {
+      history_count = 0;
+    }
+    history_next = (history_next + 1) % history_size;
+    if (history_count < history_size)
+    {
+      ++history_count;
+    }
+    states.publish(state);
+    ++frames_received;
+  }
+
+  int fd;
+  int wake_fd;
+  std::atomic<bool> running;
+  std::thread reader;
+  uint32_t velocity_window_us;
+  RasmParser parser;
+  Stamp history[history_size];
+  int history_count;
+  int history_next;
+  LatestValue<JointState> states;
+  std::atomic<unsigned long> frames_received;
+  std::atomic<unsigned long> bad_frames;
+  std::atomic<unsigned long> lost_frames;
+};
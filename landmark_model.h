@@ -0,0 +1,483 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include <dlib/image_processing.h>
+
+//A precompiled landmark model (".rsp") that is used straight from a memory map: loading it
+//is an mmap and a few pointer assignments instead of parsing dlib's serialized
+//shape_predictor. It holds the same cascade of regression forests dlib trains, laid out as
+//flat arrays, and FlatShapePredictor evaluates it the way dlib::shape_predictor does.
+//
+//A model may predict only some of the 68 iBUG landmarks (see tools/train_landmark_model.cpp).
+//It records which ones, and LandmarkPredictor always hands out 68-part shapes with the
+//landmarks the model does not predict marked dlib::OBJECT_PART_NOT_PRESENT, so code that
+//reads landmarks by their iBUG number works with any model.
+//
+//File layout (all values little-endian, every section 64-byte aligned):
+//  RasmLandmarkModelHeader
+//  part_ids        uint32[parts]                               iBUG number of each part
+//  initial_shape   float[2 * parts]                            x0 y0 x1 y1 ...
+//  anchors         uint32[cascades * feature_pixels]
+//  deltas          float[2 * cascades * feature_pixels]
+//  splits          RasmLandmarkSplit[cascades * trees * (2^tree_depth - 1)]
+//  leaves          float[cascades * trees * 2^tree_depth * 2 * parts]
+
+const char rasm_landmark_magic[8] = {'R', 'A', 'S', 'M', 'L', 'M', 'K', '1'};
+const uint32_t rasm_landmark_version = 1;
+const std::size_t rasm_landmark_alignment = 64;
+const unsigned long ibug_landmark_count = 68;
+
+struct RasmLandmarkModelHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t parts;
+  uint32_t cascades;
+  uint32_t trees;            //per cascade
+  uint32_t tree_depth;
+  uint32_t feature_pixels;   //per cascade
+  uint64_t part_ids_offset;
+  uint64_t initial_shape_offset;
+  uint64_t anchors_offset;
+  uint64_t deltas_offset;
+  uint64_t splits_offset;
+  uint64_t leaves_offset;
+  uint64_t file_size;
+};
+
+struct RasmLandmarkSplit
+{
+  uint32_t idx1;
+  uint32_t idx2;
+  float thresh;
+};
+
+//Writes sp as a .rsp model. part_ids gives the iBUG number of each of sp's parts (empty
+//means sp predicts all 68 in order). If max_cascades is not zero, only that many cascades are
+//kept, which is faster and less accurate. Returns false (after saying why) if sp cannot be
+//written in this format.
+inline bool writeFlatLandmarkModel(const dlib::shape_predictor& sp, const std::vector<uint32_t>& part_ids,
+                                   const std::string& path, unsigned long max_cascades = 0)
+{
+  //shape_predictor keeps its forests private, but its serialized form is just the members in
+  //order, so read them back out of that.
+  std::stringstream buffer;
+  dlib::serialize(sp, buffer);
+  int version;
+  dlib::matrix<float, 0, 1> initial_shape;
+  std::vector<std::vector<dlib::impl::regression_tree> > forests;
+  std::vector<std::vector<unsigned long> > anchor_idx;
+  std::vector<std::vector<dlib::vector<float, 2> > > deltas;
+  dlib::deserialize(version, buffer);
+  dlib::deserialize(initial_shape, buffer);
+  dlib::deserialize(forests, buffer);
+  dlib::deserialize(anchor_idx, buffer);
+  dlib::deserialize(deltas, buffer);
+
+  RasmLandmarkModelHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, rasm_landmark_magic, sizeof(header.magic));
+  header.version = rasm_landmark_version;
+  header.parts = initial_shape.size() / 2;
+  header.cascades = max_cascades && max_cascades < forests.size() ? max_cascades : forests.size();
+  if (header.cascades == 0 || forests[0].empty())
+  {
+    std::cout << "The model has no regression trees" << std::endl;
+    return false;
+  }
+  header.trees = forests[0].size();
+  header.feature_pixels = anchor_idx[0].size();
+  const std::size_t split_count = forests[0][0].splits.size();
+  header.tree_depth = 0;
+  while (((std::size_t)1 << header.tree_depth) - 1 < split_count)
+  {
+    ++header.tree_depth;
+  }
+  const std::size_t leaf_count = (std::size_t)1 << header.tree_depth;
+  //dlib's trainer gives every cascade the same number of trees, every tree the same depth and
+  //every cascade the same feature pool, which is what lets the layout be flat.
+  for (uint32_t c = 0; c < header.cascades; ++c)
+  {
+    if (forests[c].size() != header.trees || anchor_idx[c].size() != header.feature_pixels)
+    {
+      std::cout << "Cascade " << c << " does not have the same shape as the first one" << std::endl;
+      return false;
+    }
+    for (const dlib::impl::regression_tree& tree : forests[c])
+    {
+      if (tree.splits.size() != split_count || tree.leaf_values.size() != leaf_count)
+      {
+        std::cout << "Cascade " << c << " has trees of different depths" << std::endl;
+        return false;
+      }
+    }
+  }
+  if (!part_ids.empty() && part_ids.size() != header.parts)
+  {
+    std::cout << "The model has " << header.parts << " parts but " << part_ids.size() << " part numbers were given" << std::endl;
+    return false;
+  }
+
+  auto align = [](uint64_t offset) { return (offset + rasm_landmark_alignment - 1) / rasm_landmark_alignment * rasm_landmark_alignment; };
+  const uint64_t per_cascade_pixels = (uint64_t)header.cascades * header.feature_pixels;
+  const uint64_t tree_count = (uint64_t)header.cascades * header.trees;
+  header.part_ids_offset = align(sizeof(header));
+  header.initial_shape_offset = align(header.part_ids_offset + sizeof(uint32_t) * header.parts);
+  header.anchors_offset = align(header.initial_shape_offset + sizeof(float) * 2 * header.parts);
+  header.deltas_offset = align(header.anchors_offset + sizeof(uint32_t) * per_cascade_pixels);
+  header.splits_offset = align(header.deltas_offset + sizeof(float) * 2 * per_cascade_pixels);
+  header.leaves_offset = align(header.splits_offset + sizeof(RasmLandmarkSplit) * tree_count * split_count);
+  header.file_size = header.leaves_offset + sizeof(float) * tree_count * leaf_count * 2 * header.parts;
+
+  std::vector<char> image(header.file_size, 0);
+  std::memcpy(&image[0], &header, sizeof(header));
+  uint32_t* out_part_ids = reinterpret_cast<uint32_t*>(&image[header.part_ids_offset]);
+  for (uint32_t i = 0; i < header.parts; ++i)
+  {
+    out_part_ids[i] = part_ids.empty() ? i : part_ids[i];
+  }
+  float* out_initial_shape = reinterpret_cast<float*>(&image[header.initial_shape_offset]);
+  for (uint32_t i = 0; i < 2 * header.parts; ++i)
+  {
+    out_initial_shape[i] = initial_shape(i);
+  }
+  uint32_t* out_anchors = reinterpret_cast<uint32_t*>(&image[header.anchors_offset]);
+  float* out_deltas = reinterpret_cast<float*>(&image[header.deltas_offset]);
+  RasmLandmarkSplit* out_splits = reinterpret_cast<RasmLandmarkSplit*>(&image[header.splits_offset]);
+  float* out_leaves = reinterpret_cast<float*>(&image[header.leaves_offset]);
+  for (uint32_t c = 0; c < header.cascades; ++c)
+  {
+    for (uint32_t p = 0; p < header.feature_pixels; ++p)
+    {
+      *out_anchors++ = anchor_idx[c][p];
+      *out_deltas++ = deltas[c][p].x();
+      *out_deltas++ = deltas[c][p].y();
+    }
+    for (const dlib::impl::regression_tree& tree : forests[c])
+    {
+      for (const dlib::impl::split_feature& split : tree.splits)
+      {
+        out_splits->idx1 = split.idx1;
+        out_splits->idx2 = split.idx2;
+        out_splits->thresh = split.thresh;
+        ++out_splits;
+      }
+      for (const dlib::matrix<float, 0, 1>& leaf : tree.leaf_values)
+      {
+        for (long i = 0; i < leaf.size(); ++i)
+        {
+          *out_leaves++ = leaf(i);
+        }
+      }
+    }
+  }
+
+  std::ofstream out(path.c_str(), std::ios::binary);
+  out.write(&image[0], image.size());
+  if (!out)
+  {
+    std::cout << "Unable to write " << path << std::endl;
+    return false;
+  }
+  return true;
+}
+
+//Evaluates a .rsp model straight out of its memory map.
+class FlatShapePredictor
+{
+public:
+  FlatShapePredictor() : map(MAP_FAILED), map_size(0), header(NULL) {}
+  ~FlatShapePredictor() { close(); }
+
+  FlatShapePredictor(const FlatShapePredictor&) = delete;
+  FlatShapePredictor& operator=(const FlatShapePredictor&) = delete;
+
+  //Maps the model. With prefault the whole file is read in now (MAP_POPULATE), so the first
+  //face does not pay for the page faults. Returns false (after saying why) on a bad file.
+  bool open(const std::string& path, bool prefault = true)
+  {
+    close();
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+      std::cout << "Unable to open " << path << ": " << std::strerror(errno) << std::endl;
+      return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (std::size_t)info.st_size < sizeof(RasmLandmarkModelHeader))
+    {
+      std::cout << path << " is not a landmark model" << std::endl;
+      ::close(fd);
+      return false;
+    }
+    map_size = info.st_size;
+    map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE | (prefault ? MAP_POPULATE : 0), fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+    {
+      std::cout << "Unable to map " << path << ": " << std::strerror(errno) << std::endl;
+      return false;
+    }
+    const char* base = static_cast<const char*>(map);
+    header = reinterpret_cast<const RasmLandmarkModelHeader*>(base);
+    if (std::memcmp(header->magic, rasm_landmark_magic, sizeof(header->magic)) != 0 ||
+        header->version != rasm_landmark_version || header->file_size != map_size ||
+        header->parts == 0 || header->tree_depth == 0)
+    {
+      std::cout << path << " is not a version " << rasm_landmark_version << " landmark model" << std::endl;
+      close();
+      return false;
+    }
+    part_ids = reinterpret_cast<const uint32_t*>(base + header->part_ids_offset);
+    initial_shape = reinterpret_cast<const float*>(base + header->initial_shape_offset);
+    anchors = reinterpret_cast<const uint32_t*>(base + header->anchors_offset);
+    deltas = reinterpret_cast<const float*>(base + header->deltas_offset);
+    splits = reinterpret_cast<const RasmLandmarkSplit*>(base + header->splits_offset);
+    leaves = reinterpret_cast<const float*>(base + header->leaves_offset);
+    split_count = (1u << header->tree_depth) - 1;
+    shape_size = 2 * header->parts;
+    if (!indicesInRange())
+    {
+      std::cout << path << " is damaged" << std::endl;
+      close();
+      return false;
+    }
+    current_shape.resize(shape_size);
+    feature_pixel_values.resize(header->feature_pixels);
+    return true;
+  }
+
+  void close()
+  {
+    if (map != MAP_FAILED)
+    {
+      munmap(map, map_size);
+      map = MAP_FAILED;
+    }
+    header = NULL;
+  }
+
+  bool isOpen() const { return header != NULL; }
+  unsigned long numParts() const { return header->parts; }
+  unsigned long cascades() const { return header->cascades; }
+  //iBUG number of part i.
+  unsigned long partId(unsigned long i) const { return part_ids[i]; }
+
+  //Landmarks of the face in rect, one per model part. Same steps as
+  //dlib::shape_predictor::operator(): for every cascade, sample the feature pixels around the
+  //current shape estimate and add up the leaves the trees pick.
+  template <typename image_type>
+  void predict(const image_type& img, const dlib::rectangle& rect, std::vector<dlib::point>& parts)
+  {
+    std::copy(initial_shape, initial_shape + shape_size, current_shape.begin());
+    //Shape coordinates run 0..1 across the face box.
+    const double box_x = rect.left();
+    const double box_y = rect.top();
+    const double box_w = rect.right() - rect.left();
+    const double box_h = rect.bottom() - rect.top();
+    dlib::const_image_view<image_type> view(img);
+    const long rows = view.nr();
+    const long cols = view.nc();
+    const std::size_t leaf_count = split_count + 1;
+    const RasmLandmarkSplit* tree_splits = splits;
+    const float* tree_leaves = leaves;
+    for (uint32_t c = 0; c < header->cascades; ++c)
+    {
+      //Similarity transform from the mean shape to the current estimate.
+      float m00, m01, m10, m11;
+      similarityTransform(m00, m01, m10, m11);
+      const uint32_t* cascade_anchors = anchors + (std::size_t)c * header->feature_pixels;
+      const float* cascade_deltas = deltas + (std::size_t)c * header->feature_pixels * 2;
+      for (uint32_t p = 0; p < header->feature_pixels; ++p)
+      {
+        const float dx = cascade_deltas[2 * p];
+        const float dy = cascade_deltas[2 * p + 1];
+        const float sx = m00 * dx + m01 * dy + current_shape[2 * cascade_anchors[p]];
+        const float sy = m10 * dx + m11 * dy + current_shape[2 * cascade_anchors[p] + 1];
+        const long x = static_cast<long>(std::floor(box_x + box_w * sx + 0.5));
+        const long y = static_cast<long>(std::floor(box_y + box_h * sy + 0.5));
+        if (x >= 0 && y >= 0 && x < cols && y < rows)
+        {
+          feature_pixel_values[p] = dlib::get_pixel_intensity(view[y][x]);
+        }
+        else
+        {
+          feature_pixel_values[p] = 0;
+        }
+      }
+      for (uint32_t t = 0; t < header->trees; ++t)
+      {
+        std::size_t node = 0;
+        while (node < split_count)
+        {
+          const RasmLandmarkSplit& split = tree_splits[node];
+          node = feature_pixel_values[split.idx1] - feature_pixel_values[split.idx2] > split.thresh ? 2 * node + 1 : 2 * node + 2;
+        }
+        const float* leaf = tree_leaves + (node - split_count) * shape_size;
+        for (std::size_t i = 0; i < shape_size; ++i)
+        {
+          current_shape[i] += leaf[i];
+        }
+        tree_splits += split_count;
+        tree_leaves += leaf_count * shape_size;
+      }
+    }
+    parts.resize(header->parts);
+    for (uint32_t i = 0; i < header->parts; ++i)
+    {
+      parts[i] = dlib::point(static_cast<long>(std::floor(box_x + box_w * current_shape[2 * i] + 0.5)),
+                             static_cast<long>(std::floor(box_y + box_h * current_shape[2 * i + 1] + 0.5)));
+    }
+  }
+
+private:
+  //Every index in the file points inside the arrays it indexes, so predict() never has to check.
+  bool indicesInRange() const
+  {
+    for (uint32_t i = 0; i < header->parts; ++i)
+    {
+      if (part_ids[i] >= ibug_landmark_count)
+      {
+        return false;
+      }
+    }
+    for (uint64_t i = 0; i < (uint64_t)header->cascades * header->feature_pixels; ++i)
+    {
+      if (anchors[i] >= header->parts)
+      {
+        return false;
+      }
+    }
+    for (uint64_t i = 0; i < (uint64_t)header->cascades * header->trees * split_count; ++i)
+    {
+      if (splits[i].idx1 >= header->feature_pixels || splits[i].idx2 >= header->feature_pixels)
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  //Least-squares scale and rotation taking initial_shape onto current_shape, the 2x2 part of
+  //what dlib's find_similarity_transform gives.
+  void similarityTransform(float& m00, float& m01, float& m10, float& m11) const
+  {
+    const uint32_t n = header->parts;
+    if (n == 1)
+    {
+      m00 = m11 = 1;
+      m01 = m10 = 0;
+      return;
+    }
+    double from_x = 0, from_y = 0, to_x = 0, to_y = 0;
+    for (uint32_t i = 0; i < n; ++i)
+    {
+      from_x += initial_shape[2 * i];
+      from_y += initial_shape[2 * i + 1];
+      to_x += current_shape[2 * i];
+      to_y += current_shape[2 * i + 1];
+    }
+    from_x /= n;
+    from_y /= n;
+    to_x /= n;
+    to_y /= n;
+    double dot = 0, cross = 0, norm = 0;
+    for (uint32_t i = 0; i < n; ++i)
+    {
+      const double fx = initial_shape[2 * i] - from_x;
+      const double fy = initial_shape[2 * i + 1] - from_y;
+      const double tx = current_shape[2 * i] - to_x;
+      const double ty = current_shape[2 * i + 1] - to_y;
+      dot += fx * tx + fy * ty;
+      cross += fx * ty - fy * tx;
+      norm += fx * fx + fy * fy;
+    }
+    const double a = norm > 0 ? dot / norm : 1;
+    const double b = norm > 0 ? cross / norm : 0;
+    m00 = a;
+    m01 = -b;
+    m10 = b;
+    m11 = a;
+  }
+
+  void* map;
+  std::size_t map_size;
+  const RasmLandmarkModelHeader* header;
+  const uint32_t* part_ids;
+  const float* initial_shape;
+  const uint32_t* anchors;
+  const float* deltas;
+  const RasmLandmarkSplit* splits;
+  const float* leaves;
+  std::size_t split_count;
+  std::size_t shape_size;
+  //scratch, sized once in open()
+  std::vector<float> current_shape;
+  std::vector<float> feature_pixel_values;
+};
+
+//The landmark model main-code runs: a dlib .dat shape predictor or a .rsp flat model (picked
+//by the file extension). Either way the result is a 68-part iBUG shape.
+class LandmarkPredictor
+{
+public:
+  LandmarkPredictor() : flat_model(false) {}
+
+  bool load(const std::string& path)
+  {
+    flat_model = path.size() > 4 && path.compare(path.size() - 4, 4, ".rsp") == 0;
+    if (flat_model)
+    {
+      return flat.open(path);
+    }
+    try
+    {
+      dlib::deserialize(path) >> predictor;
+    }
+    catch (dlib::serialization_error& e)
+    {
+      std::cout << "Unable to load " << path << ": " << e.what() << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  //How many landmarks the model actually predicts.
+  unsigned long predictedParts() const { return flat_model ? flat.numParts() : predictor.num_parts(); }
+  bool isFlat() const { return flat_model; }
+
+  template <typename image_type>
+  dlib::full_object_detection operator()(const image_type& img, const dlib::rectangle& rect)
+  {
+    if (!flat_model)
+    {
+      return predictor(img, rect);
+    }
+    flat.predict(img, rect, predicted);
+    std::vector<dlib::point> parts(ibug_landmark_count, dlib::OBJECT_PART_NOT_PRESENT);
+    for (unsigned long i = 0; i < predicted.size(); ++i)
+    {
+      parts[flat.partId(i)] = predicted[i];
+    }
+    return dlib::full_object_detection(rect, parts);
+  }
+
+private:
+  bool flat_model;
+  dlib::shape_predictor predictor;
+  FlatShapePredictor flat;
+  std::vector<dlib::point> predicted;
+};
@@ -1,368 +1,328 @@
-//Note that according to the python documentation, 
-//the Python.h header file should be included first, before any other header file.
-#include <Python.h>
 #include <iostream>
 #include <dlib/opencv.h>
 #include <opencv2/highgui/highgui.hpp>
-#include <opencv2/calib3d/calib3d.hpp>
-#include <opencv2/imgproc/imgproc.hpp>
-#include <dlib/image_processing/frontal_face_detector.h>
-#include <dlib/image_processing/render_face_detections.h>
 #include <dlib/image_processing.h>
-#include <fstream>
-#include <unistd.h>
-#include <cmath>
-#include <stdio.h>
 #include <time.h>
+#include <atomic>
+#include <csignal>
+#include <memory>
+#include <thread>
+#include "pipeline.h"
+#include "capture.h"
+#include "detector_engine.h"
+#include "display.h"
+#include "face_pose.h"
+#include "face_tracker.h"
+#include "metrics.h"
+#include "options.h"
+#include "pipeline_metrics.h"
+#include "serial_writer.h"
+
+//How often the queue depth and drop counters are printed, in seconds.
+const int pipeline_stats_period = 5;
+
+//Cleared by the display loop when escape is pressed (or by Ctrl-C, which is the only way out
+//with --display=off); every stage thread watches it.
+std::atomic<bool> running(true);
+
+void stopRunning(int)
+{
+    running = false;
+}
 
-//Intrisics can be calculated using opencv sample code under opencv/sources/samples/cpp/tutorial_code/calib3d
-//Normally, you can also apprximate fx and fy by image width, cx by half image width, cy by half image height instead
-double K[9] = {7.3530833553043510e+02, 0.0, 320.0, 0.0, 7.3530833553043510e+02, 240.0, 0.0, 0.0, 1.0};
-double D[5] = {-2.3528667558034226e-02, 1.3301431879108856e+00, 0.0, 0.0,
-    -6.0786673300480434e+00};
-const int debounce_camera_time_delay = 1;
-const double centimeter_to_inch_conversion = 1/2.54;
-
-int main(int argc, char *argv[]){
-
-  //The python documentation explains much of the python code (see "Extending and Embedding
-  //Python")
-    wchar_t *program = Py_DecodeLocale(argv[0], NULL);
-    if (program == NULL) {
-        fprintf(stderr, "Fatal error: cannot decode argv[0]\n");
-        exit(1);
-    }
-    Py_SetProgramName(program);  /* optional but recommended */
-    Py_Initialize();
-    //Make the serial connection via the Python interpreter
-    PyRun_SimpleString("import serial\n");
-    PyRun_SimpleString("ser = serial.Serial('/dev/ttyACM0', 9600, timeout=5)");
-    cv::VideoCapture cap(1);
-    if (!cap.isOpened())
+//Set by each stage as it returns. When a file or directory runs out the capture stage stops,
+//and every later stage finishes what is already queued before it stops too, so main returns
+//after the last frame instead of waiting for escape.
+std::atomic<bool> capture_done(false);
+std::atomic<bool> detect_done(false);
+std::atomic<bool> pose_done(false);
+std::atomic<bool> render_done(false);
+
+//The pipeline is capture -> detect -> pose -> actuate, one thread per stage. Frames picked for
+//display branch off after the pose stage to a render thread that does all the drawing, and
+//the HighGUI window is served from the main thread. Stages only talk through the lock-free queues below (and
+//the serial writer's newest-command mailbox), so the end-to-end frame rate is set by the
+//slowest stage instead of the sum of all of them.
+FrameQueue detect_queue;    //capture -> detect
+FrameQueue pose_queue;      //detect -> pose
+FrameQueue render_queue;    //pose -> render
+FrameQueue display_queue;   //render -> main thread
+SerialWriter serial_writer; //pose -> actuate, runs its own writer thread
+FacePoseWriter pose_channel; //pose -> rasm_motion, through shared memory
+MetricsRegistry metrics_registry;             //written out by metrics_exporter (--metrics)
+PipelineMetrics pipeline_metrics(metrics_registry);
+MetricsExporter metrics_exporter;
+
+//Frames that made it to the window (the queues count what went in).
+std::atomic<unsigned long> frames_displayed(0);
+
+void captureStage(CaptureBackend& capture, const DetectorEngine& detector, const DisplayOptions& display)
+{
+    unsigned long frame_id = 0;
+    CapturedImage image;
+    while (running)
+    {
+        // Grab a frame. BGR is only made for frames that will be shown, or when the detector
+        // needs color.
+        Frame frame;
+        frame.id = frame_id;
+        pipeline_clock::time_point start = pipeline_clock::now();
+        if (!capture.read(image, detector.needsColor() || wantsDisplay(display, frame)))
         {
-        std::cout << "Unable to connect to camera" << std::endl;
-        return EXIT_FAILURE;
+            if (capture.ended())
+            {
+                std::cout << "End of input after " << frame_id << " frames" << std::endl;
+                break;
+            }
+            continue;
         }
-    //Load face detection and pose estimation models (dlib).
-    dlib::frontal_face_detector detector;
-    dlib::shape_predictor predictor;
-    detector = dlib::get_frontal_face_detector();
-    dlib::deserialize("../data/face_model_68_points.dat") >> predictor;
-     //fill in cam intrinsics and distortion coefficients
-    cv::Mat cam_matrix = cv::Mat(3, 3, CV_64FC1, K);
-    cv::Mat dist_coeffs = cv::Mat(5, 1, CV_64FC1, D);
-    //fill in 3D ref points(world coordinates), model referenced from http://aifi.isr.uc.pt/Downloads/OpenGL/glAnthropometric3DModel.cpp
-    std::vector<cv::Point3d> object_pts;
- 
-    object_pts.push_back(cv::Point3d(6.825897, 6.760612, 4.402142));     //#33 left brow left corner
-    object_pts.push_back(cv::Point3d(1.330353, 7.122144, 6.903745));     //#29 left brow right corner
-    object_pts.push_back(cv::Point3d(-1.330353, 7.122144, 6.903745));    //#34 right brow left corner
-    object_pts.push_back(cv::Point3d(-6.825897, 6.760612, 4.402142));    //#38 right brow right corner
-    object_pts.push_back(cv::Point3d(5.311432, 5.485328, 3.987654));     //#13 left eye left corner
-    object_pts.push_back(cv::Point3d(1.789930, 5.393625, 4.413414));     //#17 left eye right corner
-    object_pts.push_back(cv::Point3d(-1.789930, 5.393625, 4.413414));    //#25 right eye left corner
-    object_pts.push_back(cv::Point3d(-5.311432, 5.485328, 3.987654));    //#21 right eye right corner
-    object_pts.push_back(cv::Point3d(2.005628, 1.409845, 6.165652));     //#55 nose left corner
-    object_pts.push_back(cv::Point3d(-2.005628, 1.409845, 6.165652));    //#49 nose right corner
-    object_pts.push_back(cv::Point3d(2.774015, -2.080775, 5.048531));    //#43 mouth left corner
-    object_pts.push_back(cv::Point3d(-2.774015, -2.080775, 5.048531));   //#39 mouth right corner
-    object_pts.push_back(cv::Point3d(0.000000, -3.116408, 6.097667));    //#45 mouth central bottom corner
-    object_pts.push_back(cv::Point3d(0.000000, -7.415691, 4.070434));    //#6 chin corner
-
-    //2D ref points(image coordinates), referenced from detected facial feature
-    std::vector<cv::Point2d> image_pts;
-
-    //result
-    cv::Mat rotation_vec;                           //3 x 1
-    cv::Mat rotation_mat;                           //3 x 3 R
-    cv::Mat translation_vec;                        //3 x 1 T
-    cv::Mat pose_mat = cv::Mat(3, 4, CV_64FC1);     //3 x 4 R | T
-    cv::Mat euler_angle = cv::Mat(3, 1, CV_64FC1);
-
-    //reproject 3D points world coordinate axis to verify result pose
-    std::vector<cv::Point3d> reprojectsrc;
-    reprojectsrc.push_back(cv::Point3d(10.0, 10.0, 10.0));
-    reprojectsrc.push_back(cv::Point3d(10.0, 10.0, -10.0));
-    reprojectsrc.push_back(cv::Point3d(10.0, -10.0, -10.0));
-    reprojectsrc.push_back(cv::Point3d(10.0, -10.0, 10.0));
-    reprojectsrc.push_back(cv::Point3d(-10.0, 10.0, 10.0));
-    reprojectsrc.push_back(cv::Point3d(-10.0, 10.0, -10.0));
-    reprojectsrc.push_back(cv::Point3d(-10.0, -10.0, -10.0));
-    reprojectsrc.push_back(cv::Point3d(-10.0, -10.0, 10.0));
-
-    //reprojected 2D points
-    std::vector<cv::Point2d> reprojectdst;
-    reprojectdst.resize(8);
-
-    //temp buf for decomposeProjectionMatrix()
-    cv::Mat out_intrinsics = cv::Mat(3, 3, CV_64FC1);
-    cv::Mat out_rotation = cv::Mat(3, 3, CV_64FC1);
-    cv::Mat out_translation = cv::Mat(3, 1, CV_64FC1);
+        frame.times.capture_us = elapsedMicroseconds(start);
+        frame.captured = image.captured;
+        frame.image = image.bgr;
+        frame.gray = image.gray;
+        frame.capture_buffer = std::move(image.buffer);
+        ++frame_id;
+        pipeline_metrics.captured(frame.times);
+        //If detection is still busy with the last frame this one is simply dropped; the
+        //camera keeps grabbing either way.
+        detect_queue.push(std::move(frame));
+    }
+    capture_done = true;
+}
 
-    //text on screen
-    std::ostringstream outtext;
-    bool still_roll = false;
-    bool still_pitch = false;
-    bool still_yaw = false;
-    bool still_y = false;
-    bool still_x = false;
-    time_t time_since_still_roll = 0;
-    time_t time_since_still_pitch = 0;
-    time_t time_since_still_yaw = 0;
-    time_t time_since_still_y = 0;
-    time_t time_since_still_x = 0;
-    //Loop until the escape key is pressed.
-    while (1)
+void detectStage(FaceTracker& tracker, LandmarkPredictor& predictor)
+{
+    Frame frame;
+    while (running)
     {
-      //usleep(500000);
-        // Grab a frame
-        cv::Mat temp;
-        cap >> temp;
-
-        dlib::cv_image<dlib::bgr_pixel> cimg(temp);
-
-        // Detect faces
-        std::vector<dlib::rectangle> faces = detector(cimg);
-
-        // Find the pose of each face
-        if (faces.size() > 0)
-            {
-            //std::cout << "DETECTED " << faces.size() << std::endl << std::endl;
-            //track features
-            dlib::full_object_detection shape = predictor(cimg, faces[0]);
-
-            //draw features
-            for (unsigned int i = 0; i < 68; ++i)
-                {
-                cv::circle(temp, cv::Point(shape.part(i).x(), shape.part(i).y()), 2, cv::Scalar(0, 0, 255), -1);
-                }
-
-            //fill in 2D ref points, annotations follow https://ibug.doc.ic.ac.uk/resources/300-W/
-
-            image_pts.push_back(cv::Point2d(shape.part(17).x(), shape.part(17).y())); //#17 left brow left corner
-            image_pts.push_back(cv::Point2d(shape.part(21).x(), shape.part(21).y())); //#21 left brow right corner
-            image_pts.push_back(cv::Point2d(shape.part(22).x(), shape.part(22).y())); //#22 right brow left corner
-            image_pts.push_back(cv::Point2d(shape.part(26).x(), shape.part(26).y())); //#26 right brow right corner
-            image_pts.push_back(cv::Point2d(shape.part(36).x(), shape.part(36).y())); //#36 left eye left corner
-            image_pts.push_back(cv::Point2d(shape.part(39).x(), shape.part(39).y())); //#39 left eye right corner
-            image_pts.push_back(cv::Point2d(shape.part(42).x(), shape.part(42).y())); //#42 right eye left corner
-            image_pts.push_back(cv::Point2d(shape.part(45).x(), shape.part(45).y())); //#45 right eye right corner
-            image_pts.push_back(cv::Point2d(shape.part(31).x(), shape.part(31).y())); //#31 nose left corner
-            image_pts.push_back(cv::Point2d(shape.part(35).x(), shape.part(35).y())); //#35 nose right corner
-            image_pts.push_back(cv::Point2d(shape.part(48).x(), shape.part(48).y())); //#48 mouth left corner
-            image_pts.push_back(cv::Point2d(shape.part(54).x(), shape.part(54).y())); //#54 mouth right corner
-            image_pts.push_back(cv::Point2d(shape.part(57).x(), shape.part(57).y())); //#57 mouth central bottom corner
-            image_pts.push_back(cv::Point2d(shape.part(8).x(), shape.part(8).y()));   //#8 chin corner
-
-            //calc pose
-            cv::solvePnP(object_pts, image_pts, cam_matrix, dist_coeffs, rotation_vec, translation_vec);
-
-            //reproject
-            cv::projectPoints(reprojectsrc, rotation_vec, translation_vec, cam_matrix, dist_coeffs, reprojectdst);
-
-            //draw axis
-            cv::line(temp, reprojectdst[0], reprojectdst[1], cv::Scalar(0, 0, 255));
-            cv::line(temp, reprojectdst[1], reprojectdst[2], cv::Scalar(0, 0, 255));
-            cv::line(temp, reprojectdst[2], reprojectdst[3], cv::Scalar(0, 0, 255));
-            cv::line(temp, reprojectdst[3], reprojectdst[0], cv::Scalar(0, 0, 255));
-            cv::line(temp, reprojectdst[4], reprojectdst[5], cv::Scalar(0, 0, 255));
-            cv::line(temp, reprojectdst[5], reprojectdst[6], cv::Scalar(0, 0, 255));
-            cv::line(temp, reprojectdst[6], reprojectdst[7], cv::Scalar(0, 0, 255));
-            cv::line(temp, reprojectdst[7], reprojectdst[4], cv::Scalar(0, 0, 255));
-            cv::line(temp, reprojectdst[0], reprojectdst[4], cv::Scalar(0, 0, 255));
-            cv::line(temp, reprojectdst[1], reprojectdst[5], cv::Scalar(0, 0, 255));
-            cv::line(temp, reprojectdst[2], reprojectdst[6], cv::Scalar(0, 0, 255));
-            cv::line(temp, reprojectdst[3], reprojectdst[7], cv::Scalar(0, 0, 255));
-
-            //This line of code finds the point that is located at the center of the face that
-            //is being detected.
-            cv::Point2d my_point = ((reprojectdst[0] + reprojectdst[1] + reprojectdst[2] + reprojectdst[3] + reprojectdst[4] + reprojectdst[5] + reprojectdst[6] + reprojectdst[7])/8);
-            //Get the x and y coordinates of the point at the center of the face that is being
-            //detected.
-            double my_x = my_point.x;
-            double my_y = my_point.y;
-            double x_for_pose = my_x/temp.cols;
-            double y_for_pose = my_y/temp.rows;
-            //std::cout << x_for_pose << std::endl;
-            //std::cout << y_for_pose << std::endl;
-            x_for_pose = x_for_pose -0.5;
-            y_for_pose = y_for_pose -0.5;
-            double x_distance = -translation_vec.at<double>(1,1)*atan(27.6*3.14159265/180)*x_for_pose/0.5;
-            double y_distance = translation_vec.at<double>(1,1)*atan(20*3.14159265/180)*y_for_pose/0.5;
-
-            //calc euler angle
-            cv::Rodrigues(rotation_vec, rotation_mat);
-            cv::hconcat(rotation_mat, translation_vec, pose_mat);
-            cv::decomposeProjectionMatrix(pose_mat, out_intrinsics, out_rotation, out_translation, cv::noArray(), cv::noArray(), cv::noArray(), euler_angle);
-
-                          //show angle result
-            //outtext << "X: " << std::setprecision(3) << euler_angle.at<double>(0);
-            double z_pos = -translation_vec.at<double>(1, 1)*centimeter_to_inch_conversion;
-            outtext << "Distance from camera [in]: " << std::setprecision(3) << z_pos;
-            cv::putText(temp, outtext.str(), cv::Point(50, 40), cv::FONT_HERSHEY_SIMPLEX, 0.75, cv::Scalar(0, 0, 0));
-            outtext.str("");
-            double x_pos = x_distance*centimeter_to_inch_conversion;
-            outtext << "x position [in]: " << std::setprecision(3) << x_pos;
-            //outtext << "Y: " << std::setprecision(3) << euler_angle.at<double>(1);
-            cv::putText(temp, outtext.str(), cv::Point(50, 60), cv::FONT_HERSHEY_SIMPLEX, 0.75, cv::Scalar(0, 0, 0));
-            outtext.str("");
-            //outtext << "Z: " << std::setprecision(3) << euler_angle.at<double>(2);
-            double y_pos = y_distance*centimeter_to_inch_conversion;
-            outtext << "y position [in]: " << std::setprecision(3) << y_pos;
-            cv::putText(temp, outtext.str(), cv::Point(50, 80), cv::FONT_HERSHEY_SIMPLEX, 0.75, cv::Scalar(0, 0, 0));
-            outtext.str("");
-            //outtext << "rot_vec 1: " << std::setprecision(3) << rotation_vec.at<double>(1, 1);
-            double pitch = euler_angle.at<double>(0);
-            outtext << "Pitch in degrees: " << std::setprecision(3) << pitch;
-            cv::putText(temp, outtext.str(), cv::Point(50, 100), cv::FONT_HERSHEY_SIMPLEX, 0.75, cv::Scalar(0, 0, 0));
-            outtext.str("");
-            //outtext << "rot_vec 2: " << std::setprecision(3) << rotation_vec.at<double>(2, 1);
-            double yaw = euler_angle.at<double>(1);
-            outtext << "Yaw in degrees: " << std::setprecision(3) << yaw;
-            cv::putText(temp, outtext.str(), cv::Point(50, 120), cv::FONT_HERSHEY_SIMPLEX, 0.75, cv::Scalar(0, 0, 0));
-            outtext.str("");
-            //outtext << "rot_vec 3: " << std::setprecision(3) << rotation_vec.at<double>(3, 1);
-            double roll = euler_angle.at<double>(2);
-            outtext << "Roll in degrees: " << std::setprecision(3) << roll;
-            cv::putText(temp, outtext.str(), cv::Point(50, 140), cv::FONT_HERSHEY_SIMPLEX, 0.75, cv::Scalar(0, 0, 0));
-            outtext.str("");
-            char buffer[100];
-            ////////////////////////// roll /////////////////////////////////// #
-            if(still_roll)
-            {
-              time_since_still_roll = time(NULL);
-            }
-            if(abs(roll) < 5)
-            {
-              roll = 0.0;
-              still_roll = true;
-            }
-            else
-            {
-              still_roll = false;
-            }
-            if(time(NULL) < time_since_still_roll + debounce_camera_time_delay)
-            {
-              roll = 0.0;
-            }
-            sprintf(buffer,"ser.write('#%+03d\\x00'.encode())", (int)(roll*-2));
-            PyRun_SimpleString(buffer);
-            PyRun_SimpleString("ser.flush()");
-            
-            ///////////////////////// pitch ////////////////////////////////// &
-            if(still_pitch)
-            {
-              time_since_still_pitch = time(NULL);
-            }
-            if(abs(pitch) < 5)
-            {
-              pitch = 0.0;
-              still_pitch = true;
-            }
-            else
-            {
-              still_pitch = false;
-            }
-            if(time(NULL) < time_since_still_pitch + debounce_camera_time_delay)
+        //Read before popping: anything pushed before the upstream stage stopped is still seen.
+        const bool upstream_done = capture_done;
+        if (!detect_queue.popLatest(frame))
+        {
+            if (upstream_done)
             {
-              pitch = 0.0;
+                break;
             }
-            sprintf(buffer,"ser.write('&%+03d\\x00'.encode())", (int)(pitch*2));
-
-            PyRun_SimpleString(buffer);
-            PyRun_SimpleString("ser.flush()");
-
-            outtext << buffer;
-            cv::putText(temp, outtext.str(), cv::Point(100, 200), cv::FONT_HERSHEY_SIMPLEX, 1.5, cv::Scalar(255, 255, 255), 3);
-            outtext.str("");
+            std::this_thread::sleep_for(stage_idle_wait);
+            continue;
+        }
+        detectFace(tracker, predictor, tracker.faceDetector().detectorEngine(), frame);
+        pipeline_metrics.detected(frame.times, frame.has_face);
+        pose_queue.push(std::move(frame));
+    }
+    detect_done = true;
+}
 
-            ///////////////////////// yaw ///////////////////////////////////// *
-            if(still_yaw)
+void poseStage(const RasmOptions& options)
+{
+    const DisplayOptions& display = options.display;
+    PoseEstimator estimator;
+    PoseFilter filter(options.filter);
+    CommandGenerator generator(options.commands);
+    Frame frame;
+    SharedFacePose shared_pose;
+    while (running)
+    {
+        //Read before popping: anything pushed before the upstream stage stopped is still seen.
+        const bool upstream_done = detect_done;
+        if (!pose_queue.popLatest(frame))
+        {
+            if (upstream_done)
             {
-              time_since_still_yaw = time(NULL);
+                break;
             }
-            if(abs(yaw) < 5)
+            std::this_thread::sleep_for(stage_idle_wait);
+            continue;
+        }
+        const bool sent = estimatePose(estimator, filter, generator, frame);
+        if (sent)
             {
-              yaw = 0.0;
-              still_yaw = true;
+            serial_writer.submit(frame.command);
             }
-            else
+        pipeline_metrics.posed(frame.times, frame.has_face, sent, elapsedMicroseconds(frame.captured));
+        //Frames without a face go in as well (confidence 0), so a reader knows it is gone.
+        if (pose_channel.isOpen())
             {
-              still_yaw = false;
+            sharedFacePose(frame, shared_pose);
+            pose_channel.write(shared_pose);
             }
-            if(time(NULL) < time_since_still_yaw + debounce_camera_time_delay)
+        if (wantsDisplay(display, frame))
             {
-              yaw = 0.0;
+            render_queue.push(std::move(frame));
             }
-            sprintf(buffer,"ser.write('*%+03d\\x00'.encode())", (int)(yaw*-2));
-            PyRun_SimpleString(buffer);
-            PyRun_SimpleString("ser.flush()");
-
-
+    }
+    pose_done = true;
+}
 
-            ///////////////////////// y /////////////////////////////////////// $
-            if(still_y)
-            {
-              time_since_still_y = time(NULL);
-            }
-            if(abs(y_pos) <= 3)
-            {
-              y_pos = 0;
-              still_y = true;
-            }
-            else
-            {
-              still_y = false;
-            }
-            if(time(NULL) < time_since_still_y + debounce_camera_time_delay)
+void renderStage(const DisplayOptions& display)
+{
+    Frame frame;
+    while (running)
+    {
+        //Read before popping: anything pushed before the upstream stage stopped is still seen.
+        const bool upstream_done = pose_done;
+        if (!render_queue.popLatest(frame))
+        {
+            if (upstream_done)
             {
-              y_pos = 0.0;
+                break;
             }
+            std::this_thread::sleep_for(stage_idle_wait);
+            continue;
+        }
+        renderFrame(display, frame);
+        display_queue.push(std::move(frame));
+    }
+    render_done = true;
+}
 
-            sprintf(buffer,"ser.write('$%+03d\\x00'.encode())", (int)(y_pos*-2));
-            PyRun_SimpleString(buffer);
-            PyRun_SimpleString("ser.flush()");
+void printPipelineStats()
+{
+    std::cout << "pipeline: captured " << detect_queue.pushed()
+              << " | detect depth " << detect_queue.depth() << " dropped " << detect_queue.dropped()
+              << " | pose depth " << pose_queue.depth() << " dropped " << pose_queue.dropped()
+              << " | serial sent " << serial_writer.framesSent() << " coalesced " << serial_writer.framesCoalesced()
+              << " errors " << serial_writer.writeErrors()
+              << " | poses published " << pose_channel.written()
+              << " | render depth " << render_queue.depth() << " dropped " << render_queue.dropped()
+              << " | display depth " << display_queue.depth() << " dropped " << display_queue.dropped()
+              << " shown " << frames_displayed << std::endl;
+}
 
+//What the queues, the serial writer and the pose channel count already, read when the metrics
+//are written out.
+void registerPipelineCounters()
+{
+    struct Queue { const char* name; const FrameQueue& queue; };
+    const Queue queues[] = {{"detect", detect_queue}, {"pose", pose_queue}, {"render", render_queue},
+                            {"display", display_queue}};
+    for (const Queue& q : queues)
+    {
+        const FrameQueue* queue = &q.queue;
+        metrics_registry.counterFunction(std::string("rasm_") + q.name + "_queue_dropped_total",
+                                         std::string("Frames dropped going into the ") + q.name + " queue.",
+                                         [queue]() { return (double)queue->dropped(); });
+        metrics_registry.gauge(std::string("rasm_") + q.name + "_queue_depth",
+                               std::string("Frames waiting in the ") + q.name + " queue.",
+                               [queue]() { return (double)queue->depth(); });
+    }
+    metrics_registry.counterFunction("rasm_serial_frames_sent_total", "Motion frames written to the Arduino.",
+                                     []() { return (double)serial_writer.framesSent(); });
+    metrics_registry.counterFunction("rasm_serial_frames_coalesced_total",
+                                     "Motion commands replaced by a newer one before they were sent.",
+                                     []() { return (double)serial_writer.framesCoalesced(); });
+    metrics_registry.counterFunction("rasm_serial_bytes_sent_total", "Bytes written to the Arduino.",
+                                     []() { return (double)serial_writer.bytesSent(); });
+    metrics_registry.counterFunction("rasm_serial_write_errors_total", "Failed writes to the Arduino.",
+                                     []() { return (double)serial_writer.writeErrors(); });
+    metrics_registry.counterFunction("rasm_poses_published_total", "Face poses written to the pose channel.",
+                                     []() { return (double)pose_channel.written(); });
+    metrics_registry.counterFunction("rasm_frames_displayed_total", "Frames shown in the window.",
+                                     []() { return (double)frames_displayed; });
+}
 
+int main(int argc, char *argv[]){
 
-            /////////////////////// x //////////////////////////////////////// ^
-            if(still_x)
-            {
-              time_since_still_x = time(NULL);
-            }
-            if(abs(x_pos) <= 3)
-            {
-              x_pos = 0;
-              still_x = true;
-            }
-            else
+    RasmOptions options;
+    if (!parseOptions(argc, argv, options))
+    {
+        return EXIT_FAILURE;
+    }
+    //Make the serial connection to the Arduino
+    if (!serial_writer.open(options.serial_port.c_str()))
+    {
+        return EXIT_FAILURE;
+    }
+    if (!options.pose_channel.empty() && !pose_channel.open(options.pose_channel.c_str()))
+    {
+        return EXIT_FAILURE;
+    }
+    std::unique_ptr<CaptureBackend> capture = createCaptureBackend(options.capture);
+    if (!capture)
+        {
+        return EXIT_FAILURE;
+        }
+    //Load face detection and pose estimation models.
+    std::unique_ptr<DetectorEngine> detector = createDetectorEngine(options.detector);
+    LandmarkPredictor predictor;
+    if (!detector || !predictor.load(options.landmark_model))
+        {
+        return EXIT_FAILURE;
+        }
+    FaceTracker tracker(*detector, options.tracker, options.detection);
+    registerPipelineCounters();
+    if (!options.metrics_file.empty())
+    {
+        metrics_exporter.start(metrics_registry, options.metrics_file, options.metrics_period);
+    }
+
+    std::thread capture_thread(captureStage, std::ref(*capture), std::cref(*detector), std::cref(options.display));
+    std::thread detect_thread(detectStage, std::ref(tracker), std::ref(predictor));
+    std::thread pose_thread(poseStage, std::cref(options));
+    std::thread render_thread;
+    const bool show_window = options.display.mode != DISPLAY_OFF;
+    if (show_window)
+    {
+        render_thread = std::thread(renderStage, std::cref(options.display));
+    }
+    std::signal(SIGINT, stopRunning);
+    std::signal(SIGTERM, stopRunning);
+    std::cout << "capture: " << capture->name() << " | detector: " << detector->name() << " | pose filter: " << poseFilterModeName(options.filter.mode)
+              << " | display: " << displayModeName(options.display.mode) << std::endl;
+
+    time_t time_of_last_stats = time(NULL);
+    Frame frame;
+    //Loop until the escape key (or Ctrl-C) is pressed, or the input runs out and the last frame
+    //has gone through.
+    if (show_window)
+    {
+        cv::namedWindow( "demo", cv::WINDOW_NORMAL);
+    }
+    while (running)
+    {
+        if (!show_window)
+        {
+            if (pose_done)
             {
-              still_x = false;
+                break;
             }
-            if(time(NULL) < time_since_still_x + debounce_camera_time_delay)
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        else
+        {
+            const bool pipeline_done = render_done;
+            if (display_queue.popLatest(frame))
             {
-              x_pos = 0.0;
-            }
-
-            sprintf(buffer,"ser.write('^%+03d\\x00'.encode())", (int)(-x_pos));
-            PyRun_SimpleString(buffer);
-            PyRun_SimpleString("ser.flush()");
-
-
-
-            ////////////////// clear image points ////////////////
-            image_pts.clear();
+                cv::imshow("demo", frame.image);
+                frames_displayed++;
             }
  //press esc to end
-        cv::namedWindow( "demo", cv::WINDOW_NORMAL);
-        cv::imshow("demo", temp);
-        unsigned char key = cv::waitKey(1);
-        if (key == 27)
-            {
-            break;
-            }
+            unsigned char key = cv::waitKey(1);
+            if (key == 27)
+                {
+                running = false;
+                }
+            else if (pipeline_done && display_queue.depth() == 0)
+                {
+                break;
+                }
+        }
+        if (time(NULL) >= time_of_last_stats + pipeline_stats_period)
+        {
+            printPipelineStats();
+            time_of_last_stats = time(NULL);
+        }
     }
-    PyMem_RawFree(program);
+    capture_thread.join();
+    detect_thread.join();
+    pose_thread.join();
+    if (render_thread.joinable())
+    {
+        render_thread.join();
+    }
+    serial_writer.close();
+    metrics_exporter.stop();
+    printPipelineStats();
+    pose_channel.close();
     return 0;
 }
-
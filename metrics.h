@@ -0,0 +1,359 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "stage_timing.h"
+
+//Counters and latency histograms that can stay on in the tracking loop and the motion node,
+//exported every so often as a Prometheus text file (for node_exporter's textfile collector, or
+//for tools/rasm_metrics.cpp, which prints live rates from it).
+//
+//Every thread that counts or records gets its own shard of the counters and histograms the
+//first time it does, so the hot path is a plain load and store on a cache line nobody else
+//writes: no locks, no atomic read-modify-write, no sharing. The exporter adds the shards up;
+//it may see one shard a count ahead of another, never a torn number. Metrics that something
+//already counts (the queues, the serial writer) are read through a function at export time
+//instead of being counted twice.
+class MetricsRegistry
+{
+public:
+  static const int max_counters = 32;
+  static const int max_histograms = 16;
+  static const int max_shards = 16;   //threads after that share one more, with atomic adds
+
+  MetricsRegistry() : id(nextRegistryId()), shard_count(0)
+  {
+    shards[max_shards].shared = true;
+  }
+
+  MetricsRegistry(const MetricsRegistry&) = delete;
+  MetricsRegistry& operator=(const MetricsRegistry&) = delete;
+
+  //Registration, before any thread counts or records. Names are Prometheus metric names; a
+  //counter's should end in _total, a histogram's (of seconds) in _seconds. Returns the id to
+  //count or record with, or -1 when there is no room left.
+  int counter(const std::string& name, const std::string& help)
+  {
+    return addMetric(name, help, COUNTER, counter_count, max_counters, nullptr);
+  }
+
+  int histogram(const std::string& name, const std::string& help)
+  {
+    return addMetric(name, help, HISTOGRAM, histogram_count, max_histograms, nullptr);
+  }
+
+  //Counters and gauges kept somewhere else, read when the metrics are exported.
+  void counterFunction(const std::string& name, const std::string& help, std::function<double()> read)
+  {
+    int unused = 0;
+    addMetric(name, help, COUNTER_FUNCTION, unused, 1 << 30, std::move(read));
+  }
+
+  void gauge(const std::string& name, const std::string& help, std::function<double()> read)
+  {
+    int unused = 0;
+    addMetric(name, help, GAUGE, unused, 1 << 30, std::move(read));
+  }
+
+  void add(int id, uint64_t n = 1)
+  {
+    if (id >= 0)
+    {
+      Shard& mine = shard();
+      mine.bump(mine.counters[id], n);
+    }
+  }
+
+  void record(int id, double us)
+  {
+    if (id < 0)
+    {
+      return;
+    }
+    Shard& mine = shard();
+    ShardHistogram& h = mine.histograms[id];
+    mine.bump(h.counts[LatencyHistogram::bucketFor(us)], 1);
+    mine.bump(h.total, 1);
+    mine.bump(h.sum_ns, (uint64_t)(us * 1000));
+  }
+
+  //Sums over the shards; any thread may call these.
+  uint64_t counterValue(int id) const
+  {
+    uint64_t sum = 0;
+    for (int s = 0; s <= max_shards; ++s)
+    {
+      sum += shards[s].counters[id].load(std::memory_order_relaxed);
+    }
+    return sum;
+  }
+
+  //Cumulative count of the samples up to LatencyHistogram::bucketLimit(bucket), the number
+  //of samples and their sum in seconds.
+  void histogramValue(int id, std::vector<uint64_t>& cumulative, uint64_t& count, double& sum_seconds) const
+  {
+    cumulative.assign(LatencyHistogram::bucket_count, 0);
+    uint64_t sum_ns = 0;
+    count = 0;
+    for (int s = 0; s <= max_shards; ++s)
+    {
+      const ShardHistogram& h = shards[s].histograms[id];
+      for (int i = 0; i < LatencyHistogram::bucket_count; ++i)
+      {
+        cumulative[i] += h.counts[i].load(std::memory_order_relaxed);
+      }
+      count += h.total.load(std::memory_order_relaxed);
+      sum_ns += h.sum_ns.load(std::memory_order_relaxed);
+    }
+    for (int i = 1; i < LatencyHistogram::bucket_count; ++i)
+    {
+      cumulative[i] += cumulative[i - 1];
+    }
+    sum_seconds = sum_ns / 1e9;
+  }
+
+  //Prometheus text exposition format. Histogram buckets are two per doubling from 1 us (every
+  //other one of LatencyHistogram's, whose edges they share) up to about 0.7 s.
+  void writePrometheus(std::ostream& out) const
+  {
+    std::vector<uint64_t> cumulative;
+    for (const Metric& metric : metrics)
+    {
+      static const char* const types[] = {"counter", "histogram", "counter", "gauge"};
+      out << "# HELP " << metric.name << ' ' << metric.help << "\n# TYPE " << metric.name << ' '
+          << types[metric.kind] << '\n';
+      if (metric.kind == COUNTER)
+      {
+        out << metric.name << ' ' << counterValue(metric.id) << '\n';
+      }
+      else if (metric.kind == HISTOGRAM)
+      {
+        uint64_t count;
+        double sum;
+        histogramValue(metric.id, cumulative, count, sum);
+        //The last bucket also holds everything slower, so it is only in +Inf.
+        for (int i = 0; i < LatencyHistogram::bucket_count - 1; i += 2)
+        {
+          out << metric.name << "_bucket{le=\"" << LatencyHistogram::bucketLimit(i) / 1e6 << "\"} " << cumulative[i]
+              << '\n';
+        }
+        out << metric.name << "_bucket{le=\"+Inf\"} " << count << '\n'
+            << metric.name << "_sum " << sum << '\n'
+            << metric.name << "_count " << count << '\n';
+      }
+      else
+      {
+        out << metric.name << ' ' << metric.read() << '\n';
+      }
+    }
+  }
+
+  //Replaces path in one step (write, then rename), so readers never see half a file.
+  bool writePrometheusFile(const std::string& path) const
+  {
+    const std::string temporary = path + ".tmp";
+    {
+      std::ofstream out(temporary.c_str());
+      if (!out)
+      {
+        return false;
+      }
+      writePrometheus(out);
+      if (!out)
+      {
+        return false;
+      }
+    }
+    return std::rename(temporary.c_str(), path.c_str()) == 0;
+  }
+
+private:
+  enum Kind { COUNTER, HISTOGRAM, COUNTER_FUNCTION, GAUGE };
+
+  struct Metric
+  {
+    std::string name;
+    std::string help;
+    Kind kind;
+    int id;
+    std::function<double()> read;
+  };
+
+  struct ShardHistogram
+  {
+    std::atomic<uint64_t> counts[LatencyHistogram::bucket_count];
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> sum_ns;
+  };
+
+  struct alignas(64) Shard
+  {
+    Shard() : shared(false)
+    {
+      for (std::atomic<uint64_t>& c : counters)
+      {
+        c.store(0, std::memory_order_relaxed);
+      }
+      for (ShardHistogram& h : histograms)
+      {
+        for (std::atomic<uint64_t>& c : h.counts)
+        {
+          c.store(0, std::memory_order_relaxed);
+        }
+        h.total.store(0, std::memory_order_relaxed);
+        h.sum_ns.store(0, std::memory_order_relaxed);
+      }
+    }
+
+    //Only the owning thread writes an unshared shard, so it needs no read-modify-write.
+    void bump(std::atomic<uint64_t>& value, uint64_t n)
+    {
+      if (shared)
+      {
+        value.fetch_add(n, std::memory_order_relaxed);
+      }
+      else
+      {
+        value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+      }
+    }
+
+    bool shared;
+    std::atomic<uint64_t> counters[max_counters];
+    ShardHistogram histograms[max_histograms];
+  };
+
+  int addMetric(const std::string& name, const std::string& help, Kind kind, int& count, int limit,
+                std::function<double()> read)
+  {
+    if (count >= limit)
+    {
+      return -1;
+    }
+    metrics.push_back(Metric{name, help, kind, count, std::move(read)});
+    return count++;
+  }
+
+  static uint64_t nextRegistryId()
+  {
+    static std::atomic<uint64_t> next(1);
+    return next.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  //This thread's shard. A thread remembers its shards in the last few registries it used (by
+  //id, so a new registry where an old one was is not mistaken for it).
+  Shard& shard()
+  {
+    struct Owned
+    {
+      uint64_t registry;
+      Shard* shard;
+    };
+    static const int remembered = 4;
+    thread_local Owned owned[remembered] = {};
+    thread_local int next_slot = 0;
+    if (owned[0].registry == id)
+    {
+      return *owned[0].shard;
+    }
+    for (int i = 1; i < remembered; ++i)
+    {
+      if (owned[i].registry == id)
+      {
+        return *owned[i].shard;
+      }
+    }
+    const int index = shard_count.fetch_add(1, std::memory_order_relaxed);
+    Owned& slot = owned[next_slot];
+    next_slot = (next_slot + 1) % remembered;
+    slot.registry = id;
+    slot.shard = &shards[index < max_shards ? index : max_shards];
+    return *slot.shard;
+  }
+
+  const uint64_t id;
+  std::vector<Metric> metrics;
+  int counter_count = 0;
+  int histogram_count = 0;
+  //In the registry itself rather than on the heap, where C++14 does not keep them 64-byte aligned.
+  Shard shards[max_shards + 1];
+  std::atomic<int> shard_count;
+};
+
+//Writes a registry's Prometheus file every period on its own thread, and once more on stop().
+class MetricsExporter
+{
+public:
+  MetricsExporter() : registry(nullptr), running(false), write_errors(0) {}
+  ~MetricsExporter() { stop(); }
+
+  MetricsExporter(const MetricsExporter&) = delete;
+  MetricsExporter& operator=(const MetricsExporter&) = delete;
+
+  void start(const MetricsRegistry& metrics, const std::string& file, double period_seconds)
+  {
+    stop();
+    registry = &metrics;
+    path = file;
+    period = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::duration<double>(period_seconds));
+    running = true;
+    thread = std::thread(&MetricsExporter::exportLoop, this);
+  }
+
+  void stop()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!running)
+      {
+        return;
+      }
+      running = false;
+    }
+    wake.notify_all();
+    thread.join();
+    write();
+  }
+
+  unsigned long writeErrors() const { return write_errors; }
+
+private:
+  void write()
+  {
+    if (!registry->writePrometheusFile(path) && write_errors++ == 0)
+    {
+      std::cout << "Unable to write the metrics to " << path << std::endl;
+    }
+  }
+
+  void exportLoop()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (running)
+    {
+      lock.unlock();
+      write();
+      lock.lock();
+      wake.wait_for(lock, period, [this]() { return !running; });
+    }
+  }
+
+  const MetricsRegistry* registry;
+  std::string path;
+  std::chrono::milliseconds period;
+  bool running;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::thread thread;
+  std::atomic<unsigned long> write_errors;
+};
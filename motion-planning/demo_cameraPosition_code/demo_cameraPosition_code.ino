@@ -8,6 +8,11 @@
 
 
 #include <common.h>
+#include <arm_kinematics.h>
+
+// The DH table of linearTransformationDHParameters.m, and where the Tobii screen is on the last link.
+ArmKinematics<double> arm;
+const double tobii_screen[3] = {ARM_TOBII_SCREEN_X, ARM_TOBII_SCREEN_Y, ARM_TOBII_SCREEN_Z};
 
 void setup() {
   Serial.begin(9600);
@@ -17,19 +22,17 @@ void setup() {
 }
 
 void loop() {
-  double th1 = shoulderAngle() * PI / 180.0;
-  double th2 = elbowAngle() * PI / 180.0;
-  double th3 = yawAngle() * PI / 180.0;
-  double th4 = pitchAngle() * PI / 180.0;
-  double th5 = rollAngle() * PI / 180.0;
-
-  // These formulas come from the output of the matlab file "linearTransformationDHParameters.m"
+  const double theta[ARM_JOINT_COUNT] = {shoulderAngle() * PI / 180.0, elbowAngle() * PI / 180.0,
+                                         yawAngle() * PI / 180.0, pitchAngle() * PI / 180.0,
+                                         rollAngle() * PI / 180.0};
+  double camera[3];
+  arm.point(theta, tobii_screen, camera);
   Serial.print("x = ");
-  Serial.println( (79 * cos(th1 + th2)) / 4 + 16 * cos(th1) - (3 * sin(th1 + th2)*sin(th3)) / 2 + (cos(th4 + th5) * ((13 * sin(th1 + th2)*sin(th3)) / 2 - (13 * cos(th1 + th2)*cos(th3)) / 2)) / 2 + (sin(th4 + th5) * ((sin(th1 + th2)*sin(th3)) / 2 - (cos(th1 + th2)*cos(th3)) / 2)) / 2 - cos(th4) * (sin(th1 + th2)*sin(th3) - cos(th1 + th2)*cos(th3)) + cos(th5) * ((cos(th1 + th2)*sin(th3)) / 2 + (sin(th1 + th2)*cos(th3)) / 2) - sin(th4) * ((9 * sin(th1 + th2)*sin(th3)) / 2 - (9 * cos(th1 + th2)*cos(th3)) / 2) - sin(th5) * ((13 * cos(th1 + th2)*sin(th3)) / 2 + (13 * sin(th1 + th2)*cos(th3)) / 2) + (cos(th4 - th5) * ((13 * sin(th1 + th2)*sin(th3)) / 2 - (13 * cos(th1 + th2)*cos(th3)) / 2)) / 2 - (sin(th4 - th5) * ((sin(th1 + th2)*sin(th3)) / 2 - (cos(th1 + th2)*cos(th3)) / 2)) / 2 + (3 * cos(th1 + th2)*cos(th3)) / 2);
+  Serial.println(camera[0]);
   Serial.print("y = ");
-  Serial.println((79 * sin(th1 + th2)) / 4 + 16 * sin(th1) - (13 * sin(th1 + th2 + th3)*cos(th4 + th5)) / 4 - (sin(th1 + th2 + th3)*sin(th4 + th5)) / 4 - (cos(th1 + th2 + th3)*cos(th5)) / 2 + sin(th1 + th2 + th3)*cos(th4) + (13 * cos(th1 + th2 + th3)*sin(th5)) / 2 + (9 * sin(th1 + th2 + th3)*sin(th4)) / 2 - (13 * cos(th4 - th5)*sin(th1 + th2 + th3)) / 4 + (sin(th4 - th5)*sin(th1 + th2 + th3)) / 4 + (3 * cos(th1 + th2)*sin(th3)) / 2 + (3 * sin(th1 + th2)*cos(th3)) / 2);
+  Serial.println(camera[1]);
   Serial.print("z = ");
-  Serial.println((9 * cos(th4)) / 2 - sin(th4) + (13 * cos(th5)*sin(th4)) / 2 + (sin(th4)*sin(th5)) / 2);
+  Serial.println(camera[2]);
   Serial.println("");
   Serial.println("");
   delay(500);
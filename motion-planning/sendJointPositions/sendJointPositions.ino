@@ -1,40 +1,70 @@
 /*
 
-   Please note that this code
-   will use a default baud rate
-   of 57600
+   Streams the five encoder angles to the computer as binary
+   joint-state frames (see rasm_protocol.h) at RASM_SERIAL_BAUD,
+   each with the time the encoders were read and a sequence number.
+   rasm_motion (JointStateReceiver) reads them. The encoders are
+   sampled in the background by encoder_sampler.h.
 
 */
 
-#include <ros.h>
-#include <std_msgs/Float64.h>
 #include <common.h>
+#include <encoder_sampler.h>
+#include <rasm_protocol.h>
 
+// Joint-state frames per second. A frame is 19 bytes, 1.65 ms on the wire at 115200
+// baud, so the link tops out a little above 500.
+#define JOINT_STATE_RATE_HZ 200
 
-
-
-ros::NodeHandle  nh;
-
-std_msgs::Float64 shoulder_angle;
-ros::Publisher shoulder("shoulder", &shoulder_angle);
-
-std_msgs::Float64 elbow_angle;
-ros::Publisher elbow("elbow", &elbow_angle);
+const unsigned long joint_state_period_us = 1000000UL / JOINT_STATE_RATE_HZ;
+unsigned long next_joint_state_us;
+uint8_t joint_state_sequence = 0;
+RasmJointStateFrame joint_state;
+uint8_t joint_state_frame[RASM_JOINT_STATE_FRAME_SIZE];
+EncoderSnapshot encoders;
 
 
 void setup()
 {
-  nh.initNode();
-  nh.advertise(shoulder);
-  nh.advertise(elbow);
+  Serial.begin(RASM_SERIAL_BAUD);
+  // In RASM_JOINT_* order.
+  const uint8_t encoder_pins[RASM_JOINT_COUNT] = {(uint8_t)shoulder_encoder_pin, (uint8_t)elbow_encoder_pin,
+                                                  (uint8_t)yaw_encoder_pin, (uint8_t)pitch_encoder_pin,
+                                                  (uint8_t)roll_encoder_pin};
+  encoder_sampler.begin(encoder_pins, RASM_JOINT_COUNT);
+  next_joint_state_us = micros();
 }
 
 void loop()
 {
-  shoulder_angle.data = shoulderAngle();
-  shoulder.publish(&shoulder_angle);
-  elbow_angle.data = elbowAngle();
-  elbow.publish(&elbow_angle);
-  nh.spinOnce();
-  delay(1000);
+  encoder_sampler.poll();
+  const unsigned long now = micros();
+  if ((long)(now - next_joint_state_us) < 0)
+  {
+    return;
+  }
+  next_joint_state_us += joint_state_period_us;
+  if ((long)(now - next_joint_state_us) >= 0)
+  {
+    // Fell a whole period behind: start the schedule over instead of bursting.
+    next_joint_state_us = now + joint_state_period_us;
+  }
+
+  // The sequence number goes up for every frame, sent or not, so the computer can tell
+  // how many it missed.
+  encoder_sampler.snapshot(encoders);
+  joint_state.sequence = joint_state_sequence++;
+  joint_state.time_us = encoders.time_us;
+  joint_state.angles[RASM_JOINT_SHOULDER] = rasmJointAngle(shoulderAngleFromSteps(encoders.steps(RASM_JOINT_SHOULDER)));
+  joint_state.angles[RASM_JOINT_ELBOW] = rasmJointAngle(elbowAngleFromSteps(encoders.steps(RASM_JOINT_ELBOW)));
+  joint_state.angles[RASM_JOINT_YAW] = rasmJointAngle(yawAngleFromSteps(encoders.steps(RASM_JOINT_YAW)));
+  joint_state.angles[RASM_JOINT_PITCH] = rasmJointAngle(pitchAngleFromSteps(encoders.steps(RASM_JOINT_PITCH)));
+  joint_state.angles[RASM_JOINT_ROLL] = rasmJointAngle(rollAngleFromSteps(encoders.steps(RASM_JOINT_ROLL)));
+  const uint8_t size = rasmEncodeJointState(joint_state, joint_state_frame);
+
+  // Never wait on the UART: if the last frame is still going out, drop this one.
+  if (Serial.availableForWrite() >= size)
+  {
+    Serial.write(joint_state_frame, size);
+  }
 }
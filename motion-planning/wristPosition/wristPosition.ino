@@ -1,3 +1,5 @@
+#include <arm_kinematics.h>
+
 int roll_encoder_pin = A5;
 int elbow_encoder_pin = A8;
 int pitch_encoder_pin = A6;
@@ -10,6 +12,7 @@ double elbowEncoderOffset = 171.7; //degrees
 #define cosDeg(degrees) cos((degrees)*PI/180.0)
 double a1 = 16.0; //inches
 double a2 = 19.75; //inches
+ArmKinematics<double> arm;   // the DH table of linearTransformationDHParameters.m
 
 double shoulderAngle()
 {
@@ -30,13 +33,14 @@ void setup() {
 }
 
 void loop() {
-  double theta1 = shoulderAngle();
-  double theta2 = elbowAngle();
-
-  // This math uses the result of the linear transform T1*T2*[a2, 0, 0, 1] using the DH parameter method
+  // The wrist is frame 3's origin, T1*T2*[a2, 0, 0, 1] using the DH parameter method; the wrist
+  // yaw (theta3) turns about it, so it does not matter here.
+  const double theta[3] = {shoulderAngle() * PI / 180.0, elbowAngle() * PI / 180.0, 0};
+  double rotation[3][3], position[3];
+  arm.forward(theta, rotation, position, 3);
   Serial.print("x = ");
-  Serial.println((cosDeg(theta1)*cosDeg(theta2)-sinDeg(theta1)*sinDeg(theta2))*a2 + a1*cosDeg(theta1));
+  Serial.println(position[0]);
   Serial.print("y = ");
-  Serial.println((sinDeg(theta1)*cosDeg(theta2)+cosDeg(theta1)*sinDeg(theta2))*a2 + a1*sinDeg(theta1));
+  Serial.println(position[1]);
   delay(500);
 }
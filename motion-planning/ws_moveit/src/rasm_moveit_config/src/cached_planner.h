@@ -0,0 +1,294 @@
+#pragma once
+#include <chrono>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <moveit/move_group_interface/move_group_interface.h>
+#include <moveit/planning_scene/planning_scene.h>
+#include <moveit/robot_model_loader/robot_model_loader.h>
+#include <moveit/robot_state/conversions.h>
+#include <moveit/robot_trajectory/robot_trajectory.h>
+#include <moveit/trajectory_processing/iterative_time_parameterization.h>
+#include "ros/ros.h"
+#include "plan_cache.h"
+
+// Plans a group's moves from the plan cache first, then the roadmap, and only then through
+// move_group (OMPL, ompl_planning.yaml); whatever plans a move, the cache keeps it (plan_cache.h).
+//
+// The roadmap lives in the file in the ~roadmap_file parameter (default
+// ~/.ros/<group>.roadmap). It is built the first time, and again whenever the URDF, the SRDF or
+// joint_limits.yaml on the parameter server are not what it was built from; refresh() checks
+// that and empties the cache as well. The roadmap and the cache only know about the arm itself
+// (its joint limits and self-collisions): anything added to the planning scene's world has to
+// go through move_group, so clear() the cache when adding some.
+class CachedPlanner
+{
+public:
+  typedef moveit::planning_interface::MoveGroupInterface::Plan Plan;
+  enum Source { FROM_CACHE, FROM_ROADMAP, FROM_PLANNER, NOT_PLANNED };
+
+  explicit CachedPlanner(moveit::planning_interface::MoveGroupInterface& move_group)
+    : move_group(move_group), group(nullptr), fingerprint(0), roadmap_built(false), roadmap_time_ms(0)
+  {
+    ros::NodeHandle private_nh("~");
+    const char* home = std::getenv("HOME");
+    private_nh.param<std::string>("roadmap_file", roadmap_file,
+                                  std::string(home ? home : ".") + "/.ros/" + move_group.getName() + ".roadmap");
+    private_nh.param("roadmap_samples", settings.samples, settings.samples);
+    private_nh.param("roadmap_neighbours", settings.neighbours, settings.neighbours);
+    double resolution;
+    private_nh.param("plan_cache_resolution", resolution, 0.01);
+    cache.setResolution(resolution);
+    refresh();
+  }
+
+  // Checks the robot description against what the cache and roadmap were made from, and
+  // starts them again if it has changed. True if it did.
+  bool refresh()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    const uint64_t current = descriptionFingerprint();
+    if (group && current == fingerprint)
+    {
+      return false;
+    }
+    if (group)
+    {
+      ROS_WARN_NAMED("plan_cache", "Robot description changed; dropping %zu cached plans and the roadmap",
+                     cache.size());
+    }
+    loader.reset(new robot_model_loader::RobotModelLoader("robot_description", false));
+    model = loader->getModel();
+    group = model ? model->getJointModelGroup(move_group.getName()) : nullptr;
+    if (!group)
+    {
+      ROS_ERROR_NAMED("plan_cache", "No group %s in robot_description", move_group.getName().c_str());
+      return true;
+    }
+    scene.reset(new planning_scene::PlanningScene(model));
+    state.reset(new moveit::core::RobotState(model));
+    state->setToDefaultValues();
+    cache.invalidate(current);
+    fingerprint = current;
+    loadRoadmap();
+    return true;
+  }
+
+  Source plan(const JointVector& start, const std::string& target, Plan& plan)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    const auto named = named_states.find(target);
+    if (named == named_states.end())
+    {
+      return NOT_PLANNED;
+    }
+    return planMove(start, cache.key(start, target), named->second, [&]() { move_group.setNamedTarget(target); },
+                    plan);
+  }
+
+  Source plan(const JointVector& start, const JointVector& goal, Plan& plan)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return planMove(start, cache.key(start, goal), goal, [&]() { move_group.setJointValueTarget(goal); }, plan);
+  }
+
+  void clear()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    cache.clear();
+  }
+
+  const std::map<std::string, JointVector>& namedStates() const { return named_states; }
+  const PlanCache<Plan>& planCache() const { return cache; }
+  const Roadmap& roadmap() const { return road; }
+  bool roadmapBuilt() const { return roadmap_built; }     // rather than loaded from roadmap_file
+  double roadmapTimeMs() const { return roadmap_time_ms; }
+
+private:
+  // What the model, and so the roadmap, is made from: the URDF (joint limits), the SRDF (groups,
+  // named states, disabled collisions), joint_limits.yaml and the roadmap settings.
+  uint64_t descriptionFingerprint() const
+  {
+    PlanFingerprint hash;
+    for (const char* parameter : {"robot_description", "robot_description_semantic", "robot_description_planning"})
+    {
+      XmlRpc::XmlRpcValue value;
+      hash.add(parameter);
+      if (ros::param::get(parameter, value))
+      {
+        hash.add(value.getType() == XmlRpc::XmlRpcValue::TypeString ? static_cast<std::string&>(value) : value.toXml());
+      }
+    }
+    hash.add(move_group.getName());
+    hash.add((double)settings.samples);
+    hash.add((double)settings.neighbours);
+    hash.add(settings.step);
+    return hash.value();
+  }
+
+  bool valid(const JointVector& joints)
+  {
+    state->setJointGroupPositions(group, joints);
+    if (!state->satisfiesBounds(group, bounds_margin))
+    {
+      return false;
+    }
+    state->update();
+    return !scene->isStateColliding(*state, group->getName());
+  }
+
+  void loadRoadmap()
+  {
+    JointVector lower, upper;
+    for (const moveit::core::JointModel::Bounds* bounds : group->getActiveJointModelsBounds())
+    {
+      for (const moveit::core::VariableBounds& variable : *bounds)
+      {
+        lower.push_back(variable.min_position_);
+        upper.push_back(variable.max_position_);
+      }
+    }
+    named_states.clear();
+    JointPath fixed;
+    for (const std::string& name : group->getDefaultStateNames())
+    {
+      std::map<std::string, double> values;
+      group->getVariableDefaultPositions(name, values);
+      JointVector joints;
+      for (const std::string& variable : group->getVariableNames())
+      {
+        joints.push_back(values[variable]);
+      }
+      named_states[name] = joints;
+      fixed.push_back(joints);
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    roadmap_built = !road.load(roadmap_file, fingerprint);
+    if (roadmap_built)
+    {
+      road.build(lower, upper, fixed, settings, [this](const JointVector& joints) { return valid(joints); },
+                 fingerprint);
+      if (!road.save(roadmap_file))
+      {
+        ROS_WARN_NAMED("plan_cache", "Unable to save the roadmap to %s", roadmap_file.c_str());
+      }
+    }
+    roadmap_time_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    ROS_INFO_NAMED("plan_cache", "%s roadmap of %zu configurations and %zu edges in %.1f ms (%s)",
+                   roadmap_built ? "Built" : "Loaded", road.size(), road.edgeCount(), roadmap_time_ms,
+                   roadmap_file.c_str());
+  }
+
+  template <typename SetTarget>
+  Source planMove(const JointVector& start, const std::string& key, const JointVector& goal, SetTarget setTarget,
+                  Plan& plan)
+  {
+    if (!group)
+    {
+      return NOT_PLANNED;
+    }
+    if (const Plan* cached = cache.find(key))
+    {
+      plan = *cached;
+      startFrom(start, plan);
+      return FROM_CACHE;
+    }
+    const auto began = std::chrono::steady_clock::now();
+    Source source = FROM_ROADMAP;
+    JointPath path;
+    if (road.query(start, goal, [this](const JointVector& joints) { return valid(joints); }, path))
+    {
+      timePath(path, plan);
+      plan.planning_time_ = std::chrono::duration<double>(std::chrono::steady_clock::now() - began).count();
+    }
+    else
+    {
+      state->setJointGroupPositions(group, start);
+      move_group.setStartState(*state);
+      setTarget();
+      const bool planned = move_group.plan(plan) == moveit::planning_interface::MoveItErrorCode::SUCCESS;
+      move_group.setStartStateToCurrentState();
+      if (!planned)
+      {
+        return NOT_PLANNED;
+      }
+      source = FROM_PLANNER;
+    }
+    cache.store(key, plan);
+    return source;
+  }
+
+  // A cached plan starts in the same grid cell as start, not at it.
+  void startFrom(const JointVector& start, Plan& plan)
+  {
+    const std::vector<std::string>& variables = group->getVariableNames();
+    trajectory_msgs::JointTrajectory& trajectory = plan.trajectory_.joint_trajectory;
+    sensor_msgs::JointState& start_state = plan.start_state_.joint_state;
+    for (std::size_t v = 0; v < variables.size(); ++v)
+    {
+      for (std::size_t j = 0; !trajectory.points.empty() && j < trajectory.joint_names.size(); ++j)
+      {
+        if (trajectory.joint_names[j] == variables[v])
+        {
+          trajectory.points[0].positions[j] = start[v];
+        }
+      }
+      for (std::size_t j = 0; j < start_state.name.size() && j < start_state.position.size(); ++j)
+      {
+        if (start_state.name[j] == variables[v])
+        {
+          start_state.position[j] = start[v];
+        }
+      }
+    }
+  }
+
+  // Waypoints every waypoint_spacing rad along the path, timed within the joint limits as
+  // move_group times OMPL's paths.
+  void timePath(const JointPath& path, Plan& plan)
+  {
+    robot_trajectory::RobotTrajectory trajectory(model, group);
+    for (std::size_t i = 0; i < path.size(); ++i)
+    {
+      const int steps = i == 0 ? 1 : std::max(1, (int)std::ceil(jointDistance(path[i - 1], path[i]) / waypoint_spacing));
+      for (int s = 1; s <= steps; ++s)
+      {
+        JointVector joints = path[i];
+        for (std::size_t j = 0; i > 0 && j < joints.size(); ++j)
+        {
+          joints[j] = path[i - 1][j] + (path[i][j] - path[i - 1][j]) * s / steps;
+        }
+        state->setJointGroupPositions(group, joints);
+        state->update();
+        trajectory.addSuffixWayPoint(*state, 0);
+      }
+    }
+    time_parameterization.computeTimeStamps(trajectory);
+    trajectory.getRobotTrajectoryMsg(plan.trajectory_);
+    moveit::core::robotStateToRobotStateMsg(trajectory.getFirstWayPoint(), plan.start_state_);
+  }
+
+  static constexpr double bounds_margin = 0.01;      // rad the start may be outside the limits
+  static constexpr double waypoint_spacing = 0.05;   // rad
+
+  moveit::planning_interface::MoveGroupInterface& move_group;
+  std::unique_ptr<robot_model_loader::RobotModelLoader> loader;
+  moveit::core::RobotModelPtr model;
+  const moveit::core::JointModelGroup* group;
+  planning_scene::PlanningScenePtr scene;
+  std::unique_ptr<moveit::core::RobotState> state;
+  trajectory_processing::IterativeParabolicTimeParameterization time_parameterization;
+  std::map<std::string, JointVector> named_states;
+  Roadmap::Settings settings;
+  Roadmap road;
+  PlanCache<Plan> cache;
+  std::string roadmap_file;
+  uint64_t fingerprint;
+  bool roadmap_built;
+  double roadmap_time_ms;
+  std::mutex mutex;
+};
@@ -0,0 +1,244 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <thread>
+#include <time.h>
+#include <controller_manager/controller_manager.h>
+#include <hardware_interface/robot_hw.h>
+#include "ros/ros.h"
+#include "metrics.h"
+
+// Settings for ControlLoop. loop_hz and cycle_time_error_threshold are read from the
+// generic_hw_control_loop namespace of ros_controllers.yaml.
+struct ControlLoopOptions
+{
+  double loop_hz = 300;
+  // A cycle that takes longer than this (seconds) past its deadline counts as an overrun.
+  double cycle_time_error_threshold = 0.01;
+  // SCHED_FIFO priority for the loop thread; 0 leaves it on the normal scheduler.
+  int realtime_priority = 80;
+  // How often the jitter and overrun statistics are logged, in seconds.
+  double report_period = 10;
+
+  void load(const ros::NodeHandle& nh)
+  {
+    nh.param("generic_hw_control_loop/loop_hz", loop_hz, loop_hz);
+    nh.param("generic_hw_control_loop/cycle_time_error_threshold", cycle_time_error_threshold,
+             cycle_time_error_threshold);
+    nh.param("generic_hw_control_loop/realtime_priority", realtime_priority, realtime_priority);
+    nh.param("generic_hw_control_loop/report_period", report_period, report_period);
+  }
+};
+
+// Timing of the control loop over one report period, in microseconds. Wake-up latency is
+// how late the thread woke up after its deadline; cycle time is read + update + write.
+struct ControlLoopStats
+{
+  unsigned long cycles = 0;
+  unsigned long overruns = 0;
+  double latency_max = 0;
+  double latency_sum = 0;
+  double latency_sum_sq = 0;
+  double cycle_max = 0;
+  double cycle_sum = 0;
+
+  void record(double latency_us, double cycle_us, bool overrun)
+  {
+    ++cycles;
+    overruns += overrun ? 1 : 0;
+    latency_max = std::max(latency_max, latency_us);
+    latency_sum += latency_us;
+    latency_sum_sq += latency_us * latency_us;
+    cycle_max = std::max(cycle_max, cycle_us);
+    cycle_sum += cycle_us;
+  }
+
+  double latencyMean() const { return cycles ? latency_sum / cycles : 0; }
+  // Standard deviation of the wake-up latency, i.e. the period jitter.
+  double jitter() const
+  {
+    if (cycles == 0)
+    {
+      return 0;
+    }
+    const double mean = latencyMean();
+    return std::sqrt(std::max(0.0, latency_sum_sq / cycles - mean * mean));
+  }
+  double cycleMean() const { return cycles ? cycle_sum / cycles : 0; }
+};
+
+// Runs read -> ControllerManager::update -> write on the robot at a fixed rate on its own
+// thread, SCHED_FIFO if the process is allowed to (rtprio in /etc/security/limits.conf),
+// sleeping to absolute deadlines on CLOCK_MONOTONIC so the period does not drift. A cycle
+// that misses its deadline is counted as an overrun and the schedule restarts from now,
+// instead of running the missed cycles back to back. The loop thread never blocks on
+// anything but its own sleep: statistics are handed to the logging side through a flag
+// and are simply kept for the next period if the last ones have not been picked up yet.
+class ControlLoop
+{
+public:
+  ControlLoop(hardware_interface::RobotHW& robot, controller_manager::ControllerManager& cm,
+              const ControlLoopOptions& options)
+    : robot(robot), cm(cm), options(options), running(false), stats_ready(false), metrics(nullptr),
+      latency_metric(-1), cycle_metric(-1), overrun_metric(-1)
+  {
+  }
+
+  // Also keeps every cycle's timing in the runtime metrics (metrics.h). Call before start().
+  void addMetrics(MetricsRegistry& registry)
+  {
+    metrics = &registry;
+    latency_metric = registry.histogram("rasm_control_wakeup_latency_seconds",
+                                        "How late the control loop woke up after its deadline.");
+    cycle_metric = registry.histogram("rasm_control_cycle_seconds", "Control loop read, update and write.");
+    overrun_metric = registry.counter("rasm_control_overruns_total", "Control cycles that missed their deadline.");
+  }
+
+  ~ControlLoop()
+  {
+    stop();
+  }
+
+  void start()
+  {
+    running = true;
+    thread = std::thread(&ControlLoop::run, this);
+  }
+
+  void stop()
+  {
+    running = false;
+    if (thread.joinable())
+    {
+      thread.join();
+    }
+  }
+
+  // Logs the statistics of the last finished report period, if there is one. Called from a
+  // non-realtime thread.
+  void report()
+  {
+    if (!stats_ready.load(std::memory_order_acquire))
+    {
+      return;
+    }
+    const ControlLoopStats s = published_stats;
+    stats_ready.store(false, std::memory_order_release);
+    ROS_INFO_NAMED("control_loop",
+                   "control loop: %lu cycles at %.0f Hz | wake-up latency mean %.1f us max %.1f us "
+                   "jitter %.1f us | cycle mean %.1f us max %.1f us | overruns %lu",
+                   s.cycles, options.loop_hz, s.latencyMean(), s.latency_max, s.jitter(), s.cycleMean(),
+                   s.cycle_max, s.overruns);
+  }
+
+private:
+  static double microseconds(const timespec& a, const timespec& b)
+  {
+    return (b.tv_sec - a.tv_sec) * 1e6 + (b.tv_nsec - a.tv_nsec) / 1e3;
+  }
+
+  static void add(timespec& t, long ns)
+  {
+    t.tv_nsec += ns;
+    while (t.tv_nsec >= 1000000000L)
+    {
+      t.tv_nsec -= 1000000000L;
+      ++t.tv_sec;
+    }
+  }
+
+  void makeRealtime()
+  {
+    if (options.realtime_priority <= 0)
+    {
+      return;
+    }
+    sched_param param;
+    std::memset(&param, 0, sizeof(param));
+    param.sched_priority = std::min(options.realtime_priority, sched_get_priority_max(SCHED_FIFO));
+    const int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (error != 0)
+    {
+      ROS_WARN_NAMED("control_loop", "control loop stays on the normal scheduler (SCHED_FIFO: %s)",
+                     std::strerror(error));
+      return;
+    }
+    // Keep page faults out of the loop.
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+    {
+      ROS_WARN_NAMED("control_loop", "mlockall: %s", std::strerror(errno));
+    }
+    ROS_INFO_NAMED("control_loop", "control loop running SCHED_FIFO at priority %d", param.sched_priority);
+  }
+
+  void run()
+  {
+    makeRealtime();
+    const long period_ns = static_cast<long>(1e9 / options.loop_hz);
+    const double threshold_us = options.cycle_time_error_threshold * 1e6;
+    const unsigned long cycles_per_report =
+        std::max(1UL, static_cast<unsigned long>(options.report_period * options.loop_hz));
+    ControlLoopStats stats;
+    timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    timespec last_start = deadline;
+    add(deadline, period_ns);
+    while (running && ros::ok())
+    {
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+      timespec start;
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      const ros::Duration period(microseconds(last_start, start) / 1e6);
+      last_start = start;
+      const ros::Time now = ros::Time::now();
+
+      robot.read(now, period);
+      cm.update(now, period);
+      robot.write(now, period);
+
+      timespec end;
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      const double latency_us = microseconds(deadline, start);
+      const double cycle_us = microseconds(start, end);
+      const bool overrun = microseconds(deadline, end) > threshold_us;
+      stats.record(latency_us, cycle_us, overrun);
+      if (metrics)
+      {
+        metrics->record(latency_metric, latency_us);
+        metrics->record(cycle_metric, cycle_us);
+        metrics->add(overrun_metric, overrun ? 1 : 0);
+      }
+
+      add(deadline, period_ns);
+      if (microseconds(deadline, end) > 0)
+      {
+        // Already past the next deadline: start the schedule over from now.
+        deadline = end;
+        add(deadline, period_ns);
+      }
+      if (stats.cycles >= cycles_per_report && !stats_ready.load(std::memory_order_acquire))
+      {
+        published_stats = stats;
+        stats_ready.store(true, std::memory_order_release);
+        stats = ControlLoopStats();
+      }
+    }
+  }
+
+  hardware_interface::RobotHW& robot;
+  controller_manager::ControllerManager& cm;
+  ControlLoopOptions options;
+  std::atomic<bool> running;
+  std::thread thread;
+  // Written by the loop thread while stats_ready is false, read by report() while it is true.
+  ControlLoopStats published_stats;
+  std::atomic<bool> stats_ready;
+  MetricsRegistry* metrics;
+  int latency_metric, cycle_metric, overrun_metric;
+};
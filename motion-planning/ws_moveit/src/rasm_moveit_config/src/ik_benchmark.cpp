@@ -0,0 +1,187 @@
+// Compares the closed-form kinematics plugin (rasm_kinematics_plugin.cpp) with KDL's on the
+// rasm_arm group: solve time, success rate and how close the solution puts the tip to the
+// target, over poses made from joint angles sampled uniformly within the joint limits (so every
+// pose is reachable), each solved from a random seed.
+//
+// roslaunch rasm_moveit_config ik_benchmark.launch [samples:=N] [group:=G]
+//
+// It also times the closed form of the whole five-joint DH chain (rasm_ik.h), which is not in
+// the URDF yet, so there is nothing to compare it with.
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+#include <moveit/kinematics_base/kinematics_base.h>
+#include <moveit/robot_model_loader/robot_model_loader.h>
+#include <moveit/robot_state/robot_state.h>
+#include <pluginlib/class_loader.h>
+#include <random_numbers/random_numbers.h>
+#include <tf2_eigen/tf2_eigen.h>
+#include "ros/ros.h"
+#include "rasm_ik.h"
+#include "stage_timing.h"
+
+struct SolverResult
+{
+  LatencyHistogram time;
+  unsigned long attempts = 0;
+  unsigned long solved = 0;
+  unsigned long accurate = 0;     // within the tolerances of the target
+  unsigned long branches = 0;     // all-solutions getPositionIK, when the plugin has it
+  double position_error_sum = 0;  // metres, over the solved ones
+  double position_error_max = 0;
+  double orientation_error_max = 0;   // radians
+};
+
+static void report(const char* name, const SolverResult& result)
+{
+  std::printf("%-8s solved %6.2f%%  accurate %6.2f%%  time mean %8.1f us  p50 %8.1f us  p99 %8.1f us  max %8.1f us\n",
+              name, 100.0 * result.solved / std::max(1ul, result.attempts),
+              100.0 * result.accurate / std::max(1ul, result.attempts), result.time.mean(),
+              result.time.percentile(50), result.time.percentile(99), result.time.max());
+  std::printf("         position error mean %.3g m  max %.3g m  orientation error max %.3g rad",
+              result.position_error_sum / std::max(1ul, result.solved), result.position_error_max,
+              result.orientation_error_max);
+  if (result.branches)
+  {
+    std::printf("  branches per pose %.2f", (double)result.branches / std::max(1ul, result.attempts));
+  }
+  std::printf("\n");
+}
+
+int main(int argc, char** argv)
+{
+  ros::init(argc, argv, "ik_benchmark");
+  ros::NodeHandle private_nh("~");
+  int samples, seed;
+  std::string group_name;
+  double timeout, position_tolerance, orientation_tolerance;
+  private_nh.param("samples", samples, 10000);
+  private_nh.param("seed", seed, 1);
+  private_nh.param<std::string>("group", group_name, "rasm_arm");
+  private_nh.param("timeout", timeout, 0.005);   // kinematics_solver_timeout in kinematics.yaml
+  private_nh.param("position_tolerance", position_tolerance, 1e-5);
+  private_nh.param("orientation_tolerance", orientation_tolerance, 1e-4);
+
+  robot_model_loader::RobotModelLoader loader("robot_description", false);
+  const moveit::core::RobotModelPtr& model = loader.getModel();
+  const moveit::core::JointModelGroup* group = model ? model->getJointModelGroup(group_name) : nullptr;
+  if (!group)
+  {
+    ROS_ERROR("No group %s in robot_description", group_name.c_str());
+    return 1;
+  }
+  const std::string tip = group->getLinkModelNames().back();
+  const std::string base = model->getModelFrame();
+
+  pluginlib::ClassLoader<kinematics::KinematicsBase> plugin_loader("moveit_core", "kinematics::KinematicsBase");
+  const char* const plugin_names[] = {"kdl_kinematics_plugin/KDLKinematicsPlugin", "rasm_kinematics/RasmKinematicsPlugin"};
+  const char* const short_names[] = {"KDL", "closed"};
+  std::vector<kinematics::KinematicsBasePtr> solvers;
+  for (const char* name : plugin_names)
+  {
+    kinematics::KinematicsBasePtr solver = plugin_loader.createInstance(name);
+    if (!solver->initialize(*model, group_name, base, std::vector<std::string>(1, tip), 0.005))
+    {
+      ROS_ERROR("%s does not support %s", name, group_name.c_str());
+      return 1;
+    }
+    solver->setDefaultTimeout(timeout);
+    solvers.push_back(solver);
+  }
+
+  std::printf("%s: %zu joints, %s to %s, %d poses, KDL timeout %.1f ms\n", group_name.c_str(),
+              group->getActiveJointModels().size(), base.c_str(), tip.c_str(), samples, timeout * 1000);
+  random_numbers::RandomNumberGenerator random(seed);
+  moveit::core::RobotState state(model);
+  state.setToDefaultValues();
+  std::vector<SolverResult> results(solvers.size());
+  std::vector<double> seed_joints, solution;
+  for (int sample = 0; sample < samples && ros::ok(); ++sample)
+  {
+    state.setToRandomPositions(group, random);
+    state.update();
+    const Eigen::Isometry3d target = state.getGlobalLinkTransform(tip);
+    const geometry_msgs::Pose pose = tf2::toMsg(target);
+    state.setToRandomPositions(group, random);
+    state.copyJointGroupPositions(group, seed_joints);
+    for (size_t s = 0; s < solvers.size(); ++s)
+    {
+      SolverResult& result = results[s];
+      moveit_msgs::MoveItErrorCodes error_code;
+      const auto start = std::chrono::steady_clock::now();
+      const bool solved = solvers[s]->searchPositionIK(pose, seed_joints, timeout, solution, error_code);
+      result.time.record(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+      ++result.attempts;
+      std::vector<std::vector<double>> all;
+      kinematics::KinematicsResult all_result;
+      if (s == solvers.size() - 1 &&
+          solvers[s]->getPositionIK(std::vector<geometry_msgs::Pose>(1, pose), seed_joints, all, all_result,
+                                    kinematics::KinematicsQueryOptions()))
+      {
+        result.branches += all.size();
+      }
+      if (!solved)
+      {
+        continue;
+      }
+      ++result.solved;
+      moveit::core::RobotState reached(state);
+      reached.setJointGroupPositions(group, solution);
+      reached.update();
+      const Eigen::Isometry3d pose_reached = reached.getGlobalLinkTransform(tip);
+      const double position_error = (pose_reached.translation() - target.translation()).norm();
+      const double orientation_error =
+          Eigen::AngleAxisd(pose_reached.linear().transpose() * target.linear()).angle();
+      result.position_error_sum += position_error;
+      result.position_error_max = std::max(result.position_error_max, position_error);
+      result.orientation_error_max = std::max(result.orientation_error_max, orientation_error);
+      result.accurate += position_error <= position_tolerance && orientation_error <= orientation_tolerance;
+    }
+  }
+  for (size_t s = 0; s < solvers.size(); ++s)
+  {
+    report(short_names[s], results[s]);
+  }
+
+  // The whole arm, as linearTransformationDHParameters.m has it, in metres.
+  RasmDHChain dh;
+  dh.scale(0.0254);
+  SolverResult whole;
+  for (int sample = 0; sample < samples; ++sample)
+  {
+    double q[RasmDHChain::joint_count], rotation[3][3], position[3], solutions[2][RasmDHChain::joint_count];
+    for (double& joint : q)
+    {
+      joint = random.uniformReal(-M_PI, M_PI);
+    }
+    dh.forward(q, rotation, position);
+    const auto start = std::chrono::steady_clock::now();
+    const int count = dh.inverse(rotation, position, solutions, q[4]);
+    whole.time.record(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+    ++whole.attempts;
+    whole.branches += count;
+    double best = 1e9;
+    for (int i = 0; i < count; ++i)
+    {
+      double reached_rotation[3][3], reached_position[3];
+      dh.forward(solutions[i], reached_rotation, reached_position);
+      best = std::min(best, std::sqrt(std::pow(reached_position[0] - position[0], 2) +
+                                      std::pow(reached_position[1] - position[1], 2) +
+                                      std::pow(reached_position[2] - position[2], 2)));
+    }
+    if (count > 0)
+    {
+      ++whole.solved;
+      whole.accurate += best <= position_tolerance;
+      whole.position_error_sum += best;
+      whole.position_error_max = std::max(whole.position_error_max, best);
+    }
+  }
+  std::printf("\nfive-joint DH chain (rasm_ik.h only, poses from joint angles anywhere in -pi..pi)\n");
+  report("closed", whole);
+  return 0;
+}
@@ -0,0 +1,468 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <limits>
+#include <list>
+#include <queue>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Plans for the moves rasm_motion makes over and over (park, home and the search pattern in
+// notes.txt) without running OMPL every time. A plan cache keyed on where the move starts and
+// where it goes answers a repeated move; a probabilistic roadmap of the group's joint space,
+// built once and kept on disk, answers a new one. cached_planner.h puts them in front of
+// move_group; this part does not need ROS, so it can be checked on its own.
+
+typedef std::vector<double> JointVector;
+typedef std::vector<JointVector> JointPath;
+
+inline double jointDistance(const JointVector& a, const JointVector& b)
+{
+  double sum = 0;
+  for (std::size_t i = 0; i < a.size(); ++i)
+  {
+    sum += (a[i] - b[i]) * (a[i] - b[i]);
+  }
+  return std::sqrt(sum);
+}
+
+// FNV-1a over what a roadmap or cache was made from (the SRDF, the joint limits, the roadmap
+// settings), so one made from something else can be told apart and thrown away.
+class PlanFingerprint
+{
+public:
+  PlanFingerprint() : hash(14695981039346656037ull) {}
+
+  void add(const void* data, std::size_t size)
+  {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (std::size_t i = 0; i < size; ++i)
+    {
+      hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+  }
+  void add(const std::string& text) { add(text.data(), text.size() + 1); }
+  void add(double value) { add(&value, sizeof value); }
+
+  uint64_t value() const { return hash; }
+
+private:
+  uint64_t hash;
+};
+
+// A probabilistic roadmap (PRM): collision-free joint configurations joined to their nearest
+// neighbours by straight, checked segments. A query joins the start and goal to the roadmap,
+// takes the shortest way through it and then shortcuts that.
+class Roadmap
+{
+public:
+  typedef std::function<bool(const JointVector&)> ValidityCheck;
+
+  struct Settings
+  {
+    int samples = 300;      // random configurations, besides the fixed ones
+    int neighbours = 10;    // each is joined to at most this many of its nearest
+    double step = 0.01;     // rad between the configurations checked along a segment
+    unsigned seed = 1;
+  };
+
+  Roadmap() : fingerprint_(0) {}
+
+  // Samples the box lower..upper. The fixed configurations (the named states) go in first, so
+  // moves between them run along the roadmap's own edges.
+  void build(const JointVector& lower, const JointVector& upper, const JointPath& fixed, const Settings& use,
+             const ValidityCheck& valid, uint64_t fingerprint)
+  {
+    settings = use;
+    fingerprint_ = fingerprint;
+    nodes.clear();
+    adjacency.clear();
+    for (const JointVector& joints : fixed)
+    {
+      if (valid(joints))
+      {
+        nodes.push_back(joints);
+      }
+    }
+    std::mt19937 random(settings.seed);
+    JointVector joints(lower.size());
+    for (int i = 0; i < settings.samples; ++i)
+    {
+      for (std::size_t j = 0; j < joints.size(); ++j)
+      {
+        joints[j] = std::uniform_real_distribution<double>(lower[j], upper[j])(random);
+      }
+      if (valid(joints))
+      {
+        nodes.push_back(joints);
+      }
+    }
+    adjacency.assign(nodes.size(), std::vector<Edge>());
+    for (std::size_t i = 0; i < nodes.size(); ++i)
+    {
+      for (const Edge& near : nearest(nodes[i]))
+      {
+        const std::size_t j = near.first;
+        if (j == i || joined(i, j) || !segmentValid(nodes[i], nodes[j], valid))
+        {
+          continue;
+        }
+        adjacency[i].push_back(Edge(j, near.second));
+        adjacency[j].push_back(Edge(i, near.second));
+      }
+    }
+  }
+
+  // A collision-free path from start to goal, or false if the roadmap has none (then it is
+  // move_group's turn).
+  bool query(const JointVector& start, const JointVector& goal, const ValidityCheck& valid, JointPath& path) const
+  {
+    path.clear();
+    if (segmentValid(start, goal, valid))
+    {
+      path.push_back(start);
+      path.push_back(goal);
+      return true;
+    }
+    const std::vector<Edge> entries = connections(start, valid, false);
+    const std::vector<Edge> exits = connections(goal, valid, true);
+    if (entries.empty() || exits.empty())
+    {
+      return false;
+    }
+
+    // Dijkstra from the start through the roadmap to the goal.
+    const double infinity = std::numeric_limits<double>::infinity();
+    std::vector<double> cost(nodes.size(), infinity);
+    std::vector<double> exit_cost(nodes.size(), infinity);
+    std::vector<int> previous(nodes.size(), -1);
+    typedef std::pair<double, std::size_t> Queued;
+    std::priority_queue<Queued, std::vector<Queued>, std::greater<Queued>> queue;
+    for (const Edge& entry : entries)
+    {
+      cost[entry.first] = entry.second;
+      queue.push(Queued(entry.second, entry.first));
+    }
+    for (const Edge& exit : exits)
+    {
+      exit_cost[exit.first] = exit.second;
+    }
+    double best = infinity;
+    int last = -1;
+    while (!queue.empty() && queue.top().first < best)
+    {
+      const Queued top = queue.top();
+      queue.pop();
+      if (top.first > cost[top.second])
+      {
+        continue;
+      }
+      if (top.first + exit_cost[top.second] < best)
+      {
+        best = top.first + exit_cost[top.second];
+        last = (int)top.second;
+      }
+      for (const Edge& edge : adjacency[top.second])
+      {
+        if (top.first + edge.second < cost[edge.first])
+        {
+          cost[edge.first] = top.first + edge.second;
+          previous[edge.first] = (int)top.second;
+          queue.push(Queued(cost[edge.first], edge.first));
+        }
+      }
+    }
+    if (last < 0)
+    {
+      return false;
+    }
+    JointPath through;
+    for (int node = last; node >= 0; node = previous[node])
+    {
+      through.push_back(nodes[node]);
+    }
+    through.push_back(start);
+    std::reverse(through.begin(), through.end());
+    through.push_back(goal);
+    shortcut(through, valid, path);
+    return true;
+  }
+
+  // The file starts with the fingerprint the roadmap was built with; load() fails on a
+  // different one, as on a missing or damaged file.
+  bool save(const std::string& file) const
+  {
+    std::FILE* out = std::fopen(file.c_str(), "wb");
+    if (!out)
+    {
+      return false;
+    }
+    const uint32_t header[4] = {magic, (uint32_t)dimensions(), (uint32_t)nodes.size(), (uint32_t)settings.neighbours};
+    bool ok = std::fwrite(header, sizeof header, 1, out) == 1 &&
+              std::fwrite(&fingerprint_, sizeof fingerprint_, 1, out) == 1 &&
+              std::fwrite(&settings.step, sizeof settings.step, 1, out) == 1;
+    for (std::size_t i = 0; ok && i < nodes.size(); ++i)
+    {
+      const uint32_t count = (uint32_t)adjacency[i].size();
+      ok = std::fwrite(nodes[i].data(), sizeof(double), nodes[i].size(), out) == nodes[i].size() &&
+           std::fwrite(&count, sizeof count, 1, out) == 1;
+      for (const Edge& edge : adjacency[i])
+      {
+        const uint32_t to = (uint32_t)edge.first;
+        ok = ok && std::fwrite(&to, sizeof to, 1, out) == 1 &&
+             std::fwrite(&edge.second, sizeof edge.second, 1, out) == 1;
+      }
+    }
+    return std::fclose(out) == 0 && ok;
+  }
+
+  bool load(const std::string& file, uint64_t expected_fingerprint)
+  {
+    std::FILE* in = std::fopen(file.c_str(), "rb");
+    if (!in)
+    {
+      return false;
+    }
+    uint32_t header[4] = {0, 0, 0, 0};
+    uint64_t fingerprint;
+    double step;
+    bool ok = std::fread(header, sizeof header, 1, in) == 1 && header[0] == magic &&
+              std::fread(&fingerprint, sizeof fingerprint, 1, in) == 1 && fingerprint == expected_fingerprint &&
+              std::fread(&step, sizeof step, 1, in) == 1;
+    std::vector<JointVector> read_nodes(ok ? header[2] : 0, JointVector(header[1]));
+    std::vector<std::vector<Edge>> read_adjacency(read_nodes.size());
+    for (std::size_t i = 0; ok && i < read_nodes.size(); ++i)
+    {
+      uint32_t count;
+      ok = std::fread(read_nodes[i].data(), sizeof(double), header[1], in) == header[1] &&
+           std::fread(&count, sizeof count, 1, in) == 1;
+      for (uint32_t e = 0; ok && e < count; ++e)
+      {
+        uint32_t to;
+        double length;
+        ok = std::fread(&to, sizeof to, 1, in) == 1 && std::fread(&length, sizeof length, 1, in) == 1 &&
+             to < read_nodes.size();
+        read_adjacency[i].push_back(Edge(to, length));
+      }
+    }
+    std::fclose(in);
+    if (!ok)
+    {
+      return false;
+    }
+    nodes.swap(read_nodes);
+    adjacency.swap(read_adjacency);
+    fingerprint_ = fingerprint;
+    settings.neighbours = (int)header[3];
+    settings.step = step;
+    return true;
+  }
+
+  std::size_t size() const { return nodes.size(); }
+  std::size_t dimensions() const { return nodes.empty() ? 0 : nodes[0].size(); }
+  std::size_t edgeCount() const
+  {
+    std::size_t count = 0;
+    for (const std::vector<Edge>& edges : adjacency)
+    {
+      count += edges.size();
+    }
+    return count / 2;
+  }
+  uint64_t fingerprint() const { return fingerprint_; }
+
+private:
+  typedef std::pair<std::size_t, double> Edge;   // node, distance
+  static const uint32_t magic = 0x314d5250;       // "PRM1"
+
+  // Every configuration strictly after from, up to and including to.
+  bool segmentValid(const JointVector& from, const JointVector& to, const ValidityCheck& valid) const
+  {
+    const int steps = std::max(1, (int)std::ceil(jointDistance(from, to) / settings.step));
+    JointVector joints(from.size());
+    for (int s = 1; s <= steps; ++s)
+    {
+      for (std::size_t j = 0; j < joints.size(); ++j)
+      {
+        joints[j] = from[j] + (to[j] - from[j]) * s / steps;
+      }
+      if (!valid(joints))
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  std::vector<Edge> nearest(const JointVector& joints) const
+  {
+    std::vector<Edge> near(nodes.size());
+    for (std::size_t i = 0; i < nodes.size(); ++i)
+    {
+      near[i] = Edge(i, jointDistance(joints, nodes[i]));
+    }
+    const std::size_t count = std::min(near.size(), (std::size_t)settings.neighbours + 1);
+    std::partial_sort(near.begin(), near.begin() + count, near.end(),
+                      [](const Edge& a, const Edge& b) { return a.second < b.second; });
+    near.resize(count);
+    return near;
+  }
+
+  bool joined(std::size_t i, std::size_t j) const
+  {
+    for (const Edge& edge : adjacency[i])
+    {
+      if (edge.first == j)
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // The roadmap nodes joints can be joined to; to_joints checks the segments towards joints
+  // (the goal), otherwise away from it (the start, which may be just outside the limits).
+  std::vector<Edge> connections(const JointVector& joints, const ValidityCheck& valid, bool to_joints) const
+  {
+    std::vector<Edge> joinable;
+    for (const Edge& near : nearest(joints))
+    {
+      const JointVector& node = nodes[near.first];
+      if (to_joints ? segmentValid(node, joints, valid) : segmentValid(joints, node, valid))
+      {
+        joinable.push_back(near);
+      }
+    }
+    return joinable;
+  }
+
+  // Skips every waypoint that can be gone straight past.
+  void shortcut(const JointPath& through, const ValidityCheck& valid, JointPath& path) const
+  {
+    std::size_t from = 0;
+    path.push_back(through[0]);
+    while (from + 1 < through.size())
+    {
+      std::size_t to = through.size() - 1;
+      while (to > from + 1 && !segmentValid(through[from], through[to], valid))
+      {
+        --to;
+      }
+      path.push_back(through[to]);
+      from = to;
+    }
+  }
+
+  Settings settings;
+  uint64_t fingerprint_;
+  JointPath nodes;
+  std::vector<std::vector<Edge>> adjacency;
+};
+
+// Plans by where they start and where they go, the most recently used kept. The start, and a
+// goal given as joint values, are rounded to a grid of resolution rad, so encoder noise around
+// the same pose still finds the plan; a hit's plan starts up to resolution / 2 from where the
+// arm is, which has to stay inside the trajectory executor's start tolerance.
+template <typename Plan>
+class PlanCache
+{
+public:
+  explicit PlanCache(double resolution = 0.01, std::size_t capacity = 256)
+    : resolution(resolution), capacity(capacity), fingerprint_(0), hits(0), misses(0)
+  {
+  }
+
+  std::string key(const JointVector& start, const std::string& target) const
+  {
+    return grid(start) + '@' + target;
+  }
+
+  std::string key(const JointVector& start, const JointVector& goal) const
+  {
+    return grid(start) + '=' + grid(goal);
+  }
+
+  const Plan* find(const std::string& key)
+  {
+    const auto found = index.find(key);
+    if (found == index.end())
+    {
+      ++misses;
+      return nullptr;
+    }
+    ++hits;
+    entries.splice(entries.begin(), entries, found->second);
+    return &found->second->second;
+  }
+
+  void store(const std::string& key, const Plan& plan)
+  {
+    const auto found = index.find(key);
+    if (found != index.end())
+    {
+      entries.erase(found->second);
+    }
+    entries.emplace_front(key, plan);
+    index[key] = entries.begin();
+    if (entries.size() > capacity)
+    {
+      index.erase(entries.back().first);
+      entries.pop_back();
+    }
+  }
+
+  void clear()
+  {
+    entries.clear();
+    index.clear();
+  }
+
+  // Empties the cache if its plans were made from something else. True if it did.
+  bool invalidate(uint64_t fingerprint)
+  {
+    if (fingerprint == fingerprint_)
+    {
+      return false;
+    }
+    clear();
+    fingerprint_ = fingerprint;
+    return true;
+  }
+
+  void setResolution(double rad)
+  {
+    resolution = rad;
+    clear();
+  }
+
+  std::size_t size() const { return entries.size(); }
+  unsigned long hitCount() const { return hits; }
+  unsigned long missCount() const { return misses; }
+
+private:
+  std::string grid(const JointVector& joints) const
+  {
+    std::string cells;
+    for (double joint : joints)
+    {
+      cells += std::to_string(std::lround(joint / resolution));
+      cells += ',';
+    }
+    return cells;
+  }
+
+  typedef std::list<std::pair<std::string, Plan>> Entries;
+  double resolution;
+  std::size_t capacity;
+  uint64_t fingerprint_;
+  unsigned long hits;
+  unsigned long misses;
+  Entries entries;   // most recently used first
+  std::unordered_map<std::string, typename Entries::iterator> index;
+};
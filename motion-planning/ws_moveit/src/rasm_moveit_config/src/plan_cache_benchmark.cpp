@@ -0,0 +1,145 @@
+// Compares planning the search pattern through move_group every time (OMPL, as rasm_motion
+// used to) with the plan cache and roadmap of cached_planner.h: home, the four corners of the
+// search sweep, home, park and home again, round after round, each move starting from where
+// the last one ended plus a little encoder noise.
+//
+// roslaunch rasm_moveit_config plan_cache_benchmark.launch [rounds:=N] [jitter:=RAD]
+//
+// It also times loading (or building) the roadmap, and checks that changing joint_limits.yaml
+// on the parameter server empties the cache. Exits 1 if a move could not be planned or the
+// cache was not emptied.
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+#include <moveit/move_group_interface/move_group_interface.h>
+#include "ros/ros.h"
+#include "cached_planner.h"
+#include "stage_timing.h"
+
+struct PlannerResult
+{
+  LatencyHistogram time;
+  unsigned long failed = 0;
+  double path_length = 0;   // rad, summed over the moves
+};
+
+static double pathLength(const moveit::planning_interface::MoveGroupInterface::Plan& plan)
+{
+  const std::vector<trajectory_msgs::JointTrajectoryPoint>& points = plan.trajectory_.joint_trajectory.points;
+  double length = 0;
+  for (std::size_t i = 1; i < points.size(); ++i)
+  {
+    length += jointDistance(points[i - 1].positions, points[i].positions);
+  }
+  return length;
+}
+
+static void report(const char* name, const PlannerResult& result)
+{
+  std::printf("%-10s %6lu moves  time mean %9.1f us  p50 %9.1f us  p99 %9.1f us  max %9.1f us  "
+              "path %.3f rad/move  failed %lu\n",
+              name, (unsigned long)result.time.count(), result.time.mean(), result.time.percentile(50),
+              result.time.percentile(99), result.time.max(),
+              result.path_length / std::max<double>(1, result.time.count()), result.failed);
+}
+
+static double elapsedUs(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv)
+{
+  ros::init(argc, argv, "plan_cache_benchmark");
+  ros::AsyncSpinner spinner(1);
+  spinner.start();
+  ros::NodeHandle private_nh("~");
+  int rounds, seed;
+  double jitter;
+  std::string group_name;
+  private_nh.param("rounds", rounds, 20);
+  private_nh.param("seed", seed, 1);
+  private_nh.param("jitter", jitter, 0.002);   // rad either way on every joint
+  private_nh.param<std::string>("group", group_name, "rasm_arm");
+
+  moveit::planning_interface::MoveGroupInterface move_group(group_name);
+  CachedPlanner planner(move_group);
+  std::printf("%s roadmap: %zu configurations, %zu edges, %.1f ms\n", planner.roadmapBuilt() ? "built" : "loaded",
+              planner.roadmap().size(), planner.roadmap().edgeCount(), planner.roadmapTimeMs());
+
+  const char* const pattern[] = {"home", "search_1", "search_2", "search_3", "search_4", "home", "park"};
+  for (const char* target : pattern)
+  {
+    if (!planner.namedStates().count(target))
+    {
+      ROS_ERROR("No named state %s for %s in the SRDF", target, group_name.c_str());
+      return 1;
+    }
+  }
+
+  std::mt19937 random(seed);
+  std::uniform_real_distribution<double> noise(-jitter, jitter);
+  moveit::core::RobotState state(move_group.getRobotModel());
+  state.setToDefaultValues();
+  const moveit::core::JointModelGroup* group = state.getJointModelGroup(group_name);
+  PlannerResult cold, roadmap, hit;
+  JointVector at = planner.namedStates().at("home");
+  for (int round = 0; round < rounds && ros::ok(); ++round)
+  {
+    for (const char* target : pattern)
+    {
+      JointVector start = at;
+      for (double& joint : start)
+      {
+        joint += noise(random);
+      }
+
+      moveit::planning_interface::MoveGroupInterface::Plan plan;
+      state.setJointGroupPositions(group, start);
+      move_group.setStartState(state);
+      move_group.setNamedTarget(target);
+      auto began = std::chrono::steady_clock::now();
+      const bool planned = move_group.plan(plan) == moveit::planning_interface::MoveItErrorCode::SUCCESS;
+      cold.time.record(elapsedUs(began));
+      cold.failed += !planned;
+      cold.path_length += planned ? pathLength(plan) : 0;
+
+      began = std::chrono::steady_clock::now();
+      const CachedPlanner::Source source = planner.plan(start, target, plan);
+      const double us = elapsedUs(began);
+      PlannerResult& result = source == CachedPlanner::FROM_CACHE ? hit : roadmap;
+      result.time.record(us);
+      result.failed += source == CachedPlanner::NOT_PLANNED;
+      result.path_length += source == CachedPlanner::NOT_PLANNED ? 0 : pathLength(plan);
+      at = planner.namedStates().at(target);
+    }
+  }
+  move_group.setStartStateToCurrentState();
+
+  std::printf("%d rounds of the search pattern, start jitter %.3f rad\n", rounds, jitter);
+  report("move_group", cold);
+  report("roadmap", roadmap);   // cache misses: the roadmap, or move_group where it has no path
+  report("cache hit", hit);
+  std::printf("cache: %lu hits, %lu misses, %zu plans; median cold plan / median hit %.0fx\n",
+              planner.planCache().hitCount(), planner.planCache().missCount(), planner.planCache().size(),
+              cold.time.percentile(50) / std::max(1.0, hit.time.percentile(50)));
+
+  // A change to the joint limits has to throw the cache and the roadmap away.
+  const std::string limit = "robot_description_planning/joint_limits/A1_to_A2/max_velocity";
+  double max_velocity = 0.5;
+  ros::param::get(limit, max_velocity);
+  ros::param::set(limit, max_velocity * 0.5);
+  const auto began = std::chrono::steady_clock::now();
+  const bool invalidated = planner.refresh() && planner.planCache().size() == 0;
+  const double refresh_ms = elapsedUs(began) / 1000;
+  ros::param::set(limit, max_velocity);
+  planner.refresh();
+  std::printf("changing %s %s the cache (%.1f ms to rebuild)\n", limit.c_str(),
+              invalidated ? "emptied" : "did NOT empty", refresh_ms);
+
+  const bool ok = invalidated && !cold.failed && !roadmap.failed && !hit.failed;
+  ros::shutdown();
+  return ok ? 0 : 1;
+}
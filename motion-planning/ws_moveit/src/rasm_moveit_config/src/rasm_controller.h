@@ -1,68 +1,83 @@
-#include <hardware_interface/joint_command_interface.h>
 #include <hardware_interface/joint_state_interface.h>
 #include <hardware_interface/robot_hw.h>
 #include "ros/ros.h"
-#include <std_msgs/Float64.h>
+#include <cmath>
 #include <iostream>
+#include <string>
+#include "joint_state_receiver.h"
 #pragma once
+
+// URDF joint names, in RASM_JOINT_* order.
+static const char* const rasm_joint_names[RASM_JOINT_COUNT] = {"base_link_to_A1", "A1_to_A2", "wrist_yaw",
+                                                               "wrist_pitch", "wrist_roll"};
+
+// The RASM_JOINT_* of a URDF joint, or -1.
+inline int rasmJointIndex(const std::string& name)
+{
+  for (int i = 0; i < RASM_JOINT_COUNT; ++i)
+  {
+    if (name == rasm_joint_names[i])
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
 class MyRobot : public hardware_interface::RobotHW
 {
 public:
   virtual ~MyRobot(){}
-  MyRobot() 
- { 
-   // connect and register the joint state interface
-   hardware_interface::JointStateHandle state_handle_a("A", &pos[0], &vel[0], &eff[0]);
-   jnt_state_interface.registerHandle(state_handle_a);
-
-   hardware_interface::JointStateHandle state_handle_b("B", &pos[1], &vel[1], &eff[1]);
-   jnt_state_interface.registerHandle(state_handle_b);
+  // Joint states come from the arm's joint-state frames on the serial port in the
+  // ~telemetry_port parameter (default /dev/ttyACM1), the board running sendJointPositions.
+  // Nothing else reads that board. There is no command interface: the arm is moved by
+  // TrajectoryActionServer (trajectory_action_server.h), which sends MoveIt's trajectories to
+  // arduino_main whole, so no controller here has anything to claim.
+  explicit MyRobot(ros::NodeHandle&)
+ {
+   // connect and register the joint state interface, one handle per encoder (the wrist
+   // joints are not in the URDF yet, but their state is published all the same)
+   for (int i = 0; i < RASM_JOINT_COUNT; ++i)
+   {
+     pos[i] = vel[i] = eff[i] = 0;
+     hardware_interface::JointStateHandle state_handle(rasm_joint_names[i], &pos[i], &vel[i], &eff[i]);
+     jnt_state_interface.registerHandle(state_handle);
+   }
 
    registerInterface(&jnt_state_interface);
 
-   // connect and register the joint position interface
-   hardware_interface::JointHandle pos_handle_a(jnt_state_interface.getHandle("A"), &cmd[0]);
-   jnt_pos_interface.registerHandle(pos_handle_a);
-
-   hardware_interface::JointHandle pos_handle_b(jnt_state_interface.getHandle("B"), &cmd[1]);
-   jnt_pos_interface.registerHandle(pos_handle_b);
-
-   registerInterface(&jnt_pos_interface);
-  }
-  
+   std::string port;
+   ros::NodeHandle private_nh("~");
+   private_nh.param<std::string>("telemetry_port", port, "/dev/ttyACM1");
+   if (!receiver.open(port.c_str()))
+   {
+     ROS_ERROR("No joint states: unable to open %s", port.c_str());
+   }
+ }
 
-  class Reader
+  // Called at the start of each control cycle: positions and velocities (the receiver works
+  // them out from the firmware's timestamps) from the newest joint-state frame, if a new
+  // one came in since the last cycle. Never blocks.
+  void read(const ros::Time&, const ros::Duration&) override
   {
-  private:
-    double value;
-  public:
-    void read(const std_msgs::Float64& msg)
+    JointState state;
+    if (!receiver.latest(state))
     {
-      value = msg.data;
+      return;
     }
-    double getValue()
+    for (int i = 0; i < RASM_JOINT_COUNT; ++i)
     {
-      return value;
+      pos[i] = state.position[i] * M_PI / 180.0;
+      vel[i] = state.velocity[i] * M_PI / 180.0;
     }
-  };
-
-  Reader shoulder;
-  Reader elbow;
-
-  void read()
-  {
-    this->pos[0] = shoulder.getValue();
-    this->pos[1] = elbow.getValue();
   }
 
-  friend void write();
+  const JointStateReceiver& jointStates() const { return receiver; }
 
 private:
   hardware_interface::JointStateInterface jnt_state_interface;
-  hardware_interface::PositionJointInterface jnt_pos_interface;
-  double cmd[2];
-  double pos[2];
-  double vel[2];
-  double eff[2];
+  JointStateReceiver receiver;
+  double pos[RASM_JOINT_COUNT];
+  double vel[RASM_JOINT_COUNT];
+  double eff[RASM_JOINT_COUNT];
 };
-
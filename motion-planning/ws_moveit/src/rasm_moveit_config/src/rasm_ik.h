@@ -0,0 +1,215 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include "arduino_extra/arm_kinematics.h"
+
+// Closed-form inverse kinematics for the RASM. No ROS in here, so the solver can be checked
+// and timed on its own; rasm_kinematics_plugin.cpp wraps it for MoveIt. The forward kinematics
+// of the whole arm are arduino_extra/arm_kinematics.h, which the firmware uses too.
+//
+// Two kinds of chain are solved:
+//
+// - RasmDHChain, the whole arm as linearTransformationDHParameters.m describes it (Craig's
+//   convention: T_i = RotX(alpha_i-1) TransX(a_i-1) RotZ(th_i) TransZ(d_i), all d_i = 0). The
+//   shoulder, elbow and wrist yaw turn about parallel axes, so they are a planar three-link arm
+//   whose last link is the wrist; the pitch and roll then follow from the orientation alone.
+//   Up to two solutions, elbow up and elbow down. (Flipping the wrist gives the same
+//   orientation, but a4 puts frame 5 on the other side of the arm's plane.)
+//
+// - RasmPlanarChain, any chain of up to three revolute joints about parallel axes with fixed
+//   offsets between them in the plane they turn in, which is what the rasm_arm group in
+//   rasm.urdf.xacro is (shoulder and elbow). Up to two solutions.
+//
+// Solutions are angles in radians in (-pi, pi]; the caller checks them against the joint
+// limits and against the target (a pose the chain cannot reach still gives its nearest
+// candidates).
+
+// Angle in (-pi, pi].
+inline double rasmWrapAngle(double angle)
+{
+  angle = std::remainder(angle, 2 * M_PI);
+  return angle <= -M_PI ? angle + 2 * M_PI : angle;
+}
+
+// Shoulder and elbow of a two-link planar arm, link lengths l1 and l2, putting the end of
+// the second link at (x, y). Writes up to two (shoulder, elbow) pairs, elbow angle positive
+// first, and returns how many. An out-of-reach point gives the arm stretched towards it.
+inline int rasmSolveTwoLink(double l1, double l2, double x, double y, double solutions[2][2])
+{
+  const double cos_elbow = (x * x + y * y - l1 * l1 - l2 * l2) / (2 * l1 * l2);
+  const double elbow = std::acos(std::max(-1.0, std::min(1.0, cos_elbow)));
+  const int count = elbow == 0 || elbow == M_PI ? 1 : 2;
+  for (int i = 0; i < count; ++i)
+  {
+    const double q2 = i == 0 ? elbow : -elbow;
+    solutions[i][0] = rasmWrapAngle(std::atan2(y, x) - std::atan2(l2 * std::sin(q2), l1 + l2 * std::cos(q2)));
+    solutions[i][1] = rasmWrapAngle(q2);
+  }
+  return count;
+}
+
+struct RasmDHChain : ArmKinematics<double>
+{
+  static const int joint_count = ARM_JOINT_COUNT;
+  // The lengths are those of linearTransformationDHParameters.m, in inches, until scale()d;
+  // the twists must stay at 0, 0, 0, -pi/2, -pi/2. forward() is ArmKinematics'.
+
+  // Joint angles that put frame 5 at the pose. The wrist is singular when the pitch is 0 or
+  // pi (yaw and roll turn about the same axis); the roll is then taken as roll_hint and the yaw
+  // makes up the rest. Returns the number of solutions written, at most two.
+  int inverse(const double rotation[3][3], const double position[3], double solutions[2][joint_count],
+              double roll_hint = 0) const
+  {
+    const double c4 = std::max(-1.0, std::min(1.0, -rotation[2][2]));
+    // The orientation leaves the sign of sin(pitch) open; frame 5's height (-a4 sin(pitch))
+    // settles it.
+    const double s4 = std::copysign(std::sqrt(1 - c4 * c4), -position[2] * a[4]);
+    double phi, roll;
+    if (std::fabs(s4) < 1e-9)
+    {
+      roll = roll_hint;
+      // Only phi - roll (pitch 0) or phi + roll (pitch pi) shows in the rotation.
+      phi = c4 > 0 ? std::atan2(rotation[1][0], rotation[0][0]) + roll
+                   : std::atan2(-rotation[1][0], -rotation[0][0]) - roll;
+    }
+    else
+    {
+      roll = std::atan2(rotation[2][1] / s4, -rotation[2][0] / s4);
+      phi = std::atan2(-rotation[1][2] / s4, -rotation[0][2] / s4);
+    }
+    // Back from frame 5 along the wrist to the end of the elbow link (frame 3).
+    const double reach = a[3] + a[4] * c4;
+    const double x = position[0] - reach * std::cos(phi);
+    const double y = position[1] - reach * std::sin(phi);
+    double arm[2][2];
+    const int count = rasmSolveTwoLink(a[1], a[2], x, y, arm);
+    for (int i = 0; i < count; ++i)
+    {
+      solutions[i][0] = arm[i][0];
+      solutions[i][1] = arm[i][1];
+      solutions[i][2] = rasmWrapAngle(phi - arm[i][0] - arm[i][1]);
+      solutions[i][3] = std::atan2(s4, c4);
+      solutions[i][4] = rasmWrapAngle(roll);
+    }
+    return count;
+  }
+};
+
+// A chain of revolute joints about parallel axes, described in the plane they turn in. Each
+// joint (and then the tip) sits at a fixed offset and fixed turn from the joint before it (the
+// first from the chain's base); out-of-plane offsets do not change as the joints turn, so only
+// the tip's height is kept.
+struct RasmPlanarChain
+{
+  static const int max_joints = 3;
+  int joint_count = 0;
+  // Index joint_count is the tip.
+  double x[max_joints + 1] = {};
+  double y[max_joints + 1] = {};
+  double turn[max_joints + 1] = {};
+  double height = 0;
+  // The direction each joint turns: 1 if its axis points along the plane's normal, -1 if against.
+  double sign[max_joints] = {1, 1, 1};
+
+  // Tip position and heading in the plane for joint angles q.
+  void forward(const double* q, double& tip_x, double& tip_y, double& heading) const
+  {
+    tip_x = tip_y = heading = 0;
+    for (int i = 0; i <= joint_count; ++i)
+    {
+      tip_x += std::cos(heading) * x[i] - std::sin(heading) * y[i];
+      tip_y += std::sin(heading) * x[i] + std::cos(heading) * y[i];
+      heading += turn[i] + (i < joint_count ? sign[i] * q[i] : 0);
+    }
+    heading = rasmWrapAngle(heading);
+  }
+
+  // Joint angles that put the tip at (tip_x, tip_y) with the heading. With one joint (or two
+  // and the tip on the last axis) the position fixes everything the heading does not; with two
+  // joints the heading is not used otherwise. Returns the number of solutions written.
+  int inverse(double tip_x, double tip_y, double heading, double solutions[2][max_joints]) const
+  {
+    // Everything is solved for the heading of each link (the sum of turns up to it); the
+    // joint angles follow at the end.
+    double link[2][max_joints];
+    int count = 0;
+    // The target relative to the first joint, in the base's frame.
+    const double px = tip_x - x[0], py = tip_y - y[0];
+    if (joint_count == 1)
+    {
+      link[0][0] = onCircle(px, py, x[1], y[1], turn[1], heading);
+      count = 1;
+    }
+    else if (joint_count == 2)
+    {
+      count = twoLinks(px, py, x[1], y[1], x[2], y[2], turn[2], heading, link);
+    }
+    else if (joint_count == 3)
+    {
+      // The heading fixes the last link, which leaves the first two to reach the third joint.
+      const double last = heading - turn[3];
+      const double jx = px - (std::cos(last) * x[3] - std::sin(last) * y[3]);
+      const double jy = py - (std::sin(last) * x[3] + std::cos(last) * y[3]);
+      count = twoLinks(jx, jy, x[1], y[1], x[2], y[2], 0, last - turn[2], link);
+      for (int i = 0; i < count; ++i)
+      {
+        link[i][2] = last;
+      }
+    }
+    for (int i = 0; i < count; ++i)
+    {
+      double previous = 0;
+      for (int j = 0; j < joint_count; ++j)
+      {
+        solutions[i][j] = rasmWrapAngle(sign[j] * (link[i][j] - previous - turn[j]));
+        previous = link[i][j];
+      }
+    }
+    return count;
+  }
+
+private:
+  static double length(double x, double y) { return std::sqrt(x * x + y * y); }
+
+  // Heading of a link that turns about the origin and carries a point (x, y) (then turned by
+  // turn) to (px, py); with the point on the axis the heading is taken from the target heading.
+  static double onCircle(double px, double py, double x, double y, double turn, double heading)
+  {
+    if (length(x, y) < 1e-12)
+    {
+      return heading - turn;
+    }
+    return std::atan2(py, px) - std::atan2(y, x);
+  }
+
+  // Headings of two links, the first turning about the origin with the second's joint at (x1,
+  // y1) on it, the second carrying (x2, y2) to (px, py).
+  static int twoLinks(double px, double py, double x1, double y1, double x2, double y2, double turn2,
+                      double heading, double link[2][max_joints])
+  {
+    const double l1 = length(x1, y1), l2 = length(x2, y2);
+    if (l2 < 1e-12)
+    {
+      // The tip is on the second axis: the first link reaches it, the heading sets the second.
+      link[0][0] = onCircle(px, py, x1, y1, 0, heading);
+      link[0][1] = heading - turn2;
+      return 1;
+    }
+    if (l1 < 1e-12)
+    {
+      // Both joints on one axis: only their sum matters; all of it goes to the second.
+      link[0][0] = 0;
+      link[0][1] = onCircle(px, py, x2, y2, turn2, heading);
+      return 1;
+    }
+    double arm[2][2];
+    const int count = rasmSolveTwoLink(l1, l2, px, py, arm);
+    for (int i = 0; i < count; ++i)
+    {
+      // rasmSolveTwoLink's links run along x; these are turned by the offsets' own directions.
+      link[i][0] = arm[i][0] - std::atan2(y1, x1);
+      link[i][1] = arm[i][0] + arm[i][1] - std::atan2(y2, x2);
+    }
+    return count;
+  }
+};
@@ -0,0 +1,437 @@
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+#include <moveit/kinematics_base/kinematics_base.h>
+#include <moveit/robot_model/joint_model_group.h>
+#include <moveit/robot_model/revolute_joint_model.h>
+#include <moveit/robot_model/robot_model.h>
+#include <pluginlib/class_list_macros.h>
+#include <tf2_eigen/tf2_eigen.h>
+#include "ros/ros.h"
+#include "rasm_ik.h"
+
+namespace rasm_kinematics
+{
+// MoveIt kinematics plugin that solves the rasm_arm group in closed form (rasm_ik.h) instead of
+// iterating like KDL: a solve takes a few microseconds, never times out on a reachable pose, and
+// returns every branch (elbow up and down) through the all-solutions getPositionIK().
+//
+// The chain is read from the robot model. A group of up to three revolute joints about
+// parallel axes (shoulder and elbow in rasm.urdf.xacro) is solved as a planar arm; a group of
+// five joints is solved as the whole arm of linearTransformationDHParameters.m, with its link
+// lengths taken from the URDF. Either way the solver is checked against the model's own
+// forward kinematics when the plugin is loaded, and refuses the group if they disagree.
+//
+// The pose is the tip link's pose in the base frame. An arm with fewer than six joints
+// cannot reach every pose: a solution is only returned if it puts the tip within
+// position_tolerance (metres) and orientation_tolerance (radians) of the pose, which sampling
+// poses from the arm's own joint space always satisfies.
+class RasmKinematicsPlugin : public kinematics::KinematicsBase
+{
+public:
+  bool initialize(const moveit::core::RobotModel& robot_model, const std::string& group_name,
+                  const std::string& base_frame, const std::vector<std::string>& tip_frames,
+                  double search_discretization) override
+  {
+    storeValues(robot_model, group_name, base_frame, tip_frames, search_discretization);
+    const moveit::core::JointModelGroup* group = robot_model.getJointModelGroup(group_name);
+    if (!group)
+    {
+      ROS_ERROR_NAMED("rasm_kinematics", "Unknown planning group %s", group_name.c_str());
+      return false;
+    }
+    if (tip_frames.size() != 1)
+    {
+      ROS_ERROR_NAMED("rasm_kinematics", "Group %s: only one tip frame is supported", group_name.c_str());
+      return false;
+    }
+    lookupParam("position_tolerance", position_tolerance, 1e-5);
+    lookupParam("orientation_tolerance", orientation_tolerance, 1e-4);
+
+    // The joints from the base out, each relative to the one before it at zero angle. The base
+    // is either a link or the model frame (world, through the virtual joint), which is above
+    // the root link.
+    const moveit::core::LinkModel* tip = robot_model.getLinkModel(getTipFrame());
+    const bool from_model_frame = getBaseFrame() == robot_model.getModelFrame();
+    const moveit::core::LinkModel* base = from_model_frame ? nullptr : robot_model.getLinkModel(getBaseFrame());
+    if (!tip || (!base && !from_model_frame))
+    {
+      ROS_ERROR_NAMED("rasm_kinematics", "Group %s: unknown base %s or tip %s", group_name.c_str(),
+                      getBaseFrame().c_str(), getTipFrame().c_str());
+      return false;
+    }
+    std::vector<const moveit::core::JointModel*> joints;
+    std::vector<Eigen::Isometry3d> origins(1, Eigen::Isometry3d::Identity());
+    for (const moveit::core::LinkModel* link = tip; link != base; link = link->getParentLinkModel())
+    {
+      if (!link)
+      {
+        ROS_ERROR_NAMED("rasm_kinematics", "Group %s: %s is not below %s", group_name.c_str(),
+                        getTipFrame().c_str(), getBaseFrame().c_str());
+        return false;
+      }
+      const moveit::core::JointModel* joint = link->getParentJointModel();
+      if (joint->getType() == moveit::core::JointModel::FIXED)
+      {
+        origins.back() = link->getJointOriginTransform() * origins.back();
+        continue;
+      }
+      if (joint->getType() != moveit::core::JointModel::REVOLUTE || !group->hasJointModel(joint->getName()))
+      {
+        ROS_ERROR_NAMED("rasm_kinematics", "Group %s: joint %s is not one of the group's revolute joints",
+                        group_name.c_str(), joint->getName().c_str());
+        return false;
+      }
+      joints.push_back(joint);
+      origins.push_back(link->getJointOriginTransform());
+    }
+    // origins runs tip first: [tip offset, last joint, ..., first joint].
+    std::reverse(joints.begin(), joints.end());
+    std::reverse(origins.begin(), origins.end());
+    tip_offset = origins.back();
+    origins.pop_back();
+    if (joints.size() != group->getActiveJointModels().size())
+    {
+      ROS_ERROR_NAMED("rasm_kinematics", "Group %s: not all of its joints are between %s and %s", group_name.c_str(),
+                      getBaseFrame().c_str(), getTipFrame().c_str());
+      return false;
+    }
+    joint_origins = origins;
+    joint_names.clear();
+    axes.clear();
+    min_position.clear();
+    max_position.clear();
+    for (const moveit::core::JointModel* joint : joints)
+    {
+      joint_names.push_back(joint->getName());
+      axes.push_back(static_cast<const moveit::core::RevoluteJointModel*>(joint)->getAxis());
+      const moveit::core::VariableBounds& bounds = joint->getVariableBounds()[0];
+      min_position.push_back(bounds.position_bounded_ ? bounds.min_position_ : -M_PI);
+      max_position.push_back(bounds.position_bounded_ ? bounds.max_position_ : M_PI);
+    }
+    link_names.assign(1, getTipFrame());
+
+    if (!buildPlanar() && !buildDH())
+    {
+      ROS_ERROR_NAMED("rasm_kinematics",
+                      "Group %s: its %zu joints are neither a planar chain of up to %d nor the five-joint RASM arm",
+                      group_name.c_str(), joints.size(), RasmPlanarChain::max_joints);
+      return false;
+    }
+    if (!selfTest())
+    {
+      ROS_ERROR_NAMED("rasm_kinematics", "Group %s: the closed-form solution does not match the URDF",
+                      group_name.c_str());
+      return false;
+    }
+    ROS_INFO_NAMED("rasm_kinematics", "Group %s: solving %zu joints %s", group_name.c_str(), joints.size(),
+                   planar ? "as a planar arm" : "as the RASM DH chain");
+    return true;
+  }
+
+  bool getPositionIK(const geometry_msgs::Pose& ik_pose, const std::vector<double>& ik_seed_state,
+                     std::vector<double>& solution, moveit_msgs::MoveItErrorCodes& error_code,
+                     const kinematics::KinematicsQueryOptions& options = kinematics::KinematicsQueryOptions()) const override
+  {
+    return searchPositionIK(ik_pose, ik_seed_state, default_timeout_, std::vector<double>(), solution,
+                            IKCallbackFn(), error_code, options);
+  }
+
+  // Every branch that reaches the pose, nearest to the seed first.
+  bool getPositionIK(const std::vector<geometry_msgs::Pose>& ik_poses, const std::vector<double>& ik_seed_state,
+                     std::vector<std::vector<double>>& solutions, kinematics::KinematicsResult& result,
+                     const kinematics::KinematicsQueryOptions&) const override
+  {
+    solutions.clear();
+    if (ik_poses.size() != 1)
+    {
+      result.kinematic_error = kinematics::KinematicErrors::MULTIPLE_TIPS_NOT_SUPPORTED;
+      return false;
+    }
+    Eigen::Isometry3d target;
+    tf2::fromMsg(ik_poses[0], target);
+    solve(target, ik_seed_state, solutions);
+    result.kinematic_error = solutions.empty() ? kinematics::KinematicErrors::NO_SOLUTION :
+                                                 kinematics::KinematicErrors::OK;
+    result.solution_percentage = solutions.empty() ? 0 : 1;
+    return !solutions.empty();
+  }
+
+  bool searchPositionIK(const geometry_msgs::Pose& ik_pose, const std::vector<double>& ik_seed_state, double timeout,
+                        std::vector<double>& solution, moveit_msgs::MoveItErrorCodes& error_code,
+                        const kinematics::KinematicsQueryOptions& options = kinematics::KinematicsQueryOptions()) const override
+  {
+    return searchPositionIK(ik_pose, ik_seed_state, timeout, std::vector<double>(), solution, IKCallbackFn(),
+                            error_code, options);
+  }
+
+  bool searchPositionIK(const geometry_msgs::Pose& ik_pose, const std::vector<double>& ik_seed_state, double timeout,
+                        const std::vector<double>& consistency_limits, std::vector<double>& solution,
+                        moveit_msgs::MoveItErrorCodes& error_code,
+                        const kinematics::KinematicsQueryOptions& options = kinematics::KinematicsQueryOptions()) const override
+  {
+    return searchPositionIK(ik_pose, ik_seed_state, timeout, consistency_limits, solution, IKCallbackFn(),
+                            error_code, options);
+  }
+
+  bool searchPositionIK(const geometry_msgs::Pose& ik_pose, const std::vector<double>& ik_seed_state, double timeout,
+                        std::vector<double>& solution, const IKCallbackFn& solution_callback,
+                        moveit_msgs::MoveItErrorCodes& error_code,
+                        const kinematics::KinematicsQueryOptions& options = kinematics::KinematicsQueryOptions()) const override
+  {
+    return searchPositionIK(ik_pose, ik_seed_state, timeout, std::vector<double>(), solution, solution_callback,
+                            error_code, options);
+  }
+
+  // There is nothing to search: the branches are tried nearest to the seed first, and the
+  // first one within the consistency limits that the callback (if any) accepts is returned.
+  bool searchPositionIK(const geometry_msgs::Pose& ik_pose, const std::vector<double>& ik_seed_state, double,
+                        const std::vector<double>& consistency_limits, std::vector<double>& solution,
+                        const IKCallbackFn& solution_callback, moveit_msgs::MoveItErrorCodes& error_code,
+                        const kinematics::KinematicsQueryOptions&) const override
+  {
+    if (ik_seed_state.size() != joint_names.size() ||
+        (!consistency_limits.empty() && consistency_limits.size() != joint_names.size()))
+    {
+      error_code.val = moveit_msgs::MoveItErrorCodes::INVALID_ROBOT_STATE;
+      return false;
+    }
+    Eigen::Isometry3d target;
+    tf2::fromMsg(ik_pose, target);
+    std::vector<std::vector<double>> solutions;
+    solve(target, ik_seed_state, solutions);
+    error_code.val = moveit_msgs::MoveItErrorCodes::NO_IK_SOLUTION;
+    for (const std::vector<double>& candidate : solutions)
+    {
+      bool consistent = true;
+      for (size_t i = 0; i < consistency_limits.size(); ++i)
+      {
+        consistent = consistent && std::fabs(candidate[i] - ik_seed_state[i]) <= consistency_limits[i];
+      }
+      if (!consistent)
+      {
+        continue;
+      }
+      if (solution_callback)
+      {
+        solution_callback(ik_pose, candidate, error_code);
+        if (error_code.val != moveit_msgs::MoveItErrorCodes::SUCCESS)
+        {
+          continue;
+        }
+      }
+      solution = candidate;
+      error_code.val = moveit_msgs::MoveItErrorCodes::SUCCESS;
+      return true;
+    }
+    return false;
+  }
+
+  bool getPositionFK(const std::vector<std::string>& fk_link_names, const std::vector<double>& joint_angles,
+                     std::vector<geometry_msgs::Pose>& poses) const override
+  {
+    poses.clear();
+    if (joint_angles.size() != joint_names.size())
+    {
+      return false;
+    }
+    for (const std::string& name : fk_link_names)
+    {
+      if (name != getTipFrame())
+      {
+        ROS_ERROR_NAMED("rasm_kinematics", "Forward kinematics only for %s, not %s", getTipFrame().c_str(),
+                        name.c_str());
+        return false;
+      }
+      poses.push_back(tf2::toMsg(forward(joint_angles.data())));
+    }
+    return true;
+  }
+
+  const std::vector<std::string>& getJointNames() const override { return joint_names; }
+  const std::vector<std::string>& getLinkNames() const override { return link_names; }
+
+private:
+  // Tip pose from the URDF's chain: each joint's origin, then its turn about its axis.
+  Eigen::Isometry3d forward(const double* q) const
+  {
+    Eigen::Isometry3d pose = Eigen::Isometry3d::Identity();
+    for (size_t i = 0; i < joint_origins.size(); ++i)
+    {
+      pose = pose * joint_origins[i] * Eigen::AngleAxisd(q[i], axes[i]);
+    }
+    return pose * tip_offset;
+  }
+
+  // The chain as RasmPlanarChain, if every axis is parallel to the base's z axis and every
+  // offset only turns about it.
+  bool buildPlanar()
+  {
+    planar = false;
+    if (joint_origins.size() > (size_t)RasmPlanarChain::max_joints)
+    {
+      return false;
+    }
+    plane = RasmPlanarChain();
+    plane.joint_count = (int)joint_origins.size();
+    Eigen::Matrix3d orientation = Eigen::Matrix3d::Identity();
+    for (int i = 0; i <= plane.joint_count; ++i)
+    {
+      const Eigen::Isometry3d& origin = i < plane.joint_count ? joint_origins[i] : tip_offset;
+      const Eigen::Matrix3d& rotation = origin.linear();
+      // Joint frames only turn about z; the tip frame may be tilted any way, which is undone on
+      // the target before solving.
+      if (i < plane.joint_count && std::fabs(rotation(2, 2) - 1) > 1e-9)
+      {
+        return false;
+      }
+      plane.x[i] = origin.translation().x();
+      plane.y[i] = origin.translation().y();
+      plane.turn[i] = i < plane.joint_count ? std::atan2(rotation(1, 0), rotation(0, 0)) : 0;
+      plane.height += origin.translation().z();
+      if (i < plane.joint_count)
+      {
+        orientation = orientation * rotation;
+        const double along = (orientation * axes[i]).z();
+        if (std::fabs(std::fabs(along) - 1) > 1e-9)
+        {
+          return false;
+        }
+        plane.sign[i] = along > 0 ? 1 : -1;
+      }
+    }
+    tip_rotation = tip_offset.linear();
+    planar = true;
+    return true;
+  }
+
+  // The chain as the RASM DH chain, lengths from the URDF's joint origins.
+  bool buildDH()
+  {
+    if (joint_origins.size() != (size_t)RasmDHChain::joint_count)
+    {
+      return false;
+    }
+    for (int i = 1; i < RasmDHChain::joint_count; ++i)
+    {
+      dh.a[i] = joint_origins[i].translation().x();
+    }
+    return true;
+  }
+
+  // The closed form must reproduce poses made by the URDF's chain.
+  bool selfTest()
+  {
+    std::mt19937 random(1);
+    std::vector<double> q(joint_names.size()), seed(joint_names.size(), 0);
+    for (int sample = 0; sample < 100; ++sample)
+    {
+      for (size_t i = 0; i < q.size(); ++i)
+      {
+        q[i] = std::uniform_real_distribution<double>(min_position[i], max_position[i])(random);
+      }
+      std::vector<std::vector<double>> solutions;
+      solve(forward(q.data()), seed, solutions);
+      if (solutions.empty())
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Every branch within the joint limits that reaches the target, nearest to the seed first.
+  void solve(const Eigen::Isometry3d& target, const std::vector<double>& seed,
+             std::vector<std::vector<double>>& solutions) const
+  {
+    solutions.clear();
+    double candidates[2][RasmDHChain::joint_count];
+    int count;
+    if (planar)
+    {
+      const Eigen::Matrix3d last = target.linear() * tip_rotation.transpose();
+      double planar_candidates[2][RasmPlanarChain::max_joints];
+      count = plane.inverse(target.translation().x(), target.translation().y(), std::atan2(last(1, 0), last(0, 0)),
+                            planar_candidates);
+      for (int i = 0; i < count; ++i)
+      {
+        std::copy(planar_candidates[i], planar_candidates[i] + plane.joint_count, candidates[i]);
+      }
+    }
+    else
+    {
+      double rotation[3][3], position[3];
+      for (int row = 0; row < 3; ++row)
+      {
+        for (int column = 0; column < 3; ++column)
+        {
+          rotation[row][column] = target.linear()(row, column);
+        }
+        position[row] = target.translation()(row);
+      }
+      count = dh.inverse(rotation, position, candidates, seed.size() == joint_names.size() ? seed.back() : 0);
+    }
+    for (int i = 0; i < count; ++i)
+    {
+      std::vector<double> solution(candidates[i], candidates[i] + joint_names.size());
+      if (withinLimits(solution) && reaches(solution, target))
+      {
+        solutions.push_back(solution);
+      }
+    }
+    std::sort(solutions.begin(), solutions.end(),
+              [&](const std::vector<double>& a, const std::vector<double>& b) {
+                return distance(a, seed) < distance(b, seed);
+              });
+  }
+
+  // Turns each angle by whole turns into its joint's limits, if it fits at all.
+  bool withinLimits(std::vector<double>& q) const
+  {
+    for (size_t i = 0; i < q.size(); ++i)
+    {
+      q[i] += 2 * M_PI * std::ceil((min_position[i] - q[i]) / (2 * M_PI));
+      if (q[i] > max_position[i])
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool reaches(const std::vector<double>& q, const Eigen::Isometry3d& target) const
+  {
+    const Eigen::Isometry3d pose = forward(q.data());
+    return (pose.translation() - target.translation()).norm() <= position_tolerance &&
+           Eigen::AngleAxisd(pose.linear().transpose() * target.linear()).angle() <= orientation_tolerance;
+  }
+
+  static double distance(const std::vector<double>& a, const std::vector<double>& b)
+  {
+    double sum = 0;
+    for (size_t i = 0; i < a.size() && i < b.size(); ++i)
+    {
+      sum += (a[i] - b[i]) * (a[i] - b[i]);
+    }
+    return sum;
+  }
+
+  std::vector<std::string> joint_names;
+  std::vector<std::string> link_names;
+  std::vector<Eigen::Isometry3d> joint_origins;   // each joint relative to the one before, at zero angle
+  std::vector<Eigen::Vector3d> axes;
+  std::vector<double> min_position;
+  std::vector<double> max_position;
+  Eigen::Isometry3d tip_offset = Eigen::Isometry3d::Identity();   // tip link relative to the last joint
+  Eigen::Matrix3d tip_rotation = Eigen::Matrix3d::Identity();
+  double position_tolerance = 1e-5;
+  double orientation_tolerance = 1e-4;
+  bool planar = false;
+  RasmPlanarChain plane;
+  RasmDHChain dh;
+};
+}  // namespace rasm_kinematics
+
+PLUGINLIB_EXPORT_CLASS(rasm_kinematics::RasmKinematicsPlugin, kinematics::KinematicsBase)
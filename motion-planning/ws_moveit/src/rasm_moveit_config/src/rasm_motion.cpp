@@ -9,6 +9,14 @@
 
 #include <moveit_visual_tools/moveit_visual_tools.h>
 #include "rasm_controller.h"
+#include "control_loop.h"
+#include "trajectory_action_server.h"
+#include "cached_planner.h"
+#include <std_msgs/String.h>
+#include <geometry_msgs/PoseStamped.h>
+#include <tf2/LinearMath/Quaternion.h>
+#include "face_pose_channel.h"
+#include "metrics.h"
 #include <controller_manager/controller_manager.h>
 #include <robot_mechanism_controllers/joint_trajectory_action_controller.h>
 #include <control_msgs/FollowJointTrajectoryAction.h>
@@ -23,10 +31,42 @@ int main(int argc, char** argv)
   ros::NodeHandle node_handle;
   ros::AsyncSpinner spinner(1);
   spinner.start();
-  MyRobot rasm;
-  controller_manager::ControllerManager cm(&rasm);
-  ros::Subscriber shoulder_sub = node_handle.subscribe("shoulder", 1000, &MyRobot::Reader::read, &rasm.shoulder);
-  ros::Subscriber elbow_sub = node_handle.subscribe("elbow", 1000, &MyRobot::Reader::read, &rasm.elbow);
+  MyRobot rasm(node_handle);
+  controller_manager::ControllerManager cm(&rasm, node_handle);
+
+  // Runtime metrics (metrics.h), written to ~metrics_file every ~metrics_period seconds for
+  // tools/rasm_metrics.cpp or Prometheus; an empty ~metrics_file writes none.
+  MetricsRegistry metrics;
+  MetricsExporter metrics_exporter;
+  std::string metrics_file;
+  double metrics_period;
+  ros::param::param<std::string>("~metrics_file", metrics_file, "/tmp/rasm_motion.prom");
+  ros::param::param("~metrics_period", metrics_period, 1.0);
+
+  // Drive the hardware interface and the controllers at a fixed rate on their own thread.
+  ControlLoopOptions loop_options;
+  loop_options.load(node_handle);
+  ControlLoop control_loop(rasm, cm, loop_options);
+  control_loop.addMetrics(metrics);
+  control_loop.start();
+
+  // Execute MoveIt's trajectories (controllers.yaml) on the arm's own interpolator.
+  TrajectoryActionServer trajectory_server(node_handle, "rasm_arm_controller");
+
+  const JointStateReceiver& joint_states = rasm.jointStates();
+  metrics.counterFunction("rasm_joint_states_received_total", "Joint state frames from arduino_main.",
+                          [&]() { return (double)joint_states.framesReceived(); });
+  metrics.counterFunction("rasm_joint_states_bad_total", "Joint state frames that failed their checksum.",
+                          [&]() { return (double)joint_states.badFrames(); });
+  metrics.counterFunction("rasm_joint_states_lost_total", "Joint state frames missing from the sequence.",
+                          [&]() { return (double)joint_states.lostFrames(); });
+  const TrajectoryStreamer& streamer = trajectory_server.trajectoryStreamer();
+  metrics.counterFunction("rasm_trajectory_bytes_sent_total", "Bytes of trajectory frames sent to arduino_main.",
+                          [&]() { return (double)streamer.bytesSent(); });
+  metrics.counterFunction("rasm_trajectory_bytes_received_total", "Bytes of trajectory status from arduino_main.",
+                          [&]() { return (double)streamer.bytesReceived(); });
+  metrics.counterFunction("rasm_trajectory_write_errors_total", "Failed writes to the trajectory port.",
+                          [&]() { return (double)streamer.writeErrors(); });
 
   // Setup
   // ^^^^^
@@ -80,7 +120,93 @@ int main(int argc, char** argv)
   std::vector<double> joint_group_positions;
   current_state->copyJointGroupPositions(joint_model_group, joint_group_positions);
 
-  rasm.read();
-  ros::waitForShutdown();
+  // Moves to the named states in the SRDF (home, park, search_1..4) published on move_to,
+  // planned from the plan cache and roadmap when they can be.
+  CachedPlanner planner(move_group);
+  const int plan_metrics[] = {
+      metrics.counter("rasm_plans_from_cache_total", "Moves planned from the plan cache."),
+      metrics.counter("rasm_plans_from_roadmap_total", "Moves planned on the roadmap."),
+      metrics.counter("rasm_plans_from_move_group_total", "Moves planned by move_group."),
+      metrics.counter("rasm_plans_failed_total", "Moves that could not be planned.")};
+  const int plan_time_metric = metrics.histogram("rasm_plan_seconds", "Time to plan a move_to move.");
+  ros::Subscriber move_to = node_handle.subscribe<std_msgs::String>(
+      "move_to", 1, [&](const std_msgs::String::ConstPtr& target) {
+        moveit::planning_interface::MoveGroupInterface::Plan plan;
+        const auto began = std::chrono::steady_clock::now();
+        const CachedPlanner::Source source = planner.plan(move_group.getCurrentJointValues(), target->data, plan);
+        metrics.record(plan_time_metric,
+                       std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - began).count());
+        metrics.add(plan_metrics[source]);
+        if (source == CachedPlanner::NOT_PLANNED)
+        {
+          ROS_WARN_NAMED(node_name, "No plan to %s", target->data.c_str());
+          return;
+        }
+        static const char* const sources[] = {"cache", "roadmap", "move_group"};
+        ROS_INFO_NAMED(node_name, "Moving to %s (planned by %s)", target->data.c_str(), sources[source]);
+        move_group.asyncExecute(plan);
+      });
+
+  // The face poses main-code publishes in shared memory (face_pose_channel.h), as face_pose in
+  // the camera's optical frame (~camera_frame, default the last link) for whatever aims the
+  // camera. That frame is right-handed the way REP 103 has camera optical frames: x to the
+  // right of the image, y down it and z out along the optical axis, in metres. FacePose has x
+  // positive to the camera's left and z minus the depth, so both are flipped; y already points
+  // down. The orientation is the head model's (head_pose_solver.h) in the same frame: main-code's
+  // pitch, yaw and roll are rotations about x, y and z, applied in that order (R = Rz Ry Rx, as
+  // rotationToEuler decomposes it), which is what setRPY takes. Frames without a face are
+  // skipped; main-code may start before or after this node.
+  std::string camera_frame;
+  ros::param::param<std::string>("~camera_frame", camera_frame, last_link);
+  ros::Publisher face_pose_publisher = node_handle.advertise<geometry_msgs::PoseStamped>("face_pose", 1);
+  FacePoseReader face_poses;
+  uint64_t last_face_pose = 0;
+  const int face_pose_metric = metrics.counter("rasm_face_poses_total", "Face poses published on face_pose.");
+  const int face_pose_age_metric =
+      metrics.histogram("rasm_face_pose_age_seconds", "Time from capturing a frame to publishing its face pose.");
+  ros::Timer face_pose_timer = node_handle.createTimer(ros::Duration(0.01), [&](const ros::TimerEvent&) {
+    if (!face_poses.ready() && !face_poses.open())
+    {
+      return;
+    }
+    SharedFacePose pose;
+    if (!face_poses.latest(pose) || pose.index + 1 == last_face_pose || pose.confidence <= 0)
+    {
+      return;
+    }
+    last_face_pose = pose.index + 1;
+    const double inch = 0.0254;
+    geometry_msgs::PoseStamped message;
+    message.header.frame_id = camera_frame;
+    message.header.stamp = ros::Time::now() - ros::Duration((facePoseClockNs() - pose.captured_ns) * 1e-9);
+    message.pose.position.x = -pose.x * inch;
+    message.pose.position.y = pose.y * inch;
+    message.pose.position.z = -pose.z * inch;
+    tf2::Quaternion rotation;
+    rotation.setRPY(pose.pitch * M_PI / 180, pose.yaw * M_PI / 180, pose.roll * M_PI / 180);
+    message.pose.orientation.x = rotation.x();
+    message.pose.orientation.y = rotation.y();
+    message.pose.orientation.z = rotation.z();
+    message.pose.orientation.w = rotation.w();
+    face_pose_publisher.publish(message);
+    metrics.add(face_pose_metric);
+    metrics.record(face_pose_age_metric, (facePoseClockNs() - pose.captured_ns) / 1e3);
+  });
+  if (!metrics_file.empty())
+  {
+    metrics_exporter.start(metrics, metrics_file, metrics_period);
+  }
+
+  // Log the control loop's timing until shutdown, and drop the cached plans if the robot
+  // description changes.
+  ros::Rate report_rate(1);
+  while (ros::ok())
+  {
+    control_loop.report();
+    planner.refresh();
+    report_rate.sleep();
+  }
+  control_loop.stop();
+  metrics_exporter.stop();
   return 0;
 }
@@ -0,0 +1,173 @@
+#pragma once
+#include <actionlib/server/simple_action_server.h>
+#include <control_msgs/FollowJointTrajectoryAction.h>
+#include <cmath>
+#include <string>
+#include <vector>
+#include "ros/ros.h"
+#include "rasm_controller.h"
+#include "trajectory_streamer.h"
+
+// The FollowJointTrajectory action MoveIt executes rasm_arm's trajectories with
+// (controllers.yaml: rasm_arm_controller/follow_joint_trajectory). Instead of a command every
+// control cycle, the whole trajectory goes to arduino_main as waypoints, a few to a frame, over
+// the serial port in the ~trajectory_port parameter (default /dev/ttyACM0), and the firmware
+// interpolates between them itself (trajectory_streamer.h, arduino_extra/trajectory_player.h).
+// That is the port main-code sends its motion frames on: whichever of the two opens it first
+// has the arm, and the other one is refused the port.
+//
+// The goal succeeds when the firmware says it got to the last waypoint. It is aborted if the
+// firmware has not got there ~trajectory_timeout_margin seconds (default 1) after the
+// trajectory should have ended, or if arduino_main stops it because a waypoint is outside a
+// joint's limits, and stopped where it is if the goal is cancelled. Feedback
+// gives where the trajectory has got to on the firmware's own clock.
+class TrajectoryActionServer
+{
+public:
+  TrajectoryActionServer(ros::NodeHandle& nh, const std::string& controller)
+    : server(nh, controller + "/follow_joint_trajectory",
+             boost::bind(&TrajectoryActionServer::execute, this, _1), false)
+  {
+    ros::NodeHandle private_nh("~");
+    std::string port;
+    private_nh.param<std::string>("trajectory_port", port, "/dev/ttyACM0");
+    private_nh.param("trajectory_timeout_margin", timeout_margin, 1.0);
+    connected = streamer.open(port.c_str());
+    if (!connected)
+    {
+      ROS_ERROR("No trajectory execution: unable to open %s", port.c_str());
+    }
+    server.start();
+  }
+
+  const TrajectoryStreamer& trajectoryStreamer() const { return streamer; }
+
+private:
+  typedef control_msgs::FollowJointTrajectoryResult Result;
+
+  void abort(int32_t code, const std::string& why)
+  {
+    Result result;
+    result.error_code = code;
+    result.error_string = why;
+    ROS_WARN_NAMED("trajectory", "trajectory aborted: %s", why.c_str());
+    server.setAborted(result, why);
+  }
+
+  void execute(const control_msgs::FollowJointTrajectoryGoalConstPtr& goal)
+  {
+    const trajectory_msgs::JointTrajectory& trajectory = goal->trajectory;
+    if (!connected)
+    {
+      abort(Result::INVALID_GOAL, "the trajectory port is not open");
+      return;
+    }
+    std::vector<int> joints;
+    uint8_t mask = 0;
+    for (const std::string& name : trajectory.joint_names)
+    {
+      const int joint = rasmJointIndex(name);
+      if (joint < 0)
+      {
+        abort(Result::INVALID_JOINTS, "unknown joint " + name);
+        return;
+      }
+      joints.push_back(joint);
+      mask |= 1 << joint;
+    }
+
+    // The firmware works in degrees.
+    std::vector<TrajectoryWaypoint> points(trajectory.points.size());
+    bool velocities = true;
+    for (std::size_t i = 0; i < points.size(); ++i)
+    {
+      const trajectory_msgs::JointTrajectoryPoint& point = trajectory.points[i];
+      if (point.positions.size() != joints.size())
+      {
+        abort(Result::INVALID_GOAL, "a waypoint does not have a position for every joint");
+        return;
+      }
+      velocities = velocities && point.velocities.size() == joints.size();
+      points[i].time = point.time_from_start.toSec();
+      for (std::size_t j = 0; j < joints.size(); ++j)
+      {
+        points[i].position[joints[j]] = point.positions[j] * 180 / M_PI;
+        points[i].velocity[joints[j]] = velocities ? point.velocities[j] * 180 / M_PI : 0;
+      }
+    }
+    if (!velocities)
+    {
+      fillTrajectoryVelocities(points);
+    }
+    if (points.empty())
+    {
+      Result result;
+      result.error_code = Result::SUCCESSFUL;
+      server.setSucceeded(result);
+      return;
+    }
+
+    const int id = streamer.start(points, mask);
+    if (id < 0)
+    {
+      abort(Result::INVALID_GOAL, "too many waypoints");
+      return;
+    }
+    const ros::Time deadline =
+        ros::Time::now() + ros::Duration(points.back().time + goal->goal_time_tolerance.toSec() + timeout_margin);
+    control_msgs::FollowJointTrajectoryFeedback feedback;
+    feedback.joint_names = trajectory.joint_names;
+    feedback.desired.positions.resize(joints.size());
+    feedback.desired.velocities.resize(joints.size());
+    ros::Rate rate(50);
+    while (ros::ok())
+    {
+      if (server.isPreemptRequested())
+      {
+        streamer.stop();
+        server.setPreempted();
+        return;
+      }
+      RasmTrajectoryStatusFrame status;
+      if (streamer.status(status) && status.trajectory == id)
+      {
+        if (status.state == RASM_TRAJECTORY_DONE)
+        {
+          Result result;
+          result.error_code = Result::SUCCESSFUL;
+          server.setSucceeded(result);
+          return;
+        }
+        if (status.state == RASM_TRAJECTORY_STOPPED)
+        {
+          abort(Result::PATH_TOLERANCE_VIOLATED, "arduino_main stopped the trajectory (a waypoint outside a joint's limits?)");
+          return;
+        }
+        const double t = status.time_ms / 1000.0;
+        feedback.header.stamp = ros::Time::now();
+        feedback.desired.time_from_start = ros::Duration(t);
+        for (std::size_t j = 0; j < joints.size(); ++j)
+        {
+          double position, velocity;
+          sampleTrajectory(points, t, joints[j], position, velocity);
+          feedback.desired.positions[j] = position * M_PI / 180;
+          feedback.desired.velocities[j] = velocity * M_PI / 180;
+        }
+        server.publishFeedback(feedback);
+      }
+      if (ros::Time::now() > deadline)
+      {
+        streamer.stop();
+        abort(Result::GOAL_TOLERANCE_VIOLATED, "arduino_main did not finish the trajectory in time");
+        return;
+      }
+      rate.sleep();
+    }
+    streamer.stop();
+  }
+
+  actionlib::SimpleActionServer<control_msgs::FollowJointTrajectoryAction> server;
+  TrajectoryStreamer streamer;
+  bool connected;
+  double timeout_margin;
+};
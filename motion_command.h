@@ -0,0 +1,20 @@
+#pragma once
+
+#include <chrono>
+
+typedef std::chrono::steady_clock pipeline_clock;
+
+//One command per axis, already scaled to what the Arduino expects: the values become the
+//setpoints of a motion frame (RasmMotionFrame in arduino_extra/rasm_protocol.h, in
+//RASM_AXIS_* order), clamped to int16. The comments are the prefix characters the old ASCII
+//commands used for each axis, and the units CommandGenerator scales the offsets to.
+struct MotionCommand
+{
+  unsigned long frame_id = 0;
+  pipeline_clock::time_point captured;
+  int roll = 0;   // # (half degrees)
+  int pitch = 0;  // & (half degrees)
+  int yaw = 0;    // * (half degrees)
+  int y = 0;      // $ (half inches)
+  int x = 0;      // ^ (tenths of an inch)
+};
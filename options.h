@@ -0,0 +1,380 @@
+#pragma once
+
+#include <cfloat>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include "capture.h"
+#include "detector_engine.h"
+#include "command_generator.h"
+#include "display.h"
+#include "face_detector.h"
+#include "face_pose_channel.h"
+#include "face_tracker.h"
+#include "pose_filter.h"
+
+//Run time settings for main-code, given on the command line as --name=value (or just --name
+//for switches). Anything left at its default behaves the way the program always has.
+struct RasmOptions
+{
+  CaptureOptions capture;
+  FaceTrackerOptions tracker;
+  DetectorEngineOptions detector;
+  FaceDetectorOptions detection;
+  DisplayOptions display;
+  PoseFilterOptions filter;
+  CommandGeneratorOptions commands;
+  //arduino_main's port. main-code has it while it runs; rasm_motion's trajectory_port is the same
+  //board, so only one of the two can drive the arm at a time
+  std::string serial_port = "/dev/ttyACM0";
+  //POSIX shared memory the face poses are published in for rasm_motion (face_pose_channel.h);
+  //empty for none
+  std::string pose_channel = face_pose_channel_name;
+  //Prometheus text file the runtime metrics are written to (metrics.h); empty for none
+  std::string metrics_file = "/tmp/rasm-main-code.prom";
+  double metrics_period = 1;   //seconds between writes
+  //dlib .dat shape predictor or .rsp landmark model (landmark_model.h)
+  std::string landmark_model = "../data/face_model_68_points.dat";
+};
+
+inline void printUsage(const char* program)
+{
+  std::cout << "usage: " << program << " [options]\n"
+            << "  --capture=BACKEND        opencv (cv::VideoCapture, the default), v4l2 (mmap'd driver\n"
+            << "                           buffers, grayscale straight to the detector) or file\n"
+            << "  --capture-device=DEV     camera number or /dev/videoN, or for file a video, a\n"
+            << "                           directory of images or a raw .yuyv recording (default 1)\n"
+            << "  --capture-size=WxH       frame size for v4l2 and raw .yuyv files (default 640x480)\n"
+            << "  --capture-buffers=N      driver buffers in the v4l2 ring (default 6)\n"
+            << "  --detector=ENGINE        face detector: hog (dlib, the default), ssd (OpenCV DNN\n"
+            << "                           ResNet-10 SSD) or yunet (OpenCV DNN, int8 YuNet)\n"
+            << "  --detector-model=PATH    model file for ssd or yunet (default: the one in ../data)\n"
+            << "  --detector-config=PATH   network description for ssd (default ../data/deploy.prototxt)\n"
+            << "  --detector-threads=N     threads OpenCV may use for ssd and yunet (default: all), or\n"
+            << "                           for hog, threads to scan on (default 1)\n"
+            << "  --detector-input=WxH     network input size for ssd (default 300x300) or yunet\n"
+            << "                           (default 320x240)\n"
+            << "  --detector-score=X       with ssd or yunet, ignore faces scoring below X (default 0.5)\n"
+            << "  --track                  follow the face between detections instead of\n"
+            << "                           running the detector on every frame\n"
+            << "  --detect-every=N         with --track, re-detect at least every N frames (default 10)\n"
+            << "  --track-confidence=X     with --track, re-detect when the tracker's confidence\n"
+            << "                           drops below X (default 7)\n"
+            << "  --detect-scale=X         run the face detector on the frame shrunk by X, e.g. 0.5\n"
+            << "                           (default 1); faces are mapped back to full resolution\n"
+            << "  --detect-roi=POLICY      where to look for the face: full (default), last-face or\n"
+            << "                           motion (the part of the frame that changed)\n"
+            << "  --full-frame-every=N     with a region policy, scan the whole frame at least every\n"
+            << "                           N frames (default 10)\n"
+            << "  --roi-padding=X          pad regions around the last face by X face widths on\n"
+            << "                           every side (default 0.5)\n"
+            << "  --pose-filter=MODE       off (commands from each frame's pose, as before), smooth\n"
+            << "                           (Kalman filtered pose; it lags, so the arm overshoots more)\n"
+            << "                           or predict (filtered and extrapolated to when the motors\n"
+            << "                           will act on the command; the default)\n"
+            << "  --actuation-delay=MS     with --pose-filter=predict, time from sending a command to\n"
+            << "                           the motors acting on it (default 30)\n"
+            << "  --angle-deadband=DEG     angles smaller than this send no command (default 5)\n"
+            << "  --position-deadband=IN   offsets up to this send no command (default 3)\n"
+            << "  --debounce=MS            hold an axis that was still for this long before moving it\n"
+            << "                           again (default 1000)\n"
+            << "  --display=MODE           off (no window, no drawing), preview (every Nth frame,\n"
+            << "                           shrunk) or full (every frame with text; the default)\n"
+            << "  --preview-every=N        with --display=preview, show one frame in N (default 5)\n"
+            << "  --preview-scale=X        with --display=preview, shrink frames by X (default 0.5)\n"
+            << "  --landmark-model=PATH    landmark model, a dlib .dat shape predictor or a .rsp\n"
+            << "                           model (default ../data/face_model_68_points.dat)\n"
+            << "  --serial=PATH            serial port of arduino_main (default /dev/ttyACM0)\n"
+            << "  --pose-channel=NAME      shared memory to publish the face poses in for rasm_motion\n"
+            << "                           (default /rasm_face_pose; off for none)\n"
+            << "  --metrics=PATH           file to write the runtime metrics to, in Prometheus text\n"
+            << "                           format (default /tmp/rasm-main-code.prom; off for none)\n"
+            << "  --metrics-period=S       seconds between writes of the metrics file (default 1)\n";
+}
+
+//Returns a pointer to the value if arg is "--name=value", otherwise NULL.
+inline const char* optionValue(const char* arg, const char* name)
+{
+  const std::size_t length = std::strlen(name);
+  if (std::strncmp(arg, name, length) == 0 && arg[length] == '=')
+  {
+    return arg + length + 1;
+  }
+  return NULL;
+}
+
+//Smallest value a setting that has to be more than 0 accepts.
+const double above_zero = DBL_MIN;
+
+//Reads value as a number from min to max. Returns false (after saying what the option takes,
+//and printing the usage) for anything else: atof would quietly make 0 of a typo.
+inline bool numberOption(const char* program, const char* name, const char* value, double min, double max,
+                         const char* range, double& number)
+{
+  char* end = NULL;
+  number = std::strtod(value, &end);
+  if (end == value || *end != '\0' || !(number >= min && number <= max))
+  {
+    std::cout << name << " must be " << range << std::endl;
+    printUsage(program);
+    return false;
+  }
+  return true;
+}
+
+//The same for a whole number.
+inline bool integerOption(const char* program, const char* name, const char* value, long min, long max,
+                          const char* range, long& number)
+{
+  char* end = NULL;
+  number = std::strtol(value, &end, 10);
+  if (end == value || *end != '\0' || number < min || number > max)
+  {
+    std::cout << name << " must be " << range << std::endl;
+    printUsage(program);
+    return false;
+  }
+  return true;
+}
+
+//Fills in options from argv. Returns false (after printing the usage) on anything it does
+//not recognize.
+inline bool parseOptions(int argc, char* argv[], RasmOptions& options)
+{
+  for (int i = 1; i < argc; ++i)
+  {
+    const char* arg = argv[i];
+    const char* value;
+    double number;
+    long integer;
+    if (std::strcmp(arg, "--help") == 0)
+    {
+      printUsage(argv[0]);
+      return false;
+    }
+    else if ((value = optionValue(arg, "--capture")))
+    {
+      if (!parseCaptureBackend(value, options.capture.backend))
+      {
+        std::cout << "Unknown capture backend " << value << std::endl;
+        printUsage(argv[0]);
+        return false;
+      }
+    }
+    else if ((value = optionValue(arg, "--capture-device")))
+    {
+      options.capture.device = value;
+    }
+    else if ((value = optionValue(arg, "--capture-size")))
+    {
+      if (!parseInputSize(value, options.capture.width, options.capture.height))
+      {
+        std::cout << "--capture-size must be WIDTHxHEIGHT, e.g. 640x480" << std::endl;
+        printUsage(argv[0]);
+        return false;
+      }
+    }
+    else if ((value = optionValue(arg, "--capture-buffers")))
+    {
+      if (!integerOption(argv[0], "--capture-buffers", value, 2, INT_MAX, "at least 2", integer))
+      {
+        return false;
+      }
+      options.capture.buffers = (int)integer;
+    }
+    else if ((value = optionValue(arg, "--detector")))
+    {
+      if (!parseDetectorEngine(value, options.detector.engine))
+      {
+        std::cout << "Unknown face detector " << value << std::endl;
+        printUsage(argv[0]);
+        return false;
+      }
+    }
+    else if ((value = optionValue(arg, "--detector-model")))
+    {
+      options.detector.model = value;
+    }
+    else if ((value = optionValue(arg, "--detector-config")))
+    {
+      options.detector.config = value;
+    }
+    else if ((value = optionValue(arg, "--detector-threads")))
+    {
+      if (!integerOption(argv[0], "--detector-threads", value, 1, INT_MAX, "at least 1", integer))
+      {
+        return false;
+      }
+      options.detector.threads = (int)integer;
+    }
+    else if ((value = optionValue(arg, "--detector-input")))
+    {
+      if (!parseInputSize(value, options.detector.input_width, options.detector.input_height))
+      {
+        std::cout << "--detector-input must be WIDTHxHEIGHT, e.g. 300x300" << std::endl;
+        printUsage(argv[0]);
+        return false;
+      }
+    }
+    else if ((value = optionValue(arg, "--detector-score")))
+    {
+      if (!numberOption(argv[0], "--detector-score", value, 0, 1, "from 0 to 1", number))
+      {
+        return false;
+      }
+      options.detector.min_score = static_cast<float>(number);
+    }
+    else if (std::strcmp(arg, "--track") == 0)
+    {
+      options.tracker.enabled = true;
+    }
+    else if ((value = optionValue(arg, "--detect-every")))
+    {
+      if (!integerOption(argv[0], "--detect-every", value, 1, LONG_MAX, "at least 1", integer))
+      {
+        return false;
+      }
+      options.tracker.detect_every = integer;
+    }
+    else if ((value = optionValue(arg, "--track-confidence")))
+    {
+      if (!numberOption(argv[0], "--track-confidence", value, 0, DBL_MAX, "0 or more", number))
+      {
+        return false;
+      }
+      options.tracker.min_confidence = number;
+    }
+    else if ((value = optionValue(arg, "--detect-scale")))
+    {
+      if (!numberOption(argv[0], "--detect-scale", value, above_zero, 1, "more than 0 and at most 1", number))
+      {
+        return false;
+      }
+      options.detection.scale = number;
+    }
+    else if ((value = optionValue(arg, "--detect-roi")))
+    {
+      if (!parseRoiPolicy(value, options.detection.roi))
+      {
+        std::cout << "Unknown detection region policy " << value << std::endl;
+        printUsage(argv[0]);
+        return false;
+      }
+    }
+    else if ((value = optionValue(arg, "--full-frame-every")))
+    {
+      if (!integerOption(argv[0], "--full-frame-every", value, 1, LONG_MAX, "at least 1", integer))
+      {
+        return false;
+      }
+      options.detection.full_frame_every = integer;
+    }
+    else if ((value = optionValue(arg, "--roi-padding")))
+    {
+      if (!numberOption(argv[0], "--roi-padding", value, 0, DBL_MAX, "0 or more", number))
+      {
+        return false;
+      }
+      options.detection.roi_padding = number;
+    }
+    else if ((value = optionValue(arg, "--pose-filter")))
+    {
+      if (!parsePoseFilterMode(value, options.filter.mode))
+      {
+        std::cout << "Unknown pose filter mode " << value << std::endl;
+        printUsage(argv[0]);
+        return false;
+      }
+    }
+    else if ((value = optionValue(arg, "--actuation-delay")))
+    {
+      if (!numberOption(argv[0], "--actuation-delay", value, 0, DBL_MAX, "0 or more", number))
+      {
+        return false;
+      }
+      options.filter.actuation_delay_ms = number;
+    }
+    else if ((value = optionValue(arg, "--angle-deadband")))
+    {
+      if (!numberOption(argv[0], "--angle-deadband", value, 0, 180, "from 0 to 180", number))
+      {
+        return false;
+      }
+      options.commands.angle_deadband = number;
+    }
+    else if ((value = optionValue(arg, "--position-deadband")))
+    {
+      if (!numberOption(argv[0], "--position-deadband", value, 0, DBL_MAX, "0 or more", number))
+      {
+        return false;
+      }
+      options.commands.position_deadband = number;
+    }
+    else if ((value = optionValue(arg, "--debounce")))
+    {
+      if (!numberOption(argv[0], "--debounce", value, 0, DBL_MAX, "0 or more", number))
+      {
+        return false;
+      }
+      options.commands.debounce_ms = number;
+    }
+    else if ((value = optionValue(arg, "--display")))
+    {
+      if (!parseDisplayMode(value, options.display.mode))
+      {
+        std::cout << "Unknown display mode " << value << std::endl;
+        printUsage(argv[0]);
+        return false;
+      }
+    }
+    else if ((value = optionValue(arg, "--preview-every")))
+    {
+      if (!integerOption(argv[0], "--preview-every", value, 1, LONG_MAX, "at least 1", integer))
+      {
+        return false;
+      }
+      options.display.preview_every = integer;
+    }
+    else if ((value = optionValue(arg, "--preview-scale")))
+    {
+      if (!numberOption(argv[0], "--preview-scale", value, above_zero, 1, "more than 0 and at most 1", number))
+      {
+        return false;
+      }
+      options.display.preview_scale = number;
+    }
+    else if ((value = optionValue(arg, "--landmark-model")))
+    {
+      options.landmark_model = value;
+    }
+    else if ((value = optionValue(arg, "--serial")))
+    {
+      options.serial_port = value;
+    }
+    else if ((value = optionValue(arg, "--pose-channel")))
+    {
+      options.pose_channel = std::strcmp(value, "off") == 0 ? "" : value;
+    }
+    else if ((value = optionValue(arg, "--metrics")))
+    {
+      options.metrics_file = std::strcmp(value, "off") == 0 ? "" : value;
+    }
+    else if ((value = optionValue(arg, "--metrics-period")))
+    {
+      if (!numberOption(argv[0], "--metrics-period", value, above_zero, DBL_MAX, "more than 0", number))
+      {
+        return false;
+      }
+      options.metrics_period = number;
+    }
+    else
+    {
+      std::cout << "Unknown option " << arg << std::endl;
+      printUsage(argv[0]);
+      return false;
+    }
+  }
+  return true;
+}
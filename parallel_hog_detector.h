@@ -0,0 +1,308 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <dlib/image_processing/frontal_face_detector.h>
+#include "thread_pool.h"
+
+//dlib's frontal_face_detector with its work spread over a thread pool. The detector scans an
+//image pyramid (each level 5/6 the size of the one before) with five HOG filters, one level
+//and one filter after the other; here every level's HOG features are a task of their own,
+//and each level's filtering is cut into bands of rows, one task per band, that all five
+//filters run over.
+//
+//The faces are the ones the detector itself finds, in the same order with the same
+//confidences. This mirrors what object_detector and scan_fhog_pyramid (dlib 19.13) do, and
+//everything that decides a face is computed from the same numbers the same way:
+// - The pyramid levels are made one from the other, as scan_fhog_pyramid::load makes them.
+// - A band is a full-width run of feature rows plus, above and below it, the half of the
+//   filter that hangs over its edge (the filter's footprint is the detection window, so a
+//   face on the border between two bands is seen whole by one of them). Every filter
+//   response is therefore computed from the same features at the same column position as
+//   in the whole level, and comes out bit for bit the same.
+// - The detections of each filter are sorted, thresholded, sorted together and put through
+//   the detector's own non-max suppression exactly as object_detector does.
+//hog-scaling-benchmark checks the result against the detector frame by frame.
+class ParallelHogDetector
+{
+public:
+  typedef dlib::frontal_face_detector detector_type;
+  typedef detector_type::image_scanner_type scanner_type;
+  typedef dlib::pyramid_down<6> pyramid_type;
+  typedef dlib::default_fhog_feature_extractor feature_extractor_type;
+  static_assert(std::is_same<scanner_type, dlib::scan_fhog_pyramid<pyramid_type> >::value,
+                "ParallelHogDetector follows frontal_face_detector's scanner");
+
+  ParallelHogDetector(const detector_type& detector, int threads) : detector(detector), pool(std::max(1, threads))
+  {
+    const scanner_type& scanner = detector.get_scanner();
+    extractor = scanner.get_feature_extractor();
+    cell_size = scanner.get_cell_size();
+    window_rows = scanner.get_fhog_window_height();
+    window_cols = scanner.get_fhog_window_width();
+    box_rows = window_rows - 2 * scanner.get_padding();
+    box_cols = window_cols - 2 * scanner.get_padding();
+    min_level_width = scanner.get_min_pyramid_layer_width();
+    min_level_height = scanner.get_min_pyramid_layer_height();
+    max_levels = scanner.get_max_pyramid_levels();
+    for (unsigned long i = 0; i < detector.num_detectors(); ++i)
+    {
+      filters.push_back(scanner.build_fhog_filterbank(detector.get_w(i)));
+      thresholds.push_back(detector.get_w(i)(scanner.get_num_dimensions()));
+    }
+  }
+
+  ParallelHogDetector(const ParallelHogDetector&) = delete;
+  ParallelHogDetector& operator=(const ParallelHogDetector&) = delete;
+
+  int threads() const { return pool.size(); }
+
+  //Faces best first, as detector(img, dets) gives them. img is grayscale (unsigned char) or
+  //BGR (dlib::bgr_pixel), and must stay as it is until this returns.
+  template <typename image_type>
+  void operator()(const image_type& img, std::vector<dlib::rect_detection>& dets)
+  {
+    typedef typename dlib::image_traits<image_type>::pixel_type pixel_type;
+    static_assert(std::is_same<pixel_type, dlib::bgr_pixel>::value || std::is_same<pixel_type, unsigned char>::value,
+                  "ParallelHogDetector works on BGR or grayscale images");
+    std::vector<std::unique_ptr<dlib::array2d<pixel_type> > >& images = levelImages(pixel_type());
+
+    //How many levels scan_fhog_pyramid makes of an image this size, and roughly how many
+    //feature cells they come to, to size the bands by.
+    pyramid_type pyr;
+    dlib::rectangle rect = dlib::get_rect(img);
+    double cells = 0;
+    unsigned long level_count = 0;
+    do
+    {
+      cells += (double)rect.area() / (cell_size * cell_size);
+      rect = pyr.rect_down(rect);
+      ++level_count;
+    } while (rect.width() >= min_level_width && rect.height() >= min_level_height && level_count < max_levels);
+    //About two bands per thread, so a thread that finishes early has something left to take.
+    band_cells = std::max(1.0, cells / (2 * pool.size()));
+    while (levels.size() < level_count)
+    {
+      levels.emplace_back(new Level());
+    }
+    //Gray and BGR images are kept apart and each grows on its own: after scanning one kind,
+    //levels can be long enough while the other kind's images are still missing.
+    while (images.size() < level_count)
+    {
+      images.emplace_back(new dlib::array2d<pixel_type>());
+    }
+
+    //The features of the whole image take longest, so they go first; the smaller levels are
+    //made while they run, each one from the last, and handed out as soon as it is there.
+    pool.submit([this, &img]() { scanLevel(img, 0); });
+    for (unsigned long l = 1; l < level_count; ++l)
+    {
+      if (l == 1)
+      {
+        pyr(img, *images[1]);
+      }
+      else
+      {
+        pyr(*images[l - 1], *images[l]);
+      }
+      const dlib::array2d<pixel_type>& level_image = *images[l];
+      pool.submit([this, &level_image, l]() { scanLevel(level_image, l); });
+    }
+    pool.wait();
+    merge(level_count, dets);
+  }
+
+  //Just the boxes, like detector(img).
+  template <typename image_type>
+  void operator()(const image_type& img, std::vector<dlib::rectangle>& faces)
+  {
+    (*this)(img, detections);
+    faces.clear();
+    for (const dlib::rect_detection& d : detections)
+    {
+      faces.push_back(d.rect);
+    }
+  }
+
+private:
+  typedef scanner_type::fhog_filterbank filterbank_type;
+  typedef dlib::array<dlib::array2d<float> > fhog_image;
+  typedef std::vector<std::pair<double, dlib::rectangle> > scored_rects;
+
+  //Feature rows [first_row, last_row] of a level, as the filters see them: features holds
+  //the rows from input_row on, enough to cover the filter around each of them.
+  struct Band
+  {
+    long first_row = 0;
+    long last_row = 0;
+    long input_row = 0;
+    fhog_image features;   //unused when the band is the whole level
+    dlib::array2d<float> saliency;
+    std::vector<scored_rects> found;   //per filter
+  };
+
+  struct Level
+  {
+    fhog_image features;
+    std::vector<std::unique_ptr<Band> > bands;
+    unsigned long band_count = 0;
+  };
+
+  std::vector<std::unique_ptr<dlib::array2d<unsigned char> > >& levelImages(unsigned char) { return gray_images; }
+  std::vector<std::unique_ptr<dlib::array2d<dlib::bgr_pixel> > >& levelImages(dlib::bgr_pixel) { return bgr_images; }
+
+  //One level's HOG features, then its bands (on whichever threads are free).
+  template <typename image_type>
+  void scanLevel(const image_type& image, unsigned long l)
+  {
+    Level& level = *levels[l];
+    extractor(image, level.features, cell_size, window_rows, window_cols);
+    const long rows = level.features[0].nr();
+    const long cols = level.features[0].nc();
+    //Rows the filter fits on, as spatially_filter_image has it: centred, the odd row below.
+    const long top = window_rows / 2;
+    const long bottom = rows - 1 - (window_rows - 1) / 2;
+    level.band_count = 0;
+    if (bottom < top)
+    {
+      return;
+    }
+    const long valid_rows = bottom - top + 1;
+    //Bands at least a window high, so the overlap never costs more than the band itself.
+    const long most = std::max(1L, valid_rows / window_rows);
+    const long count = std::min(most, std::max(1L, (long)(valid_rows * cols / band_cells + 0.5)));
+    while ((long)level.bands.size() < count)
+    {
+      level.bands.emplace_back(new Band());
+    }
+    level.band_count = count;
+    for (long b = 0; b < count; ++b)
+    {
+      Band& band = *level.bands[b];
+      band.first_row = top + valid_rows * b / count;
+      band.last_row = top + valid_rows * (b + 1) / count - 1;
+      band.input_row = band.first_row - top;
+      if (b + 1 < count)
+      {
+        pool.submit([this, l, b]() { scanBand(*levels[l], *levels[l]->bands[b], l); });
+      }
+    }
+    //The last band stays on this thread.
+    scanBand(level, *level.bands[count - 1], l);
+  }
+
+  void scanBand(const Level& level, Band& band, unsigned long l)
+  {
+    const fhog_image* features = &level.features;
+    if (level.band_count > 1)
+    {
+      copyRows(level.features, band.input_row, band.last_row + (window_rows - 1) / 2, band.features);
+      features = &band.features;
+    }
+    band.found.resize(filters.size());
+    pyramid_type pyr;
+    for (std::size_t i = 0; i < filters.size(); ++i)
+    {
+      //As impl::detect_from_fhog_pyramid does it, on rows offset by input_row.
+      scored_rects& found = band.found[i];
+      found.clear();
+      const dlib::rectangle area = dlib::impl::apply_filters_to_fhog(filters[i], *features, band.saliency);
+      for (long r = area.top(); r <= area.bottom(); ++r)
+      {
+        for (long c = area.left(); c <= area.right(); ++c)
+        {
+          if (band.saliency[r][c] >= thresholds[i])
+          {
+            dlib::rectangle rect = extractor.feats_to_image(
+                dlib::centered_rect(dlib::point(c, r + band.input_row), box_cols, box_rows), cell_size, window_rows,
+                window_cols);
+            found.push_back(std::make_pair(band.saliency[r][c], pyr.rect_up(rect, l)));
+          }
+        }
+      }
+    }
+  }
+
+  static void copyRows(const fhog_image& from, long first, long last, fhog_image& to)
+  {
+    if (to.max_size() < from.size())
+    {
+      to.set_max_size(from.size());
+    }
+    to.set_size(from.size());
+    const long cols = from[0].nc();
+    for (unsigned long p = 0; p < from.size(); ++p)
+    {
+      to[p].set_size(last - first + 1, cols);
+      for (long r = first; r <= last; ++r)
+      {
+        std::copy(&from[p][r][0], &from[p][r][0] + cols, &to[p][r - first][0]);
+      }
+    }
+  }
+
+  //What object_detector::operator() does with the detections of each of its filters.
+  void merge(unsigned long level_count, std::vector<dlib::rect_detection>& dets)
+  {
+    all.clear();
+    for (std::size_t i = 0; i < filters.size(); ++i)
+    {
+      filter_found.clear();
+      for (unsigned long l = 0; l < level_count; ++l)
+      {
+        for (unsigned long b = 0; b < levels[l]->band_count; ++b)
+        {
+          const scored_rects& band_found = levels[l]->bands[b]->found[i];
+          filter_found.insert(filter_found.end(), band_found.begin(), band_found.end());
+        }
+      }
+      std::sort(filter_found.rbegin(), filter_found.rend());
+      for (const std::pair<double, dlib::rectangle>& f : filter_found)
+      {
+        dlib::rect_detection d;
+        d.detection_confidence = f.first - thresholds[i];
+        d.weight_index = i;
+        d.rect = f.second;
+        all.push_back(d);
+      }
+    }
+    if (filters.size() > 1)
+    {
+      std::sort(all.rbegin(), all.rend());
+    }
+    const dlib::test_box_overlap& overlaps = detector.get_overlap_tester();
+    dets.clear();
+    for (const dlib::rect_detection& d : all)
+    {
+      bool suppressed = false;
+      for (std::size_t k = 0; k < dets.size() && !suppressed; ++k)
+      {
+        suppressed = overlaps(d.rect, dets[k].rect);
+      }
+      if (!suppressed)
+      {
+        dets.push_back(d);
+      }
+    }
+  }
+
+  detector_type detector;
+  ThreadPool pool;
+  feature_extractor_type extractor;
+  long cell_size;
+  long window_rows, window_cols;   //the filter, in feature cells
+  long box_rows, box_cols;         //the detection window inside it
+  unsigned long min_level_width, min_level_height, max_levels;
+  std::vector<filterbank_type> filters;
+  std::vector<double> thresholds;
+  double band_cells;
+  std::vector<std::unique_ptr<Level> > levels;
+  std::vector<std::unique_ptr<dlib::array2d<unsigned char> > > gray_images;
+  std::vector<std::unique_ptr<dlib::array2d<dlib::bgr_pixel> > > bgr_images;
+  scored_rects filter_found;
+  std::vector<dlib::rect_detection> all;
+  std::vector<dlib::rect_detection> detections;
+};
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <dlib/image_processing.h>
+#include <opencv2/core/core.hpp>
+#include <vector>
+#include <dlib/opencv.h>
+#include "command_generator.h"
+#include "face_pose.h"
+#include "face_pose_channel.h"
+#include "face_tracker.h"
+#include "landmark_model.h"
+#include "motion_command.h"
+#include "pose_filter.h"
+#include "spsc_queue.h"
+#include "stage_timing.h"
+
+//Everything one camera frame picks up on its way through the pipeline. Each stage fills in
+//its own part and moves the frame on to the next queue, so nothing is copied but the
+//cv::Mat header.
+struct Frame
+{
+  unsigned long id = 0;
+  pipeline_clock::time_point captured;   //stamped right after the grab (or by the driver)
+  cv::Mat image;   //BGR; may be empty when the capture backend gives gray and nothing needs color
+  cv::Mat gray;    //luminance, when the capture backend has it without converting
+  std::shared_ptr<void> capture_buffer;   //keeps a driver buffer gray points into out of the ring
+
+  //detect stage
+  bool has_face = false;
+  dlib::rectangle face;
+  dlib::full_object_detection shape;
+
+  //pose stage (only filled in when has_face)
+  FacePose pose;
+  PoseSample target;   //the (filtered, predicted) pose the command was made from
+  MotionCommand command;
+
+  StageTimes times;
+};
+
+inline int frameWidth(const Frame& frame) { return frame.gray.empty() ? frame.image.cols : frame.gray.cols; }
+inline int frameHeight(const Frame& frame) { return frame.gray.empty() ? frame.image.rows : frame.gray.rows; }
+
+//The queues are tiny on purpose: a stage that falls behind should pick up the newest frame
+//(SpscQueue::popLatest), not work through a backlog of stale ones.
+const std::size_t frame_queue_capacity = 2;
+typedef SpscQueue<Frame, frame_queue_capacity> FrameQueue;
+
+//How long an idle stage waits before polling its input queue again.
+const std::chrono::microseconds stage_idle_wait(500);
+
+//The work the detect stage does on one frame: find (or follow) the face, then its landmarks.
+//Shared by main-code and the offline benchmark so both measure the same thing.
+template <typename image_type>
+inline void detectFace(FaceTracker& tracker, LandmarkPredictor& predictor, const image_type& cimg, Frame& frame)
+{
+  // Detect (or, with --track, follow) the face
+  pipeline_clock::time_point start = pipeline_clock::now();
+  frame.has_face = tracker.update(cimg, frame.face);
+  frame.times.detect_us = elapsedMicroseconds(start);
+
+  // Find the landmarks of the face
+  if (frame.has_face)
+  {
+    start = pipeline_clock::now();
+    frame.shape = predictor(cimg, frame.face);
+    frame.times.landmarks_us = elapsedMicroseconds(start);
+  }
+}
+
+//Works on the grayscale image when the capture backend gave one and the detector engine
+//does not need color, and on the BGR image otherwise.
+inline void detectFace(FaceTracker& tracker, LandmarkPredictor& predictor, const DetectorEngine& engine, Frame& frame)
+{
+  if (!frame.gray.empty() && (!engine.needsColor() || frame.image.empty()))
+  {
+    detectFace(tracker, predictor, dlib::cv_image<unsigned char>(frame.gray), frame);
+  }
+  else
+  {
+    detectFace(tracker, predictor, dlib::cv_image<dlib::bgr_pixel>(frame.image), frame);
+  }
+}
+
+//The work the pose stage does on one frame: head pose, the pose filter and the resulting
+//motion commands. Returns false if there was no face to work with, in which case the next
+//face's pose is solved cold.
+inline bool estimatePose(PoseEstimator& estimator, PoseFilter& filter, CommandGenerator& generator, Frame& frame)
+{
+  if (!frame.has_face)
+  {
+    estimator.faceLost();
+    return false;
+  }
+  estimator.estimate(frame.shape, frameWidth(frame), frameHeight(frame), frame.pose, frame.times);
+  pipeline_clock::time_point start = pipeline_clock::now();
+  PoseSample measured;
+  poseSample(frame.pose, frame.captured, measured);
+  filter.update(measured, start, frame.target);
+  frame.command.frame_id = frame.id;
+  frame.command.captured = frame.captured;
+  generator.generate(frame.target, frame.command);
+  frame.times.command_us = elapsedMicroseconds(start);
+  return true;
+}
+
+//What the face pose channel carries for a frame. Confidence falls with the head model's
+//reprojection error: 1 for a perfect fit, 0.5 at 4 pixels RMS, and 0 for a frame without a face.
+inline void sharedFacePose(const Frame& frame, SharedFacePose& pose)
+{
+  pose = SharedFacePose();
+  pose.frame_id = frame.id;
+  pose.captured_ns = facePoseClockNs(frame.captured);
+  if (frame.has_face)
+  {
+    pose.x = frame.pose.x_pos;
+    pose.y = frame.pose.y_pos;
+    pose.z = frame.pose.z_pos;
+    pose.roll = frame.pose.roll;
+    pose.pitch = frame.pose.pitch;
+    pose.yaw = frame.pose.yaw;
+    pose.confidence = 1 / (1 + frame.pose.reprojection_error / 4);
+  }
+}
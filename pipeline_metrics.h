@@ -0,0 +1,67 @@
+#pragma once
+
+#include "metrics.h"
+#include "stage_timing.h"
+
+//The tracking loop's metrics: a latency histogram per stage, from the StageTimes each frame
+//already carries, and how many frames went through, how many had no face and how many turned
+//into motion commands. Each stage thread reports its own part of the frame, so every call
+//lands in that thread's shard of the registry (metrics.h).
+class PipelineMetrics
+{
+public:
+  explicit PipelineMetrics(MetricsRegistry& registry) : registry(registry)
+  {
+    frames = registry.counter("rasm_frames_total", "Frames captured.");
+    faceless = registry.counter("rasm_faceless_frames_total", "Frames detection found no face in.");
+    commands = registry.counter("rasm_commands_total", "Motion commands handed to the serial writer.");
+    capture = registry.histogram("rasm_capture_seconds", "Time to grab and decode a frame.");
+    detect = registry.histogram("rasm_detect_seconds", "Time to find (or follow) the face.");
+    landmarks = registry.histogram("rasm_landmarks_seconds", "Time to find the face's landmarks.");
+    pose = registry.histogram("rasm_pose_seconds", "Time for solvePnP, reprojection and the Euler angles.");
+    command = registry.histogram("rasm_command_seconds", "Time for the pose filter and the motion commands.");
+    end_to_end = registry.histogram("rasm_end_to_end_seconds",
+                                    "Time from capturing a frame to its pose stage being done.");
+  }
+
+  //capture stage
+  void captured(const StageTimes& times)
+  {
+    registry.add(frames);
+    registry.record(capture, times.capture_us);
+  }
+
+  //detect stage
+  void detected(const StageTimes& times, bool has_face)
+  {
+    registry.record(detect, times.detect_us);
+    if (has_face)
+    {
+      registry.record(landmarks, times.landmarks_us);
+    }
+    else
+    {
+      registry.add(faceless);
+    }
+  }
+
+  //pose stage; sent is whether the frame's command went to the serial writer
+  void posed(const StageTimes& times, bool has_face, bool sent, double end_to_end_us)
+  {
+    if (has_face)
+    {
+      registry.record(pose, times.solve_pnp_us + times.euler_us);
+      registry.record(command, times.command_us);
+    }
+    if (sent)
+    {
+      registry.add(commands);
+    }
+    registry.record(end_to_end, end_to_end_us);
+  }
+
+private:
+  MetricsRegistry& registry;
+  int frames, faceless, commands;
+  int capture, detect, landmarks, pose, command, end_to_end;
+};
@@ -0,0 +1,263 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include "motion_command.h"
+
+//The parts of a face pose the filter and the command generator work on, in FacePose's units.
+enum PoseAxis
+{
+  AXIS_X,          //inches
+  AXIS_Y,          //inches
+  AXIS_DISTANCE,   //inches
+  AXIS_PITCH,      //degrees
+  AXIS_YAW,        //degrees
+  AXIS_ROLL        //degrees
+};
+const int pose_axis_count = 6;
+
+inline bool isAngleAxis(int axis) { return axis >= AXIS_PITCH; }
+
+//Angle difference wrapped into [-180, 180).
+inline double wrapDegrees(double angle)
+{
+  return angle - 360.0 * std::floor((angle + 180.0) / 360.0);
+}
+
+//A face pose at one point on the pipeline clock.
+struct PoseSample
+{
+  //When the face was there: the capture time for a measured pose, the expected actuation
+  //time for a predicted one.
+  pipeline_clock::time_point time;
+  double axis[pose_axis_count] = {};
+};
+
+//What the pose filter does between pose estimation and command generation.
+enum PoseFilterMode
+{
+  FILTER_OFF,       //commands come straight from each frame's pose (what main-code always did)
+  FILTER_SMOOTH,    //Kalman filtered pose at capture time
+  FILTER_PREDICT    //Kalman filtered pose extrapolated to when the motors will act on it
+};
+
+inline const char* poseFilterModeName(PoseFilterMode mode)
+{
+  switch (mode)
+  {
+    case FILTER_OFF:
+      return "off";
+    case FILTER_SMOOTH:
+      return "smooth";
+    case FILTER_PREDICT:
+      return "predict";
+  }
+  return "unknown";
+}
+
+//Returns false if name is not one of the names poseFilterModeName() gives out.
+inline bool parsePoseFilterMode(const char* name, PoseFilterMode& mode)
+{
+  const PoseFilterMode modes[] = {FILTER_OFF, FILTER_SMOOTH, FILTER_PREDICT};
+  for (PoseFilterMode m : modes)
+  {
+    if (std::strcmp(name, poseFilterModeName(m)) == 0)
+    {
+      mode = m;
+      return true;
+    }
+  }
+  return false;
+}
+
+struct PoseFilterOptions
+{
+  PoseFilterMode mode = FILTER_PREDICT;
+  //Time from a command leaving the pose stage to the motors acting on it (serial link and
+  //the Arduino's loop). The pipeline's own latency is measured.
+  double actuation_delay_ms = 30;
+  //Never extrapolate further than this, however late the frame is.
+  double max_prediction_ms = 250;
+  //Standard deviation of a single frame's measurement...
+  double position_noise = 0.3;   //inches
+  double angle_noise = 1.5;      //degrees
+  //...and of the face's acceleration, which sets how quickly the filter follows a change.
+  //Only the ratio to the noise matters. Lower values smooth more but lag; higher ones put
+  //more of the noise into the velocity that predict extrapolates with. So there are two: a
+  //low one for a face that moves smoothly...
+  double position_acceleration = 40;    //inches/s^2
+  double angle_acceleration = 200;      //degrees/s^2
+  //...and a high one for a frame the filter did not see coming, a measurement further than
+  //maneuver_threshold standard deviations from where the face was expected (a head turning
+  //or stopping). Tuned with pose-filter-benchmark and tests/pose_filter_test.cpp.
+  double position_maneuver_acceleration = 75;   //inches/s^2
+  double angle_maneuver_acceleration = 750;     //degrees/s^2
+  double maneuver_threshold = 3;
+  //A gap between faces longer than this starts the filter over.
+  double max_gap_ms = 500;
+  //Weight of the newest frame in the running average of the pipeline latency.
+  double latency_smoothing = 0.1;
+};
+
+//Constant velocity Kalman filter for one axis: position p and velocity v, with the
+//acceleration treated as white noise.
+class AxisKalman
+{
+public:
+  AxisKalman() : p(0), v(0), p_var(0), pv_cov(0), v_var(0), wraps(false) {}
+
+  //Starts over at z, with velocity unknown.
+  void reset(double z, double measurement_var, bool wrap_degrees)
+  {
+    wraps = wrap_degrees;
+    p = z;
+    v = 0;
+    p_var = measurement_var;
+    pv_cov = 0;
+    v_var = 1e4 * measurement_var;
+  }
+
+  //Moves the state dt seconds ahead.
+  void predict(double dt, double acceleration_var)
+  {
+    p = wrap(p + v * dt);
+    const double dt2 = dt * dt;
+    p_var += dt * (2 * pv_cov + dt * v_var) + acceleration_var * dt2 * dt2 / 4;
+    pv_cov += dt * v_var + acceleration_var * dt2 * dt / 2;
+    v_var += acceleration_var * dt2;
+  }
+
+  //How far z is from where the filter expects it, in standard deviations.
+  double surprise(double z, double measurement_var) const
+  {
+    return std::fabs(wrap(z - p)) / std::sqrt(p_var + measurement_var);
+  }
+
+  //Folds in a measurement of the position.
+  void update(double z, double measurement_var)
+  {
+    const double innovation = wrap(z - p);
+    const double s = p_var + measurement_var;
+    const double kp = p_var / s;
+    const double kv = pv_cov / s;
+    p = wrap(p + kp * innovation);
+    v += kv * innovation;
+    v_var -= kv * pv_cov;
+    pv_cov -= kv * p_var;   //uses p_var from before the update
+    p_var -= kp * p_var;
+  }
+
+  //Where the axis will be dt seconds from now if it keeps its velocity.
+  double extrapolate(double dt) const { return wrap(p + v * dt); }
+
+  double position() const { return p; }
+  double velocity() const { return v; }
+
+private:
+  double wrap(double x) const { return wraps ? wrapDegrees(x) : x; }
+
+  double p;
+  double v;
+  double p_var;
+  double pv_cov;
+  double v_var;
+  bool wraps;
+};
+
+//Sits between pose estimation and command generation. Runs a constant velocity Kalman
+//filter over each axis, on the capture timestamps of the frames (with more acceleration
+//allowed for a frame it did not see coming, so a turn of the head is not smoothed away), and
+//in FILTER_PREDICT
+//extrapolates the pose to when the command made from it will move the arm: capture time
+//plus the measured (smoothed) pipeline latency plus the actuation delay. That way the
+//command describes where the face will be, not where it was a few frames ago.
+class PoseFilter
+{
+public:
+  explicit PoseFilter(const PoseFilterOptions& options = PoseFilterOptions())
+    : options(options), started(false), latency_ms(0), horizon_ms(0) {}
+
+  //measured is a pose straight from the estimator, stamped with its capture time; now is
+  //when the command is being made. out gets the pose to make the command from.
+  void update(const PoseSample& measured, pipeline_clock::time_point now, PoseSample& out)
+  {
+    if (options.mode == FILTER_OFF)
+    {
+      out = measured;
+      return;
+    }
+    const double frame_latency_ms = std::chrono::duration<double, std::milli>(now - measured.time).count();
+    const double gap_ms = std::chrono::duration<double, std::milli>(measured.time - last_time).count();
+    if (!started || gap_ms > options.max_gap_ms || gap_ms < 0)
+    {
+      for (int a = 0; a < pose_axis_count; ++a)
+      {
+        axes[a].reset(measured.axis[a], measurementVariance(a), isAngleAxis(a));
+      }
+      latency_ms = frame_latency_ms;
+      started = true;
+    }
+    else
+    {
+      const double dt = gap_ms / 1000;
+      for (int a = 0; a < pose_axis_count; ++a)
+      {
+        const AxisKalman before = axes[a];
+        axes[a].predict(dt, accelerationVariance(a, false));
+        if (axes[a].surprise(measured.axis[a], measurementVariance(a)) > options.maneuver_threshold)
+        {
+          axes[a] = before;
+          axes[a].predict(dt, accelerationVariance(a, true));
+        }
+        axes[a].update(measured.axis[a], measurementVariance(a));
+      }
+      latency_ms += options.latency_smoothing * (frame_latency_ms - latency_ms);
+    }
+    last_time = measured.time;
+
+    horizon_ms = 0;
+    if (options.mode == FILTER_PREDICT)
+    {
+      horizon_ms = std::min(options.max_prediction_ms, latency_ms + options.actuation_delay_ms);
+    }
+    out.time = measured.time + std::chrono::duration_cast<pipeline_clock::duration>(
+                                 std::chrono::duration<double, std::milli>(horizon_ms));
+    for (int a = 0; a < pose_axis_count; ++a)
+    {
+      out.axis[a] = axes[a].extrapolate(horizon_ms / 1000);
+    }
+  }
+
+  //Forget the face, so the next pose starts the filter over.
+  void reset() { started = false; }
+
+  const PoseFilterOptions& settings() const { return options; }
+  //Running average of capture to command time, and how far the last pose was extrapolated.
+  double pipelineLatencyMs() const { return latency_ms; }
+  double predictionMs() const { return horizon_ms; }
+  const AxisKalman& axis(PoseAxis a) const { return axes[a]; }
+
+private:
+  double measurementVariance(int axis) const
+  {
+    const double sigma = isAngleAxis(axis) ? options.angle_noise : options.position_noise;
+    return sigma * sigma;
+  }
+
+  double accelerationVariance(int axis, bool maneuver) const
+  {
+    const double sigma = isAngleAxis(axis)
+                           ? (maneuver ? options.angle_maneuver_acceleration : options.angle_acceleration)
+                           : (maneuver ? options.position_maneuver_acceleration : options.position_acceleration);
+    return sigma * sigma;
+  }
+
+  PoseFilterOptions options;
+  AxisKalman axes[pose_axis_count];
+  bool started;
+  pipeline_clock::time_point last_time;
+  double latency_ms;
+  double horizon_ms;
+};
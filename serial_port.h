@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/file.h>
+#include <termios.h>
+#include <unistd.h>
+
+//Opens a serial port non-blocking and sets it to raw 8N1 at the given termios speed constant
+//(the firmware expects RASM_SERIAL_BAUD). Anything that accepts termios settings works, so a
+//pseudo-terminal can stand in for the Arduino. The port is locked for as long as it is open, so
+//a second program (main-code and rasm_motion both write to arduino_main) gets -1 instead of
+//interleaving its frames with the first one's. Returns the file descriptor, or -1 (after
+//saying why) if the port cannot be used.
+inline int openSerialPort(const char* device, speed_t baud)
+{
+  const int fd = ::open(device, O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (fd < 0)
+  {
+    std::cout << "Unable to open serial port " << device << ": " << std::strerror(errno) << std::endl;
+    return -1;
+  }
+  if (flock(fd, LOCK_EX | LOCK_NB) != 0)
+  {
+    std::cout << "Unable to use serial port " << device << ": "
+              << (errno == EWOULDBLOCK ? "another program has it open" : std::strerror(errno)) << std::endl;
+    ::close(fd);
+    return -1;
+  }
+  struct termios tty;
+  if (tcgetattr(fd, &tty) != 0)
+  {
+    std::cout << "Unable to read settings of " << device << ": " << std::strerror(errno) << std::endl;
+    ::close(fd);
+    return -1;
+  }
+  cfmakeraw(&tty);
+  cfsetispeed(&tty, baud);
+  cfsetospeed(&tty, baud);
+  tty.c_cflag |= CLOCAL | CREAD;
+  tty.c_cflag &= ~(CSTOPB | CRTSCTS);
+  if (tcsetattr(fd, TCSANOW, &tty) != 0)
+  {
+    std::cout << "Unable to configure " << device << ": " << std::strerror(errno) << std::endl;
+    ::close(fd);
+    return -1;
+  }
+  return fd;
+}
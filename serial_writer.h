@@ -0,0 +1,213 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <termios.h>
+#include <thread>
+#include <unistd.h>
+#include "arduino_extra/rasm_protocol.h"
+#include "motion_command.h"
+#include "serial_port.h"
+#include "spsc_queue.h"
+
+//Writes MotionCommands to the Arduino over a serial port. All five axis commands for a frame
+//go out as one binary motion frame (see arduino_extra/rasm_protocol.h) with one write() from
+//a dedicated writer thread, and submit() never blocks the caller: if the port is still busy
+//with an earlier frame, anything submitted in the meantime is coalesced so only the newest
+//command is sent next. Nothing is allocated once the port is open.
+//
+//The port can be anything that accepts termios settings, so a pseudo-terminal stands in for
+//the Arduino in benchmarks (see benchmarks/serial_benchmark.cpp).
+class SerialWriter
+{
+public:
+  static const std::size_t max_frame_size = RASM_MOTION_FRAME_SIZE;
+
+  SerialWriter() : fd(-1), wake_fd(-1), running(false), sequence(0), frames_sent(0), bytes_sent(0), write_errors(0) {}
+  ~SerialWriter() { close(); }
+
+  SerialWriter(const SerialWriter&) = delete;
+  SerialWriter& operator=(const SerialWriter&) = delete;
+
+  //Opens and configures the port (raw 8N1 at the given termios speed constant; the firmware
+  //expects RASM_SERIAL_BAUD) and starts the writer thread. Returns false if the port cannot
+  //be used.
+  bool open(const char* device, speed_t baud = B115200)
+  {
+    fd = openSerialPort(device, baud);
+    if (fd < 0)
+    {
+      return false;
+    }
+    wake_fd = eventfd(0, EFD_NONBLOCK);
+    if (wake_fd < 0)
+    {
+      std::cout << "Unable to create eventfd: " << std::strerror(errno) << std::endl;
+      close();
+      return false;
+    }
+    running = true;
+    writer = std::thread(&SerialWriter::writerLoop, this);
+    return true;
+  }
+
+  //Stops the writer thread (dropping anything not yet sent) and closes the port.
+  void close()
+  {
+    if (running)
+    {
+      running = false;
+      wake();
+      writer.join();
+    }
+    if (wake_fd >= 0)
+    {
+      ::close(wake_fd);
+      wake_fd = -1;
+    }
+    if (fd >= 0)
+    {
+      ::close(fd);
+      fd = -1;
+    }
+  }
+
+  //Hands a command to the writer thread. Safe to call from one producer thread only.
+  void submit(const MotionCommand& command)
+  {
+    latest.publish(command);
+    wake();
+  }
+
+  //Builds the motion frame for one command. Returns the number of bytes written to frame,
+  //which must hold max_frame_size bytes.
+  static std::size_t encode(const MotionCommand& command, uint8_t sequence, uint8_t* frame)
+  {
+    RasmMotionFrame motion;
+    motion.sequence = sequence;
+    motion.setpoints[RASM_AXIS_ROLL] = clampSetpoint(command.roll);
+    motion.setpoints[RASM_AXIS_PITCH] = clampSetpoint(command.pitch);
+    motion.setpoints[RASM_AXIS_YAW] = clampSetpoint(command.yaw);
+    motion.setpoints[RASM_AXIS_Y] = clampSetpoint(command.y);
+    motion.setpoints[RASM_AXIS_X] = clampSetpoint(command.x);
+    return rasmEncodeMotion(motion, frame);
+  }
+
+  unsigned long framesSent() const { return frames_sent; }
+  unsigned long framesCoalesced() const { return latest.overwritten(); }
+  unsigned long bytesSent() const { return bytes_sent; }
+  unsigned long writeErrors() const { return write_errors; }
+
+private:
+  static int16_t clampSetpoint(int value)
+  {
+    return value > INT16_MAX ? INT16_MAX : value < INT16_MIN ? INT16_MIN : value;
+  }
+
+  void wake()
+  {
+    const uint64_t one = 1;
+    if (::write(wake_fd, &one, sizeof(one)) < 0)
+    {
+      //The counter can only fail to take another increment if it is already non-zero, in
+      //which case the writer is going to wake up anyway.
+    }
+  }
+
+  //Replaces the frame being written with the newest command, if there is one. A frame is
+  //only replaced before its first byte is out; a half-sent frame has to be finished or the
+  //Arduino would see a garbled command.
+  void nextFrame(uint8_t* frame, std::size_t& frame_size, std::size_t& written)
+  {
+    if (written != 0 && written != frame_size)
+    {
+      return;
+    }
+    MotionCommand command;
+    if (latest.take(command))
+    {
+      frame_size = encode(command, sequence++, frame);
+      written = 0;
+    }
+  }
+
+  void writerLoop()
+  {
+    uint8_t frame[max_frame_size];
+    std::size_t frame_size = 0;
+    std::size_t written = 0;
+    struct pollfd fds[2];
+    fds[0].fd = wake_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = fd;
+    fds[1].events = POLLOUT;
+    while (running)
+    {
+      //Pick up the newest command before waiting: a submit() that came in while the last
+      //frame was half-sent has had its wake-up used already, and would otherwise wait for the
+      //next one.
+      nextFrame(frame, frame_size, written);
+      //Only wait for the port when there is something left to write to it.
+      const bool pending = written < frame_size;
+      const int ready = poll(fds, pending ? 2 : 1, -1);
+      if (ready < 0 && errno == EINTR)
+      {
+        continue;
+      }
+      //Anything else does not go away by asking again (the port or the eventfd is gone), and
+      //asking again at once would only spin: the writer stops and says why, and the commands
+      //after that are dropped.
+      if (ready < 0 || (fds[0].revents & POLLNVAL) || (pending && (fds[1].revents & POLLNVAL)))
+      {
+        const char* reason = ready < 0 ? std::strerror(errno) : "its port or eventfd was closed";
+        ++write_errors;
+        std::cout << "Serial writer stopped: " << reason << std::endl;
+        return;
+      }
+      if (fds[0].revents & POLLIN)
+      {
+        uint64_t count;
+        if (::read(wake_fd, &count, sizeof(count)) < 0)
+        {
+          //Spurious wake up; nothing to clear.
+        }
+      }
+      nextFrame(frame, frame_size, written);
+      if (written < frame_size)
+      {
+        const ssize_t result = ::write(fd, frame + written, frame_size - written);
+        if (result > 0)
+        {
+          written += result;
+          bytes_sent += result;
+          if (written == frame_size)
+          {
+            ++frames_sent;
+          }
+        }
+        else if (result < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        {
+          ++write_errors;
+          //Give up on this frame; the next command will be tried from scratch.
+          written = frame_size;
+        }
+      }
+    }
+  }
+
+  int fd;
+  int wake_fd;
+  std::atomic<bool> running;
+  std::thread writer;
+  LatestValue<MotionCommand> latest;
+  uint8_t sequence;   //only touched by the writer thread
+  std::atomic<unsigned long> frames_sent;
+  std::atomic<unsigned long> bytes_sent;
+  std::atomic<unsigned long> write_errors;
+};
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+//A bounded, lock-free, single-producer/single-consumer ring buffer used to hand frames
+//from one pipeline stage to the next. Exactly one thread may call push() and exactly one
+//(other) thread may call pop()/popLatest(). Nothing ever blocks: a full queue rejects the
+//new item and an empty queue returns false, so a slow stage can never stall the stage
+//in front of it.
+template <typename T, std::size_t Capacity>
+class SpscQueue
+{
+  static_assert(Capacity > 0, "SpscQueue needs room for at least one item");
+
+public:
+  SpscQueue() : head(0), tail(0), pushed_count(0), dropped_count(0) {}
+
+  SpscQueue(const SpscQueue&) = delete;
+  SpscQueue& operator=(const SpscQueue&) = delete;
+
+  //Producer side. Returns false (and counts a drop) if the consumer has not kept up.
+  bool push(T&& item)
+  {
+    const std::size_t t = tail.load(std::memory_order_relaxed);
+    const std::size_t next = increment(t);
+    if (next == head.load(std::memory_order_acquire))
+    {
+      dropped_count.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    slots[t] = std::move(item);
+    tail.store(next, std::memory_order_release);
+    pushed_count.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  //Consumer side. Takes the oldest queued item.
+  bool pop(T& item)
+  {
+    const std::size_t h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire))
+    {
+      return false;
+    }
+    item = std::move(slots[h]);
+    head.store(increment(h), std::memory_order_release);
+    return true;
+  }
+
+  //Consumer side. Takes the newest queued item and throws away everything older, counting
+  //each discarded item as a drop. This is what keeps a stage that fell behind working on
+  //the freshest frame instead of chewing through a backlog.
+  bool popLatest(T& item)
+  {
+    if (!pop(item))
+    {
+      return false;
+    }
+    while (pop(item))
+    {
+      dropped_count.fetch_add(1, std::memory_order_relaxed);
+    }
+    return true;
+  }
+
+  //These may be read from any thread; they are snapshots and only approximately current.
+  std::size_t depth() const
+  {
+    const std::size_t h = head.load(std::memory_order_acquire);
+    const std::size_t t = tail.load(std::memory_order_acquire);
+    return (t + slot_count - h) % slot_count;
+  }
+  unsigned long pushed() const { return pushed_count.load(std::memory_order_relaxed); }
+  unsigned long dropped() const { return dropped_count.load(std::memory_order_relaxed); }
+  static constexpr std::size_t capacity() { return Capacity; }
+
+private:
+  //One slot is always left empty so that head == tail unambiguously means "empty".
+  static constexpr std::size_t slot_count = Capacity + 1;
+
+  static std::size_t increment(std::size_t index)
+  {
+    return (index + 1 == slot_count) ? 0 : index + 1;
+  }
+
+  T slots[slot_count];
+  //head and tail live on separate cache lines so the two threads do not false-share.
+  alignas(64) std::atomic<std::size_t> head;
+  alignas(64) std::atomic<std::size_t> tail;
+  alignas(64) std::atomic<unsigned long> pushed_count;
+  std::atomic<unsigned long> dropped_count;
+};
+
+//A lock-free single-producer/single-consumer mailbox that only ever holds the newest value
+//(a triple buffer). Unlike SpscQueue a busy consumer never makes the producer fail: every
+//publish() replaces whatever the consumer has not picked up yet, which is exactly what
+//you want for setpoints where only the latest one matters.
+template <typename T>
+class LatestValue
+{
+public:
+  LatestValue() : back(0), middle(1), front(2), overwritten_count(0) {}
+
+  LatestValue(const LatestValue&) = delete;
+  LatestValue& operator=(const LatestValue&) = delete;
+
+  //Producer side.
+  void publish(const T& value)
+  {
+    slots[back] = value;
+    const unsigned previous = middle.exchange(back | fresh_bit, std::memory_order_acq_rel);
+    if (previous & fresh_bit)
+    {
+      overwritten_count.fetch_add(1, std::memory_order_relaxed);
+    }
+    back = previous & index_mask;
+  }
+
+  //Consumer side. Returns false if nothing new was published since the last take().
+  bool take(T& value)
+  {
+    if (!(middle.load(std::memory_order_relaxed) & fresh_bit))
+    {
+      return false;
+    }
+    front = middle.exchange(front, std::memory_order_acq_rel) & index_mask;
+    value = slots[front];
+    return true;
+  }
+
+  //How many values were replaced before the consumer got to them.
+  unsigned long overwritten() const { return overwritten_count.load(std::memory_order_relaxed); }
+
+private:
+  static constexpr unsigned fresh_bit = 4;
+  static constexpr unsigned index_mask = 3;
+
+  T slots[3];
+  unsigned back;                  //only touched by the producer
+  alignas(64) std::atomic<unsigned> middle;
+  alignas(64) unsigned front;     //only touched by the consumer
+  std::atomic<unsigned long> overwritten_count;
+};
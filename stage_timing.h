@@ -0,0 +1,104 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include "motion_command.h"
+
+//How long each step of the tracking loop took for one frame, in microseconds. Steps that did
+//not run for a frame (no face found, for example) stay at zero.
+struct StageTimes
+{
+  double capture_us = 0;     //grabbing/decoding the frame
+  double detect_us = 0;      //finding the face
+  double landmarks_us = 0;   //shape predictor
+  double solve_pnp_us = 0;   //solvePnP and reprojection
+  double euler_us = 0;       //Euler angles and face position
+  double command_us = 0;     //pose filter and turning the pose into motion commands
+};
+
+inline double elapsedMicroseconds(pipeline_clock::time_point start)
+{
+  return std::chrono::duration<double, std::micro>(pipeline_clock::now() - start).count();
+}
+
+//Latency histogram with fixed, logarithmically spaced buckets: four per doubling from 1 us up
+//to about 1 s, with everything slower landing in the last bucket. Recording is a couple of
+//arithmetic operations and an increment, so it can stay on in the tracking loop.
+class LatencyHistogram
+{
+public:
+  static const int bucket_count = 81;
+
+  LatencyHistogram() { reset(); }
+
+  void reset()
+  {
+    std::fill(counts, counts + bucket_count, 0);
+    total = 0;
+    sum_us = 0;
+    max_us = 0;
+  }
+
+  void record(double us)
+  {
+    ++counts[bucketFor(us)];
+    ++total;
+    sum_us += us;
+    max_us = std::max(max_us, us);
+  }
+
+  //Upper edge of bucket i in microseconds.
+  static double bucketLimit(int i)
+  {
+    return std::pow(2.0, i / 4.0);
+  }
+
+  static int bucketFor(double us)
+  {
+    if (us <= 1)
+    {
+      return 0;
+    }
+    const int i = (int)std::ceil(4 * std::log2(us));
+    return std::min(i, bucket_count - 1);
+  }
+
+  uint64_t count() const { return total; }
+  uint64_t bucketCount(int i) const { return counts[i]; }
+  double mean() const { return total ? sum_us / total : 0; }
+  double max() const { return max_us; }
+
+  //Estimated p-th percentile (0-100), interpolated inside the bucket it falls in.
+  double percentile(double p) const
+  {
+    if (total == 0)
+    {
+      return 0;
+    }
+    const double rank = p / 100.0 * total;
+    uint64_t seen = 0;
+    for (int i = 0; i < bucket_count; ++i)
+    {
+      if (counts[i] == 0)
+      {
+        continue;
+      }
+      if (seen + counts[i] >= rank)
+      {
+        const double low = i == 0 ? 0 : bucketLimit(i - 1);
+        const double high = std::min(bucketLimit(i), max_us);
+        return low + (high - low) * (rank - seen) / counts[i];
+      }
+      seen += counts[i];
+    }
+    return max_us;
+  }
+
+private:
+  uint64_t counts[bucket_count];
+  uint64_t total;
+  double sum_us;
+  double max_us;
+};
@@ -0,0 +1,427 @@
+//Checks the binary protocol in arduino_extra/rasm_protocol.h: every frame type comes back
+//through RasmParser with the values it was encoded with, a frame with a bad CRC is thrown
+//away, the parser finds its way back after a byte is dropped or one is inserted, and gaps in
+//the sequence numbers are counted as lost frames. Prints each failed check and exits with 1
+//if there was one.
+//Usage: protocol-test
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "arduino_extra/rasm_protocol.h"
+
+int failures = 0;
+
+#define CHECK(condition) check((condition), #condition, __LINE__)
+
+void check(bool ok, const char* what, int line)
+{
+  if (!ok)
+  {
+    std::printf("protocol_test.cpp:%d: failed: %s\n", line, what);
+    ++failures;
+  }
+}
+
+//A decoded frame of whatever type the parser last returned.
+struct Parsed
+{
+  uint8_t type;
+  RasmMotionFrame motion;
+  RasmJointStateFrame joint_state;
+  RasmTrajectoryFrame trajectory;
+  RasmTrajectoryStatusFrame status;
+};
+
+std::vector<Parsed> parseAll(const std::vector<uint8_t>& stream, RasmParser& parser)
+{
+  std::vector<Parsed> frames;
+  for (uint8_t byte : stream)
+  {
+    if (!parser.feed(byte))
+    {
+      continue;
+    }
+    Parsed parsed;
+    std::memset(&parsed, 0, sizeof(parsed));
+    parsed.type = parser.type();
+    switch (parsed.type)
+    {
+      case RASM_FRAME_MOTION:
+        parser.decodeMotion(parsed.motion);
+        break;
+      case RASM_FRAME_JOINT_STATE:
+        parser.decodeJointState(parsed.joint_state);
+        break;
+      case RASM_FRAME_TRAJECTORY:
+        parser.decodeTrajectory(parsed.trajectory);
+        break;
+      case RASM_FRAME_TRAJECTORY_STATUS:
+        parser.decodeTrajectoryStatus(parsed.status);
+        break;
+    }
+    frames.push_back(parsed);
+  }
+  return frames;
+}
+
+void append(std::vector<uint8_t>& stream, const uint8_t* frame, uint8_t size)
+{
+  stream.insert(stream.end(), frame, frame + size);
+}
+
+RasmMotionFrame motionFrame(uint8_t sequence)
+{
+  RasmMotionFrame motion;
+  motion.sequence = sequence;
+  for (int axis = 0; axis < RASM_AXIS_COUNT; ++axis)
+  {
+    motion.setpoints[axis] = (int16_t)(sequence * 37 + axis * 1000 - 2500);
+  }
+  return motion;
+}
+
+void appendMotion(std::vector<uint8_t>& stream, uint8_t sequence)
+{
+  uint8_t frame[RASM_MOTION_FRAME_SIZE];
+  append(stream, frame, rasmEncodeMotion(motionFrame(sequence), frame));
+}
+
+bool sameMotion(const RasmMotionFrame& a, const RasmMotionFrame& b)
+{
+  return a.sequence == b.sequence && std::memcmp(a.setpoints, b.setpoints, sizeof(a.setpoints)) == 0;
+}
+
+void testMotionRoundTrip()
+{
+  RasmMotionFrame motion;
+  motion.sequence = 200;
+  const int16_t setpoints[RASM_AXIS_COUNT] = {INT16_MIN, -1, 0, 1, INT16_MAX};
+  std::memcpy(motion.setpoints, setpoints, sizeof(setpoints));
+  uint8_t frame[RASM_MOTION_FRAME_SIZE];
+  CHECK(rasmEncodeMotion(motion, frame) == RASM_MOTION_FRAME_SIZE);
+  std::vector<uint8_t> stream;
+  append(stream, frame, RASM_MOTION_FRAME_SIZE);
+  RasmParser parser;
+  const std::vector<Parsed> frames = parseAll(stream, parser);
+  CHECK(frames.size() == 1);
+  if (frames.size() == 1)
+  {
+    CHECK(frames[0].type == RASM_FRAME_MOTION);
+    CHECK(sameMotion(frames[0].motion, motion));
+  }
+}
+
+void testJointStateRoundTrip()
+{
+  RasmJointStateFrame state;
+  state.sequence = 7;
+  state.time_us = 0xFEDCBA98;
+  for (int joint = 0; joint < RASM_JOINT_COUNT; ++joint)
+  {
+    state.angles[joint] = rasmJointAngle(-170.5 + 85.5 * joint);
+  }
+  uint8_t frame[RASM_JOINT_STATE_FRAME_SIZE];
+  CHECK(rasmEncodeJointState(state, frame) == RASM_JOINT_STATE_FRAME_SIZE);
+  std::vector<uint8_t> stream;
+  append(stream, frame, RASM_JOINT_STATE_FRAME_SIZE);
+  RasmParser parser;
+  const std::vector<Parsed> frames = parseAll(stream, parser);
+  CHECK(frames.size() == 1);
+  if (frames.size() == 1)
+  {
+    const RasmJointStateFrame& got = frames[0].joint_state;
+    CHECK(frames[0].type == RASM_FRAME_JOINT_STATE);
+    CHECK(got.sequence == 7);
+    CHECK(got.time_us == 0xFEDCBA98);
+    for (int joint = 0; joint < RASM_JOINT_COUNT; ++joint)
+    {
+      CHECK(got.angles[joint] == state.angles[joint]);
+      CHECK(rasmJointDegrees(got.angles[joint]) == -170.5 + 85.5 * joint);
+    }
+  }
+}
+
+void testTrajectoryRoundTrip()
+{
+  RasmTrajectoryFrame trajectory;
+  std::memset(&trajectory, 0, sizeof(trajectory));
+  trajectory.sequence = 255;
+  trajectory.trajectory = 42;
+  trajectory.joints = (1 << RASM_JOINT_SHOULDER) | (1 << RASM_JOINT_ROLL);
+  trajectory.flags = RASM_TRAJECTORY_END;
+  trajectory.count = RASM_TRAJECTORY_BATCH - 1;   //a short last batch
+  trajectory.first = 65000;
+  for (int i = 0; i < RASM_TRAJECTORY_BATCH; ++i)
+  {
+    trajectory.points[i].duration_ms = (uint16_t)(i == 0 ? 0 : 1000 * i + 1);
+    for (int joint = 0; joint < RASM_JOINT_COUNT; ++joint)
+    {
+      trajectory.points[i].angles[joint] = (int16_t)(-3000 * i + 97 * joint);
+      trajectory.points[i].velocities[joint] = (int16_t)(250 * i - 13 * joint);
+    }
+  }
+  uint8_t frame[RASM_TRAJECTORY_FRAME_SIZE];
+  CHECK(rasmEncodeTrajectory(trajectory, frame) == RASM_TRAJECTORY_FRAME_SIZE);
+  std::vector<uint8_t> stream;
+  append(stream, frame, RASM_TRAJECTORY_FRAME_SIZE);
+  RasmParser parser;
+  const std::vector<Parsed> frames = parseAll(stream, parser);
+  CHECK(frames.size() == 1);
+  if (frames.size() == 1)
+  {
+    const RasmTrajectoryFrame& got = frames[0].trajectory;
+    CHECK(frames[0].type == RASM_FRAME_TRAJECTORY);
+    CHECK(got.sequence == 255);
+    CHECK(got.trajectory == 42);
+    CHECK(got.joints == trajectory.joints);
+    CHECK(got.flags == RASM_TRAJECTORY_END);
+    CHECK(got.count == RASM_TRAJECTORY_BATCH - 1);
+    CHECK(got.first == 65000);
+    for (int i = 0; i < got.count; ++i)
+    {
+      CHECK(got.points[i].duration_ms == trajectory.points[i].duration_ms);
+      for (int joint = 0; joint < RASM_JOINT_COUNT; ++joint)
+      {
+        CHECK(got.points[i].angles[joint] == trajectory.points[i].angles[joint]);
+        CHECK(got.points[i].velocities[joint] == trajectory.points[i].velocities[joint]);
+      }
+    }
+  }
+  //The waypoint past count goes out as zeros.
+  const uint8_t* unused = frame + RASM_HEADER_SIZE + 6 + (RASM_TRAJECTORY_BATCH - 1) * RASM_TRAJECTORY_POINT_SIZE;
+  bool zeros = true;
+  for (int i = 0; i < RASM_TRAJECTORY_POINT_SIZE; ++i)
+  {
+    zeros = zeros && unused[i] == 0;
+  }
+  CHECK(zeros);
+}
+
+void testTrajectoryStatusRoundTrip()
+{
+  RasmTrajectoryStatusFrame status;
+  status.sequence = 3;
+  status.trajectory = 42;
+  status.state = RASM_TRAJECTORY_STARVED;
+  status.free = RASM_TRAJECTORY_BUFFER;
+  status.rejected = 250;
+  status.received = 65535;
+  status.segment = 1234;
+  status.time_ms = 4000000000u;
+  uint8_t frame[RASM_TRAJECTORY_STATUS_FRAME_SIZE];
+  CHECK(rasmEncodeTrajectoryStatus(status, frame) == RASM_TRAJECTORY_STATUS_FRAME_SIZE);
+  std::vector<uint8_t> stream;
+  append(stream, frame, RASM_TRAJECTORY_STATUS_FRAME_SIZE);
+  RasmParser parser;
+  const std::vector<Parsed> frames = parseAll(stream, parser);
+  CHECK(frames.size() == 1);
+  if (frames.size() == 1)
+  {
+    const RasmTrajectoryStatusFrame& got = frames[0].status;
+    CHECK(frames[0].type == RASM_FRAME_TRAJECTORY_STATUS);
+    CHECK(got.sequence == 3);
+    CHECK(got.trajectory == 42);
+    CHECK(got.state == RASM_TRAJECTORY_STARVED);
+    CHECK(got.free == RASM_TRAJECTORY_BUFFER);
+    CHECK(got.rejected == 250);
+    CHECK(got.received == 65535);
+    CHECK(got.segment == 1234);
+    CHECK(got.time_ms == 4000000000u);
+  }
+}
+
+void testJointAngleScaling()
+{
+  CHECK(rasmJointAngle(0) == 0);
+  CHECK(rasmJointAngle(1.01) == 51);
+  CHECK(rasmJointAngle(-1.01) == -51);
+  CHECK(rasmJointAngle(1000) == INT16_MAX);
+  CHECK(rasmJointAngle(-1000) == INT16_MIN);
+}
+
+//Frames of every type one after the other, as the two ends of the link mix them.
+void testMixedStream()
+{
+  std::vector<uint8_t> stream;
+  appendMotion(stream, 0);
+  RasmJointStateFrame state;
+  std::memset(&state, 0, sizeof(state));
+  state.sequence = 1;
+  uint8_t frame[RASM_TRAJECTORY_FRAME_SIZE];
+  append(stream, frame, rasmEncodeJointState(state, frame));
+  RasmTrajectoryStatusFrame status;
+  std::memset(&status, 0, sizeof(status));
+  status.sequence = 2;
+  append(stream, frame, rasmEncodeTrajectoryStatus(status, frame));
+  RasmTrajectoryFrame trajectory;
+  std::memset(&trajectory, 0, sizeof(trajectory));
+  trajectory.sequence = 3;
+  append(stream, frame, rasmEncodeTrajectory(trajectory, frame));
+  RasmParser parser;
+  const std::vector<Parsed> frames = parseAll(stream, parser);
+  CHECK(frames.size() == 4);
+  if (frames.size() == 4)
+  {
+    CHECK(frames[0].type == RASM_FRAME_MOTION);
+    CHECK(frames[1].type == RASM_FRAME_JOINT_STATE);
+    CHECK(frames[2].type == RASM_FRAME_TRAJECTORY_STATUS);
+    CHECK(frames[3].type == RASM_FRAME_TRAJECTORY);
+  }
+  CHECK(parser.goodFrames() == 4);
+  CHECK(parser.badFrames() == 0);
+  CHECK(parser.lostFrames() == 0);
+}
+
+//Every single-bit error anywhere after the sync byte, payload and CRC alike, is caught.
+void testBadCrcRejected()
+{
+  std::vector<uint8_t> good;
+  appendMotion(good, 9);
+  for (std::size_t byte = 1; byte < good.size(); ++byte)
+  {
+    for (int bit = 0; bit < 8; ++bit)
+    {
+      std::vector<uint8_t> stream = good;
+      stream[byte] ^= (uint8_t)(1 << bit);
+      RasmParser parser;
+      const std::vector<Parsed> frames = parseAll(stream, parser);
+      CHECK(frames.empty());
+      CHECK(parser.goodFrames() == 0);
+      //A damaged type byte can read as another type, whose frame is still waiting for bytes.
+      CHECK(parser.badFrames() == 1 || byte == 1);
+    }
+  }
+  //A corrupted frame between two good ones costs only itself.
+  std::vector<uint8_t> stream;
+  appendMotion(stream, 0);
+  appendMotion(stream, 1);
+  appendMotion(stream, 2);
+  stream[RASM_MOTION_FRAME_SIZE + RASM_HEADER_SIZE + 4] ^= 0x10;
+  RasmParser parser;
+  const std::vector<Parsed> frames = parseAll(stream, parser);
+  CHECK(frames.size() == 2);
+  if (frames.size() == 2)
+  {
+    CHECK(sameMotion(frames[0].motion, motionFrame(0)));
+    CHECK(sameMotion(frames[1].motion, motionFrame(2)));
+  }
+  CHECK(parser.badFrames() >= 1);   //more if a CRC byte of the damaged frame looks like a sync byte
+  CHECK(parser.lostFrames() == 1);
+}
+
+//Takes out or puts in one byte at every position of the second of a run of motion frames.
+//Whatever comes out has to be one of the frames that went in, unchanged, every frame before
+//the damage comes through, and the parser is back in step within a trajectory frame's worth
+//of bytes: a damaged header can read as the start of the longest frame type, which then
+//swallows what follows it, and a lost byte makes the damaged frame swallow the next one's
+//sync byte.
+void testResync()
+{
+  const int count = 16;
+  std::vector<uint8_t> clean;
+  for (int i = 0; i < count; ++i)
+  {
+    appendMotion(clean, (uint8_t)i);
+  }
+  for (int inserted = 0; inserted < 2; ++inserted)
+  {
+    for (int offset = 0; offset < RASM_MOTION_FRAME_SIZE; ++offset)
+    {
+      for (int value = 0; value < 256; value += inserted ? 1 : 256)
+      {
+        std::vector<uint8_t> stream = clean;
+        const int at = RASM_MOTION_FRAME_SIZE + offset;
+        if (inserted)
+        {
+          stream.insert(stream.begin() + at, (uint8_t)value);
+        }
+        else
+        {
+          stream.erase(stream.begin() + at);
+        }
+        RasmParser parser;
+        const std::vector<Parsed> frames = parseAll(stream, parser);
+        bool intact = true;
+        std::vector<bool> seen(count, false);
+        for (const Parsed& f : frames)
+        {
+          const int sequence = f.motion.sequence;
+          intact = intact && f.type == RASM_FRAME_MOTION && sequence < count && !seen[sequence] &&
+                   sameMotion(f.motion, motionFrame((uint8_t)sequence));
+          if (sequence < count)
+          {
+            seen[sequence] = true;
+          }
+        }
+        bool resynced = seen[0];
+        for (int i = 2; i < count; ++i)
+        {
+          if (i * RASM_MOTION_FRAME_SIZE >= at + RASM_TRAJECTORY_FRAME_SIZE)
+          {
+            resynced = resynced && seen[i];
+          }
+        }
+        if (!intact || !resynced)
+        {
+          std::printf("  %s byte %d (0x%02x) of frame 1\n", inserted ? "inserted" : "dropped", offset, value);
+        }
+        CHECK(intact);
+        CHECK(resynced);
+      }
+    }
+  }
+}
+
+void testSequenceGaps()
+{
+  //0, 1, 2, then 5 (3 and 4 lost), then 6.
+  std::vector<uint8_t> stream;
+  const uint8_t sequences[] = {0, 1, 2, 5, 6};
+  for (uint8_t s : sequences)
+  {
+    appendMotion(stream, s);
+  }
+  RasmParser parser;
+  CHECK(parseAll(stream, parser).size() == 5);
+  CHECK(parser.lostFrames() == 2);
+
+  //Wrapping from 255 to 0 is not a gap; a gap across the wrap counts what was skipped.
+  std::vector<uint8_t> wrapped;
+  const uint8_t wrapping[] = {254, 255, 0, 1, 3};
+  for (uint8_t s : wrapping)
+  {
+    appendMotion(wrapped, s);
+  }
+  RasmParser wrap_parser;
+  CHECK(parseAll(wrapped, wrap_parser).size() == 5);
+  CHECK(wrap_parser.lostFrames() == 1);
+
+  //The first frame the parser sees sets where it counts from.
+  std::vector<uint8_t> late;
+  appendMotion(late, 100);
+  appendMotion(late, 101);
+  RasmParser late_parser;
+  CHECK(parseAll(late, late_parser).size() == 2);
+  CHECK(late_parser.lostFrames() == 0);
+}
+
+int main()
+{
+  testMotionRoundTrip();
+  testJointStateRoundTrip();
+  testTrajectoryRoundTrip();
+  testTrajectoryStatusRoundTrip();
+  testJointAngleScaling();
+  testMixedStream();
+  testBadCrcRejected();
+  testResync();
+  testSequenceGaps();
+  if (failures > 0)
+  {
+    std::printf("%d checks failed\n", failures);
+    return EXIT_FAILURE;
+  }
+  std::printf("all protocol checks passed\n");
+  return EXIT_SUCCESS;
+}
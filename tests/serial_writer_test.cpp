@@ -0,0 +1,106 @@
+//Checks that SerialWriter (serial_writer.h) always ends up sending the newest command, even
+//when it was submitted while an earlier frame was only partly written. A pseudo-terminal that
+//nobody reads stands in for a busy Arduino, so frames go out a piece at a time. Exits with 1
+//if the last command never arrives.
+//Usage: serial-writer-test
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <pty.h>
+#include <unistd.h>
+#include <vector>
+#include "serial_writer.h"
+
+int failures = 0;
+
+//One round on a fresh pseudo-terminal. Whether the writer is caught mid-frame depends on where
+//the pty's buffer happens to fill up, so main() runs a few rounds.
+void checkLastCommandArrives(int round)
+{
+  int master, slave;
+  char slave_name[64];
+  if (openpty(&master, &slave, slave_name, NULL, NULL) != 0)
+  {
+    std::perror("openpty");
+    ++failures;
+    return;
+  }
+  SerialWriter writer;
+  if (!writer.open(slave_name))
+  {
+    ++failures;
+    ::close(master);
+    ::close(slave);
+    return;
+  }
+
+  //Fill the pty's buffer so the writer is left in the middle of a frame, then submit the
+  //command that has to come out last. Nothing is submitted after it.
+  const int16_t last_roll = 31337;
+  MotionCommand command;
+  for (int i = 0; i < 20000 + round * 7; ++i)
+  {
+    command.roll = i % 30000;
+    writer.submit(command);
+  }
+  usleep(200000);
+  command.roll = last_roll;
+  writer.submit(command);
+  usleep(50000);
+
+  std::vector<uint8_t> received;
+  uint8_t buffer[4096];
+  fcntl(master, F_SETFL, O_NONBLOCK);
+  for (int idle = 0; idle < 50;)
+  {
+    const ssize_t count = read(master, buffer, sizeof(buffer));
+    if (count > 0)
+    {
+      received.insert(received.end(), buffer, buffer + count);
+      idle = 0;
+    }
+    else
+    {
+      ++idle;
+      usleep(2000);
+    }
+  }
+  writer.close();
+  ::close(master);
+  ::close(slave);
+
+  RasmParser parser;
+  RasmMotionFrame motion;
+  unsigned long frames = 0;
+  int roll = -1;
+  for (uint8_t byte : received)
+  {
+    if (parser.feed(byte) && parser.type() == RASM_FRAME_MOTION)
+    {
+      parser.decodeMotion(motion);
+      roll = motion.setpoints[RASM_AXIS_ROLL];
+      ++frames;
+    }
+  }
+  if (roll != last_roll)
+  {
+    std::printf("serial_writer_test.cpp: round %d: the last command never arrived (%lu frames, last roll %d)\n",
+                round, frames, roll);
+    ++failures;
+  }
+}
+
+int main()
+{
+  for (int round = 0; round < 8; ++round)
+  {
+    checkLastCommandArrives(round);
+  }
+  if (failures != 0)
+  {
+    std::printf("%d serial writer checks failed\n", failures);
+    return EXIT_FAILURE;
+  }
+  std::printf("all serial writer checks passed\n");
+  return EXIT_SUCCESS;
+}
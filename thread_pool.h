@@ -0,0 +1,104 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//A fixed set of worker threads, started once and kept, that run the tasks handed to them.
+//Whoever calls wait() works through the queue as well instead of sleeping, so a pool of N
+//threads is N - 1 workers plus the caller. Tasks may submit more tasks; wait() returns once
+//every task submitted since the last wait() has finished. One thread at a time may wait().
+class ThreadPool
+{
+public:
+  explicit ThreadPool(int threads) : pending(0), stopping(false)
+  {
+    for (int i = 1; i < threads; ++i)
+    {
+      workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+  }
+
+  ~ThreadPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    work.notify_all();
+    for (std::thread& worker : workers)
+    {
+      worker.join();
+    }
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  //Threads that run tasks, counting the one that waits.
+  int size() const { return (int)workers.size() + 1; }
+
+  void submit(std::function<void()> task)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      tasks.push_back(std::move(task));
+      ++pending;
+    }
+    work.notify_one();
+  }
+
+  void wait()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (pending > 0)
+    {
+      if (tasks.empty())
+      {
+        done.wait(lock);
+        continue;
+      }
+      runOne(lock);
+    }
+  }
+
+private:
+  //Runs the task at the front of the queue with the lock let go; lock is held again after.
+  void runOne(std::unique_lock<std::mutex>& lock)
+  {
+    std::function<void()> task = std::move(tasks.front());
+    tasks.pop_front();
+    lock.unlock();
+    task();
+    lock.lock();
+    if (--pending == 0)
+    {
+      done.notify_all();
+    }
+  }
+
+  void workerLoop()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+      work.wait(lock, [this]() { return stopping || !tasks.empty(); });
+      if (tasks.empty())
+      {
+        return;
+      }
+      runOne(lock);
+    }
+  }
+
+  std::vector<std::thread> workers;
+  std::deque<std::function<void()> > tasks;
+  int pending;   //submitted and not finished yet
+  bool stopping;
+  std::mutex mutex;
+  std::condition_variable work;
+  std::condition_variable done;
+};
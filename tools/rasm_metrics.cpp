@@ -0,0 +1,252 @@
+//Prints live rates from the Prometheus text files main-code (--metrics) and rasm_motion
+//(~metrics_file) keep writing (metrics.h), without needing a Prometheus server: it reads each
+//file every period and shows what changed in between.
+//
+//Usage:
+//  rasm-metrics [--period=S] [--once] [FILE...]
+//      FILE defaults to /tmp/rasm-main-code.prom and /tmp/rasm_motion.prom, whichever exist.
+//      For each counter the rate per second over the last period, for each gauge its value,
+//      and for each latency histogram how many samples a second and their mean, p50 and p99
+//      over the last period. --once prints the totals since the program started instead.
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+struct Histogram
+{
+  std::vector<std::pair<double, double> > buckets;   //upper edge in seconds, cumulative count
+  double count = 0;
+  double sum = 0;
+};
+
+//One reading of a metrics file.
+struct Snapshot
+{
+  std::map<std::string, std::string> types;   //metric name -> counter, gauge or histogram
+  std::map<std::string, double> values;       //counters and gauges
+  std::map<std::string, Histogram> histograms;
+  std::chrono::steady_clock::time_point time;
+};
+
+bool endsWith(const std::string& text, const char* suffix)
+{
+  const std::size_t length = std::strlen(suffix);
+  return text.size() >= length && text.compare(text.size() - length, length, suffix) == 0;
+}
+
+//Reads the subset of the text format metrics.h writes: no labels but le, no timestamps.
+bool readMetrics(const std::string& path, Snapshot& snapshot)
+{
+  std::ifstream in(path.c_str());
+  if (!in)
+  {
+    return false;
+  }
+  snapshot = Snapshot();
+  snapshot.time = std::chrono::steady_clock::now();
+  std::string line;
+  while (std::getline(in, line))
+  {
+    std::istringstream fields(line);
+    std::string name;
+    if (line.compare(0, 7, "# TYPE ") == 0)
+    {
+      std::string type;
+      fields.ignore(7);
+      fields >> name >> type;
+      snapshot.types[name] = type;
+      continue;
+    }
+    if (line.empty() || line[0] == '#')
+    {
+      continue;
+    }
+    double value;
+    if (!(fields >> name >> value))
+    {
+      continue;
+    }
+    const std::size_t brace = name.find("_bucket{le=\"");
+    if (brace != std::string::npos)
+    {
+      const std::string edge = name.substr(brace + 12, name.find('"', brace + 12) - brace - 12);
+      snapshot.histograms[name.substr(0, brace)].buckets.push_back(
+          std::make_pair(edge == "+Inf" ? HUGE_VAL : std::atof(edge.c_str()), value));
+    }
+    else if (endsWith(name, "_count") && snapshot.types.count(name.substr(0, name.size() - 6)))
+    {
+      snapshot.histograms[name.substr(0, name.size() - 6)].count = value;
+    }
+    else if (endsWith(name, "_sum") && snapshot.types.count(name.substr(0, name.size() - 4)))
+    {
+      snapshot.histograms[name.substr(0, name.size() - 4)].sum = value;
+    }
+    else
+    {
+      snapshot.values[name] = value;
+    }
+  }
+  return true;
+}
+
+//The p-th percentile (0-100) of the samples between two readings, in seconds, interpolated
+//inside the bucket it falls in; the +Inf bucket reports its lower edge.
+double percentile(const Histogram& now, const Histogram* before, double p)
+{
+  const double total = now.count - (before ? before->count : 0);
+  if (total <= 0)
+  {
+    return 0;
+  }
+  const double rank = p / 100 * total;
+  double low_edge = 0, low_count = 0;
+  for (std::size_t i = 0; i < now.buckets.size(); ++i)
+  {
+    const double count = now.buckets[i].second - (before && i < before->buckets.size() ? before->buckets[i].second : 0);
+    const double edge = now.buckets[i].first;
+    if (count >= rank)
+    {
+      if (edge == HUGE_VAL || count == low_count)
+      {
+        return low_edge;
+      }
+      return low_edge + (edge - low_edge) * (rank - low_count) / (count - low_count);
+    }
+    low_edge = edge;
+    low_count = count;
+  }
+  return low_edge;
+}
+
+//Prints one file; before is the previous reading, or null for totals.
+void printMetrics(const std::string& path, const Snapshot& now, const Snapshot* before)
+{
+  const double seconds = before ? std::chrono::duration<double>(now.time - before->time).count() : 0;
+  std::printf("%s%s\n", path.c_str(), before ? "" : " (totals)");
+  for (const auto& value : now.values)
+  {
+    const auto type = now.types.find(value.first);
+    if (type != now.types.end() && type->second == "counter")
+    {
+      if (before)
+      {
+        const auto previous = before->values.find(value.first);
+        double delta = value.second - (previous == before->values.end() ? 0 : previous->second);
+        if (delta < 0)
+        {
+          delta = value.second;   //the program was started again
+        }
+        std::printf("  %-40s %12.1f /s\n", value.first.c_str(), seconds > 0 ? delta / seconds : 0);
+      }
+      else
+      {
+        std::printf("  %-40s %12.0f\n", value.first.c_str(), value.second);
+      }
+    }
+    else
+    {
+      std::printf("  %-40s %12g\n", value.first.c_str(), value.second);
+    }
+  }
+  for (const auto& histogram : now.histograms)
+  {
+    const Histogram* previous = nullptr;
+    if (before)
+    {
+      const auto found = before->histograms.find(histogram.first);
+      previous = found == before->histograms.end() ? nullptr : &found->second;
+    }
+    const Histogram& h = histogram.second;
+    const double count = h.count - (previous ? previous->count : 0);
+    const double sum = h.sum - (previous ? previous->sum : 0);
+    if (before)
+    {
+      std::printf("  %-40s %12.1f /s", histogram.first.c_str(), seconds > 0 ? count / seconds : 0);
+    }
+    else
+    {
+      std::printf("  %-40s %12.0f   ", histogram.first.c_str(), count);
+    }
+    std::printf("  mean %9.1f us  p50 %9.1f us  p99 %9.1f us\n", count > 0 ? sum / count * 1e6 : 0,
+                percentile(h, previous, 50) * 1e6, percentile(h, previous, 99) * 1e6);
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  double period = 1;
+  bool once = false;
+  std::vector<std::string> paths;
+  for (int i = 1; i < argc; ++i)
+  {
+    if (std::strncmp(argv[i], "--period=", 9) == 0 && std::atof(argv[i] + 9) > 0)
+    {
+      period = std::atof(argv[i] + 9);
+    }
+    else if (std::strcmp(argv[i], "--once") == 0)
+    {
+      once = true;
+    }
+    else if (argv[i][0] == '-')
+    {
+      std::printf("usage: %s [--period=S] [--once] [FILE...]\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+    else
+    {
+      paths.push_back(argv[i]);
+    }
+  }
+  if (paths.empty())
+  {
+    for (const char* path : {"/tmp/rasm-main-code.prom", "/tmp/rasm_motion.prom"})
+    {
+      if (access(path, R_OK) == 0)
+      {
+        paths.push_back(path);
+      }
+    }
+  }
+  if (paths.empty())
+  {
+    std::printf("No metrics files; is main-code or rasm_motion running?\n");
+    return EXIT_FAILURE;
+  }
+
+  std::vector<Snapshot> previous(paths.size());
+  std::vector<bool> have_previous(paths.size(), false);
+  for (;;)
+  {
+    for (std::size_t f = 0; f < paths.size(); ++f)
+    {
+      Snapshot now;
+      if (!readMetrics(paths[f], now))
+      {
+        std::printf("%s: unable to read\n", paths[f].c_str());
+        have_previous[f] = false;
+        continue;
+      }
+      if (once || have_previous[f])
+      {
+        printMetrics(paths[f], now, once ? nullptr : &previous[f]);
+      }
+      previous[f] = now;
+      have_previous[f] = true;
+    }
+    if (once)
+    {
+      return EXIT_SUCCESS;
+    }
+    std::fflush(stdout);
+    std::this_thread::sleep_for(std::chrono::duration<double>(period));
+  }
+}
@@ -0,0 +1,196 @@
+//Trains a landmark model that only predicts the 14 iBUG landmarks the head pose is solved
+//from (head_pose_landmarks in head_pose_solver.h), and converts dlib shape predictors to the
+//memory-mappable .rsp format (landmark_model.h).
+//
+//Usage:
+//  train-landmark-model TRAINING_XML OUTPUT [--test=TESTING_XML] [--cascade-depth=N]
+//                       [--tree-depth=N] [--trees=N] [--feature-pool=N] [--oversampling=N]
+//                       [--nu=X] [--threads=N]
+//      Trains on a dlib imglab dataset with all 68 iBUG landmarks, for example
+//      labels_ibug_300W_train.xml from http://dlib.net/files/data/ibug_300W_large_face_landmark_dataset.tar.gz,
+//      and writes OUTPUT.dat (dlib's format) and OUTPUT.rsp.
+//  train-landmark-model --convert=MODEL.dat OUTPUT.rsp [--cascades=N]
+//      Converts any dlib shape predictor, e.g. data/face_model_68_points.dat, keeping only the
+//      first N cascades if --cascades is given.
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <dlib/data_io.h>
+#include <dlib/image_processing.h>
+#include "head_pose_solver.h"
+#include "landmark_model.h"
+#include "options.h"
+
+//Mean landmark error relative to the distance between the outer eye corners (iBUG 36 and
+//45, parts 4 and 7 of the reduced model), the usual way to compare landmark models.
+double meanNormalizedError(const dlib::shape_predictor& sp, const dlib::array<dlib::array2d<unsigned char> >& images,
+                           const std::vector<std::vector<dlib::full_object_detection> >& faces)
+{
+  double total = 0;
+  unsigned long count = 0;
+  for (unsigned long i = 0; i < images.size(); ++i)
+  {
+    for (const dlib::full_object_detection& truth : faces[i])
+    {
+      const double interocular = dlib::length(truth.part(4) - truth.part(7));
+      if (interocular == 0)
+      {
+        continue;
+      }
+      const dlib::full_object_detection shape = sp(images[i], truth.get_rect());
+      for (unsigned long p = 0; p < shape.num_parts(); ++p)
+      {
+        total += dlib::length(shape.part(p) - truth.part(p)) / interocular;
+        ++count;
+      }
+    }
+  }
+  return count ? total / count : 0;
+}
+
+//Keeps only the head pose landmarks of every face, in head_pose_landmarks order.
+bool loadReduced(const std::string& xml, dlib::array<dlib::array2d<unsigned char> >& images,
+                 std::vector<std::vector<dlib::full_object_detection> >& faces)
+{
+  std::vector<std::vector<dlib::full_object_detection> > full;
+  dlib::load_image_dataset(images, full, xml);
+  faces.resize(full.size());
+  for (unsigned long i = 0; i < full.size(); ++i)
+  {
+    for (const dlib::full_object_detection& face : full[i])
+    {
+      if (face.num_parts() != ibug_landmark_count)
+      {
+        std::cout << xml << " does not have all 68 iBUG landmarks on every face" << std::endl;
+        return false;
+      }
+      std::vector<dlib::point> parts;
+      for (int p = 0; p < head_pose_point_count; ++p)
+      {
+        parts.push_back(face.part(head_pose_landmarks[p]));
+      }
+      faces[i].push_back(dlib::full_object_detection(face.get_rect(), parts));
+    }
+  }
+  return true;
+}
+
+int main(int argc, char* argv[])
+{
+  std::vector<std::string> positional;
+  std::string convert_path;
+  std::string test_xml;
+  unsigned long cascades = 0;
+  dlib::shape_predictor_trainer trainer;
+  //dlib's defaults, except for a shallower cascade: most of the accuracy comes from the first
+  //cascades, and every cascade costs a feature pixel pass.
+  trainer.set_cascade_depth(10);
+  trainer.set_num_threads(2);
+  for (int i = 1; i < argc; ++i)
+  {
+    const char* value;
+    if ((value = optionValue(argv[i], "--convert")))
+    {
+      convert_path = value;
+    }
+    else if ((value = optionValue(argv[i], "--cascades")))
+    {
+      cascades = std::strtoul(value, NULL, 10);
+    }
+    else if ((value = optionValue(argv[i], "--test")))
+    {
+      test_xml = value;
+    }
+    else if ((value = optionValue(argv[i], "--cascade-depth")))
+    {
+      trainer.set_cascade_depth(std::strtoul(value, NULL, 10));
+    }
+    else if ((value = optionValue(argv[i], "--tree-depth")))
+    {
+      trainer.set_tree_depth(std::strtoul(value, NULL, 10));
+    }
+    else if ((value = optionValue(argv[i], "--trees")))
+    {
+      trainer.set_num_trees_per_cascade_level(std::strtoul(value, NULL, 10));
+    }
+    else if ((value = optionValue(argv[i], "--feature-pool")))
+    {
+      trainer.set_feature_pool_size(std::strtoul(value, NULL, 10));
+    }
+    else if ((value = optionValue(argv[i], "--oversampling")))
+    {
+      trainer.set_oversampling_amount(std::strtoul(value, NULL, 10));
+    }
+    else if ((value = optionValue(argv[i], "--nu")))
+    {
+      trainer.set_nu(std::atof(value));
+    }
+    else if ((value = optionValue(argv[i], "--threads")))
+    {
+      trainer.set_num_threads(std::strtoul(value, NULL, 10));
+    }
+    else if (argv[i][0] == '-')
+    {
+      std::cout << "Unknown option " << argv[i] << std::endl;
+      return EXIT_FAILURE;
+    }
+    else
+    {
+      positional.push_back(argv[i]);
+    }
+  }
+
+  if (!convert_path.empty())
+  {
+    if (positional.size() != 1)
+    {
+      std::cout << "usage: " << argv[0] << " --convert=MODEL.dat OUTPUT.rsp [--cascades=N]" << std::endl;
+      return EXIT_FAILURE;
+    }
+    dlib::shape_predictor sp;
+    dlib::deserialize(convert_path) >> sp;
+    std::vector<uint32_t> part_ids;
+    if (sp.num_parts() == (unsigned long)head_pose_point_count)
+    {
+      part_ids.assign(head_pose_landmarks, head_pose_landmarks + head_pose_point_count);
+    }
+    else if (sp.num_parts() != ibug_landmark_count)
+    {
+      std::cout << convert_path << " has " << sp.num_parts() << " parts; only 68-point and "
+                << head_pose_point_count << "-point iBUG models can be converted" << std::endl;
+      return EXIT_FAILURE;
+    }
+    return writeFlatLandmarkModel(sp, part_ids, positional[0], cascades) ? 0 : EXIT_FAILURE;
+  }
+
+  if (positional.size() != 2)
+  {
+    std::cout << "usage: " << argv[0] << " TRAINING_XML OUTPUT [training options]" << std::endl;
+    std::cout << "       " << argv[0] << " --convert=MODEL.dat OUTPUT.rsp [--cascades=N]" << std::endl;
+    return EXIT_FAILURE;
+  }
+  dlib::array<dlib::array2d<unsigned char> > images;
+  std::vector<std::vector<dlib::full_object_detection> > faces;
+  if (!loadReduced(positional[0], images, faces))
+  {
+    return EXIT_FAILURE;
+  }
+  trainer.be_verbose();
+  const dlib::shape_predictor sp = trainer.train(images, faces);
+  std::cout << "mean training error (fraction of eye distance): " << meanNormalizedError(sp, images, faces) << std::endl;
+  if (!test_xml.empty())
+  {
+    dlib::array<dlib::array2d<unsigned char> > test_images;
+    std::vector<std::vector<dlib::full_object_detection> > test_faces;
+    if (loadReduced(test_xml, test_images, test_faces))
+    {
+      std::cout << "mean testing error (fraction of eye distance): "
+                << meanNormalizedError(sp, test_images, test_faces) << std::endl;
+    }
+  }
+
+  dlib::serialize(positional[1] + ".dat") << sp;
+  const std::vector<uint32_t> part_ids(head_pose_landmarks, head_pose_landmarks + head_pose_point_count);
+  return writeFlatLandmarkModel(sp, part_ids, positional[1] + ".rsp") ? 0 : EXIT_FAILURE;
+}
@@ -0,0 +1,507 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <mutex>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <termios.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "arduino_extra/rasm_protocol.h"
+#include "serial_port.h"
+
+//One waypoint of a planned trajectory, in the firmware's joint angles (joint_angles.h).
+struct TrajectoryWaypoint
+{
+  double time = 0;                           //seconds from the start of the trajectory
+  double position[RASM_JOINT_COUNT] = {};    //degrees, RASM_JOINT_* order
+  double velocity[RASM_JOINT_COUNT] = {};    //degrees per second
+};
+
+//Gives every waypoint but the first and last the average of the slopes on either side of it,
+//for trajectories that come without velocities. The ends stay at rest.
+inline void fillTrajectoryVelocities(std::vector<TrajectoryWaypoint>& points)
+{
+  for (std::size_t i = 0; i < points.size(); ++i)
+  {
+    for (int joint = 0; joint < RASM_JOINT_COUNT; ++joint)
+    {
+      double velocity = 0;
+      if (i > 0 && i + 1 < points.size())
+      {
+        const double before = points[i].time - points[i - 1].time;
+        const double after = points[i + 1].time - points[i].time;
+        if (before > 0 && after > 0)
+        {
+          velocity = ((points[i].position[joint] - points[i - 1].position[joint]) / before +
+                      (points[i + 1].position[joint] - points[i].position[joint]) / after) / 2;
+        }
+      }
+      points[i].velocity[joint] = velocity;
+    }
+  }
+}
+
+//Where joint is at time t (seconds) along the trajectory, interpolated the way the firmware
+//does it (trajectory_player.h): the cubic through the two waypoints around t and their
+//velocities. Before the start and after the end, the first and last waypoint.
+inline void sampleTrajectory(const std::vector<TrajectoryWaypoint>& points, double t, int joint, double& position,
+                             double& velocity)
+{
+  velocity = 0;
+  if (points.empty())
+  {
+    position = 0;
+    return;
+  }
+  if (t <= points.front().time)
+  {
+    position = points.front().position[joint];
+    return;
+  }
+  if (t >= points.back().time)
+  {
+    position = points.back().position[joint];
+    return;
+  }
+  std::size_t i = 1;
+  while (points[i].time <= t)
+  {
+    ++i;
+  }
+  const TrajectoryWaypoint& from = points[i - 1];
+  const TrajectoryWaypoint& to = points[i];
+  const double duration = to.time - from.time;
+  const double s = (t - from.time) / duration;
+  const double s2 = s * s;
+  const double s3 = s2 * s;
+  const double p0 = from.position[joint], v0 = from.velocity[joint];
+  const double p1 = to.position[joint], v1 = to.velocity[joint];
+  position = (2 * s3 - 3 * s2 + 1) * p0 + (s3 - 2 * s2 + s) * duration * v0 + (3 * s2 - 2 * s3) * p1 +
+             (s3 - s2) * duration * v1;
+  velocity = (6 * s2 - 6 * s) / duration * p0 + (3 * s2 - 4 * s + 1) * v0 + (6 * s - 6 * s2) / duration * p1 +
+             (3 * s2 - 2 * s) * v1;
+}
+
+//Decides which trajectory frames go to arduino_main and when, from the status frames it sends
+//back. Knows nothing about the port, so the firmware simulator can drive it too.
+//
+//The firmware buffers RASM_TRAJECTORY_BUFFER waypoints; each status says how many more it can
+//take. Frames only go out full (RASM_TRAJECTORY_BATCH waypoints) unless what is left of the
+//trajectory is less, so a trajectory costs about one frame per RASM_TRAJECTORY_BATCH
+//waypoints, however long it runs. A frame that gets lost shows up as the firmware rejecting
+//the ones after it, or, if nothing comes back at all, as resend_timeout_us passing without a
+//status; either way sending starts again from the firmware's last count.
+class TrajectoryBatcher
+{
+public:
+  double resend_timeout_us = 250000;
+  static const int max_stop_attempts = 4;
+
+  explicit TrajectoryBatcher(uint8_t first_id = 1)
+    : id(first_id - 1), joints(0), running(false), stopping(false), stop_sent_us(-1), stop_attempts(0),
+      next_point(0), limit(0), acknowledged(0), rejected(0), quiet_until_us(0), waiting_since_us(0), sequence(0),
+      frames_sent(0), resends(0), have_status(false) {}
+
+  //Starts on a new trajectory; whatever was left of the last one is dropped as soon as the
+  //firmware gets the first frame of this one. joints has a bit (1 << RASM_JOINT_*) for each
+  //joint it moves. Returns false (and sends nothing) for an empty trajectory or one with more
+  //waypoints than a frame can number.
+  bool start(const std::vector<TrajectoryWaypoint>& trajectory, uint8_t joint_mask, double now_us)
+  {
+    if (trajectory.empty() || trajectory.size() > UINT16_MAX)
+    {
+      return false;
+    }
+    points.clear();
+    long previous_ms = 0;
+    for (std::size_t i = 0; i < trajectory.size(); ++i)
+    {
+      //Round the times, not the durations, so the rounding never adds up.
+      const long time_ms = std::lround(trajectory[i].time * 1000);
+      RasmTrajectoryPoint point;
+      const long duration = i == 0 ? 0 : time_ms - previous_ms;
+      point.duration_ms = (uint16_t)(duration < 0 ? 0 : duration > UINT16_MAX ? UINT16_MAX : duration);
+      previous_ms = time_ms;
+      for (int joint = 0; joint < RASM_JOINT_COUNT; ++joint)
+      {
+        point.angles[joint] = rasmJointAngle(trajectory[i].position[joint]);
+        point.velocities[joint] = rasmJointAngle(trajectory[i].velocity[joint]);
+      }
+      points.push_back(point);
+    }
+    ++id;
+    joints = joint_mask;
+    running = true;
+    stopping = false;
+    next_point = 0;
+    limit = RASM_TRAJECTORY_BUFFER;
+    acknowledged = 0;
+    quiet_until_us = 0;
+    waiting_since_us = now_us;
+    have_status = false;
+    return true;
+  }
+
+  //Tells the firmware to drop the trajectory and hold where it got to.
+  void stop()
+  {
+    if (!running)
+    {
+      return;
+    }
+    running = false;
+    stopping = true;
+    stop_sent_us = -1;
+    stop_attempts = 0;
+  }
+
+  //The next frame to send at now_us, if there is one due.
+  bool next(double now_us, RasmTrajectoryFrame& frame)
+  {
+    if (stopping)
+    {
+      if (stop_sent_us >= 0 && now_us - stop_sent_us < resend_timeout_us)
+      {
+        return false;
+      }
+      if (stop_attempts == max_stop_attempts)
+      {
+        //The firmware never had this trajectory (it answers about another one), or is gone.
+        stopping = false;
+        return false;
+      }
+      ++stop_attempts;
+      stop_sent_us = now_us;
+      makeFrame(frame, RASM_TRAJECTORY_STOP, 0, 0);
+      return true;
+    }
+    if (!running)
+    {
+      return false;
+    }
+    if (next_point > acknowledged && now_us - waiting_since_us > resend_timeout_us)
+    {
+      //Nothing heard for a while with waypoints outstanding: the frame or its status got lost.
+      next_point = acknowledged;
+      ++resends;
+    }
+    const std::size_t remaining = points.size() - next_point;
+    const std::size_t room = limit > next_point ? limit - next_point : 0;
+    if (remaining == 0 || (room < RASM_TRAJECTORY_BATCH && room < remaining))
+    {
+      return false;
+    }
+    const uint8_t count = (uint8_t)std::min<std::size_t>(RASM_TRAJECTORY_BATCH, remaining);
+    makeFrame(frame, next_point + count == points.size() ? RASM_TRAJECTORY_END : 0, next_point, count);
+    for (uint8_t i = 0; i < count; ++i)
+    {
+      frame.points[i] = points[next_point + i];
+    }
+    if (next_point == acknowledged)
+    {
+      waiting_since_us = now_us;
+    }
+    next_point += count;
+    return true;
+  }
+
+  //A status frame from the firmware, received at now_us.
+  void received(const RasmTrajectoryStatusFrame& status, double now_us)
+  {
+    if (status.trajectory != id)
+    {
+      return;   //about an earlier trajectory
+    }
+    waiting_since_us = now_us;
+    if (stopping)
+    {
+      if (status.state != RASM_TRAJECTORY_RUNNING && status.state != RASM_TRAJECTORY_STARVED)
+      {
+        stopping = false;
+      }
+      return;
+    }
+    if (!running)
+    {
+      return;
+    }
+    latest = status;
+    if (have_status && status.rejected != rejected && status.received < next_point && now_us >= quiet_until_us)
+    {
+      //A frame got lost and the ones after it were thrown away. Frames already on their way
+      //will be thrown away too, so do not go back again for them.
+      next_point = status.received;
+      quiet_until_us = now_us + resend_timeout_us;
+      ++resends;
+    }
+    rejected = status.rejected;
+    have_status = true;
+    acknowledged = status.received;
+    if (status.state == RASM_TRAJECTORY_RUNNING || status.state == RASM_TRAJECTORY_STARVED)
+    {
+      limit = std::max<std::size_t>(limit, (std::size_t)status.received + status.free);
+    }
+    if (status.state == RASM_TRAJECTORY_DONE || status.state == RASM_TRAJECTORY_STOPPED)
+    {
+      running = false;
+    }
+  }
+
+  uint8_t trajectoryId() const { return id; }
+  //The trajectory has been started and is neither finished nor stopped.
+  bool busy() const { return running || stopping; }
+  bool finished() const { return have_status && latest.state == RASM_TRAJECTORY_DONE; }
+  bool haveStatus() const { return have_status; }
+  //The newest status of the current trajectory; only valid once haveStatus().
+  const RasmTrajectoryStatusFrame& status() const { return latest; }
+  std::size_t waypoints() const { return points.size(); }
+  unsigned long framesSent() const { return frames_sent; }
+  //Times sending went back to an earlier waypoint.
+  unsigned long resendCount() const { return resends; }
+
+private:
+  void makeFrame(RasmTrajectoryFrame& frame, uint8_t flags, std::size_t first, uint8_t count)
+  {
+    frame.sequence = sequence++;
+    frame.trajectory = id;
+    frame.joints = joints;
+    frame.flags = flags;
+    frame.first = (uint16_t)first;
+    frame.count = count;
+    ++frames_sent;
+  }
+
+  std::vector<RasmTrajectoryPoint> points;
+  uint8_t id;
+  uint8_t joints;
+  bool running;
+  bool stopping;
+  double stop_sent_us;
+  int stop_attempts;
+  std::size_t next_point;       //index of the next waypoint to send
+  std::size_t limit;            //the firmware has room for waypoints before this index
+  std::size_t acknowledged;     //waypoints the firmware has said it has
+  uint8_t rejected;             //its count of thrown away frames, as last seen
+  double quiet_until_us;
+  double waiting_since_us;      //last status, or first send with nothing outstanding
+  uint8_t sequence;
+  unsigned long frames_sent;
+  unsigned long resends;
+  bool have_status;
+  RasmTrajectoryStatusFrame latest;
+};
+
+//Streams trajectories to arduino_main over a serial port with a TrajectoryBatcher, on its own
+//thread: it writes the frames the batcher asks for and feeds it the status frames that come
+//back. start(), stop() and status() can be called from any thread; they only hold the lock
+//for as long as it takes to copy.
+class TrajectoryStreamer
+{
+public:
+  TrajectoryStreamer() : fd(-1), wake_fd(-1), running(false), batcher((uint8_t)std::time(NULL)), bytes_sent(0),
+                         bytes_received(0), write_errors(0) {}
+  ~TrajectoryStreamer() { close(); }
+
+  TrajectoryStreamer(const TrajectoryStreamer&) = delete;
+  TrajectoryStreamer& operator=(const TrajectoryStreamer&) = delete;
+
+  //Opens and configures the port and starts the streaming thread. Returns false if the port
+  //cannot be used.
+  bool open(const char* device, speed_t baud = B115200)
+  {
+    fd = openSerialPort(device, baud);
+    if (fd < 0)
+    {
+      return false;
+    }
+    wake_fd = eventfd(0, EFD_NONBLOCK);
+    if (wake_fd < 0)
+    {
+      std::cout << "Unable to create eventfd: " << std::strerror(errno) << std::endl;
+      close();
+      return false;
+    }
+    running = true;
+    thread = std::thread(&TrajectoryStreamer::streamLoop, this);
+    return true;
+  }
+
+  //Stops the streaming thread (without stopping the arm) and closes the port.
+  void close()
+  {
+    if (running)
+    {
+      running = false;
+      wake();
+      thread.join();
+    }
+    if (wake_fd >= 0)
+    {
+      ::close(wake_fd);
+      wake_fd = -1;
+    }
+    if (fd >= 0)
+    {
+      ::close(fd);
+      fd = -1;
+    }
+  }
+
+  //Starts streaming a trajectory, replacing any other. Returns the id its status frames will
+  //carry, or -1 if the batcher refused it.
+  int start(const std::vector<TrajectoryWaypoint>& trajectory, uint8_t joints)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!batcher.start(trajectory, joints, nowUs()))
+    {
+      return -1;
+    }
+    wake();
+    return batcher.trajectoryId();
+  }
+
+  void stop()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    batcher.stop();
+    wake();
+  }
+
+  //The newest status of the current trajectory. Returns false if none has come in yet.
+  bool status(RasmTrajectoryStatusFrame& status) const
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!batcher.haveStatus())
+    {
+      return false;
+    }
+    status = batcher.status();
+    return true;
+  }
+
+  unsigned long framesSent() const
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return batcher.framesSent();
+  }
+  unsigned long bytesSent() const { return bytes_sent; }
+  unsigned long bytesReceived() const { return bytes_received; }
+  unsigned long writeErrors() const { return write_errors; }
+
+private:
+  static double nowUs()
+  {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  void wake()
+  {
+    const uint64_t one = 1;
+    if (::write(wake_fd, &one, sizeof(one)) < 0)
+    {
+      //Already signalled; the thread is going to wake up anyway.
+    }
+  }
+
+  void streamLoop()
+  {
+    uint8_t frame[RASM_TRAJECTORY_FRAME_SIZE];
+    std::size_t frame_size = 0;
+    std::size_t written = 0;
+    uint8_t buffer[256];
+    RasmParser parser;
+    struct pollfd fds[2];
+    fds[0].fd = wake_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = fd;
+    while (running)
+    {
+      fds[1].events = POLLIN | (written < frame_size ? POLLOUT : 0);
+      //The timeout lets the batcher notice a status that never came.
+      const int ready = poll(fds, 2, 20);
+      if (ready < 0 && errno == EINTR)
+      {
+        continue;
+      }
+      //As in SerialWriter, a port that is gone (or a poll() that keeps failing) stops the
+      //thread instead of spinning on it. The firmware holds at the last waypoint it got, as it
+      //does whenever the batches stop coming.
+      if (ready < 0 || ((fds[0].revents | fds[1].revents) & (POLLNVAL | POLLERR | POLLHUP)))
+      {
+        const char* reason = ready < 0 ? std::strerror(errno) : "the port or eventfd was closed";
+        ++write_errors;
+        std::cout << "Trajectory streamer stopped: " << reason << std::endl;
+        return;
+      }
+      if (fds[0].revents & POLLIN)
+      {
+        uint64_t count;
+        if (::read(wake_fd, &count, sizeof(count)) < 0)
+        {
+          //Spurious wake up; nothing to clear.
+        }
+      }
+      if (fds[1].revents & POLLIN)
+      {
+        const ssize_t count = ::read(fd, buffer, sizeof(buffer));
+        for (ssize_t i = 0; i < count; ++i)
+        {
+          if (parser.feed(buffer[i]) && parser.type() == RASM_FRAME_TRAJECTORY_STATUS)
+          {
+            RasmTrajectoryStatusFrame status;
+            parser.decodeTrajectoryStatus(status);
+            std::lock_guard<std::mutex> lock(mutex);
+            batcher.received(status, nowUs());
+          }
+        }
+        bytes_received += count > 0 ? count : 0;
+      }
+      //Like SerialWriter, a frame is always finished once its first byte is out.
+      if (written == frame_size)
+      {
+        RasmTrajectoryFrame next;
+        std::unique_lock<std::mutex> lock(mutex);
+        if (batcher.next(nowUs(), next))
+        {
+          lock.unlock();
+          frame_size = rasmEncodeTrajectory(next, frame);
+          written = 0;
+        }
+      }
+      if (written < frame_size)
+      {
+        const ssize_t result = ::write(fd, frame + written, frame_size - written);
+        if (result > 0)
+        {
+          written += result;
+          bytes_sent += result;
+        }
+        else if (result < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        {
+          ++write_errors;
+          written = frame_size;   //the batcher sends it again when no status comes back
+        }
+      }
+    }
+  }
+
+  int fd;
+  int wake_fd;
+  std::atomic<bool> running;
+  std::thread thread;
+  mutable std::mutex mutex;
+  TrajectoryBatcher batcher;   //under mutex
+  std::atomic<unsigned long> bytes_sent;
+  std::atomic<unsigned long> bytes_received;
+  std::atomic<unsigned long> write_errors;
+};